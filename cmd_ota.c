@@ -14,6 +14,8 @@
 #include "cmd_ota.h"
 #include "drv_ota.h"
 
+#include <sdkconfig.h>
+#include <stdint.h>
 #include <string.h>
 
 #include "esp_log.h"
@@ -52,6 +54,41 @@ static struct {
     struct arg_end *end;
 } ota_args;
 
+static struct {
+    struct arg_str *rate;
+    struct arg_int *limit;
+    struct arg_end *end;
+} ota_rate_args;
+
+static struct {
+    struct arg_str *mirror;
+    struct arg_str *action;
+    struct arg_end *end;
+} ota_mirror_args;
+
+static struct {
+    struct arg_str *erase;
+    struct arg_str *action;
+    struct arg_end *end;
+} ota_erase_args;
+
+static struct {
+    struct arg_str *activate;
+    struct arg_str *action;
+    struct arg_end *end;
+} ota_activate_args;
+
+static struct {
+    struct arg_str *check;
+    struct arg_str *url;
+    struct arg_end *end;
+} ota_check_args;
+
+static struct {
+    struct arg_lit *reset;
+    struct arg_end *end;
+} ota_stats_args;
+
 char null_string_ota[] = "";
 
 /* *****************************************************************************
@@ -61,6 +98,143 @@ char null_string_ota[] = "";
 /* *****************************************************************************
  * Functions
  **************************************************************************** */
+/* ota rate [KB/s] */
+static int set_rate_limit(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&ota_rate_args);
+    if (nerrors != ESP_OK)
+    {
+        arg_print_errors(stderr, ota_rate_args.end, argv[0]);
+        return ESP_FAIL;
+    }
+
+    if (ota_rate_args.limit->count > 0)
+    {
+        if (ota_rate_args.limit->ival[0] < 0)
+        {
+            ESP_LOGE(TAG, "Rate limit must be 0 or more KB/s");
+            return ESP_FAIL;
+        }
+        if ((uint32_t)ota_rate_args.limit->ival[0] > UINT32_MAX / 1024)
+        {
+            ESP_LOGE(TAG, "Rate limit must be %u KB/s or less", (unsigned int)(UINT32_MAX / 1024));
+            return ESP_FAIL;
+        }
+        drv_ota_set_rate_limit((uint32_t)ota_rate_args.limit->ival[0] * 1024);
+    }
+    else
+    {
+        uint32_t limit = drv_ota_get_rate_limit();
+        if (limit > 0)
+        {
+            ESP_LOGI(TAG, "Background download at %u KB/s", (unsigned int)(limit / 1024));
+        }
+        else
+        {
+            ESP_LOGI(TAG, "No rate limit");
+        }
+    }
+    return 0;
+}
+
+#if CONFIG_DRV_OTA_MIRROR
+/* ota mirror [start|stop] */
+static int serve_mirror(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&ota_mirror_args);
+    if (nerrors != ESP_OK)
+    {
+        arg_print_errors(stderr, ota_mirror_args.end, argv[0]);
+        return ESP_FAIL;
+    }
+
+    const char* action = (ota_mirror_args.action->count > 0) ? ota_mirror_args.action->sval[0] : "";
+    if (strcmp(action, "start") == 0)
+    {
+        return (drv_ota_mirror_start(NULL) == ESP_OK) ? 0 : ESP_FAIL;
+    }
+    else if (strcmp(action, "stop") == 0)
+    {
+        drv_ota_mirror_stop();
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Mirror %s", drv_ota_mirror_active() ? "serving" : "stopped");
+    }
+    return 0;
+}
+#endif
+
+#if CONFIG_DRV_OTA_PREERASE
+/* ota erase [start|stop] */
+static int preerase_partition(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&ota_erase_args);
+    if (nerrors != ESP_OK)
+    {
+        arg_print_errors(stderr, ota_erase_args.end, argv[0]);
+        return ESP_FAIL;
+    }
+
+    const char* action = (ota_erase_args.action->count > 0) ? ota_erase_args.action->sval[0] : "";
+    if (strcmp(action, "start") == 0)
+    {
+        return (drv_ota_preerase_start() == ESP_OK) ? 0 : ESP_FAIL;
+    }
+    else if (strcmp(action, "stop") == 0)
+    {
+        drv_ota_preerase_stop();
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Erase %s, %u KB erased", drv_ota_preerase_active() ? "running" : "stopped", (unsigned int)(drv_ota_preerase_get_erased() / 1024));
+    }
+    return 0;
+}
+#endif
+
+#if CONFIG_DRV_OTA_DEFERRED_ACTIVATION
+/* ota activate [now] */
+static int activate_staged(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&ota_activate_args);
+    if (nerrors != ESP_OK)
+    {
+        arg_print_errors(stderr, ota_activate_args.end, argv[0]);
+        return ESP_FAIL;
+    }
+
+    const char* action = (ota_activate_args.action->count > 0) ? ota_activate_args.action->sval[0] : "";
+    if (strcmp(action, "now") == 0)
+    {
+        return (drv_ota_activate_now() == ESP_OK) ? 0 : ESP_FAIL;
+    }
+    drv_ota_activate_print();
+    return 0;
+}
+#endif
+
+/* ota check [url] */
+static int check_available(int argc, char **argv)
+{
+    drv_ota_check_t check;
+
+    int nerrors = arg_parse(argc, argv, (void **)&ota_check_args);
+    if (nerrors != ESP_OK)
+    {
+        arg_print_errors(stderr, ota_check_args.end, argv[0]);
+        return ESP_FAIL;
+    }
+
+    const char* url = (ota_check_args.url->count > 0) ? ota_check_args.url->sval[0] : NULL;
+    if (drv_ota_check_available(url, &check) != ESP_OK)
+    {
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Version %s on the server, %s", check.app.version, drv_ota_check_result_name(check.result));
+    return 0;
+}
+
 static int update_firmware(int argc, char **argv)
 {
     ESP_LOGI(__func__, "argc=%d", argc);
@@ -69,6 +243,33 @@ static int update_firmware(int argc, char **argv)
         ESP_LOGI(__func__, "argv[%d]=%s", i, argv[i]);
     }
 
+    if ((argc > 1) && (strcmp(argv[1], "rate") == 0))
+    {
+        return set_rate_limit(argc, argv);
+    }
+    if ((argc > 1) && (strcmp(argv[1], "check") == 0))
+    {
+        return check_available(argc, argv);
+    }
+    #if CONFIG_DRV_OTA_MIRROR
+    if ((argc > 1) && (strcmp(argv[1], "mirror") == 0))
+    {
+        return serve_mirror(argc, argv);
+    }
+    #endif
+    #if CONFIG_DRV_OTA_PREERASE
+    if ((argc > 1) && (strcmp(argv[1], "erase") == 0))
+    {
+        return preerase_partition(argc, argv);
+    }
+    #endif
+    #if CONFIG_DRV_OTA_DEFERRED_ACTIVATION
+    if ((argc > 1) && (strcmp(argv[1], "activate") == 0))
+    {
+        return activate_staged(argc, argv);
+    }
+    #endif
+
     int nerrors = arg_parse(argc, argv, (void **)&ota_args);
     if (nerrors != ESP_OK)
     {
@@ -93,12 +294,32 @@ static int update_firmware(int argc, char **argv)
 
 static void register_ota(void)
 {
-    ota_args.command = arg_strn(NULL, NULL, "<url>", 0, 1, "Command can be : ota [url]");
+    ota_args.command = arg_strn(NULL, NULL, "<url>", 0, 1, "Command can be : ota [url|file://path|uart://port] | ota check [url] | ota rate [KB/s] | ota mirror [start|stop] | ota erase [start|stop] | ota activate [now]");
     ota_args.end = arg_end(1);
 
+    ota_check_args.check = arg_str1(NULL, NULL, "check", "Tell if the server has an update, nothing is stopped");
+    ota_check_args.url = arg_str0(NULL, NULL, "<url>", "Without it the default url");
+    ota_check_args.end = arg_end(1);
+
+    ota_rate_args.rate = arg_str1(NULL, NULL, "rate", "Background download rate, 0 for no limit");
+    ota_rate_args.limit = arg_int0(NULL, NULL, "<KB/s>", "Bytes read per second in KB");
+    ota_rate_args.end = arg_end(1);
+
+    ota_mirror_args.mirror = arg_str1(NULL, NULL, "mirror", "Serve the image to peers");
+    ota_mirror_args.action = arg_str0(NULL, NULL, "start|stop", "Without it tells if serving");
+    ota_mirror_args.end = arg_end(1);
+
+    ota_erase_args.erase = arg_str1(NULL, NULL, "erase", "Erase the update partition ahead");
+    ota_erase_args.action = arg_str0(NULL, NULL, "start|stop", "Without it tells how far it got");
+    ota_erase_args.end = arg_end(1);
+
+    ota_activate_args.activate = arg_str1(NULL, NULL, "activate", "Select the staged image for boot and restart");
+    ota_activate_args.action = arg_str0(NULL, NULL, "now", "Without it tells what the image waits for");
+    ota_activate_args.end = arg_end(1);
+
     const esp_console_cmd_t cmd_ota = {
         .command = "ota",
-        .help = "Firmware Update Request",
+        .help = "Firmware Update Request, the server version with ota check, or the background download rate with ota rate",
         .hint = NULL,
         .func = &update_firmware,
         .argtable = &ota_args,
@@ -110,7 +331,49 @@ static void register_ota(void)
 }
 
 
+static int print_stats(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&ota_stats_args);
+    if (nerrors != ESP_OK)
+    {
+        arg_print_errors(stderr, ota_stats_args.end, argv[0]);
+        return ESP_FAIL;
+    }
+
+    drv_ota_print_stats();
+    drv_ota_print_processes();
+    #if CONFIG_DRV_OTA_VALIDATE
+    drv_ota_validate_print();
+    #endif
+    #if CONFIG_DRV_OTA_DEFERRED_ACTIVATION
+    drv_ota_activate_print();
+    #endif
+    if (ota_stats_args.reset->count > 0)
+    {
+        drv_ota_reset_stats();
+    }
+    return 0;
+}
+
+static void register_ota_stats(void)
+{
+    ota_stats_args.reset = arg_lit0("r", "reset", "Clear the counters after printing");
+    ota_stats_args.end = arg_end(1);
+
+    const esp_console_cmd_t cmd_ota_stats = {
+        .command = "ota_stats",
+        .help = "Firmware Update Download Statistics",
+        .hint = NULL,
+        .func = &print_stats,
+        .argtable = &ota_stats_args,
+    };
+
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cmd_ota_stats));
+}
+
+
 void cmd_ota_register(void)
 {
     register_ota();
+    register_ota_stats();
 }
\ No newline at end of file
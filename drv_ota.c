@@ -12,9 +12,26 @@
  * Header Includes
  **************************************************************************** */
 #include "drv_ota.h"
+#include "drv_ota_activate.h"
+#include "drv_ota_bundle.h"
+#include "drv_ota_check.h"
+#include "drv_ota_decomp.h"
+#include "drv_ota_delta.h"
+#include "drv_ota_digest.h"
+#include "drv_ota_manifest.h"
+#include "drv_ota_mirror.h"
+#include "drv_ota_parallel.h"
+#include "drv_ota_pipeline.h"
+#include "drv_ota_preerase.h"
+#include "drv_ota_resume.h"
+#include "drv_ota_sched.h"
+#include "drv_ota_source.h"
+#include "drv_ota_stats.h"
+#include "drv_ota_writer.h"
 #include "cmd_ota.h"
 
 #include <sdkconfig.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -22,6 +39,9 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_ota_ops.h"
 #include "esp_http_client.h"
 #include "esp_https_ota.h"
@@ -35,15 +55,78 @@
  **************************************************************************** */
 #define TAG "drv_ota"
 
+#if CONFIG_DRV_OTA_DOWNLOAD_MODE_HTTP_CLIENT || CONFIG_DRV_OTA_DOWNLOAD_MODE_PIPELINED
+#define USE_HTTP_CLIENT_DIRECTLY    1
+#else
 #define USE_HTTP_CLIENT_DIRECTLY    0
+#endif
+
+#if CONFIG_DRV_OTA_DOWNLOAD_MODE_PIPELINED
+#define USE_OTA_PIPELINE            1
+#else
+#define USE_OTA_PIPELINE            0
+#endif
+
+/* the image goes through drv_ota_writer instead of esp_ota_write() */
+#if CONFIG_DRV_OTA_RESUME || CONFIG_DRV_OTA_SKIP_UNCHANGED || CONFIG_DRV_OTA_PREERASE
+#define USE_OTA_WRITER              1
+#else
+#define USE_OTA_WRITER              0
+#endif
+
+/* the image is left staged for drv_ota_activate, esp_https_ota selects it for boot itself */
+#if CONFIG_DRV_OTA_DEFERRED_ACTIVATION && USE_HTTP_CLIENT_DIRECTLY
+#define USE_OTA_DEFERRED            1
+#else
+#define USE_OTA_DEFERRED            0
+#endif
+
+#if CONFIG_DRV_OTA_SKIP_UNCHANGED
+#define OTA_WRITER_SKIP_UNCHANGED   true
+#else
+#define OTA_WRITER_SKIP_UNCHANGED   false
+#endif
+
+#if CONFIG_DRV_OTA_LOW_MEMORY
+#define OTA_READ_BUFFER_SIZE        CONFIG_DRV_OTA_LOW_MEMORY_BUFFER_SIZE
+#else
+#define OTA_READ_BUFFER_SIZE        CONFIG_DRV_OTA_BUFFER_SIZE
+#endif
+
+/* download buffers: one read buffer, or the pipeline ring */
+#if USE_OTA_PIPELINE
+#define OTA_BUFFER_COUNT            CONFIG_DRV_OTA_PIPELINE_BUFFER_COUNT
+#define OTA_BUFFER_SIZE             CONFIG_DRV_OTA_PIPELINE_BUFFER_SIZE
+#elif USE_HTTP_CLIENT_DIRECTLY
+#define OTA_BUFFER_COUNT            1
+#define OTA_BUFFER_SIZE             OTA_READ_BUFFER_SIZE
+#endif
+
+/* the download buffers stay allocated between updates */
+#if CONFIG_DRV_OTA_BUFFER_PREALLOCATE || CONFIG_DRV_OTA_LOW_MEMORY
+#define OTA_BUFFERS_KEPT            1
+#else
+#define OTA_BUFFERS_KEPT            0
+#endif
+
+#ifdef CONFIG_DRV_OTA_TASK_STACK_SIZE
+#define OTA_TASK_STACK_SIZE         CONFIG_DRV_OTA_TASK_STACK_SIZE
+#else
+#define OTA_TASK_STACK_SIZE         8192
+#endif
+
+/* stack of ota_task after the read buffer, reserved in one block */
+#if CONFIG_DRV_OTA_LOW_MEMORY && USE_HTTP_CLIENT_DIRECTLY
+#define OTA_ARENA_SIZE              (OTA_BUFFER_COUNT * OTA_BUFFER_SIZE + OTA_TASK_STACK_SIZE)
+#elif CONFIG_DRV_OTA_LOW_MEMORY
+#define OTA_ARENA_SIZE              OTA_TASK_STACK_SIZE
+#endif
 
-#define MAX_START_STOP_PROCESSES    CONFIG_DRV_OTA_MAX_START_STOP_PROCESSES
 
 /* *****************************************************************************
  * Constants and Macros Definitions
  **************************************************************************** */
 #define OTA_URL_SIZE            256
-#define WRITE_DATA_BUFFSIZE     1024
 #define HASH_LEN                32 /* SHA-256 digest length */
 
 #define CONFIG_EXAMPLE_SKIP_VERSION_CHECK
@@ -55,12 +138,6 @@
 /* *****************************************************************************
  * Type Definitions
  **************************************************************************** */
-typedef struct drv_ota_start_stop_process_t
-{
-    drv_ota_start_stop_process_func_t start_func;
-    drv_ota_start_stop_process_func_t stop_func;
-    char name[16];
-}drv_ota_start_stop_process_t;
 
 
 /* *****************************************************************************
@@ -77,8 +154,81 @@ TaskHandle_t xHandleOTA = NULL;
 char cURLOTA[OTA_URL_SIZE] = CONFIG_DRV_OTA_FIRMWARE_UPG_URL;
 
 
+#if CONFIG_DRV_OTA_LOW_MEMORY
+static uint8_t* ota_arena = NULL;
+static StaticTask_t ota_task_buffer;
+/* suspended at its end, deleted by the next drv_ota_create_task() */
+static TaskHandle_t ota_task_parked = NULL;
+/* ota_task may end before xTaskCreateStaticPinnedToCore() returned its handle */
+static portMUX_TYPE ota_task_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool ota_task_done = false;
+#endif
+
 #if USE_HTTP_CLIENT_DIRECTLY
-static char ota_write_data[WRITE_DATA_BUFFSIZE + 1] = { 0 };
+static uint8_t* ota_buffers[OTA_BUFFER_COUNT];
+/* image of a file:// or other source read instead of the http client */
+static const drv_ota_source_t* ota_source = NULL;
+static void* ota_source_context = NULL;
+static int64_t ota_source_size = -1;
+static int64_t ota_source_received = 0;
+#endif
+
+#if USE_OTA_PIPELINE
+static drv_ota_pipeline_t ota_pipeline;
+#endif
+
+#if CONFIG_DRV_OTA_DELTA
+static drv_ota_delta_t ota_delta;
+static bool ota_delta_active = false;
+#endif
+
+#if CONFIG_DRV_OTA_BUNDLE
+static drv_ota_bundle_t ota_bundle;
+static bool ota_bundle_active = false;
+#endif
+
+#if CONFIG_DRV_OTA_COMPRESSION
+static drv_ota_decomp_t ota_decomp;
+static bool ota_decomp_active = false;
+static bool ota_decomp_header_checked = false;
+static const esp_partition_t* ota_update_partition = NULL;
+/* codec of the last response, picked in _http_event_handler */
+static drv_ota_codec_t ota_http_codec = DRV_OTA_CODEC_NONE;
+#endif
+
+#if USE_OTA_WRITER
+static drv_ota_writer_t ota_writer;
+#endif
+
+#if CONFIG_DRV_OTA_RESUME
+static drv_ota_resume_state_t ota_resume_state;
+static bool ota_resume_checkpoints = true;
+#endif
+
+#if CONFIG_DRV_OTA_RESUME || CONFIG_DRV_OTA_PARALLEL || CONFIG_DRV_OTA_CONDITIONAL_GET
+/* validators of the last response, captured in _http_event_handler */
+static char ota_http_etag[DRV_OTA_RESUME_ETAG_SIZE];
+static char ota_http_last_modified[DRV_OTA_RESUME_LAST_MODIFIED_SIZE];
+#endif
+
+#if CONFIG_DRV_OTA_PARALLEL
+/* Accept-Ranges: bytes in the last response, captured in _http_event_handler */
+static bool ota_http_accept_ranges = false;
+#endif
+
+#if CONFIG_DRV_OTA_MANIFEST
+extern const uint8_t manifest_key_pem_start[] asm("_binary_ota_manifest_key_pem_start");
+extern const uint8_t manifest_key_pem_end[] asm("_binary_ota_manifest_key_pem_end");
+static drv_ota_manifest_t ota_manifest;
+#endif
+
+#if CONFIG_DRV_OTA_VERIFY_DIGEST
+static drv_ota_digest_t ota_digest;
+/* image digest sent by the server, captured in _http_event_handler */
+static uint8_t ota_http_digest[DRV_OTA_DIGEST_SIZE];
+static bool ota_http_digest_valid = false;
+/* the header received passed the checks of esp_image_verify() */
+static bool ota_digest_header_checked = false;
 #endif
 
 
@@ -88,8 +238,6 @@ int new_image_size = 0;
 #endif
 
 
-drv_ota_start_stop_process_t drv_ota_start_stop_process_list[MAX_START_STOP_PROCESSES] = {0};
-int drv_ota_start_stop_process_count = 0;
 
 
 /* *****************************************************************************
@@ -173,182 +321,1278 @@ void drv_ota_print_info(void)
 
 
 
-void drv_ota_init(void)
+#if USE_HTTP_CLIENT_DIRECTLY
+/*
+ * Taken from DMA capable internal RAM if possible, the flash driver copies
+ * data from anywhere else through its own bounce buffer before writing.
+ * Buffers already allocated are kept.
+ */
+static esp_err_t ota_buffers_alloc(void)
 {
-    cmd_ota_register();
-
+    for (int index = 0; index < OTA_BUFFER_COUNT; index++)
+    {
+        if (ota_buffers[index] != NULL)
+        {
+            continue;
+        }
+        ota_buffers[index] = heap_caps_malloc(OTA_BUFFER_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+        if (ota_buffers[index] == NULL)
+        {
+            ota_buffers[index] = heap_caps_malloc(OTA_BUFFER_SIZE, MALLOC_CAP_8BIT);
+        }
+        if (ota_buffers[index] == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to allocate download buffer %d of %u bytes", index, (unsigned int)OTA_BUFFER_SIZE);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
 }
 
+/* preallocated buffers stay for the next update */
+static void ota_buffers_release(void)
+{
+    #if OTA_BUFFERS_KEPT == 0
+    for (int index = 0; index < OTA_BUFFER_COUNT; index++)
+    {
+        heap_caps_free(ota_buffers[index]);
+        ota_buffers[index] = NULL;
+    }
+    #endif
+}
+#endif
 
-#if USE_HTTP_CLIENT_DIRECTLY
-static void http_cleanup(esp_http_client_handle_t client)
+#if CONFIG_DRV_OTA_LOW_MEMORY
+/*
+ * One block for the stack of ota_task and the read buffer, taken while the
+ * heap is not fragmented yet and never freed. The stack has to be internal.
+ */
+static esp_err_t ota_arena_alloc(void)
 {
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
+    if (ota_arena != NULL)
+    {
+        return ESP_OK;
+    }
+    ota_arena = heap_caps_malloc(OTA_ARENA_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (ota_arena == NULL)
+    {
+        ota_arena = heap_caps_malloc(OTA_ARENA_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (ota_arena == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to reserve %u bytes for the update", (unsigned int)OTA_ARENA_SIZE);
+        return ESP_ERR_NO_MEM;
+    }
+    #if USE_HTTP_CLIENT_DIRECTLY
+    for (int index = 0; index < OTA_BUFFER_COUNT; index++)
+    {
+        ota_buffers[index] = &ota_arena[index * OTA_BUFFER_SIZE];
+    }
+    #endif
+    return ESP_OK;
 }
 #endif
 
-//static void __attribute__((noreturn)) task_fatal_error(void)
-static void task_fatal_error(void)
+/* bytes kept allocated between updates */
+static size_t ota_reserved_size(void)
 {
-    ESP_LOGE(TAG, "Exiting task due to fatal error...");
-    drv_ota_start_processes();
-    xHandleOTA = NULL;
-    (void)vTaskDelete(NULL);
-    //while (1) {;}
+    #if CONFIG_DRV_OTA_LOW_MEMORY
+    return (ota_arena != NULL) ? OTA_ARENA_SIZE : 0;
+    #elif USE_HTTP_CLIENT_DIRECTLY && CONFIG_DRV_OTA_BUFFER_PREALLOCATE
+    return (ota_buffers[OTA_BUFFER_COUNT - 1] != NULL) ? OTA_BUFFER_COUNT * OTA_BUFFER_SIZE : 0;
+    #else
+    return 0;
+    #endif
 }
 
-esp_err_t _http_event_handler(esp_http_client_event_t *evt)
+/* ota_task ends here, xHandleOTA is cleared for the next drv_ota_create_task() */
+static void ota_task_exit(void)
 {
-    switch (evt->event_id) {
-    case HTTP_EVENT_ERROR:
-        ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
-        break;
-    case HTTP_EVENT_ON_CONNECTED:
-        ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
-        break;
-    case HTTP_EVENT_HEADER_SENT:
-        ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
-        break;
-    case HTTP_EVENT_ON_HEADER:
-        ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
-        break;
-    case HTTP_EVENT_ON_DATA:
-        ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-        break;
-    case HTTP_EVENT_ON_FINISH:
-        ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
-        break;
-    case HTTP_EVENT_DISCONNECTED:
-        ESP_LOGD(TAG, "HTTP_EVENT_DISCONNECTED");
-        break;
-    case HTTP_EVENT_REDIRECT:
-        ESP_LOGD(TAG, "HTTP_EVENT_REDIRECT");
-        break;
-    default:
-        ESP_LOGD(TAG, "HTTP_EVENT_UNKNOWN : %d", evt->event_id);
-        break;
+    #if CONFIG_DRV_OTA_LOW_MEMORY
+    portENTER_CRITICAL(&ota_task_lock);
+    xHandleOTA = NULL;
+    ota_task_done = true;
+    portEXIT_CRITICAL(&ota_task_lock);
+    /* deleted by another task it is gone at once, no idle task cleanup left on the reserved stack */
+    vTaskSuspend(NULL);
+    #else
+    xHandleOTA = NULL;
+    vTaskDelete(NULL);
+    #endif
+}
 
-    }
-    return ESP_OK;
+/* a deferred update gives way to the application, processes are stopped for the activation only */
+static void ota_stop_processes_for(uint32_t resources)
+{
+    #if USE_OTA_DEFERRED
+    (void)resources;
+    #else
+    drv_ota_stop_processes_for(resources);
+    #endif
 }
 
-void parse_version(const char* version_str, int *major, int *minor, int *build) 
+void drv_ota_init(void)
 {
-    if (sscanf(version_str, "%d.%d.%d", major, minor, build) != 3) 
+    cmd_ota_register();
+
+    #if CONFIG_DRV_OTA_LOW_MEMORY
+    if (ota_arena_alloc() == ESP_OK)
     {
-        // Handle error if the format doesn't match
-        ESP_LOGE(TAG, "Error parsing version string");
+        ESP_LOGI(TAG, "%u bytes reserved for the update", (unsigned int)OTA_ARENA_SIZE);
     }
-    else
+    #endif
+
+    #if USE_HTTP_CLIENT_DIRECTLY && CONFIG_DRV_OTA_BUFFER_PREALLOCATE
+    /* allocated once while the heap is not fragmented yet, ota_task retries if this fails */
+    if (ota_buffers_alloc() == ESP_OK)
     {
-        ESP_LOGI(TAG, "Major: %d, Minor: %d, Build: %d", *major, *minor, *build);
+        ESP_LOGI(TAG, "%d download buffers of %u bytes allocated", OTA_BUFFER_COUNT, (unsigned int)OTA_BUFFER_SIZE);
     }
-}
-
-static void ota_task(void *pvParameter)
-{
-    esp_err_t err;
-    const esp_partition_t *update_partition = NULL;
-
+    #endif
 
+    #if USE_OTA_DEFERRED
+    /* an image staged before a reset is kept from the erase and served by the mirror */
+    drv_ota_activate_init();
+    #endif
 
+    #if CONFIG_DRV_OTA_MIRROR_AUTOSTART
+    drv_ota_mirror_start(NULL);
+    #endif
 
-    #if USE_HTTP_CLIENT_DIRECTLY
-    /* update handle : set by esp_ota_begin(), must be freed via esp_ota_end() */
-    esp_ota_handle_t update_handle = 0 ;
+    #if CONFIG_DRV_OTA_VALIDATE_AUTOSTART
+    drv_ota_validate_start();
     #endif
 
+    #if CONFIG_DRV_OTA_PREERASE_AUTOSTART
+    drv_ota_preerase_start();
+    #endif
+}
 
 
+#if USE_HTTP_CLIENT_DIRECTLY
+/* the TLS handshake happens in here */
+static esp_err_t ota_http_open(esp_http_client_handle_t client)
+{
+    #if CONFIG_DRV_OTA_RESUME || CONFIG_DRV_OTA_PARALLEL || CONFIG_DRV_OTA_CONDITIONAL_GET
+    ota_http_etag[0] = '\0';
+    ota_http_last_modified[0] = '\0';
+    #endif
+    #if CONFIG_DRV_OTA_PARALLEL
+    ota_http_accept_ranges = false;
+    #endif
+    #if CONFIG_DRV_OTA_VERIFY_DIGEST
+    ota_http_digest_valid = false;
+    #endif
+    int64_t connect_start = drv_ota_stats_connect_start();
+    esp_err_t err = esp_http_client_open(client, 0);
+    drv_ota_stats_connect_done(connect_start);
+    return err;
+}
 
-    ESP_LOGI(TAG, "Starting OTA");
-    const esp_partition_t *configured = esp_ota_get_boot_partition();
-    const esp_partition_t *running = esp_ota_get_running_partition();
-    ESP_LOGI(TAG, "Booting partition type %d subtype %d (offset 0x%08x)",
-             configured->type, configured->subtype, (unsigned int)configured->address);
-    ESP_LOGI(TAG, "Running partition type %d subtype %d (offset 0x%08x)",
-             running->type, running->subtype, (unsigned int)running->address);
-    if (configured != running) 
+static void ota_source_close(void)
+{
+    if ((ota_source != NULL) && (ota_source->close != NULL))
     {
-        ESP_LOGW(TAG, "Configured(Boot) OTA boot partition at offset 0x%08x, but running from offset 0x%08x",
-                 (unsigned int)configured->address, (unsigned int)running->address);
-        ESP_LOGW(TAG, "(This can happen if either the OTA boot data or preferred boot image become corrupted somehow.)");
+        ota_source->close(ota_source_context);
     }
-    esp_http_client_config_t config = 
-    {
-        .url = (char*)pvParameter,
-        //#if CONFIG_ESP_BOARD_HC00 != 1
-        .cert_pem = (char *)server_cert_pem_start,
-        //#endif
-        .event_handler = _http_event_handler,
-        .timeout_ms = CONFIG_DRV_OTA_RECV_TIMEOUT,
-        .keep_alive_enable = true,
-    };
-    #if CONFIG_DRV_OTA_CERTIFICATE_SKIP_CN_CHECK
-    config.skip_cert_common_name_check = true;
-    #endif
-
+    ota_source = NULL;
+    ota_source_context = NULL;
+}
 
+/* the response body, or the image of the source */
+static int ota_read(esp_http_client_handle_t client, char* buffer, int size)
+{
+    if (ota_source != NULL)
+    {
+        int length = ota_source->read(ota_source_context, buffer, size);
+        ota_source_received += (length > 0) ? length : 0;
+        return length;
+    }
+    return esp_http_client_read(client, buffer, size);
+}
 
+static bool ota_read_complete(esp_http_client_handle_t client)
+{
+    if (ota_source != NULL)
+    {
+        return (ota_source_size < 0) || (ota_source_received == ota_source_size);
+    }
+    return esp_http_client_is_complete_data_received(client);
+}
 
+static void http_cleanup(esp_http_client_handle_t client)
+{
+    #if USE_OTA_PIPELINE
+    /* stop the writer task before the caller aborts the ota handle it writes to */
+    drv_ota_pipeline_deinit(&ota_pipeline);
+    #endif
+    if (client != NULL)
+    {
+        esp_http_client_close(client);
+        esp_http_client_cleanup(client);
+    }
+    ota_source_close();
+}
 
+/* the checkpoint in task_fatal_error() still writes through the handle of ota_writer, released there */
+static void ota_update_abort(esp_ota_handle_t update_handle)
+{
+    #if USE_OTA_WRITER
+    (void)update_handle;
+    #else
+    esp_ota_abort(update_handle);
+    #endif
+}
+#endif
 
-    #if USE_HTTP_CLIENT_DIRECTLY == 0
-    esp_https_ota_config_t ota_config = {
-        .http_config = &config,
-    };
-    new_image_recv = 0;
-    new_image_size = 0;
-    esp_https_ota_handle_t https_ota_handle = NULL;
-    err = esp_https_ota_begin(&ota_config, &https_ota_handle);
-    if (https_ota_handle == NULL) 
+#if CONFIG_DRV_OTA_RESUME
+static void ota_resume_checkpoint(bool force)
+{
+    if (ota_resume_checkpoints == false)
     {
-        ESP_LOGE(TAG, "OTA Begin Failed");
-        task_fatal_error();
         return;
     }
-    #endif
-
-
-
-
-    #if USE_HTTP_CLIENT_DIRECTLY
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (client == NULL) 
+    if ((ota_resume_state.etag[0] == '\0') && (ota_resume_state.last_modified[0] == '\0'))
     {
-        ESP_LOGE(TAG, "Failed to initialise HTTP connection");
-        task_fatal_error();
+        /* without a validator the next attempt can not tell if the server image changed */
         return;
     }
-    err = esp_http_client_open(client, 0);
-    if (err != ESP_OK) 
+    if (ota_writer.offset <= ota_resume_state.written)
     {
-        ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
-        esp_http_client_cleanup(client);
-        task_fatal_error();
         return;
     }
-    esp_http_client_fetch_headers(client);
-    #endif
+    if ((force == false) && ((ota_writer.offset - ota_resume_state.written) < CONFIG_DRV_OTA_RESUME_CHECKPOINT_SIZE))
+    {
+        return;
+    }
+    if (drv_ota_writer_flush(&ota_writer) != ESP_OK)
+    {
+        return;
+    }
+    ota_resume_state.written = ota_writer.offset;
+    drv_ota_writer_get_sha256(&ota_writer, ota_resume_state.sha256);
+    drv_ota_resume_save(&ota_resume_state);
+}
 
+static void ota_resume_discard(void)
+{
+    drv_ota_writer_release(&ota_writer);
+    memset(&ota_resume_state, 0, sizeof(ota_resume_state));
+    drv_ota_resume_clear();
+}
 
+/* returns the offset to continue the download from, 0 if nothing usable is stored */
+static size_t ota_resume_prepare(const esp_partition_t* update_partition)
+{
+    uint8_t sha_256[HASH_LEN];
 
+    if (drv_ota_resume_load(&ota_resume_state) != ESP_OK)
+    {
+        return 0;
+    }
+    if ((ota_resume_state.partition_address != update_partition->address) || (ota_resume_state.written == 0))
+    {
+        ESP_LOGI(TAG, "Stored download progress is not for partition at offset 0x%x", (unsigned int)update_partition->address);
+        ota_resume_discard();
+        return 0;
+    }
+    ota_stop_processes_for(DRV_OTA_RESOURCE_FLASH | DRV_OTA_RESOURCE_PSRAM);
+    if (drv_ota_writer_begin(&ota_writer, update_partition, ota_resume_state.written, OTA_WRITER_SKIP_UNCHANGED) != ESP_OK)
+    {
+        ota_resume_discard();
+        return 0;
+    }
+    drv_ota_writer_get_sha256(&ota_writer, sha_256);
+    if (memcmp(sha_256, ota_resume_state.sha256, HASH_LEN) != 0)
+    {
+        ESP_LOGW(TAG, "Written %u bytes do not match stored SHA-256", (unsigned int)ota_resume_state.written);
+        ota_resume_discard();
+        return 0;
+    }
+    ESP_LOGI(TAG, "Resuming download at %u of %u bytes", (unsigned int)ota_resume_state.written, (unsigned int)ota_resume_state.image_size);
+    return ota_resume_state.written;
+}
 
-    update_partition = esp_ota_get_next_update_partition(NULL);
-    if (update_partition == NULL)
+/* new download from byte 0, remember the validators of the response */
+static void ota_resume_start(esp_http_client_handle_t client, const esp_partition_t* update_partition)
+{
+    memset(&ota_resume_state, 0, sizeof(ota_resume_state));
+    drv_ota_resume_clear();
+    ota_resume_checkpoints = true;
+    ota_resume_state.partition_address = update_partition->address;
+    int64_t content_length = esp_http_client_get_content_length(client);
+    if (content_length > 0)
     {
-        ESP_LOGE(TAG, "Failed to get update partition");
-        #if USE_HTTP_CLIENT_DIRECTLY
-        esp_http_client_cleanup(client);
+        ota_resume_state.image_size = (uint32_t)content_length;
+    }
+    strlcpy(ota_resume_state.etag, ota_http_etag, sizeof(ota_resume_state.etag));
+    strlcpy(ota_resume_state.last_modified, ota_http_last_modified, sizeof(ota_resume_state.last_modified));
+    if ((ota_resume_state.etag[0] == '\0') && (ota_resume_state.last_modified[0] == '\0'))
+    {
+        ESP_LOGW(TAG, "Server sent neither ETag nor Last-Modified, progress will not be saved");
+    }
+}
+
+/*
+ * Opens the connection and requests the image from offset on. If-Range makes
+ * the server send the whole image with 200 instead of 206 if it changed since
+ * the stored validators were taken, ESP_ERR_INVALID_STATE is returned then.
+ */
+static esp_err_t ota_http_open_from(esp_http_client_handle_t client, size_t offset)
+{
+    char range[32];
+
+    if (offset > 0)
+    {
+        snprintf(range, sizeof(range), "bytes=%u-", (unsigned int)offset);
+        esp_http_client_set_header(client, "Range", range);
+        if (ota_resume_state.etag[0] != '\0')
+        {
+            esp_http_client_set_header(client, "If-Range", ota_resume_state.etag);
+        }
+        else if (ota_resume_state.last_modified[0] != '\0')
+        {
+            esp_http_client_set_header(client, "If-Range", ota_resume_state.last_modified);
+        }
+    }
+    else
+    {
+        esp_http_client_delete_header(client, "Range");
+        esp_http_client_delete_header(client, "If-Range");
+    }
+
+    esp_err_t err = ota_http_open(client);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    esp_http_client_fetch_headers(client);
+
+    int status_code = esp_http_client_get_status_code(client);
+    if ((offset > 0) && (status_code == HttpStatus_PartialContent))
+    {
+        return ESP_OK;
+    }
+    if (status_code == HttpStatus_Ok)
+    {
+        return (offset > 0) ? ESP_ERR_INVALID_STATE : ESP_OK;
+    }
+    ESP_LOGE(TAG, "Unexpected HTTP status %d", status_code);
+    esp_http_client_close(client);
+    return ESP_ERR_INVALID_RESPONSE;
+}
+
+static esp_err_t ota_http_reconnect(esp_http_client_handle_t client, size_t offset, int* reconnect_count)
+{
+    #if CONFIG_DRV_OTA_MANIFEST
+    drv_ota_manifest_seek(&ota_manifest, offset);
+    #endif
+    while (*reconnect_count < CONFIG_DRV_OTA_RESUME_MAX_RETRIES)
+    {
+        (*reconnect_count)++;
+        drv_ota_stats_retry();
+        esp_http_client_close(client);
+        ESP_LOGW(TAG, "Reconnecting at offset %u (retry %d/%d)", (unsigned int)offset, *reconnect_count, CONFIG_DRV_OTA_RESUME_MAX_RETRIES);
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_DRV_OTA_RESUME_RETRY_DELAY_MS));
+        esp_err_t err = ota_http_open_from(client, offset);
+        if (err == ESP_OK)
+        {
+            return ESP_OK;
+        }
+        if (err == ESP_ERR_INVALID_STATE)
+        {
+            ESP_LOGE(TAG, "Image changed on server during download");
+            return err;
+        }
+        ESP_LOGW(TAG, "Reconnect failed (%s)", esp_err_to_name(err));
+    }
+    return ESP_FAIL;
+}
+#endif
+
+#if CONFIG_DRV_OTA_MANIFEST
+/* the manifest names the version, nothing is downloaded for one not to be installed */
+static esp_err_t ota_manifest_check_version(const char* version)
+{
+    esp_app_desc_t app_info;
+
+    const esp_partition_t* last_invalid_app = esp_ota_get_last_invalid_partition();
+    if ((last_invalid_app != NULL) && (esp_ota_get_partition_description(last_invalid_app, &app_info) == ESP_OK) &&
+        (strncmp(app_info.version, version, sizeof(app_info.version)) == 0))
+    {
+        ESP_LOGW(TAG, "New version is the same as invalid version.");
+        return ESP_ERR_INVALID_VERSION;
+    }
+    #ifndef CONFIG_EXAMPLE_SKIP_VERSION_CHECK
+    if ((esp_ota_get_partition_description(esp_ota_get_running_partition(), &app_info) == ESP_OK) &&
+        (strncmp(app_info.version, version, sizeof(app_info.version)) == 0))
+    {
+        ESP_LOGW(TAG, "Current running version is the same as a new. We will not continue the update.");
+        return ESP_ERR_INVALID_VERSION;
+    }
+    #endif
+    return ESP_OK;
+}
+
+/* <url><suffix> over the connection the image comes over next */
+static esp_err_t ota_manifest_fetch(esp_http_client_handle_t client, const char* url)
+{
+    char manifest_url[OTA_URL_SIZE + sizeof(CONFIG_DRV_OTA_MANIFEST_SUFFIX)];
+    uint8_t* data = NULL;
+    int64_t size = 0;
+
+    snprintf(manifest_url, sizeof(manifest_url), "%s%s", url, CONFIG_DRV_OTA_MANIFEST_SUFFIX);
+    esp_http_client_set_url(client, manifest_url);
+    esp_err_t err = ota_http_open(client);
+    if (err == ESP_OK)
+    {
+        size = esp_http_client_fetch_headers(client);
+        int status_code = esp_http_client_get_status_code(client);
+        if ((status_code != HttpStatus_Ok) || (size <= 0) || (size > CONFIG_DRV_OTA_MANIFEST_MAX_SIZE))
+        {
+            ESP_LOGE(TAG, "No manifest at %s (HTTP status %d, %d bytes)", manifest_url, status_code, (int)size);
+            err = ESP_ERR_NOT_FOUND;
+        }
+    }
+    if (err == ESP_OK)
+    {
+        data = malloc((size_t)size);
+        err = (data != NULL) ? ESP_OK : ESP_ERR_NO_MEM;
+    }
+    for (int64_t received = 0; (err == ESP_OK) && (received < size);)
+    {
+        int data_read = esp_http_client_read(client, (char*)&data[received], (int)(size - received));
+        if (data_read <= 0)
+        {
+            ESP_LOGE(TAG, "Manifest read failed at %d of %d bytes", (int)received, (int)size);
+            err = ESP_FAIL;
+        }
+        received += (data_read > 0) ? data_read : 0;
+    }
+    esp_http_client_set_url(client, url);
+    if (err != ESP_OK)
+    {
+        free(data);
+        esp_http_client_close(client);
+        return err;
+    }
+
+    err = drv_ota_manifest_parse(&ota_manifest, data, (size_t)size, manifest_key_pem_start,
+                                 manifest_key_pem_end - manifest_key_pem_start, CONFIG_DRV_OTA_MANIFEST_MAX_CHUNK_SIZE);
+    if (err == ESP_OK)
+    {
+        err = ota_manifest_check_version(ota_manifest.header.version);
+    }
+    if (err != ESP_OK)
+    {
+        drv_ota_manifest_release(&ota_manifest);
+        esp_http_client_close(client);
+    }
+    return err;
+}
+#endif
+
+#if USE_HTTP_CLIENT_DIRECTLY
+/* none of what came with the headers of a response applies to a source */
+static esp_err_t ota_source_open(const char* path)
+{
+    #if CONFIG_DRV_OTA_MANIFEST
+    /* the image would go in without the signature */
+    ESP_LOGE(TAG, "No signed manifest for a %s:// image", ota_source->scheme);
+    ota_source = NULL;
+    return ESP_ERR_NOT_SUPPORTED;
+    #else
+    #if CONFIG_DRV_OTA_RESUME
+    /* the partition no longer holds the start of a download */
+    memset(&ota_resume_state, 0, sizeof(ota_resume_state));
+    drv_ota_resume_clear();
+    ota_resume_checkpoints = false;
+    #endif
+    #if CONFIG_DRV_OTA_RESUME || CONFIG_DRV_OTA_PARALLEL || CONFIG_DRV_OTA_CONDITIONAL_GET
+    ota_http_etag[0] = '\0';
+    ota_http_last_modified[0] = '\0';
+    #endif
+    #if CONFIG_DRV_OTA_COMPRESSION
+    ota_http_codec = DRV_OTA_CODEC_NONE;
+    #endif
+    #if CONFIG_DRV_OTA_VERIFY_DIGEST
+    ota_http_digest_valid = false;
+    #endif
+    ota_source_received = 0;
+    /* the open counts as the connect in the stats */
+    int64_t connect_start = drv_ota_stats_connect_start();
+    esp_err_t err = ota_source->open(path, &ota_source_context, &ota_source_size);
+    drv_ota_stats_connect_done(connect_start);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to open %s://%s (%s)", ota_source->scheme, path, esp_err_to_name(err));
+        ota_source = NULL;
+        return err;
+    }
+    if (ota_source_size >= 0)
+    {
+        ESP_LOGI(TAG, "Image of %d bytes from %s://%s", (int)ota_source_size, ota_source->scheme, path);
+    }
+    return ESP_OK;
+    #endif
+}
+#endif
+
+#if CONFIG_DRV_OTA_VERIFY_DIGEST
+/* a resumed download continues at offset, the writer has the digest of the bytes before it */
+static void ota_digest_begin(esp_http_client_handle_t client, size_t offset)
+{
+    #if CONFIG_DRV_OTA_MANIFEST
+    static const uint8_t no_digest[DRV_OTA_DIGEST_SIZE] = { 0 };
+    if ((ota_http_digest_valid == false) && (memcmp(ota_manifest.header.image_sha256, no_digest, DRV_OTA_DIGEST_SIZE) != 0))
+    {
+        memcpy(ota_http_digest, ota_manifest.header.image_sha256, DRV_OTA_DIGEST_SIZE);
+        ota_http_digest_valid = true;
+    }
+    #endif
+    ota_digest_header_checked = false;
+    if (ota_http_digest_valid == false)
+    {
+        ESP_LOGW(TAG, "Server sent no %s, the image is verified by reading it back", CONFIG_DRV_OTA_VERIFY_DIGEST_HEADER);
+        drv_ota_digest_stop(&ota_digest);
+        return;
+    }
+    #if CONFIG_DRV_OTA_RESUME
+    drv_ota_digest_start(&ota_digest, ota_http_digest, (offset > 0) ? &ota_writer.sha : NULL, offset);
+    #else
+    drv_ota_digest_start(&ota_digest, ota_http_digest, NULL, 0);
+    #endif
+
+    int64_t content_length = esp_http_client_get_content_length(client);
+    #if CONFIG_DRV_OTA_COMPRESSION
+    if (ota_http_codec != DRV_OTA_CODEC_NONE)
+    {
+        /* the decompressed size is known only at the end */
+        content_length = 0;
+    }
+    #endif
+    if (content_length > 0)
+    {
+        drv_ota_digest_set_size(&ota_digest, offset + (size_t)content_length);
+    }
+}
+#endif
+
+#if USE_HTTP_CLIENT_DIRECTLY
+static esp_err_t ota_image_write(esp_ota_handle_t update_handle, const void* data, size_t size)
+{
+    #if CONFIG_DRV_OTA_VERIFY_DIGEST
+    /* a corrupted image is rejected before its last bytes reach the flash */
+    if (drv_ota_digest_update(&ota_digest, data, size) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Image does not match the digest sent by the server");
+        #if CONFIG_DRV_OTA_RESUME
+        /* the bytes already written are not the ones of the image, do not resume on them */
+        ota_resume_discard();
+        #endif
+        return ESP_ERR_INVALID_CRC;
+    }
+    #endif
+    int64_t start_us = esp_timer_get_time();
+    #if USE_OTA_WRITER
+    esp_err_t err = drv_ota_writer_write(&ota_writer, data, size);
+    #if CONFIG_DRV_OTA_RESUME
+    if (err == ESP_OK)
+    {
+        ota_resume_checkpoint(false);
+    }
+    #endif
+    #else
+    esp_err_t err = esp_ota_write(update_handle, data, size);
+    #endif
+    drv_ota_stats_write(start_us, size);
+    return err;
+}
+
+#if CONFIG_DRV_OTA_DELTA
+static esp_err_t ota_delta_write(void* context, const uint8_t* data, size_t size)
+{
+    esp_ota_handle_t update_handle = *(esp_ota_handle_t*)context;
+    return ota_image_write(update_handle, data, size);
+}
+
+/* checks the patch was made against the running firmware and starts the decoder */
+static esp_err_t ota_delta_start(const char* data, size_t size, esp_ota_handle_t* update_handle, esp_app_desc_t* new_app_info)
+{
+    drv_ota_delta_header_t header;
+
+    esp_err_t err = drv_ota_delta_parse_header(data, size, &header);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Invalid delta patch header");
+        return err;
+    }
+    #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5,0,0)
+    const esp_app_desc_t *app_desc = esp_app_get_description();
+    #else
+    const esp_app_desc_t *app_desc = esp_ota_get_app_description();
+    #endif
+    ESP_LOGI(TAG, "Delta patch from version %s to %s (%u bytes)", header.base_version, header.target_version, (unsigned int)header.target_size);
+    if (memcmp(header.base_app_elf_sha256, app_desc->app_elf_sha256, sizeof(header.base_app_elf_sha256)) != 0)
+    {
+        ESP_LOGE(TAG, "Delta patch is not for running version %s", app_desc->version);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    err = drv_ota_delta_init(&ota_delta, esp_ota_get_running_partition(), &header, CONFIG_DRV_OTA_DELTA_BUFFER_SIZE, ota_delta_write, update_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start delta decoder (%s)", esp_err_to_name(err));
+        return err;
+    }
+    ota_delta_active = true;
+    #if CONFIG_DRV_OTA_VERIFY_DIGEST
+    drv_ota_digest_set_size(&ota_digest, header.target_size);
+    #endif
+    #if CONFIG_DRV_OTA_RESUME
+    /* the written image size says nothing about the position in the patch */
+    ota_resume_checkpoints = false;
+    #endif
+
+    memset(new_app_info, 0, sizeof(*new_app_info));
+    strlcpy(new_app_info->version, header.target_version, sizeof(new_app_info->version));
+    return ESP_OK;
+}
+
+static void ota_delta_stop(void)
+{
+    if (ota_delta_active)
+    {
+        drv_ota_delta_deinit(&ota_delta);
+        ota_delta_active = false;
+    }
+}
+#endif
+
+/* either the image itself or a patch producing it */
+static esp_err_t ota_app_write(esp_ota_handle_t update_handle, const void* data, size_t size)
+{
+    #if CONFIG_DRV_OTA_DELTA
+    if (ota_delta_active)
+    {
+        return drv_ota_delta_feed(&ota_delta, data, size);
+    }
+    #endif
+    return ota_image_write(update_handle, data, size);
+}
+
+#if CONFIG_DRV_OTA_BUNDLE
+static esp_err_t ota_bundle_app_write(void* context, const uint8_t* data, size_t size)
+{
+    esp_ota_handle_t update_handle = *(esp_ota_handle_t*)context;
+    return ota_app_write(update_handle, data, size);
+}
+
+/* the sections are written from the start of the bundle on, the header is skipped by the feed */
+static esp_err_t ota_bundle_start(const char* data, size_t size, esp_ota_handle_t* update_handle)
+{
+    drv_ota_bundle_header_t header;
+
+    esp_err_t err = drv_ota_bundle_parse_header(data, size, &header);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Invalid bundle header in the first %u bytes", (unsigned int)size);
+        return err;
+    }
+    err = drv_ota_bundle_init(&ota_bundle, &header, ota_bundle_app_write, update_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start bundle (%s)", esp_err_to_name(err));
+        drv_ota_bundle_deinit(&ota_bundle);
+        return err;
+    }
+    ota_bundle_active = true;
+    ESP_LOGI(TAG, "Bundle of %u sections", (unsigned int)header.section_count);
+    #if CONFIG_DRV_OTA_VERIFY_DIGEST
+    drv_ota_digest_set_size(&ota_digest, header.sections[0].size);
+    #endif
+    #if CONFIG_DRV_OTA_RESUME
+    /* the written image size says nothing about the position in the bundle */
+    ota_resume_checkpoints = false;
+    #endif
+    return ESP_OK;
+}
+
+static void ota_bundle_stop(void)
+{
+    if (ota_bundle_active)
+    {
+        drv_ota_bundle_deinit(&ota_bundle);
+        ota_bundle_active = false;
+    }
+}
+#endif
+
+/* checks the start of the received image or patch and starts writing the update partition */
+static esp_err_t ota_image_begin(const char* data, size_t size, const esp_partition_t* update_partition, esp_ota_handle_t* update_handle)
+{
+    esp_err_t err;
+    esp_app_desc_t new_app_info;
+
+    /* the first write is close, processes contending for the flash stop now */
+    ota_stop_processes_for(DRV_OTA_RESOURCE_FLASH | DRV_OTA_RESOURCE_PSRAM);
+
+    #if CONFIG_DRV_OTA_BUNDLE
+    if (drv_ota_bundle_is_bundle(data, size))
+    {
+        err = ota_bundle_start(data, size, update_handle);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        /* the app section comes first, its header is checked as the one of an image */
+        data += ota_bundle.header.header_size;
+        size -= ota_bundle.header.header_size;
+    }
+    #endif
+
+    #if CONFIG_DRV_OTA_DELTA
+    if (drv_ota_delta_is_patch(data, size))
+    {
+        err = ota_delta_start(data, size, update_handle, &new_app_info);
+    }
+    else
+    #endif
+    if (size > sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) 
+    {
+        // check current version with downloading
+        memcpy(&new_app_info, &data[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)], sizeof(esp_app_desc_t));
+        err = ESP_OK;
+        #if CONFIG_DRV_OTA_VERIFY_DIGEST
+        /* a patch or a resumed image is read back, its header is not here */
+        ota_digest_header_checked = (drv_ota_digest_check_header(data, size) == ESP_OK);
+        #endif
+    }
+    else 
+    {
+        ESP_LOGE(TAG, "received package is not fit len");
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    ESP_LOGI(TAG, "New firmware version: %s", new_app_info.version);
+
+    esp_app_desc_t running_app_info;
+    if (esp_ota_get_partition_description(esp_ota_get_running_partition(), &running_app_info) == ESP_OK) 
+    {
+        ESP_LOGI(TAG, "Running firmware version: %s", running_app_info.version);
+    }
+
+    const esp_partition_t* last_invalid_app = esp_ota_get_last_invalid_partition();
+    esp_app_desc_t invalid_app_info;
+    if (esp_ota_get_partition_description(last_invalid_app, &invalid_app_info) == ESP_OK) 
+    {
+        ESP_LOGI(TAG, "Last invalid firmware version: %s", invalid_app_info.version);
+    }
+
+    // check current version with last invalid partition
+    if (last_invalid_app != NULL) 
+    {
+        if (memcmp(invalid_app_info.version, new_app_info.version, sizeof(new_app_info.version)) == 0) 
+        {
+            ESP_LOGW(TAG, "New version is the same as invalid version.");
+            ESP_LOGW(TAG, "Previously, there was an attempt to launch the firmware with %s version, but it failed.", invalid_app_info.version);
+            ESP_LOGW(TAG, "The firmware has been rolled back to the previous version.");
+            return ESP_ERR_INVALID_VERSION;
+        }
+    }
+    #ifndef CONFIG_EXAMPLE_SKIP_VERSION_CHECK
+    if (memcmp(new_app_info.version, running_app_info.version, sizeof(new_app_info.version)) == 0) 
+    {
+        ESP_LOGW(TAG, "Current running version is the same as a new. We will not continue the update.");
+        return ESP_ERR_INVALID_VERSION;
+    }
+    #endif
+
+    #if USE_OTA_WRITER
+    err = drv_ota_writer_begin(&ota_writer, update_partition, 0, OTA_WRITER_SKIP_UNCHANGED);
+    *update_handle = ota_writer.handle;
+    #else
+    err = esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, update_handle);
+    #endif
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "esp_ota_begin failed (%s)", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "esp_ota_begin succeeded");
+    return ESP_OK;
+}
+
+/* the app, or a bundle of it with data partitions */
+static esp_err_t ota_content_write(esp_ota_handle_t update_handle, const void* data, size_t size)
+{
+    #if CONFIG_DRV_OTA_BUNDLE
+    if (ota_bundle_active)
+    {
+        return drv_ota_bundle_feed(&ota_bundle, data, size);
+    }
+    #endif
+    return ota_app_write(update_handle, data, size);
+}
+
+#if CONFIG_DRV_OTA_COMPRESSION
+/*
+ * The decompressor hands over whole windows of at least 4 KB, only a smaller
+ * image comes in one piece at the end, so the first call holds the header.
+ */
+static esp_err_t ota_decoded_write(void* context, const uint8_t* data, size_t size)
+{
+    esp_ota_handle_t* update_handle = (esp_ota_handle_t*)context;
+
+    if (ota_decomp_header_checked == false)
+    {
+        esp_err_t err = ota_image_begin((const char*)data, size, ota_update_partition, update_handle);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        ota_decomp_header_checked = true;
+    }
+    return ota_content_write(*update_handle, data, size);
+}
+
+static esp_err_t ota_decomp_start(esp_ota_handle_t* update_handle, const esp_partition_t* update_partition)
+{
+    esp_err_t err = drv_ota_decomp_init(&ota_decomp, ota_http_codec, ota_decoded_write, update_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start %s decompression (%s)", drv_ota_decomp_codec_name(ota_http_codec), esp_err_to_name(err));
+        return err;
+    }
+    ota_decomp_active = true;
+    ota_decomp_header_checked = false;
+    ota_update_partition = update_partition;
+    #if CONFIG_DRV_OTA_RESUME
+    /* the written image size says nothing about the position in the compressed stream */
+    ota_resume_checkpoints = false;
+    #endif
+    return ESP_OK;
+}
+
+static void ota_decomp_stop(void)
+{
+    if (ota_decomp_active)
+    {
+        drv_ota_decomp_deinit(&ota_decomp);
+        ota_decomp_active = false;
+    }
+}
+#endif
+
+/* received bytes, compressed or not */
+static esp_err_t ota_payload_write(esp_ota_handle_t update_handle, const void* data, size_t size)
+{
+    #if CONFIG_DRV_OTA_COMPRESSION
+    if (ota_decomp_active)
+    {
+        return drv_ota_decomp_feed(&ota_decomp, data, size);
+    }
+    #endif
+    return ota_content_write(update_handle, data, size);
+}
+#endif
+
+#if USE_OTA_PIPELINE
+static esp_err_t ota_pipeline_write(void* context, const drv_ota_pipeline_buffer_t* buffer)
+{
+    esp_ota_handle_t update_handle = *(esp_ota_handle_t*)context;
+    return ota_payload_write(update_handle, buffer->data, buffer->length);
+}
+#endif
+
+#if CONFIG_DRV_OTA_PARALLEL
+/* a plain image from a full response, the delta check has to wait for the first buffer */
+static bool ota_parallel_eligible(esp_http_client_handle_t client)
+{
+    /* a background update trickles in on the one connection */
+    if (drv_ota_get_rate_limit() > 0)
+    {
+        return false;
+    }
+    if ((ota_http_accept_ranges == false) || (esp_http_client_get_status_code(client) != HttpStatus_Ok))
+    {
+        return false;
+    }
+    if (esp_http_client_get_content_length(client) < CONFIG_DRV_OTA_PARALLEL_MIN_SIZE)
+    {
+        return false;
+    }
+    #if CONFIG_DRV_OTA_COMPRESSION
+    if (ota_decomp_active)
+    {
+        return false;
+    }
+    #endif
+    return true;
+}
+
+/*
+ * Hands the rest of the image from binary_file_length on over to several
+ * ranged connections. The main connection is closed, its first buffer has
+ * been header checked and written with the sequential erase of esp_ota_begin.
+ */
+static esp_err_t ota_parallel_download(const esp_http_client_config_t* config, esp_http_client_handle_t client, const esp_partition_t* update_partition, esp_ota_handle_t update_handle, int* binary_file_length)
+{
+    drv_ota_parallel_config_t parallel_config =
+    {
+        .http_config = config,
+        .partition = update_partition,
+        .handle = update_handle,
+        .offset = *binary_file_length,
+        .size = (size_t)esp_http_client_get_content_length(client),
+        .connections = CONFIG_DRV_OTA_PARALLEL_CONNECTIONS,
+        .buffer_memory = CONFIG_DRV_OTA_PARALLEL_BUFFER_SIZE,
+    };
+    if (ota_http_etag[0] != '\0')
+    {
+        strlcpy(parallel_config.validator, ota_http_etag, sizeof(parallel_config.validator));
+    }
+    else
+    {
+        strlcpy(parallel_config.validator, ota_http_last_modified, sizeof(parallel_config.validator));
+    }
+
+    #if USE_OTA_PIPELINE
+    esp_err_t err = drv_ota_pipeline_flush(&ota_pipeline);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    #endif
+    #if CONFIG_DRV_OTA_RESUME
+    /* ranges arrive out of order, there is no written prefix to checkpoint */
+    ota_resume_checkpoints = false;
+    #endif
+    #if CONFIG_DRV_OTA_VERIFY_DIGEST
+    /* nor one to hash, the image is verified by reading it back then */
+    drv_ota_digest_stop(&ota_digest);
+    #endif
+    esp_http_client_close(client);
+
+    esp_err_t parallel_err = drv_ota_parallel_download(&parallel_config);
+    if (parallel_err == ESP_OK)
+    {
+        *binary_file_length = (int)parallel_config.size;
+    }
+    return parallel_err;
+}
+#endif
+
+//static void __attribute__((noreturn)) task_fatal_error(void)
+static void task_fatal_error(void)
+{
+    ESP_LOGE(TAG, "Exiting task due to fatal error...");
+    drv_ota_sched_stop();
+    drv_ota_stats_end(ESP_FAIL);
+    #if CONFIG_DRV_OTA_RESUME
+    /* keep what is written for the next attempt */
+    ota_resume_checkpoint(true);
+    #endif
+    #if USE_OTA_WRITER
+    drv_ota_writer_release(&ota_writer);
+    #endif
+    #if CONFIG_DRV_OTA_COMPRESSION
+    ota_decomp_stop();
+    #endif
+    #if CONFIG_DRV_OTA_DELTA
+    ota_delta_stop();
+    #endif
+    #if CONFIG_DRV_OTA_BUNDLE
+    ota_bundle_stop();
+    #endif
+    #if CONFIG_DRV_OTA_VERIFY_DIGEST
+    drv_ota_digest_stop(&ota_digest);
+    #endif
+    #if CONFIG_DRV_OTA_MANIFEST
+    drv_ota_manifest_release(&ota_manifest);
+    #endif
+    #if USE_HTTP_CLIENT_DIRECTLY
+    ota_buffers_release();
+    #endif
+    #if CONFIG_DRV_OTA_CONDITIONAL_GET
+    /* if ota_task failed before it took the connection of the probe */
+    drv_ota_check_release_client();
+    #endif
+    drv_ota_start_processes();
+    ota_task_exit();
+    //while (1) {;}
+}
+
+esp_err_t _http_event_handler(esp_http_client_event_t *evt)
+{
+    switch (evt->event_id) {
+    case HTTP_EVENT_ERROR:
+        ESP_LOGD(TAG, "HTTP_EVENT_ERROR");
+        break;
+    case HTTP_EVENT_ON_CONNECTED:
+        ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
+        break;
+    case HTTP_EVENT_HEADER_SENT:
+        ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
+        break;
+    case HTTP_EVENT_ON_HEADER:
+        ESP_LOGD(TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+        #if CONFIG_DRV_OTA_RESUME || CONFIG_DRV_OTA_PARALLEL || CONFIG_DRV_OTA_CONDITIONAL_GET
+        if (strcasecmp(evt->header_key, "ETag") == 0)
+        {
+            strlcpy(ota_http_etag, evt->header_value, sizeof(ota_http_etag));
+        }
+        else if (strcasecmp(evt->header_key, "Last-Modified") == 0)
+        {
+            strlcpy(ota_http_last_modified, evt->header_value, sizeof(ota_http_last_modified));
+        }
+        #endif
+        #if CONFIG_DRV_OTA_VERIFY_DIGEST
+        if ((strcasecmp(evt->header_key, CONFIG_DRV_OTA_VERIFY_DIGEST_HEADER) == 0) &&
+            (drv_ota_digest_parse_hex(evt->header_value, ota_http_digest) == ESP_OK))
+        {
+            ota_http_digest_valid = true;
+        }
+        #endif
+        #if CONFIG_DRV_OTA_PARALLEL
+        if ((strcasecmp(evt->header_key, "Accept-Ranges") == 0) && (strcasecmp(evt->header_value, "bytes") == 0))
+        {
+            ota_http_accept_ranges = true;
+        }
+        #endif
+        #if CONFIG_DRV_OTA_COMPRESSION
+        drv_ota_codec_t codec = drv_ota_decomp_codec_from_header(evt->header_key, evt->header_value);
+        if (codec != DRV_OTA_CODEC_NONE)
+        {
+            ota_http_codec = codec;
+        }
+        #endif
+        break;
+    case HTTP_EVENT_ON_DATA:
+        ESP_LOGD(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
+        break;
+    case HTTP_EVENT_ON_FINISH:
+        ESP_LOGD(TAG, "HTTP_EVENT_ON_FINISH");
+        break;
+    case HTTP_EVENT_DISCONNECTED:
+        ESP_LOGD(TAG, "HTTP_EVENT_DISCONNECTED");
+        break;
+    case HTTP_EVENT_REDIRECT:
+        ESP_LOGD(TAG, "HTTP_EVENT_REDIRECT");
+        break;
+    default:
+        ESP_LOGD(TAG, "HTTP_EVENT_UNKNOWN : %d", evt->event_id);
+        break;
+
+    }
+    return ESP_OK;
+}
+
+void parse_version(const char* version_str, int *major, int *minor, int *build) 
+{
+    if (sscanf(version_str, "%d.%d.%d", major, minor, build) != 3) 
+    {
+        // Handle error if the format doesn't match
+        ESP_LOGE(TAG, "Error parsing version string");
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Major: %d, Minor: %d, Build: %d", *major, *minor, *build);
+    }
+}
+
+static void ota_task(void *pvParameter)
+{
+    esp_err_t err;
+    const esp_partition_t *update_partition = NULL;
+
+
+
+
+    #if USE_HTTP_CLIENT_DIRECTLY
+    /* update handle : set by esp_ota_begin(), must be freed via esp_ota_end() */
+    esp_ota_handle_t update_handle = 0 ;
+    #endif
+
+
+
+
+    ESP_LOGI(TAG, "Starting OTA");
+    drv_ota_stats_begin();
+    drv_ota_sched_start();
+    const esp_partition_t *configured = esp_ota_get_boot_partition();
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    ESP_LOGI(TAG, "Booting partition type %d subtype %d (offset 0x%08x)",
+             configured->type, configured->subtype, (unsigned int)configured->address);
+    ESP_LOGI(TAG, "Running partition type %d subtype %d (offset 0x%08x)",
+             running->type, running->subtype, (unsigned int)running->address);
+    if (configured != running) 
+    {
+        ESP_LOGW(TAG, "Configured(Boot) OTA boot partition at offset 0x%08x, but running from offset 0x%08x",
+                 (unsigned int)configured->address, (unsigned int)running->address);
+        ESP_LOGW(TAG, "(This can happen if either the OTA boot data or preferred boot image become corrupted somehow.)");
+    }
+    esp_http_client_config_t config = 
+    {
+        .url = (char*)pvParameter,
+        //#if CONFIG_ESP_BOARD_HC00 != 1
+        .cert_pem = (char *)server_cert_pem_start,
+        //#endif
+        .event_handler = _http_event_handler,
+        .timeout_ms = CONFIG_DRV_OTA_RECV_TIMEOUT,
+        .keep_alive_enable = true,
+        /* reconnects resume the TLS session with a ticket, needs CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS */
+        .save_client_session = true,
+    };
+    #if CONFIG_DRV_OTA_CERTIFICATE_SKIP_CN_CHECK
+    config.skip_cert_common_name_check = true;
+    #endif
+
+
+
+
+
+
+    update_partition = esp_ota_get_next_update_partition(NULL);
+    if (update_partition == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to get update partition");
+        task_fatal_error();
+        return;
+    }
+    #if CONFIG_DRV_OTA_MIRROR
+    drv_ota_mirror_release(update_partition);
+    #endif
+    //assert(update_partition != NULL);
+
+    ESP_LOGI(TAG, "Writing to partition subtype %d at offset 0x%x",
+             update_partition->subtype, (unsigned int)update_partition->address);
+
+
+
+
+    #if USE_HTTP_CLIENT_DIRECTLY == 0
+    /* esp_https_ota allocates its buffer of this size for each update */
+    config.buffer_size = OTA_READ_BUFFER_SIZE;
+    esp_https_ota_config_t ota_config = {
+        .http_config = &config,
+    };
+    new_image_recv = 0;
+    new_image_size = 0;
+    esp_https_ota_handle_t https_ota_handle = NULL;
+    int64_t connect_start = drv_ota_stats_connect_start();
+    err = esp_https_ota_begin(&ota_config, &https_ota_handle);
+    drv_ota_stats_connect_done(connect_start);
+    if (https_ota_handle == NULL) 
+    {
+        ESP_LOGE(TAG, "OTA Begin Failed");
+        task_fatal_error();
+        return;
+    }
+    /* esp_https_ota_perform() erases and writes from its first call */
+    ota_stop_processes_for(DRV_OTA_RESOURCE_FLASH | DRV_OTA_RESOURCE_PSRAM);
+    #endif
+
+
+
+
+    #if USE_HTTP_CLIENT_DIRECTLY
+    if (ota_buffers_alloc() != ESP_OK)
+    {
+        task_fatal_error();
+        return;
+    }
+    esp_http_client_handle_t client = NULL;
+    #if CONFIG_DRV_OTA_RESUME
+    size_t resume_offset = 0;
+    int reconnect_count = 0;
+    #endif
+    const char* source_path = NULL;
+    ota_source = drv_ota_source_find(config.url, &source_path);
+    if (ota_source != NULL)
+    {
+        if (ota_source_open(source_path) != ESP_OK)
+        {
+            task_fatal_error();
+            return;
+        }
+    }
+    else
+    {
+        #if CONFIG_DRV_OTA_RESUME
+        resume_offset = ota_resume_prepare(update_partition);
+        #endif
+        #if CONFIG_DRV_OTA_CONDITIONAL_GET
+        /* the connection of the probe in drv_ota_create_task(), past its TLS handshake */
+        client = drv_ota_check_take_client(config.url);
+        if (client == NULL)
+        {
+            client = esp_http_client_init(&config);
+        }
+        #else
+        client = esp_http_client_init(&config);
+        #endif
+        if (client == NULL) 
+        {
+            ESP_LOGE(TAG, "Failed to initialise HTTP connection");
+            task_fatal_error();
+            return;
+        }
+        #if CONFIG_DRV_OTA_COMPRESSION
+        ota_http_codec = DRV_OTA_CODEC_NONE;
+        esp_http_client_set_header(client, "Accept-Encoding", drv_ota_decomp_accept_encoding());
+        #endif
+        #if CONFIG_DRV_OTA_MANIFEST
+        err = ota_manifest_fetch(client, config.url);
+        if (err != ESP_OK)
+        {
+            esp_http_client_cleanup(client);
+            task_fatal_error();
+            return;
+        }
+        #endif
+        #if CONFIG_DRV_OTA_RESUME
+        err = ota_http_open_from(client, resume_offset);
+        if (err == ESP_ERR_INVALID_STATE)
+        {
+            ESP_LOGW(TAG, "Image changed on server, downloading from scratch");
+            ota_resume_discard();
+            resume_offset = 0;
+            err = ESP_OK;
+        }
+        #else
+        err = ota_http_open(client);
+        #endif
+        if (err != ESP_OK) 
+        {
+            ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
+            esp_http_client_cleanup(client);
+            task_fatal_error();
+            return;
+        }
+        #if CONFIG_DRV_OTA_RESUME
+        if (resume_offset == 0)
+        {
+            ota_resume_start(client, update_partition);
+        }
+        #else
+        esp_http_client_fetch_headers(client);
+        #endif
+        #if CONFIG_DRV_OTA_MANIFEST
+        int64_t manifest_content_length = esp_http_client_get_content_length(client);
+        if ((manifest_content_length > 0) && (resume_offset + manifest_content_length != ota_manifest.header.file_size))
+        {
+            ESP_LOGE(TAG, "Image of %d bytes is not the one of the manifest", (int)(resume_offset + manifest_content_length));
+            http_cleanup(client);
+            task_fatal_error();
+            return;
+        }
+        drv_ota_manifest_seek(&ota_manifest, resume_offset);
         #endif
-        task_fatal_error();
-        return;
     }
-    //assert(update_partition != NULL);
-
-    ESP_LOGI(TAG, "Writing to partition subtype %d at offset 0x%x",
-             update_partition->subtype, (unsigned int)update_partition->address);
+    #endif
 
 
 
@@ -387,6 +1631,7 @@ static void ota_task(void *pvParameter)
     }
     uint64_t time_last = esp_timer_get_time();
     uint32_t time_passed = 0;
+    int image_recv_last = 0;
     #endif
 
     #if USE_HTTP_CLIENT_DIRECTLY
@@ -395,15 +1640,82 @@ static void ota_task(void *pvParameter)
     bool image_header_was_checked = false;
     #endif
 
+    #if CONFIG_DRV_OTA_RESUME
+    if (resume_offset > 0)
+    {
+        /* the image header was checked by the attempt which wrote the first bytes */
+        binary_file_length = resume_offset;
+        image_header_was_checked = true;
+        update_handle = ota_writer.handle;
+    }
+    #endif
+
+    #if CONFIG_DRV_OTA_VERIFY_DIGEST
+    #if CONFIG_DRV_OTA_RESUME
+    ota_digest_begin(client, resume_offset);
+    #else
+    ota_digest_begin(client, 0);
+    #endif
+    #endif
+
+    #if CONFIG_DRV_OTA_COMPRESSION
+    if (ota_http_codec != DRV_OTA_CODEC_NONE)
+    {
+        #if CONFIG_DRV_OTA_RESUME
+        if (resume_offset > 0)
+        {
+            ESP_LOGE(TAG, "Compressed image can not be resumed");
+            ota_resume_discard();
+            http_cleanup(client);
+            task_fatal_error();
+            return;
+        }
+        #endif
+        err = ota_decomp_start(&update_handle, update_partition);
+        if (err != ESP_OK)
+        {
+            http_cleanup(client);
+            task_fatal_error();
+            return;
+        }
+        /* the header is checked on the decompressed data in ota_decoded_write() */
+        image_header_was_checked = true;
+    }
+    #endif
+
+    #if USE_OTA_PIPELINE
+    /* update_handle is passed by reference as it is set by esp_ota_begin() on the first buffer */
+    err = drv_ota_pipeline_init(&ota_pipeline, ota_buffers, OTA_BUFFER_COUNT, OTA_BUFFER_SIZE, ota_pipeline_write, &update_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start OTA pipeline (%s)", esp_err_to_name(err));
+        http_cleanup(client);
+        task_fatal_error();
+        return;
+    }
+    #endif
+
+    #if CONFIG_DRV_OTA_PARALLEL
+    /* taken after the first buffer, which tells if the image is a delta patch */
+    bool parallel_pending = (client != NULL) && ota_parallel_eligible(client);
+    bool parallel_done = false;
+    #endif
+
     while (1) 
     {
 
 
 
         #if USE_HTTP_CLIENT_DIRECTLY == 0
+        /* the size of a read is not ours to choose, the limit is kept on average */
+        drv_ota_sched_acquire(OTA_READ_BUFFER_SIZE);
+        int64_t start_us = esp_timer_get_time();
         err = esp_https_ota_perform(https_ota_handle);
         int new_image_recv = esp_https_ota_get_image_len_read(https_ota_handle);
         int new_image_size = esp_https_ota_get_image_size(https_ota_handle);
+        int new_image_chunk = new_image_recv - image_recv_last;
+        drv_ota_stats_read(start_us, new_image_chunk);
+        image_recv_last = new_image_recv;
         uint64_t time_now = esp_timer_get_time();
         uint32_t time_diff = time_now - time_last;
         time_last = time_now;
@@ -411,12 +1723,14 @@ static void ota_task(void *pvParameter)
         if (time_passed >= 1000 * 1000)
         {
             time_passed -= 1000 * 1000;
-            ESP_LOGI(TAG, "Firmware image download process %7d/%7d bytes (%6.2f%%)", new_image_recv, new_image_size, (float)new_image_recv / new_image_size * 100);
+            ESP_LOGI(TAG, "Firmware image download process %7d/%7d bytes (%3d%%)", new_image_recv, new_image_size, (new_image_size > 0) ? (int)((int64_t)new_image_recv * 100 / new_image_size) : 0);
         }
         if (err != ESP_ERR_HTTPS_OTA_IN_PROGRESS) 
         {
             break;
         }
+        /* reading and writing are not told apart in here, all of it counts as busy */
+        drv_ota_sched_yield(0, new_image_chunk);
         #endif
 
 
@@ -424,9 +1738,48 @@ static void ota_task(void *pvParameter)
 
 
         #if USE_HTTP_CLIENT_DIRECTLY
-        int data_read = esp_http_client_read(client, ota_write_data, WRITE_DATA_BUFFSIZE);
+        #if USE_OTA_PIPELINE
+        drv_ota_pipeline_buffer_t* pipeline_buffer = drv_ota_pipeline_get_free(&ota_pipeline);
+        if (pipeline_buffer == NULL)
+        {
+            ESP_LOGE(TAG, "Error: flash writer failed");
+            http_cleanup(client);
+            ota_update_abort(update_handle);
+            task_fatal_error();
+            return;
+        }
+        char* read_data = (char*)pipeline_buffer->data;
+        size_t read_size = drv_ota_sched_acquire(pipeline_buffer->size);
+        int64_t start_us = esp_timer_get_time();
+        int data_read = ota_read(client, read_data, read_size);
+        #elif CONFIG_DRV_OTA_MANIFEST
+        /* read straight into the chunk, it is written once its hash matches */
+        size_t read_size = 0;
+        char* read_data = (char*)drv_ota_manifest_chunk_room(&ota_manifest, &read_size);
+        read_size = drv_ota_sched_acquire(read_size);
+        int64_t start_us = esp_timer_get_time();
+        int data_read = ota_read(client, read_data, read_size);
+        #else
+        /* mbedtls decrypts the record into its own buffer, this is the only copy */
+        char* read_data = (char*)ota_buffers[0];
+        size_t read_size = drv_ota_sched_acquire(OTA_BUFFER_SIZE);
+        int64_t start_us = esp_timer_get_time();
+        int data_read = ota_read(client, read_data, read_size);
+        #endif
+        int64_t read_us = esp_timer_get_time() - start_us;
+        drv_ota_stats_read(start_us, data_read);
         if (data_read < 0) 
         {
+            #if CONFIG_DRV_OTA_RESUME
+            #if USE_OTA_PIPELINE
+            drv_ota_pipeline_put_free(&ota_pipeline, pipeline_buffer);
+            #endif
+            ESP_LOGW(TAG, "SSL data read error at offset %d", binary_file_length);
+            if ((client != NULL) && (ota_http_reconnect(client, binary_file_length, &reconnect_count) == ESP_OK))
+            {
+                continue;
+            }
+            #endif
             ESP_LOGE(TAG, "Error: SSL data read error");
             http_cleanup(client);
             task_fatal_error();
@@ -434,89 +1787,100 @@ static void ota_task(void *pvParameter)
         } 
         else if (data_read > 0) 
         {
-            if (image_header_was_checked == false) 
+            #if CONFIG_DRV_OTA_MANIFEST
+            const uint8_t* chunk = NULL;
+            size_t chunk_length = 0;
+            drv_ota_sched_yield(read_us, data_read);
+            if (drv_ota_manifest_chunk_add(&ota_manifest, data_read, &chunk, &chunk_length) == ESP_ERR_INVALID_CRC)
             {
-                esp_app_desc_t new_app_info;
-                if (data_read > sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) 
+                /* only the bad chunk is received again, the ones before it are written */
+                if (ota_http_reconnect(client, binary_file_length, &reconnect_count) == ESP_OK)
                 {
-                    // check current version with downloading
-                    memcpy(&new_app_info, &ota_write_data[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)], sizeof(esp_app_desc_t));
-                    ESP_LOGI(TAG, "New firmware version: %s", new_app_info.version);
-
-                    esp_app_desc_t running_app_info;
-                    if (esp_ota_get_partition_description(running, &running_app_info) == ESP_OK) 
-                    {
-                        ESP_LOGI(TAG, "Running firmware version: %s", running_app_info.version);
-                    }
-
-                    const esp_partition_t* last_invalid_app = esp_ota_get_last_invalid_partition();
-                    esp_app_desc_t invalid_app_info;
-                    if (esp_ota_get_partition_description(last_invalid_app, &invalid_app_info) == ESP_OK) 
-                    {
-                        ESP_LOGI(TAG, "Last invalid firmware version: %s", invalid_app_info.version);
-                    }
-
-                    // check current version with last invalid partition
-                    if (last_invalid_app != NULL) 
-                    {
-                        if (memcmp(invalid_app_info.version, new_app_info.version, sizeof(new_app_info.version)) == 0) 
-                        {
-                            ESP_LOGW(TAG, "New version is the same as invalid version.");
-                            ESP_LOGW(TAG, "Previously, there was an attempt to launch the firmware with %s version, but it failed.", invalid_app_info.version);
-                            ESP_LOGW(TAG, "The firmware has been rolled back to the previous version.");
-                            http_cleanup(client);
-                            //infinite_loop();
-                            task_fatal_error();
-                            return;
-
-                        }
-                    }
-                    #ifndef CONFIG_EXAMPLE_SKIP_VERSION_CHECK
-                    if (memcmp(new_app_info.version, running_app_info.version, sizeof(new_app_info.version)) == 0) 
-                    {
-                        ESP_LOGW(TAG, "Current running version is the same as a new. We will not continue the update.");
-                        http_cleanup(client);
-                        //infinite_loop();
-                        task_fatal_error();
-                        return;
-                    }
-                    #endif
-
-                    image_header_was_checked = true;
-
-                    err = esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle);
-                    if (err != ESP_OK)
-                    {
-                        ESP_LOGE(TAG, "esp_ota_begin failed (%s)", esp_err_to_name(err));
-                        http_cleanup(client);
-                        esp_ota_abort(update_handle);
-                        task_fatal_error();
-                        return;
-                    }
-                    ESP_LOGI(TAG, "esp_ota_begin succeeded");
-                } 
-                else 
+                    continue;
+                }
+                ESP_LOGE(TAG, "Error: chunk at %d corrupted on every attempt", binary_file_length);
+                http_cleanup(client);
+                ota_update_abort(update_handle);
+                task_fatal_error();
+                return;
+            }
+            if (chunk_length == 0)
+            {
+                continue;
+            }
+            read_data = (char*)chunk;
+            data_read = (int)chunk_length;
+            #endif
+            if (image_header_was_checked == false) 
+            {
+                err = ota_image_begin(read_data, data_read, update_partition, &update_handle);
+                if (err != ESP_OK)
                 {
-                    ESP_LOGE(TAG, "received package is not fit len");
                     http_cleanup(client);
-                    esp_ota_abort(update_handle);
+                    ota_update_abort(update_handle);
                     task_fatal_error();
                     return;
                 }
+                image_header_was_checked = true;
             }
-            err = esp_ota_write( update_handle, (const void *)ota_write_data, data_read);
+            #if USE_OTA_PIPELINE
+            pipeline_buffer->length = data_read;
+            pipeline_buffer->offset = binary_file_length;
+            err = drv_ota_pipeline_submit(&ota_pipeline, pipeline_buffer);
+            #else
+            err = ota_payload_write(update_handle, (const void *)read_data, data_read);
+            #endif
             if (err != ESP_OK) 
             {
                 http_cleanup(client);
-                esp_ota_abort(update_handle);
+                ota_update_abort(update_handle);
                 task_fatal_error();
                 return;
             }
             binary_file_length += data_read;
             ESP_LOGD(TAG, "Written image length %d", binary_file_length);
+            #if CONFIG_DRV_OTA_RESUME
+            reconnect_count = 0;
+            #endif
+            #if CONFIG_DRV_OTA_MANIFEST == 0
+            drv_ota_sched_yield(read_us, data_read);
+            #endif
+            #if CONFIG_DRV_OTA_PARALLEL
+            if (parallel_pending)
+            {
+                parallel_pending = false;
+                /* a patch or a bundle is not the image at the offsets of the ranges */
+                #if CONFIG_DRV_OTA_DELTA
+                if (ota_delta_active == false)
+                #endif
+                #if CONFIG_DRV_OTA_BUNDLE
+                if (ota_bundle_active == false)
+                #endif
+                {
+                    err = ota_parallel_download(&config, client, update_partition, update_handle, &binary_file_length);
+                    if (err != ESP_OK)
+                    {
+                        http_cleanup(client);
+                        ota_update_abort(update_handle);
+                        task_fatal_error();
+                        return;
+                    }
+                    parallel_done = true;
+                    break;
+                }
+            }
+            #endif
         } 
         else if (data_read == 0) 
         {
+            #if USE_OTA_PIPELINE
+            drv_ota_pipeline_put_free(&ota_pipeline, pipeline_buffer);
+            #endif
+            if (ota_source != NULL)
+            {
+                ESP_LOGI(TAG, "End of %s:// image", ota_source->scheme);
+                break;
+            }
            /*
             * As esp_http_client_read never returns negative error code, we rely on
             * `errno` to check for underlying transport connectivity closure if any
@@ -524,6 +1888,18 @@ static void ota_task(void *pvParameter)
             if (errno == ECONNRESET || errno == ENOTCONN) 
             {
                 ESP_LOGE(TAG, "Connection closed, errno = %d", errno);
+                #if CONFIG_DRV_OTA_RESUME
+                if (ota_http_reconnect(client, binary_file_length, &reconnect_count) == ESP_OK)
+                {
+                    continue;
+                }
+                /* the client holds the failed response now, it would pass as complete */
+                ESP_LOGE(TAG, "Error: download interrupted at %d", binary_file_length);
+                http_cleanup(client);
+                ota_update_abort(update_handle);
+                task_fatal_error();
+                return;
+                #endif
                 break;
             }
             if (esp_http_client_is_complete_data_received(client) == true) 
@@ -539,17 +1915,131 @@ static void ota_task(void *pvParameter)
 
 
 
+    #if USE_OTA_PIPELINE
+    err = drv_ota_pipeline_flush(&ota_pipeline);
+    drv_ota_pipeline_deinit(&ota_pipeline);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error: flash writer failed (%s)", esp_err_to_name(err));
+        http_cleanup(client);
+        ota_update_abort(update_handle);
+        task_fatal_error();
+        return;
+    }
+    #endif
+
+    #if CONFIG_DRV_OTA_COMPRESSION
+    if (ota_decomp_active)
+    {
+        err = drv_ota_decomp_finish(&ota_decomp);
+        drv_ota_decomp_print_stats(&ota_decomp);
+        ota_decomp_stop();
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error: compressed image incomplete (%s)", esp_err_to_name(err));
+            http_cleanup(client);
+            ota_update_abort(update_handle);
+            task_fatal_error();
+            return;
+        }
+    }
+    #endif
+
+    #if CONFIG_DRV_OTA_DELTA
+    if (ota_delta_active)
+    {
+        err = drv_ota_delta_finish(&ota_delta);
+        ota_delta_stop();
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error: delta patch incomplete (%s)", esp_err_to_name(err));
+            http_cleanup(client);
+            ota_update_abort(update_handle);
+            task_fatal_error();
+            return;
+        }
+    }
+    #endif
+
+    #if CONFIG_DRV_OTA_BUNDLE
+    if (ota_bundle_active && (drv_ota_bundle_finish(&ota_bundle) != ESP_OK))
+    {
+        ESP_LOGE(TAG, "Error: bundle incomplete");
+        http_cleanup(client);
+        ota_update_abort(update_handle);
+        task_fatal_error();
+        return;
+    }
+    #endif
+
     #if USE_HTTP_CLIENT_DIRECTLY
     ESP_LOGI(TAG, "Total Write binary data length: %d", binary_file_length);
-    if (esp_http_client_is_complete_data_received(client) != true) 
+    #if CONFIG_DRV_OTA_PARALLEL
+    bool complete_data_received = parallel_done || ota_read_complete(client);
+    #else
+    bool complete_data_received = ota_read_complete(client);
+    #endif
+    #if CONFIG_DRV_OTA_MANIFEST
+    complete_data_received = complete_data_received && (binary_file_length == (int)ota_manifest.header.file_size);
+    ESP_LOGI(TAG, "%u chunks verified, %u corrupted received again", (unsigned int)ota_manifest.chunks_verified, (unsigned int)ota_manifest.chunks_failed);
+    drv_ota_manifest_release(&ota_manifest);
+    #endif
+    if (complete_data_received != true) 
     {
         ESP_LOGE(TAG, "Error in receiving complete file");
         http_cleanup(client);
-        esp_ota_abort(update_handle);
+        ota_update_abort(update_handle);
         task_fatal_error();
         return;
     }
+    ota_source_close();
+    /* nothing else runs while the image is verified and selected for boot */
+    ota_stop_processes_for(DRV_OTA_RESOURCE_ALL);
+    int64_t finish_start = esp_timer_get_time();
+    #if CONFIG_DRV_OTA_VERIFY_DIGEST
+    /* checked while writing, the image needs no second pass over the flash */
+    bool digest_verified = false;
+    if (ota_digest.active)
+    {
+        err = drv_ota_digest_finish(&ota_digest);
+        drv_ota_digest_stop(&ota_digest);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Image does not match the digest sent by the server");
+            #if CONFIG_DRV_OTA_RESUME
+            ota_resume_discard();
+            #endif
+            http_cleanup(client);
+            ota_update_abort(update_handle);
+            task_fatal_error();
+            return;
+        }
+        digest_verified = ota_digest_header_checked;
+        if (digest_verified == false)
+        {
+            ESP_LOGW(TAG, "Image header not checked, the image is verified by reading it back");
+        }
+    }
+    #endif
+    #if USE_OTA_WRITER
+    /* esp_ota_set_boot_partition() below validates the image written with offsets */
+    err = drv_ota_writer_flush(&ota_writer);
+    #if CONFIG_DRV_OTA_SKIP_UNCHANGED
+    ESP_LOGI(TAG, "%u of %u sectors unchanged, not erased or written", (unsigned int)ota_writer.sectors_skipped,
+        (unsigned int)(ota_writer.sectors_skipped + ota_writer.sectors_programmed));
+    #endif
+    drv_ota_writer_release(&ota_writer);
+    #else
+    #if CONFIG_DRV_OTA_VERIFY_DIGEST
+    if (digest_verified)
+    {
+        esp_ota_abort(update_handle);
+        err = ESP_OK;
+    }
+    else
+    #endif
     err = esp_ota_end(update_handle);
+    #endif
     if (err != ESP_OK) 
     {
         if (err == ESP_ERR_OTA_VALIDATE_FAILED) 
@@ -564,15 +2054,48 @@ static void ota_task(void *pvParameter)
         task_fatal_error();
         return;
     }
+    #if CONFIG_DRV_OTA_BUNDLE
+    /* the data slots follow the app from its first boot, and back on a rollback */
+    if (ota_bundle_active)
+    {
+        err = drv_ota_bundle_commit(&ota_bundle, update_partition);
+        ota_bundle_stop();
+        if (err != ESP_OK)
+        {
+            http_cleanup(client);
+            task_fatal_error();
+            return;
+        }
+    }
+    #endif
+    #if USE_OTA_DEFERRED
+    /* selected for boot later by drv_ota_activate, staged once the update is done */
+    drv_ota_stats_finish(finish_start);
+    #else
+    #if CONFIG_DRV_OTA_VERIFY_DIGEST
+    if (digest_verified)
+    {
+        err = drv_ota_digest_set_boot_partition(update_partition);
+    }
+    else
+    #endif
     err = esp_ota_set_boot_partition(update_partition);
+    drv_ota_stats_finish(finish_start);
     if (err != ESP_OK) 
     {
         ESP_LOGE(TAG, "esp_ota_set_boot_partition failed (%s)!", esp_err_to_name(err));
+        #if CONFIG_DRV_OTA_RESUME
+        ota_resume_discard();
+        #endif
         http_cleanup(client);
         task_fatal_error();
         return;
     }
     #endif
+    #if CONFIG_DRV_OTA_RESUME
+    drv_ota_resume_clear();
+    #endif
+    #endif
 
 
 
@@ -585,7 +2108,11 @@ static void ota_task(void *pvParameter)
         return;
     }
 
+    /* nothing else runs while the image is verified and selected for boot */
+    drv_ota_stop_processes_for(DRV_OTA_RESOURCE_ALL);
+    int64_t finish_start = esp_timer_get_time();
     esp_err_t ota_finish_err = esp_https_ota_finish(https_ota_handle);
+    drv_ota_stats_finish(finish_start);
     if (ota_finish_err != ESP_OK) 
     {
         ESP_LOGE(TAG, "Fail Finish due to an error %d", ota_finish_err);
@@ -594,11 +2121,38 @@ static void ota_task(void *pvParameter)
     }
     #endif
 
+    #if USE_HTTP_CLIENT_DIRECTLY
+    ota_buffers_release();
+    #endif
+    #if CONFIG_DRV_OTA_CONDITIONAL_GET
+    esp_app_desc_t installed_app_info;
+    if (esp_ota_get_partition_description(update_partition, &installed_app_info) == ESP_OK)
+    {
+        drv_ota_check_installed(config.url, ota_http_etag, ota_http_last_modified, installed_app_info.version);
+    }
+    #endif
+    drv_ota_sched_stop();
+    drv_ota_stats_end(ESP_OK);
+    #if USE_OTA_DEFERRED
+    http_cleanup(client);
+    drv_ota_start_processes();
+    /* from here on drv_ota_activate stops the processes and restarts */
+    #if CONFIG_DRV_OTA_VERIFY_DIGEST
+    drv_ota_activate_stage(update_partition, digest_verified);
+    #else
+    drv_ota_activate_stage(update_partition, false);
+    #endif
+    if (drv_ota_mirror_active())
+    {
+        /* peers get the staged image, not the one it replaces */
+        drv_ota_mirror_start(NULL);
+    }
+    #else
     ESP_LOGI(TAG, "Prepare to restart system!");
     esp_restart();
     drv_ota_start_processes();
-    xHandleOTA = NULL;
-    vTaskDelete(NULL);
+    #endif
+    ota_task_exit();
 
     return ;
 }
@@ -606,6 +2160,34 @@ static void ota_task(void *pvParameter)
 
 
 
+/* the same settings as ota_task, so the connection can be handed over to it */
+static esp_err_t ota_check(const char *url, drv_ota_check_t* check, bool keep_client)
+{
+    esp_http_client_config_t config = 
+    {
+        .url = (url != NULL) ? url : cURLOTA,
+        .cert_pem = (char *)server_cert_pem_start,
+        .event_handler = _http_event_handler,
+        .timeout_ms = CONFIG_DRV_OTA_RECV_TIMEOUT,
+        .keep_alive_enable = true,
+        .save_client_session = true,
+    };
+    #if CONFIG_DRV_OTA_CERTIFICATE_SKIP_CN_CHECK
+    config.skip_cert_common_name_check = true;
+    #endif
+    return drv_ota_check_probe(&config, check, keep_client);
+}
+
+/*
+ * Tells if url, or the default one if NULL, has an update for the running
+ * build. Only the first bytes of the image are requested and nothing is
+ * stopped, meant for polling before drv_ota_create_task().
+ */
+esp_err_t drv_ota_check_available(const char *url, drv_ota_check_t* check)
+{
+    return ota_check(url, check, false);
+}
+
 void drv_ota_create_task(const char *url)
 {
     const char* upgradeURL = url;
@@ -617,95 +2199,68 @@ void drv_ota_create_task(const char *url)
 
     if (xHandleOTA == NULL)
     {
-        drv_ota_stop_processes();
-
-        ESP_LOGI(TAG, "Creating OTA Task...");
-
-        xTaskCreate(&ota_task, "ota_task", 8192, (void *)upgradeURL, configMAX_PRIORITIES - 0, &xHandleOTA);
-        ESP_LOGI(TAG, "Created OTA Task...");
-        configASSERT(xHandleOTA);
-    }
-    else
-    {
-        ESP_LOGI(TAG, "Error OTA Task already started...");
-    }
-}
-
-void drv_ota_start_processes(void)
-{
-    for (int index = drv_ota_start_stop_process_count-1; index >= 0; index--)
-    {
-        if (drv_ota_start_stop_process_list[index].start_func)
-        {
-            ESP_LOGI(TAG, "Executing start process %s", drv_ota_start_stop_process_list[index].name);
-            drv_ota_start_stop_process_list[index].start_func();
-        }
-        else
+        #if CONFIG_DRV_OTA_LOW_MEMORY
+        if (ota_task_parked != NULL)
         {
-            if (strlen(drv_ota_start_stop_process_list[index].name) > 0)
+            while (eTaskGetState(ota_task_parked) != eSuspended)
             {
-                ESP_LOGI(TAG, "Executing start process %s skipped", drv_ota_start_stop_process_list[index].name);
+                vTaskDelay(1);
             }
-            else
-            {
-                ESP_LOGI(TAG, "Executing start process %s (empty string) skipped", drv_ota_start_stop_process_list[index].name);
-            }
-        }
-    }
-}
-void drv_ota_stop_processes(void)
-{
-    for (int index = 0; index < drv_ota_start_stop_process_count; index++)
-    {
-        if (drv_ota_start_stop_process_list[index].stop_func)
-        {
-            ESP_LOGI(TAG, "Executing stop process %s", drv_ota_start_stop_process_list[index].name);
-            drv_ota_start_stop_process_list[index].stop_func();
+            vTaskDelete(ota_task_parked);
+            ota_task_parked = NULL;
         }
-        else
+        if (ota_arena_alloc() != ESP_OK)
         {
-            if (strlen(drv_ota_start_stop_process_list[index].name) > 0)
-            {
-                ESP_LOGI(TAG, "Executing stop process %s skipped", drv_ota_start_stop_process_list[index].name);
-            }
-            else
-            {
-                ESP_LOGI(TAG, "Executing stop process %s (empty string) skipped", drv_ota_start_stop_process_list[index].name);
-            }
+            return;
         }
-    }
-}
+        #endif
+        /* the heap used from here on counts for the update */
+        drv_ota_stats_prepare(ota_reserved_size());
 
+        /* an image of a file:// or other source needs neither the probe nor the network */
+        bool local = USE_HTTP_CLIENT_DIRECTLY && (drv_ota_source_find(upgradeURL, NULL) != NULL);
 
-void drv_ota_register_start_stop_process(drv_ota_start_stop_process_func_t start_func, drv_ota_start_stop_process_func_t stop_func, char* process_name)
-{
-    if (drv_ota_start_stop_process_count < MAX_START_STOP_PROCESSES)
-    {
-        drv_ota_start_stop_process_list[drv_ota_start_stop_process_count].start_func = start_func;
-        drv_ota_start_stop_process_list[drv_ota_start_stop_process_count].stop_func = stop_func;
-        if (process_name)
+        #if CONFIG_DRV_OTA_CONDITIONAL_GET
+        drv_ota_check_t check;
+        /* ota_task goes on with the connection of the probe */
+        if ((local == false) && (ota_check(upgradeURL, &check, USE_HTTP_CLIENT_DIRECTLY) == ESP_OK) && (check.result != DRV_OTA_CHECK_AVAILABLE))
         {
-            if (strlen(process_name) < sizeof(drv_ota_start_stop_process_list[0].name))
-            {
-                strcpy(drv_ota_start_stop_process_list[drv_ota_start_stop_process_count].name, process_name);
-                ESP_LOGI(TAG, "Register process %s", drv_ota_start_stop_process_list[drv_ota_start_stop_process_count].name);
-            }
-            else
-            {
-                memcpy(drv_ota_start_stop_process_list[drv_ota_start_stop_process_count].name, process_name, sizeof(drv_ota_start_stop_process_list[0].name));
-                drv_ota_start_stop_process_list[drv_ota_start_stop_process_count].name[sizeof(drv_ota_start_stop_process_list[0].name) - 1] = '\0';
-                ESP_LOGW(TAG, "Register process %s name truncated to %s", process_name, drv_ota_start_stop_process_list[drv_ota_start_stop_process_count].name);
-            }
+            ESP_LOGI(TAG, "No update on the server, nothing stopped");
+            return;
         }
-        else
+        #endif
+
+        #if USE_OTA_DEFERRED
+        /* the download goes to the partition of an image still waiting for its activation */
+        drv_ota_activate_cancel();
+        #endif
+
+        /* the rest are stopped as the download reaches the flash */
+        ota_stop_processes_for(local ? DRV_OTA_RESOURCE_CPU : (DRV_OTA_RESOURCE_NETWORK | DRV_OTA_RESOURCE_CPU));
+
+        ESP_LOGI(TAG, "Creating OTA Task...");
+
+        /* without the pipeline ota_task writes the flash itself */
+        #if CONFIG_DRV_OTA_LOW_MEMORY
+        ota_task_done = false;
+        ota_task_parked = xTaskCreateStaticPinnedToCore(&ota_task, "ota_task", OTA_TASK_STACK_SIZE, (void *)upgradeURL, drv_ota_sched_priority(),
+                                                        &ota_arena[OTA_ARENA_SIZE - OTA_TASK_STACK_SIZE], &ota_task_buffer, drv_ota_sched_core(USE_OTA_PIPELINE == 0));
+        configASSERT(ota_task_parked);
+        portENTER_CRITICAL(&ota_task_lock);
+        if (ota_task_done == false)
         {
-            ESP_LOGI(TAG, "Register process %s (empty string)", drv_ota_start_stop_process_list[drv_ota_start_stop_process_count].name);
+            xHandleOTA = ota_task_parked;
         }
-        drv_ota_start_stop_process_count++;
+        portEXIT_CRITICAL(&ota_task_lock);
+        ESP_LOGI(TAG, "Created OTA Task...");
+        #else
+        xTaskCreatePinnedToCore(&ota_task, "ota_task", OTA_TASK_STACK_SIZE, (void *)upgradeURL, drv_ota_sched_priority(), &xHandleOTA, drv_ota_sched_core(USE_OTA_PIPELINE == 0));
+        ESP_LOGI(TAG, "Created OTA Task...");
+        configASSERT(xHandleOTA);
+        #endif
     }
     else
     {
-        ESP_LOGE(TAG, "Cannot register %s process start stop (no space left)", process_name);
+        ESP_LOGI(TAG, "Error OTA Task already started...");
     }
-    
-}
\ No newline at end of file
+}
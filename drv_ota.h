@@ -19,6 +19,16 @@ extern "C"
  * Header Includes
  **************************************************************************** */
 //#include <stddef.h>
+#include "drv_ota_activate.h"
+#include "drv_ota_bundle.h"
+#include "drv_ota_check.h"
+#include "drv_ota_mirror.h"
+#include "drv_ota_preerase.h"
+#include "drv_ota_process.h"
+#include "drv_ota_source.h"
+#include "drv_ota_sched.h"
+#include "drv_ota_stats.h"
+#include "drv_ota_validate.h"
     
 /* *****************************************************************************
  * Configuration Definitions
@@ -35,7 +45,6 @@ extern "C"
 /* *****************************************************************************
  * Type Definitions
  **************************************************************************** */
-typedef void (*drv_ota_start_stop_process_func_t)(void);
 
 /* *****************************************************************************
  * Function-Like Macro
@@ -51,12 +60,12 @@ typedef void (*drv_ota_start_stop_process_func_t)(void);
 void drv_ota_print_info(void);
 void drv_ota_init(void);
 void drv_ota_create_task(const char *url);
-void drv_ota_start_processes(void);
-void drv_ota_stop_processes(void);
-void drv_ota_register_start_stop_process(
-                drv_ota_start_stop_process_func_t start_func, 
-                drv_ota_start_stop_process_func_t stop_func, 
-                char* process_name);
+esp_err_t drv_ota_check_available(const char *url, drv_ota_check_t* check);
+/* drv_ota_get_stats(), drv_ota_reset_stats() and drv_ota_print_stats() in drv_ota_stats.h */
+/* drv_ota_register_process(), drv_ota_start_processes() and drv_ota_stop_processes() in drv_ota_process.h */
+/* drv_ota_set_rate_limit() and drv_ota_get_rate_limit() in drv_ota_sched.h */
+/* drv_ota_mirror_start() and drv_ota_mirror_stop() in drv_ota_mirror.h */
+/* drv_ota_activate_set_callback() and drv_ota_activate_now() in drv_ota_activate.h */
 
 #ifdef __cplusplus
 }
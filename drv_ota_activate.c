@@ -0,0 +1,430 @@
+/* *****************************************************************************
+ * File:   drv_ota_activate.c
+ * Author: DL
+ *
+ * Created on 2024 07 01
+ *
+ * Description: deferred activation of a downloaded image
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_activate.h"
+
+#include <sdkconfig.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include "drv_ota_process.h"
+#include "drv_ota_sched.h"
+#if CONFIG_DRV_OTA_VERIFY_DIGEST
+#include "drv_ota_digest.h"
+#endif
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_activate"
+
+#ifdef CONFIG_DRV_OTA_DEFERRED_WINDOW_START
+#define ACTIVATE_WINDOW_START       CONFIG_DRV_OTA_DEFERRED_WINDOW_START
+#else
+#define ACTIVATE_WINDOW_START       120
+#endif
+
+#ifdef CONFIG_DRV_OTA_DEFERRED_WINDOW_LENGTH
+#define ACTIVATE_WINDOW_LENGTH      CONFIG_DRV_OTA_DEFERRED_WINDOW_LENGTH
+#else
+#define ACTIVATE_WINDOW_LENGTH      120
+#endif
+
+#ifdef CONFIG_DRV_OTA_DEFERRED_CHECK_MS
+#define ACTIVATE_CHECK_MS           CONFIG_DRV_OTA_DEFERRED_CHECK_MS
+#else
+#define ACTIVATE_CHECK_MS           60000
+#endif
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define ACTIVATE_PRIORITY           (tskIDLE_PRIORITY + 1)
+#define ACTIVATE_STACK_SIZE         4096    /* esp_ota_set_boot_partition() verifies the image */
+#define ACTIVATE_MINUTES_PER_DAY    (24 * 60)
+#define ACTIVATE_CLOCK_SET_YEAR     2016    /* earlier, the clock was not set since the boot */
+
+#define ACTIVATE_NVS_NAMESPACE      "drv_ota"
+#define ACTIVATE_NVS_KEY            "staged"
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+/* stored in nvs, a reset before the window does not lose the image */
+typedef struct
+{
+    uint32_t partition_address;
+    char version[32];
+}activate_record_t;
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+/* held while the image is checked for and selected, and while the state below changes */
+static SemaphoreHandle_t activate_lock = NULL;
+static TaskHandle_t activate_task = NULL;
+static const esp_partition_t* activate_partition = NULL;
+static activate_record_t activate_record;
+static bool activate_verified = false;
+static bool activate_forced = false;
+static bool activate_clock_logged = false;
+static int64_t activate_staged_us = 0;
+
+static drv_ota_activate_func_t activate_func = NULL;
+static void* activate_arg = NULL;
+static uint32_t activate_window_start = ACTIVATE_WINDOW_START;
+static uint32_t activate_window_length = ACTIVATE_WINDOW_LENGTH;
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static bool activate_record_load(activate_record_t* record)
+{
+    nvs_handle_t nvs;
+    size_t length = sizeof(*record);
+    bool loaded = false;
+
+    if (nvs_open(ACTIVATE_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK)
+    {
+        loaded = (nvs_get_blob(nvs, ACTIVATE_NVS_KEY, record, &length) == ESP_OK) && (length == sizeof(*record));
+        nvs_close(nvs);
+    }
+    record->version[sizeof(record->version) - 1] = '\0';
+    return loaded;
+}
+
+static void activate_record_save(const activate_record_t* record)
+{
+    nvs_handle_t nvs;
+
+    if (nvs_open(ACTIVATE_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK)
+    {
+        esp_err_t err = (record != NULL) ? nvs_set_blob(nvs, ACTIVATE_NVS_KEY, record, sizeof(*record)) : nvs_erase_key(nvs, ACTIVATE_NVS_KEY);
+        if (err == ESP_OK)
+        {
+            nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+}
+
+static esp_err_t activate_lock_create(void)
+{
+    if (activate_lock == NULL)
+    {
+        activate_lock = xSemaphoreCreateMutex();
+    }
+    return (activate_lock != NULL) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+/* what the image waits for, for the logs */
+static const char* activate_condition(char* text, size_t size)
+{
+    if (activate_window_length > 0)
+    {
+        uint32_t end = (activate_window_start + activate_window_length) % ACTIVATE_MINUTES_PER_DAY;
+        snprintf(text, size, "in the window %02u:%02u-%02u:%02u%s", (unsigned int)(activate_window_start / 60), (unsigned int)(activate_window_start % 60),
+                 (unsigned int)(end / 60), (unsigned int)(end % 60), (activate_func != NULL) ? " once the application allows it" : "");
+    }
+    else
+    {
+        strlcpy(text, (activate_func != NULL) ? "once the application allows it" : "at once", size);
+    }
+    return text;
+}
+
+/* local time of the system clock, closed while it is not set */
+static bool activate_window_open(void)
+{
+    struct tm local;
+
+    if (activate_window_length == 0)
+    {
+        return true;
+    }
+    time_t now = time(NULL);
+    localtime_r(&now, &local);
+    if (local.tm_year < (ACTIVATE_CLOCK_SET_YEAR - 1900))
+    {
+        if (activate_clock_logged == false)
+        {
+            ESP_LOGW(TAG, "Clock not set, the maintenance window stays closed");
+            activate_clock_logged = true;
+        }
+        return false;
+    }
+    uint32_t minute = (uint32_t)(local.tm_hour * 60 + local.tm_min);
+    return ((minute + ACTIVATE_MINUTES_PER_DAY - activate_window_start) % ACTIVATE_MINUTES_PER_DAY) < activate_window_length;
+}
+
+/* with activate_lock held, returns only if the device does not restart */
+static void activate_image(void)
+{
+    esp_err_t err;
+
+    ESP_LOGI(TAG, "Activating %s in %s", activate_record.version, activate_partition->label);
+    /* the only time the update stops anything */
+    drv_ota_stop_processes_for(DRV_OTA_RESOURCE_ALL);
+    int64_t start_us = esp_timer_get_time();
+    #if CONFIG_DRV_OTA_VERIFY_DIGEST
+    if (activate_verified)
+    {
+        err = drv_ota_digest_set_boot_partition(activate_partition);
+    }
+    else
+    #endif
+    err = esp_ota_set_boot_partition(activate_partition);
+
+    /* not tried again, nor after the restart, a rollback would find it staged otherwise */
+    activate_partition = NULL;
+    activate_record_save(NULL);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "esp_ota_set_boot_partition failed (%s)!", esp_err_to_name(err));
+        drv_ota_start_processes();
+        return;
+    }
+    ESP_LOGI(TAG, "Boot partition set in %lld ms, %lld s after the download", (long long)((esp_timer_get_time() - start_us) / 1000),
+             (long long)((start_us - activate_staged_us) / 1000000));
+    ESP_LOGI(TAG, "Prepare to restart system!");
+    esp_restart();
+}
+
+static void activate_task_func(void* pvParameter)
+{
+    while (true)
+    {
+        xSemaphoreTake(activate_lock, portMAX_DELAY);
+        if (activate_partition == NULL)
+        {
+            activate_task = NULL;
+            xSemaphoreGive(activate_lock);
+            vTaskDelete(NULL);
+            return;
+        }
+        /* the application is asked in the window only */
+        if (activate_forced || (activate_window_open() && ((activate_func == NULL) || activate_func(activate_arg))))
+        {
+            activate_image();
+        }
+        xSemaphoreGive(activate_lock);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ACTIVATE_CHECK_MS));
+    }
+}
+
+/* before drv_ota_preerase_start(), picks up an image staged before a reset */
+void drv_ota_activate_init(void)
+{
+    activate_record_t record;
+    esp_app_desc_t app_desc;
+
+    if (activate_record_load(&record) == false)
+    {
+        return;
+    }
+    const esp_partition_t* partition = esp_ota_get_next_update_partition(NULL);
+    if ((partition != NULL) && (partition->address == record.partition_address) && (esp_ota_get_boot_partition() != partition) &&
+        (esp_ota_get_partition_description(partition, &app_desc) == ESP_OK) && (strncmp(app_desc.version, record.version, sizeof(record.version)) == 0))
+    {
+        /* checked again when it is selected, the digest of the download is gone */
+        drv_ota_activate_stage(partition, false);
+    }
+    else
+    {
+        /* activated, or overwritten since */
+        activate_record_save(NULL);
+    }
+}
+
+/*
+ * The image in partition is complete, verified is true once its digest was
+ * checked while it was written. It is selected for boot by the activation
+ * task, the running image keeps booting until then.
+ */
+esp_err_t drv_ota_activate_stage(const esp_partition_t* partition, bool verified)
+{
+    activate_record_t record = { 0 };
+    esp_app_desc_t app_desc;
+    char condition[80];
+
+    if (partition == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = esp_ota_get_partition_description(partition, &app_desc);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "No image in %s to stage (%s)", partition->label, esp_err_to_name(err));
+        return err;
+    }
+    if (activate_lock_create() != ESP_OK)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    record.partition_address = partition->address;
+    strlcpy(record.version, app_desc.version, sizeof(record.version));
+
+    xSemaphoreTake(activate_lock, portMAX_DELAY);
+    activate_record_save(&record);
+    activate_record = record;
+    activate_partition = partition;
+    activate_verified = verified;
+    activate_forced = false;
+    activate_staged_us = esp_timer_get_time();
+    if (activate_task != NULL)
+    {
+        xTaskNotifyGive(activate_task);
+    }
+    else if (xTaskCreatePinnedToCore(&activate_task_func, "ota_activate", ACTIVATE_STACK_SIZE, NULL, ACTIVATE_PRIORITY, &activate_task, drv_ota_sched_core(true)) != pdPASS)
+    {
+        /* the record stays, drv_ota_activate_init() stages it after a reset */
+        ESP_LOGE(TAG, "No activation task, image %s staged until the next reset", record.version);
+        activate_task = NULL;
+        activate_partition = NULL;
+        err = ESP_ERR_NO_MEM;
+    }
+    if (err == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Image %s staged in %s, activated %s", record.version, partition->label, activate_condition(condition, sizeof(condition)));
+    }
+    xSemaphoreGive(activate_lock);
+    return err;
+}
+
+/* a new download goes to the partition of the staged image */
+void drv_ota_activate_cancel(void)
+{
+    if (activate_lock == NULL)
+    {
+        return;
+    }
+    xSemaphoreTake(activate_lock, portMAX_DELAY);
+    if (activate_partition != NULL)
+    {
+        ESP_LOGI(TAG, "Image %s staged in %s dropped", activate_record.version, activate_partition->label);
+        activate_partition = NULL;
+        activate_record_save(NULL);
+        xTaskNotifyGive(activate_task);
+    }
+    xSemaphoreGive(activate_lock);
+}
+
+/* outside the window and whatever the callback says */
+esp_err_t drv_ota_activate_now(void)
+{
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+
+    if (activate_lock == NULL)
+    {
+        return err;
+    }
+    xSemaphoreTake(activate_lock, portMAX_DELAY);
+    if (activate_partition != NULL)
+    {
+        activate_forced = true;
+        xTaskNotifyGive(activate_task);
+        err = ESP_OK;
+    }
+    xSemaphoreGive(activate_lock);
+    return err;
+}
+
+bool drv_ota_activate_pending(void)
+{
+    return activate_partition != NULL;
+}
+
+/* the partition of the staged image, NULL if none */
+const esp_partition_t* drv_ota_activate_get_partition(void)
+{
+    return activate_partition;
+}
+
+/* func runs in the activation task and may not call drv_ota_activate functions, NULL for none */
+void drv_ota_activate_set_callback(drv_ota_activate_func_t func, void* arg)
+{
+    if (activate_lock_create() == ESP_OK)
+    {
+        xSemaphoreTake(activate_lock, portMAX_DELAY);
+        activate_func = func;
+        activate_arg = arg;
+        xSemaphoreGive(activate_lock);
+    }
+}
+
+/* start in minutes after local midnight, a length of 0 leaves it to the callback */
+esp_err_t drv_ota_activate_set_window(uint32_t start_minute, uint32_t length_minutes)
+{
+    if ((start_minute >= ACTIVATE_MINUTES_PER_DAY) || (length_minutes > ACTIVATE_MINUTES_PER_DAY))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (activate_lock_create() != ESP_OK)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(activate_lock, portMAX_DELAY);
+    activate_window_start = start_minute;
+    activate_window_length = length_minutes;
+    if (activate_task != NULL)
+    {
+        xTaskNotifyGive(activate_task);
+    }
+    xSemaphoreGive(activate_lock);
+    return ESP_OK;
+}
+
+void drv_ota_activate_print(void)
+{
+    char condition[80];
+
+    if ((activate_lock == NULL) || (activate_partition == NULL))
+    {
+        printf("Activation: no image staged\n");
+        return;
+    }
+    xSemaphoreTake(activate_lock, portMAX_DELAY);
+    if (activate_partition != NULL)
+    {
+        printf("Activation: %s staged in %s %lld s ago, %s\n", activate_record.version, activate_partition->label,
+               (long long)((esp_timer_get_time() - activate_staged_us) / 1000000), activate_condition(condition, sizeof(condition)));
+    }
+    else
+    {
+        printf("Activation: no image staged\n");
+    }
+    xSemaphoreGive(activate_lock);
+}
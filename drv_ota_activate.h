@@ -0,0 +1,72 @@
+/* *****************************************************************************
+ * File:   drv_ota_activate.h
+ * Author: DL
+ *
+ * Created on 2024 07 01
+ *
+ * Description: deferred activation of a downloaded image
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+/* true when the device may restart now, asked in the maintenance window only */
+typedef bool (*drv_ota_activate_func_t)(void* arg);
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+void drv_ota_activate_init(void);
+esp_err_t drv_ota_activate_stage(const esp_partition_t* partition, bool verified);
+void drv_ota_activate_cancel(void);
+esp_err_t drv_ota_activate_now(void);
+bool drv_ota_activate_pending(void);
+const esp_partition_t* drv_ota_activate_get_partition(void);
+
+void drv_ota_activate_set_callback(drv_ota_activate_func_t func, void* arg);
+esp_err_t drv_ota_activate_set_window(uint32_t start_minute, uint32_t length_minutes);
+void drv_ota_activate_print(void);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
@@ -0,0 +1,436 @@
+/* *****************************************************************************
+ * File:   drv_ota_bundle.c
+ * Author: DL
+ *
+ * Created on 2024 06 17
+ *
+ * Description: app image and data partitions streamed in one transfer
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_bundle.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sdkconfig.h>
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include "drv_ota_stats.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_bundle"
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define BUNDLE_NVS_NAMESPACE    "drv_ota"
+#define BUNDLE_NVS_KEY          "bundle"
+#define BUNDLE_SECTOR_SIZE      4096
+/* erased ahead of the writes in blocks the flash erases in one command */
+#define BUNDLE_ERASE_SIZE       65536
+#define BUNDLE_NAME_SIZE        (DRV_OTA_BUNDLE_LABEL_SIZE + 1)
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+/* which app partition each slot of a data partition pair belongs to */
+typedef struct
+{
+    char label[BUNDLE_NAME_SIZE];
+    char apps[2][BUNDLE_NAME_SIZE];
+}bundle_slot_t;
+
+typedef struct
+{
+    bundle_slot_t slots[DRV_OTA_BUNDLE_MAX_SECTIONS];
+}bundle_slots_t;
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+#define BUNDLE_MIN(a, b)        (((a) < (b)) ? (a) : (b))
+#define BUNDLE_ALIGN_UP(x, a)   ((((x) + (a) - 1) / (a)) * (a))
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static void bundle_slots_load(bundle_slots_t* slots)
+{
+    nvs_handle_t nvs;
+    size_t length = sizeof(*slots);
+
+    memset(slots, 0, sizeof(*slots));
+    if (nvs_open(BUNDLE_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+    {
+        return;
+    }
+    esp_err_t err = nvs_get_blob(nvs, BUNDLE_NVS_KEY, slots, &length);
+    nvs_close(nvs);
+    if ((err != ESP_OK) || (length != sizeof(*slots)))
+    {
+        memset(slots, 0, sizeof(*slots));
+    }
+}
+
+static esp_err_t bundle_slots_save(const bundle_slots_t* slots)
+{
+    nvs_handle_t nvs;
+
+    esp_err_t err = nvs_open(BUNDLE_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_blob(nvs, BUNDLE_NVS_KEY, slots, sizeof(*slots));
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Slots not saved (%s)", esp_err_to_name(err));
+    }
+    return err;
+}
+
+/* the entry of label, a free one is taken for a label not seen before */
+static bundle_slot_t* bundle_slots_find(bundle_slots_t* slots, const char* label, bool add)
+{
+    bundle_slot_t* free_slot = NULL;
+
+    for (int index = 0; index < DRV_OTA_BUNDLE_MAX_SECTIONS; index++)
+    {
+        bundle_slot_t* slot = &slots->slots[index];
+        if (strcmp(slot->label, label) == 0)
+        {
+            return slot;
+        }
+        if ((free_slot == NULL) && (slot->label[0] == '\0'))
+        {
+            free_slot = slot;
+        }
+    }
+    if (add && (free_slot != NULL))
+    {
+        strlcpy(free_slot->label, label, sizeof(free_slot->label));
+        return free_slot;
+    }
+    return NULL;
+}
+
+/* slot 0 holds the data flashed with the first app until an update says otherwise */
+static int bundle_active_slot(const bundle_slot_t* slot, const esp_partition_t* app_partition)
+{
+    if ((slot != NULL) && (app_partition != NULL) && (strcmp(slot->apps[1], app_partition->label) == 0))
+    {
+        return 1;
+    }
+    return 0;
+}
+
+/* the pair <label>_0 and <label>_1, false when the partition table has no slots for label */
+static bool bundle_find_pair(const char* label, const esp_partition_t** pair)
+{
+    char name[BUNDLE_NAME_SIZE + 2];
+
+    for (int index = 0; index < 2; index++)
+    {
+        snprintf(name, sizeof(name), "%s_%d", label, index);
+        pair[index] = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, name);
+    }
+    return (pair[0] != NULL) && (pair[1] != NULL);
+}
+
+static esp_err_t bundle_data_write(drv_ota_bundle_t* bundle, const uint8_t* data, size_t size)
+{
+    const esp_partition_t* partition = bundle->partitions[bundle->section];
+    const drv_ota_bundle_section_t* section = &bundle->header.sections[bundle->section];
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t err = ESP_OK;
+
+    uint32_t end = bundle->section_offset + size;
+    if (end > bundle->erased)
+    {
+        uint32_t erase_end = BUNDLE_MIN(BUNDLE_ALIGN_UP(end, BUNDLE_ERASE_SIZE), BUNDLE_ALIGN_UP(section->size, BUNDLE_SECTOR_SIZE));
+        err = esp_partition_erase_range(partition, bundle->erased, erase_end - bundle->erased);
+        bundle->erased = erase_end;
+    }
+    if (err == ESP_OK)
+    {
+        err = esp_partition_write(partition, bundle->section_offset, data, size);
+    }
+    drv_ota_stats_write(start_us, size);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to write %s at %u (%s)", partition->label, (unsigned int)bundle->section_offset, esp_err_to_name(err));
+    }
+    return err;
+}
+
+static esp_err_t bundle_section_end(drv_ota_bundle_t* bundle)
+{
+    const drv_ota_bundle_section_t* section = &bundle->header.sections[bundle->section];
+    uint8_t sha256[32];
+
+    mbedtls_sha256_finish(&bundle->sha, sha256);
+    if (memcmp(sha256, section->sha256, sizeof(sha256)) != 0)
+    {
+        ESP_LOGE(TAG, "Section %.16s does not match its sha256", section->label);
+        return ESP_ERR_INVALID_CRC;
+    }
+    ESP_LOGI(TAG, "Section %.16s of %u bytes verified", section->label, (unsigned int)section->size);
+    bundle->section++;
+    bundle->section_offset = 0;
+    bundle->erased = 0;
+    mbedtls_sha256_starts(&bundle->sha, 0);
+    return ESP_OK;
+}
+
+bool drv_ota_bundle_is_bundle(const void* data, size_t size)
+{
+    return (size >= DRV_OTA_BUNDLE_MAGIC_SIZE) && (memcmp(data, DRV_OTA_BUNDLE_MAGIC, DRV_OTA_BUNDLE_MAGIC_SIZE) == 0);
+}
+
+esp_err_t drv_ota_bundle_parse_header(const void* data, size_t size, drv_ota_bundle_header_t* header)
+{
+    drv_ota_bundle_file_header_t file_header;
+
+    if ((size < sizeof(file_header)) || (drv_ota_bundle_is_bundle(data, size) == false))
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(&file_header, data, sizeof(file_header));
+    size_t sections_size = file_header.section_count * sizeof(drv_ota_bundle_section_t);
+    if ((file_header.section_count == 0) || (file_header.section_count > DRV_OTA_BUNDLE_MAX_SECTIONS) ||
+        (file_header.header_size < sizeof(file_header) + sections_size))
+    {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (size < file_header.header_size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memset(header, 0, sizeof(*header));
+    header->header_size = file_header.header_size;
+    header->section_count = file_header.section_count;
+    memcpy(header->sections, (const uint8_t*)data + sizeof(file_header), sections_size);
+    return ESP_OK;
+}
+
+/*
+ * Picks the partition of each data section, the slot of a pair the running
+ * app does not use. The slot is forgotten until drv_ota_bundle_commit(), an
+ * interrupted update leaves the data of the running app as it was.
+ */
+esp_err_t drv_ota_bundle_init(drv_ota_bundle_t* bundle, const drv_ota_bundle_header_t* header, drv_ota_bundle_write_func_t app_write, void* context)
+{
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    bundle_slots_t slots;
+    bool slots_changed = false;
+
+    memset(bundle, 0, sizeof(*bundle));
+    bundle->header = *header;
+    if ((header->sections[0].flags & DRV_OTA_BUNDLE_FLAG_APP) == 0)
+    {
+        ESP_LOGE(TAG, "Bundle does not start with the app");
+        return ESP_ERR_INVALID_ARG;
+    }
+    bundle_slots_load(&slots);
+    for (uint32_t index = 0; index < header->section_count; index++)
+    {
+        const drv_ota_bundle_section_t* section = &bundle->header.sections[index];
+        char label[BUNDLE_NAME_SIZE];
+
+        memcpy(label, section->label, DRV_OTA_BUNDLE_LABEL_SIZE);
+        label[DRV_OTA_BUNDLE_LABEL_SIZE] = '\0';
+        bundle->slots[index] = -1;
+        if (section->size == 0)
+        {
+            ESP_LOGE(TAG, "Section %s is empty", label);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        if (section->flags & DRV_OTA_BUNDLE_FLAG_APP)
+        {
+            if (index > 0)
+            {
+                ESP_LOGE(TAG, "Bundle has more than one app");
+                return ESP_ERR_INVALID_ARG;
+            }
+            continue;
+        }
+
+        const esp_partition_t* pair[2];
+        const esp_partition_t* partition = NULL;
+        if (bundle_find_pair(label, pair))
+        {
+            bundle_slot_t* slot = bundle_slots_find(&slots, label, true);
+            if (slot == NULL)
+            {
+                return ESP_ERR_NO_MEM;
+            }
+            int target = 1 - bundle_active_slot(slot, running);
+            if (slot->apps[target][0] != '\0')
+            {
+                slot->apps[target][0] = '\0';
+                slots_changed = true;
+            }
+            bundle->slots[index] = (int8_t)target;
+            partition = pair[target];
+        }
+        else
+        {
+            partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+            /* the nvs in use and the ota data can not be rewritten under the running app */
+            if ((partition != NULL) && ((partition->subtype == ESP_PARTITION_SUBTYPE_DATA_OTA) || (strcmp(partition->label, "nvs") == 0)))
+            {
+                ESP_LOGE(TAG, "Partition %s can not be updated", label);
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+            if (partition != NULL)
+            {
+                ESP_LOGW(TAG, "No slots %s_0 and %s_1, %s is written in place", label, label, label);
+            }
+        }
+        if (partition == NULL)
+        {
+            ESP_LOGE(TAG, "No partition for section %s", label);
+            return ESP_ERR_NOT_FOUND;
+        }
+        if (BUNDLE_ALIGN_UP(section->size, BUNDLE_SECTOR_SIZE) > partition->size)
+        {
+            ESP_LOGE(TAG, "Section %s of %u bytes does not fit %s", label, (unsigned int)section->size, partition->label);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        bundle->partitions[index] = partition;
+        ESP_LOGI(TAG, "Section %s of %u bytes to %s", label, (unsigned int)section->size, partition->label);
+    }
+    if (slots_changed && (bundle_slots_save(&slots) != ESP_OK))
+    {
+        return ESP_FAIL;
+    }
+    mbedtls_sha256_init(&bundle->sha);
+    mbedtls_sha256_starts(&bundle->sha, 0);
+    bundle->header_left = header->header_size;
+    bundle->app_write = app_write;
+    bundle->context = context;
+    return ESP_OK;
+}
+
+/* the bundle from its first byte on, in any pieces */
+esp_err_t drv_ota_bundle_feed(drv_ota_bundle_t* bundle, const uint8_t* data, size_t size)
+{
+    size_t skip = BUNDLE_MIN(size, bundle->header_left);
+    bundle->header_left -= skip;
+    data += skip;
+    size -= skip;
+
+    while (size > 0)
+    {
+        if (bundle->section >= bundle->header.section_count)
+        {
+            ESP_LOGE(TAG, "Data after the last section");
+            return ESP_ERR_INVALID_SIZE;
+        }
+        const drv_ota_bundle_section_t* section = &bundle->header.sections[bundle->section];
+        size_t length = BUNDLE_MIN(size, section->size - bundle->section_offset);
+
+        mbedtls_sha256_update(&bundle->sha, data, length);
+        esp_err_t err = (bundle->partitions[bundle->section] == NULL) ? bundle->app_write(bundle->context, data, length)
+                                                                       : bundle_data_write(bundle, data, length);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        bundle->section_offset += length;
+        data += length;
+        size -= length;
+        if (bundle->section_offset == section->size)
+        {
+            err = bundle_section_end(bundle);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t drv_ota_bundle_finish(drv_ota_bundle_t* bundle)
+{
+    if (bundle->section < bundle->header.section_count)
+    {
+        ESP_LOGE(TAG, "Bundle ends in section %.16s", bundle->header.sections[bundle->section].label);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+/* the slots written go with app_partition, before it is set to boot */
+esp_err_t drv_ota_bundle_commit(drv_ota_bundle_t* bundle, const esp_partition_t* app_partition)
+{
+    bundle_slots_t slots;
+    bool slots_changed = false;
+
+    bundle_slots_load(&slots);
+    for (uint32_t index = 0; index < bundle->header.section_count; index++)
+    {
+        int target = bundle->slots[index];
+        if (target < 0)
+        {
+            continue;
+        }
+        char label[BUNDLE_NAME_SIZE];
+        memcpy(label, bundle->header.sections[index].label, DRV_OTA_BUNDLE_LABEL_SIZE);
+        label[DRV_OTA_BUNDLE_LABEL_SIZE] = '\0';
+        bundle_slot_t* slot = bundle_slots_find(&slots, label, true);
+        if (slot == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        strlcpy(slot->apps[target], app_partition->label, sizeof(slot->apps[target]));
+        slots_changed = true;
+        ESP_LOGI(TAG, "%s runs with %s", app_partition->label, bundle->partitions[index]->label);
+    }
+    return slots_changed ? bundle_slots_save(&slots) : ESP_OK;
+}
+
+void drv_ota_bundle_deinit(drv_ota_bundle_t* bundle)
+{
+    mbedtls_sha256_free(&bundle->sha);
+}
+
+/* the partition of label for the running app, of its pair of slots if there is one */
+const esp_partition_t* drv_ota_bundle_partition(const char* label)
+{
+    const esp_partition_t* pair[2];
+    bundle_slots_t slots;
+
+    if (bundle_find_pair(label, pair) == false)
+    {
+        return esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    }
+    bundle_slots_load(&slots);
+    return pair[bundle_active_slot(bundle_slots_find(&slots, label, false), esp_ota_get_running_partition())];
+}
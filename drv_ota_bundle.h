@@ -0,0 +1,127 @@
+/* *****************************************************************************
+ * File:   drv_ota_bundle.h
+ * Author: DL
+ *
+ * Created on 2024 06 17
+ *
+ * Description: app image and data partitions streamed in one transfer
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "mbedtls/sha256.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define DRV_OTA_BUNDLE_MAGIC            "DOTABND1"
+#define DRV_OTA_BUNDLE_MAGIC_SIZE       8
+#define DRV_OTA_BUNDLE_MAX_SECTIONS     8
+#define DRV_OTA_BUNDLE_LABEL_SIZE       16
+
+#define DRV_OTA_BUNDLE_FLAG_APP         0x01    /* the app image or a delta patch of it */
+
+/* the header is checked on the first buffer, it has to fit in it */
+#define DRV_OTA_BUNDLE_HEADER_MAX_SIZE  (sizeof(drv_ota_bundle_file_header_t) + DRV_OTA_BUNDLE_MAX_SECTIONS * sizeof(drv_ota_bundle_section_t))
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+
+/*
+ * Bundle layout, all fields little endian:
+ *   drv_ota_bundle_file_header_t
+ *   section_count drv_ota_bundle_section_t
+ *   the section contents one after another, the app section first
+ * A data section goes to the partition <label>_0 or <label>_1 the running
+ * app does not use, or in place to <label> when there are no such slots
+ * (see tools/drv_ota_bundle.py).
+ */
+typedef struct __attribute__((packed))
+{
+    char magic[DRV_OTA_BUNDLE_MAGIC_SIZE];
+    uint32_t header_size;
+    uint32_t section_count;
+}drv_ota_bundle_file_header_t;
+
+typedef struct __attribute__((packed))
+{
+    char label[DRV_OTA_BUNDLE_LABEL_SIZE];  /* not terminated when all 16 are used */
+    uint32_t size;
+    uint32_t flags;
+    uint8_t sha256[32];                     /* of the section as it is in the bundle */
+}drv_ota_bundle_section_t;
+
+typedef struct
+{
+    uint32_t header_size;
+    uint32_t section_count;
+    drv_ota_bundle_section_t sections[DRV_OTA_BUNDLE_MAX_SECTIONS];
+}drv_ota_bundle_header_t;
+
+/* output of the app section, in order */
+typedef esp_err_t (*drv_ota_bundle_write_func_t)(void* context, const uint8_t* data, size_t size);
+
+typedef struct
+{
+    drv_ota_bundle_header_t header;
+    const esp_partition_t* partitions[DRV_OTA_BUNDLE_MAX_SECTIONS];  /* NULL for the app section */
+    int8_t slots[DRV_OTA_BUNDLE_MAX_SECTIONS];                      /* 0 or 1, -1 written in place */
+    uint32_t header_left;
+    uint32_t section;
+    uint32_t section_offset;
+    uint32_t erased;
+    mbedtls_sha256_context sha;
+    drv_ota_bundle_write_func_t app_write;
+    void* context;
+}drv_ota_bundle_t;
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+bool drv_ota_bundle_is_bundle(const void* data, size_t size);
+esp_err_t drv_ota_bundle_parse_header(const void* data, size_t size, drv_ota_bundle_header_t* header);
+esp_err_t drv_ota_bundle_init(drv_ota_bundle_t* bundle, const drv_ota_bundle_header_t* header, drv_ota_bundle_write_func_t app_write, void* context);
+esp_err_t drv_ota_bundle_feed(drv_ota_bundle_t* bundle, const uint8_t* data, size_t size);
+esp_err_t drv_ota_bundle_finish(drv_ota_bundle_t* bundle);
+esp_err_t drv_ota_bundle_commit(drv_ota_bundle_t* bundle, const esp_partition_t* app_partition);
+void drv_ota_bundle_deinit(drv_ota_bundle_t* bundle);
+const esp_partition_t* drv_ota_bundle_partition(const char* label);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
@@ -0,0 +1,444 @@
+/* *****************************************************************************
+ * File:   drv_ota_check.c
+ * Author: DL
+ *
+ * Created on 2024 06 03
+ *
+ * Description: version probe of the server image without an update
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_check.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sdkconfig.h>
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "nvs.h"
+
+#include "drv_ota_bundle.h"
+#include "drv_ota_delta.h"
+#include "drv_ota_resume.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_check"
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+/* the image header, its first segment header and the app description right after */
+#define CHECK_APP_SIZE          (sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t))
+#if CONFIG_DRV_OTA_BUNDLE
+/* a bundle has its header in front of the app */
+#define CHECK_PROBE_SIZE        (DRV_OTA_BUNDLE_HEADER_MAX_SIZE + CHECK_APP_SIZE)
+#else
+#define CHECK_PROBE_SIZE        CHECK_APP_SIZE
+#endif
+#define CHECK_URL_SIZE          256
+#define CHECK_NVS_NAMESPACE     "drv_ota"
+#define CHECK_NVS_KEY           "check"
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef struct
+{
+    char etag[DRV_OTA_RESUME_ETAG_SIZE];
+    char last_modified[DRV_OTA_RESUME_LAST_MODIFIED_SIZE];
+    bool encoded;                   /* Content-Encoding other than identity */
+}check_response_t;
+
+/* handler of the caller, for the events of a connection handed over */
+typedef struct
+{
+    http_event_handle_cb handler;
+    void* user_data;
+}check_forward_t;
+
+/* what a 304 stands for, kept in NVS for an image installed or rejected */
+typedef struct
+{
+    char url[CHECK_URL_SIZE];
+    char etag[DRV_OTA_RESUME_ETAG_SIZE];
+    char last_modified[DRV_OTA_RESUME_LAST_MODIFIED_SIZE];
+    char version[32];
+    bool patch;
+    uint8_t base_app_elf_sha256[32];
+}check_answer_t;
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+/* validators of the last answer, sent back with If-None-Match and If-Modified-Since */
+static check_answer_t check_answer;
+static bool check_answer_loaded = false;
+/* description of the last 200 or 206, not kept over a reset */
+static esp_app_desc_t check_app;
+static bool check_app_valid = false;
+/* headers of the probe in progress */
+static esp_http_client_handle_t check_probe_client = NULL;
+static check_response_t check_response;
+static check_forward_t check_forward;
+/* connection of the last probe left open for the download of the image */
+static esp_http_client_handle_t check_client = NULL;
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static esp_err_t check_http_event_handler(esp_http_client_event_t* evt)
+{
+    check_response_t* response = &check_response;
+    check_forward_t* forward = (check_forward_t*)evt->user_data;
+
+    if ((evt->client == check_probe_client) && (evt->event_id == HTTP_EVENT_ON_HEADER))
+    {
+        if (strcasecmp(evt->header_key, "ETag") == 0)
+        {
+            strlcpy(response->etag, evt->header_value, sizeof(response->etag));
+        }
+        else if (strcasecmp(evt->header_key, "Last-Modified") == 0)
+        {
+            strlcpy(response->last_modified, evt->header_value, sizeof(response->last_modified));
+        }
+        else if (strcasecmp(evt->header_key, "Content-Encoding") == 0)
+        {
+            response->encoded = (strcasecmp(evt->header_value, "identity") != 0);
+        }
+    }
+    if ((forward != NULL) && (forward->handler != NULL))
+    {
+        evt->user_data = forward->user_data;
+        return forward->handler(evt);
+    }
+    return ESP_OK;
+}
+
+/* same as the checks of ota_task, which would stop on the first buffer */
+static drv_ota_check_result_t check_decide(const char* version, const uint8_t* base_elf_sha256)
+{
+    esp_app_desc_t running;
+    esp_app_desc_t invalid;
+
+    if (esp_ota_get_partition_description(esp_ota_get_running_partition(), &running) != ESP_OK)
+    {
+        return DRV_OTA_CHECK_AVAILABLE;
+    }
+    const esp_partition_t* last_invalid_app = esp_ota_get_last_invalid_partition();
+    if ((last_invalid_app != NULL) && (esp_ota_get_partition_description(last_invalid_app, &invalid) == ESP_OK) &&
+        (strncmp(invalid.version, version, sizeof(invalid.version)) == 0))
+    {
+        return DRV_OTA_CHECK_REJECTED;
+    }
+    #ifndef CONFIG_EXAMPLE_SKIP_VERSION_CHECK
+    if (strncmp(running.version, version, sizeof(running.version)) == 0)
+    {
+        return DRV_OTA_CHECK_UP_TO_DATE;
+    }
+    #endif
+    if ((base_elf_sha256 != NULL) && (memcmp(base_elf_sha256, running.app_elf_sha256, sizeof(running.app_elf_sha256)) != 0))
+    {
+        return DRV_OTA_CHECK_REJECTED;
+    }
+    return DRV_OTA_CHECK_AVAILABLE;
+}
+
+static void check_answer_load(void)
+{
+    nvs_handle_t nvs;
+    size_t length = sizeof(check_answer);
+
+    check_answer_loaded = true;
+    if (nvs_open(CHECK_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+    {
+        return;
+    }
+    if ((nvs_get_blob(nvs, CHECK_NVS_KEY, &check_answer, &length) != ESP_OK) || (length != sizeof(check_answer)))
+    {
+        memset(&check_answer, 0, sizeof(check_answer));
+    }
+    nvs_close(nvs);
+    check_answer.url[sizeof(check_answer.url) - 1] = '\0';
+    check_answer.etag[sizeof(check_answer.etag) - 1] = '\0';
+    check_answer.last_modified[sizeof(check_answer.last_modified) - 1] = '\0';
+    check_answer.version[sizeof(check_answer.version) - 1] = '\0';
+}
+
+static void check_answer_save(void)
+{
+    #if CONFIG_DRV_OTA_CONDITIONAL_GET
+    nvs_handle_t nvs;
+    check_answer_t stored;
+    size_t length = sizeof(stored);
+
+    esp_err_t err = nvs_open(CHECK_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Validators not saved, nvs_open failed (%s)", esp_err_to_name(err));
+        return;
+    }
+    /* polled often, the flash is written only for a new answer */
+    if ((nvs_get_blob(nvs, CHECK_NVS_KEY, &stored, &length) != ESP_OK) || (length != sizeof(stored)) ||
+        (memcmp(&stored, &check_answer, sizeof(stored)) != 0))
+    {
+        err = nvs_set_blob(nvs, CHECK_NVS_KEY, &check_answer, sizeof(check_answer));
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(nvs);
+        }
+    }
+    nvs_close(nvs);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Validators not saved (%s)", esp_err_to_name(err));
+    }
+    #endif
+}
+
+/* the app description out of the first bytes of an image or of a delta patch, alone or in a bundle */
+static esp_err_t check_parse(const uint8_t* data, size_t size, check_answer_t* answer)
+{
+    memset(&check_app, 0, sizeof(check_app));
+    check_app_valid = false;
+
+    #if CONFIG_DRV_OTA_BUNDLE
+    drv_ota_bundle_header_t bundle;
+    if (drv_ota_bundle_is_bundle(data, size) && (drv_ota_bundle_parse_header(data, size, &bundle) == ESP_OK))
+    {
+        data += bundle.header_size;
+        size -= bundle.header_size;
+    }
+    #endif
+
+    #if CONFIG_DRV_OTA_DELTA
+    drv_ota_delta_header_t patch;
+    if (drv_ota_delta_is_patch(data, size) && (drv_ota_delta_parse_header(data, size, &patch) == ESP_OK))
+    {
+        strlcpy(answer->version, patch.target_version, sizeof(answer->version));
+        answer->patch = true;
+        memcpy(answer->base_app_elf_sha256, patch.base_app_elf_sha256, sizeof(answer->base_app_elf_sha256));
+        return ESP_OK;
+    }
+    #endif
+
+    const esp_image_header_t* header = (const esp_image_header_t*)data;
+    const esp_app_desc_t* app = (const esp_app_desc_t*)&data[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)];
+    if ((size < CHECK_APP_SIZE) || (header->magic != ESP_IMAGE_HEADER_MAGIC) || (app->magic_word != ESP_APP_DESC_MAGIC_WORD))
+    {
+        ESP_LOGE(TAG, "No app description in the first %u bytes", (unsigned int)size);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    memcpy(&check_app, app, sizeof(check_app));
+    check_app_valid = true;
+    strlcpy(answer->version, app->version, sizeof(answer->version));
+    return ESP_OK;
+}
+
+static void check_result(drv_ota_check_t* check)
+{
+    if (check_app_valid)
+    {
+        memcpy(&check->app, &check_app, sizeof(check->app));
+    }
+    else
+    {
+        strlcpy(check->app.version, check_answer.version, sizeof(check->app.version));
+    }
+    check->result = check_decide(check_answer.version, check_answer.patch ? check_answer.base_app_elf_sha256 : NULL);
+}
+
+/*
+ * Asks for the first bytes of the image only, with the validators of the
+ * last answer for the same url. A 304 decides on the last answer again, a
+ * server ignoring the range is cut off after them. Nothing else of the
+ * update runs. With keep_client the connection of an available update is
+ * left open for drv_ota_check_take_client().
+ */
+esp_err_t drv_ota_check_probe(const esp_http_client_config_t* http_config, drv_ota_check_t* check, bool keep_client)
+{
+    check_response_t* response = &check_response;
+    esp_http_client_config_t config = *http_config;
+    uint8_t data[CHECK_PROBE_SIZE];
+    char range[32];
+
+    memset(check, 0, sizeof(*check));
+    memset(response, 0, sizeof(*response));
+    drv_ota_check_release_client();
+    if (check_answer_loaded == false)
+    {
+        check_answer_load();
+    }
+    if (keep_client)
+    {
+        check_forward.handler = http_config->event_handler;
+        check_forward.user_data = http_config->user_data;
+    }
+    config.event_handler = check_http_event_handler;
+    config.user_data = keep_client ? &check_forward : NULL;
+    config.keep_alive_enable = keep_client;
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    check_probe_client = client;
+    snprintf(range, sizeof(range), "bytes=0-%u", (unsigned int)(CHECK_PROBE_SIZE - 1));
+    esp_http_client_set_header(client, "Range", range);
+    esp_http_client_set_header(client, "Accept-Encoding", "identity");
+    bool cached = (strcmp(check_answer.url, config.url) == 0) && ((check_answer.etag[0] != '\0') || (check_answer.last_modified[0] != '\0'));
+    if (cached && (check_answer.etag[0] != '\0'))
+    {
+        esp_http_client_set_header(client, "If-None-Match", check_answer.etag);
+    }
+    if (cached && (check_answer.last_modified[0] != '\0'))
+    {
+        esp_http_client_set_header(client, "If-Modified-Since", check_answer.last_modified);
+    }
+
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
+        check_probe_client = NULL;
+        esp_http_client_cleanup(client);
+        return err;
+    }
+    esp_http_client_fetch_headers(client);
+    int status_code = esp_http_client_get_status_code(client);
+    if ((status_code == 304) && cached)
+    {
+        check_result(check);
+        check->not_modified = true;
+    }
+    else if ((status_code == 200) || (status_code == 206))
+    {
+        check_answer_t answer = { 0 };
+        size_t received = 0;
+        while ((received < sizeof(data)) && (response->encoded == false))
+        {
+            int data_read = esp_http_client_read(client, (char*)&data[received], sizeof(data) - received);
+            if (data_read <= 0)
+            {
+                break;
+            }
+            received += data_read;
+        }
+        err = response->encoded ? ESP_ERR_NOT_SUPPORTED : check_parse(data, received, &answer);
+        if (err == ESP_OK)
+        {
+            strlcpy(answer.url, config.url, sizeof(answer.url));
+            strlcpy(answer.etag, response->etag, sizeof(answer.etag));
+            strlcpy(answer.last_modified, response->last_modified, sizeof(answer.last_modified));
+            check_answer = answer;
+            check_result(check);
+            if (check->result != DRV_OTA_CHECK_AVAILABLE)
+            {
+                check_answer_save();
+            }
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "HTTP status %d", status_code);
+        err = ESP_ERR_INVALID_RESPONSE;
+    }
+    check_probe_client = NULL;
+    /* a 200 is not read to its end, the connection goes */
+    bool complete = (status_code == 304) || ((status_code == 206) && esp_http_client_is_complete_data_received(client));
+    if (keep_client && (err == ESP_OK) && (check->result == DRV_OTA_CHECK_AVAILABLE) && complete)
+    {
+        esp_http_client_delete_header(client, "Range");
+        esp_http_client_delete_header(client, "Accept-Encoding");
+        esp_http_client_delete_header(client, "If-None-Match");
+        esp_http_client_delete_header(client, "If-Modified-Since");
+        check_client = client;
+    }
+    else
+    {
+        esp_http_client_close(client);
+        esp_http_client_cleanup(client);
+    }
+
+    if (err == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Server version %s: %s%s", check->app.version, drv_ota_check_result_name(check->result), check->not_modified ? " (not modified)" : "");
+    }
+    return err;
+}
+
+/*
+ * The connection of the probe for url, past its TLS handshake. It was made
+ * with the config given to the probe and passes all events on to its handler.
+ */
+esp_http_client_handle_t drv_ota_check_take_client(const char* url)
+{
+    esp_http_client_handle_t client = check_client;
+
+    if ((client != NULL) && (strcmp(check_answer.url, url) != 0))
+    {
+        drv_ota_check_release_client();
+        return NULL;
+    }
+    check_client = NULL;
+    return client;
+}
+
+void drv_ota_check_release_client(void)
+{
+    if (check_client != NULL)
+    {
+        esp_http_client_close(check_client);
+        esp_http_client_cleanup(check_client);
+        check_client = NULL;
+    }
+}
+
+/* the image at url with these validators is the one about to run */
+void drv_ota_check_installed(const char* url, const char* etag, const char* last_modified, const char* version)
+{
+    memset(&check_answer, 0, sizeof(check_answer));
+    check_answer_loaded = true;
+    check_app_valid = false;
+    strlcpy(check_answer.url, url, sizeof(check_answer.url));
+    strlcpy(check_answer.etag, etag, sizeof(check_answer.etag));
+    strlcpy(check_answer.last_modified, last_modified, sizeof(check_answer.last_modified));
+    strlcpy(check_answer.version, version, sizeof(check_answer.version));
+    if ((check_answer.etag[0] != '\0') || (check_answer.last_modified[0] != '\0'))
+    {
+        check_answer_save();
+    }
+}
+
+const char* drv_ota_check_result_name(drv_ota_check_result_t result)
+{
+    switch (result)
+    {
+    case DRV_OTA_CHECK_UP_TO_DATE:
+        return "up to date";
+    case DRV_OTA_CHECK_AVAILABLE:
+        return "update available";
+    case DRV_OTA_CHECK_REJECTED:
+        return "rejected";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,77 @@
+/* *****************************************************************************
+ * File:   drv_ota_check.h
+ * Author: DL
+ *
+ * Created on 2024 06 03
+ *
+ * Description: version probe of the server image without an update
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "esp_app_format.h"
+#include "esp_http_client.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+typedef enum
+{
+    DRV_OTA_CHECK_UP_TO_DATE,       /* the server has the running build */
+    DRV_OTA_CHECK_AVAILABLE,        /* the server has another build */
+    DRV_OTA_CHECK_REJECTED,         /* the build rolled back before, or a patch for another base */
+}drv_ota_check_result_t;
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef struct
+{
+    drv_ota_check_result_t result;
+    esp_app_desc_t app;             /* of the server image, only the version for a delta patch or a 304 after a reset */
+    bool not_modified;              /* server answered 304 to the ETag of the last check */
+}drv_ota_check_t;
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+esp_err_t drv_ota_check_probe(const esp_http_client_config_t* http_config, drv_ota_check_t* check, bool keep_client);
+esp_http_client_handle_t drv_ota_check_take_client(const char* url);
+void drv_ota_check_release_client(void);
+void drv_ota_check_installed(const char* url, const char* etag, const char* last_modified, const char* version);
+const char* drv_ota_check_result_name(drv_ota_check_result_t result);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
@@ -0,0 +1,1027 @@
+/* *****************************************************************************
+ * File:   drv_ota_decomp.c
+ * Author: DL
+ *
+ * Created on 2024 03 18
+ *
+ * Description: streaming decompression of ota payloads
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_decomp.h"
+
+#include <sdkconfig.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#if CONFIG_DRV_OTA_COMPRESSION_ZLIB
+#include "miniz.h"
+#endif
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_decomp"
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define DECOMP_MIN_WINDOW_SIZE      4096    /* keeps the output writes from getting small */
+
+#define GZIP_FLAG_HCRC              0x02
+#define GZIP_FLAG_EXTRA             0x04
+#define GZIP_FLAG_NAME              0x08
+#define GZIP_FLAG_COMMENT           0x10
+#define GZIP_TRAILER_SIZE           8
+
+#define LZ4_FRAME_MAGIC             0x184D2204
+#define LZ4_FRAME_HEADER_MAX        19
+#define LZ4_FLG_VERSION_MASK        0xC0
+#define LZ4_FLG_VERSION             0x40
+#define LZ4_FLG_BLOCK_CHECKSUM      0x10
+#define LZ4_FLG_CONTENT_SIZE        0x08
+#define LZ4_FLG_CONTENT_CHECKSUM    0x04
+#define LZ4_FLG_DICT_ID             0x01
+#define LZ4_BLOCK_UNCOMPRESSED      0x80000000
+#define LZ4_WINDOW_SIZE             65536   /* matches reach up to 64 KB back, also across blocks */
+#define LZ4_MIN_MATCH               4
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+typedef enum
+{
+    ZLIB_STATE_DETECT,
+    ZLIB_STATE_GZIP_HEADER,
+    ZLIB_STATE_GZIP_XLEN,
+    ZLIB_STATE_GZIP_EXTRA,
+    ZLIB_STATE_GZIP_NAME,
+    ZLIB_STATE_GZIP_COMMENT,
+    ZLIB_STATE_GZIP_HCRC,
+    ZLIB_STATE_INFLATE,
+    ZLIB_STATE_TRAILER,
+}zlib_state_t;
+
+typedef enum
+{
+    HEATSHRINK_STATE_TAG,
+    HEATSHRINK_STATE_LITERAL,
+    HEATSHRINK_STATE_INDEX,
+    HEATSHRINK_STATE_COUNT,
+}heatshrink_state_t;
+
+typedef enum
+{
+    LZ4_STATE_FRAME_HEADER,
+    LZ4_STATE_BLOCK_SIZE,
+    LZ4_STATE_BLOCK_RAW,
+    LZ4_STATE_TOKEN,
+    LZ4_STATE_LITERAL_LENGTH,
+    LZ4_STATE_LITERALS,
+    LZ4_STATE_OFFSET,
+    LZ4_STATE_MATCH_LENGTH,
+    LZ4_STATE_BLOCK_CHECKSUM,
+    LZ4_STATE_CONTENT_CHECKSUM,
+}lz4_state_t;
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+struct drv_ota_decomp_codec_state_t
+{
+    /* history window, doubles as output buffer */
+    uint8_t* window;
+    size_t window_size;
+    size_t window_pos;
+    size_t flushed;
+    uint32_t produced;
+
+    union
+    {
+        #if CONFIG_DRV_OTA_COMPRESSION_ZLIB
+        struct
+        {
+            zlib_state_t state;
+            int flags;
+            uint8_t gzip_flags;
+            uint32_t left;
+            uint32_t trailer;
+            tinfl_decompressor* inflator;
+        }zlib;
+        #endif
+
+        #if CONFIG_DRV_OTA_COMPRESSION_HEATSHRINK
+        struct
+        {
+            heatshrink_state_t state;
+            uint32_t bit_buffer;
+            int bit_count;
+            uint32_t index;
+        }heatshrink;
+        #endif
+
+        #if CONFIG_DRV_OTA_COMPRESSION_LZ4
+        struct
+        {
+            lz4_state_t state;
+            uint8_t header[LZ4_FRAME_HEADER_MAX];
+            uint32_t header_length;
+            uint32_t header_size;
+            uint8_t flags;
+            uint32_t left;
+            uint32_t block_size;
+            uint32_t block_left;
+            uint32_t literal_length;
+            uint32_t match_length;
+            uint32_t offset;
+        }lz4;
+        #endif
+
+        uint8_t none;
+    };
+};
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+#define DECOMP_MIN(a, b)        (((a) < (b)) ? (a) : (b))
+#define DECOMP_MAX(a, b)        (((a) > (b)) ? (a) : (b))
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+static const char* decomp_codec_names[DRV_OTA_CODEC_COUNT] =
+{
+    [DRV_OTA_CODEC_NONE] = "none",
+    [DRV_OTA_CODEC_ZLIB] = "zlib",
+    [DRV_OTA_CODEC_HEATSHRINK] = "heatshrink",
+    [DRV_OTA_CODEC_LZ4] = "lz4",
+};
+
+static char decomp_accept_encoding[48] = "";
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static bool decomp_codec_enabled(drv_ota_codec_t codec)
+{
+    switch (codec)
+    {
+    #if CONFIG_DRV_OTA_COMPRESSION_ZLIB
+    case DRV_OTA_CODEC_ZLIB:
+        return true;
+    #endif
+    #if CONFIG_DRV_OTA_COMPRESSION_HEATSHRINK
+    case DRV_OTA_CODEC_HEATSHRINK:
+        return true;
+    #endif
+    #if CONFIG_DRV_OTA_COMPRESSION_LZ4
+    case DRV_OTA_CODEC_LZ4:
+        return true;
+    #endif
+    default:
+        return false;
+    }
+}
+
+/* header values compare case insensitive and may carry parameters after ';' */
+static bool decomp_token_match(const char* value, const char* token)
+{
+    size_t length = strlen(token);
+
+    while (*value == ' ')
+    {
+        value++;
+    }
+    if (strncasecmp(value, token, length) != 0)
+    {
+        return false;
+    }
+    return (value[length] == '\0') || (value[length] == ';') || (value[length] == ' ');
+}
+
+/* hands the window bytes not yet written to the output function */
+static esp_err_t decomp_flush(drv_ota_decomp_t* decomp)
+{
+    drv_ota_decomp_codec_state_t* st = decomp->state;
+    esp_err_t err = ESP_OK;
+
+    if (st->window_pos > st->flushed)
+    {
+        size_t length = st->window_pos - st->flushed;
+        int64_t start = esp_timer_get_time();
+        err = decomp->write_func(decomp->context, &st->window[st->flushed], length);
+        decomp->stats.write_us += esp_timer_get_time() - start;
+        decomp->stats.out_bytes += length;
+    }
+    st->flushed = st->window_pos;
+    if (st->window_pos == st->window_size)
+    {
+        st->window_pos = 0;
+        st->flushed = 0;
+    }
+    return err;
+}
+
+static inline esp_err_t decomp_put(drv_ota_decomp_t* decomp, uint8_t value)
+{
+    drv_ota_decomp_codec_state_t* st = decomp->state;
+
+    st->window[st->window_pos++] = value;
+    st->produced++;
+    if (st->window_pos == st->window_size)
+    {
+        return decomp_flush(decomp);
+    }
+    return ESP_OK;
+}
+
+/* copies a back reference byte by byte, source and destination may overlap */
+static esp_err_t decomp_copy_match(drv_ota_decomp_t* decomp, uint32_t offset, uint32_t length)
+{
+    drv_ota_decomp_codec_state_t* st = decomp->state;
+    esp_err_t err = ESP_OK;
+
+    for (uint32_t index = 0; (index < length) && (err == ESP_OK); index++)
+    {
+        err = decomp_put(decomp, st->window[(st->window_pos - offset) & (st->window_size - 1)]);
+    }
+    return err;
+}
+
+static esp_err_t decomp_window_alloc(drv_ota_decomp_codec_state_t* st, size_t window_size)
+{
+    st->window_size = window_size;
+    st->window = calloc(1, window_size);
+    return (st->window == NULL) ? ESP_ERR_NO_MEM : ESP_OK;
+}
+
+/* *****************************************************************************
+ * zlib / gzip / raw deflate with the ROM inflater
+ **************************************************************************** */
+#if CONFIG_DRV_OTA_COMPRESSION_ZLIB
+static esp_err_t zlib_init(drv_ota_decomp_codec_state_t* st)
+{
+    st->zlib.inflator = malloc(sizeof(tinfl_decompressor));
+    if (st->zlib.inflator == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    tinfl_init(st->zlib.inflator);
+    st->zlib.state = ZLIB_STATE_DETECT;
+    /* tinfl needs the whole dictionary as circular output buffer */
+    return decomp_window_alloc(st, TINFL_LZ_DICT_SIZE);
+}
+
+static void zlib_deinit(drv_ota_decomp_codec_state_t* st)
+{
+    free(st->zlib.inflator);
+    st->zlib.inflator = NULL;
+}
+
+/* skips one byte of the gzip member header */
+static void zlib_gzip_header_byte(drv_ota_decomp_codec_state_t* st, uint8_t value)
+{
+    switch (st->zlib.state)
+    {
+    case ZLIB_STATE_GZIP_HEADER:
+        if (st->zlib.left == 7)
+        {
+            st->zlib.gzip_flags = value;
+        }
+        if (--st->zlib.left > 0)
+        {
+            return;
+        }
+        st->zlib.left = 2;
+        st->zlib.trailer = 0;
+        if (st->zlib.gzip_flags & GZIP_FLAG_EXTRA)
+        {
+            st->zlib.state = ZLIB_STATE_GZIP_XLEN;
+            return;
+        }
+        break;
+    case ZLIB_STATE_GZIP_XLEN:
+        st->zlib.trailer |= (uint32_t)value << ((2 - st->zlib.left) * 8);
+        if (--st->zlib.left > 0)
+        {
+            return;
+        }
+        st->zlib.left = st->zlib.trailer;
+        if (st->zlib.left > 0)
+        {
+            st->zlib.state = ZLIB_STATE_GZIP_EXTRA;
+            return;
+        }
+        break;
+    case ZLIB_STATE_GZIP_EXTRA:
+        if (--st->zlib.left > 0)
+        {
+            return;
+        }
+        break;
+    case ZLIB_STATE_GZIP_NAME:
+    case ZLIB_STATE_GZIP_COMMENT:
+        if (value != 0)
+        {
+            return;
+        }
+        break;
+    case ZLIB_STATE_GZIP_HCRC:
+        if (--st->zlib.left > 0)
+        {
+            return;
+        }
+        st->zlib.state = ZLIB_STATE_INFLATE;
+        return;
+    default:
+        return;
+    }
+
+    /* next optional field in header order */
+    if ((st->zlib.state < ZLIB_STATE_GZIP_NAME) && (st->zlib.gzip_flags & GZIP_FLAG_NAME))
+    {
+        st->zlib.state = ZLIB_STATE_GZIP_NAME;
+    }
+    else if ((st->zlib.state < ZLIB_STATE_GZIP_COMMENT) && (st->zlib.gzip_flags & GZIP_FLAG_COMMENT))
+    {
+        st->zlib.state = ZLIB_STATE_GZIP_COMMENT;
+    }
+    else if (st->zlib.gzip_flags & GZIP_FLAG_HCRC)
+    {
+        st->zlib.left = 2;
+        st->zlib.state = ZLIB_STATE_GZIP_HCRC;
+    }
+    else
+    {
+        st->zlib.state = ZLIB_STATE_INFLATE;
+    }
+}
+
+static esp_err_t zlib_feed(drv_ota_decomp_t* decomp, const uint8_t* data, size_t size)
+{
+    drv_ota_decomp_codec_state_t* st = decomp->state;
+
+    if (st->zlib.state == ZLIB_STATE_DETECT)
+    {
+        if (data[0] == 0x1F)
+        {
+            st->zlib.state = ZLIB_STATE_GZIP_HEADER;
+            st->zlib.left = 10;
+            st->zlib.flags = 0;
+        }
+        else
+        {
+            /* a zlib stream starts with method 8 and a window of at most 32 KB */
+            st->zlib.state = ZLIB_STATE_INFLATE;
+            st->zlib.flags = (((data[0] & 0x0F) == 8) && ((data[0] >> 4) <= 7)) ? TINFL_FLAG_PARSE_ZLIB_HEADER : 0;
+        }
+    }
+
+    while ((size > 0) && (st->zlib.state < ZLIB_STATE_INFLATE))
+    {
+        zlib_gzip_header_byte(st, *data++);
+        size--;
+    }
+
+    tinfl_status status = TINFL_STATUS_NEEDS_MORE_INPUT;
+    while (((size > 0) || (status == TINFL_STATUS_HAS_MORE_OUTPUT)) && (st->zlib.state == ZLIB_STATE_INFLATE))
+    {
+        size_t in_bytes = size;
+        size_t out_bytes = st->window_size - st->window_pos;
+        status = tinfl_decompress(st->zlib.inflator, data, &in_bytes,
+                st->window, &st->window[st->window_pos], &out_bytes, st->zlib.flags | TINFL_FLAG_HAS_MORE_INPUT);
+
+        data += in_bytes;
+        size -= in_bytes;
+        st->window_pos += out_bytes;
+        st->produced += out_bytes;
+        if ((st->window_pos == st->window_size) || (status == TINFL_STATUS_DONE))
+        {
+            esp_err_t err = decomp_flush(decomp);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+        }
+        if (status == TINFL_STATUS_DONE)
+        {
+            st->zlib.state = ZLIB_STATE_TRAILER;
+            st->zlib.trailer = 0;
+            decomp->done = true;
+        }
+        else if (status < TINFL_STATUS_DONE)
+        {
+            ESP_LOGE(TAG, "Inflate failed (%d) after %u bytes", (int)status, (unsigned int)st->produced);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        else if ((in_bytes == 0) && (out_bytes == 0))
+        {
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    /* gzip crc and size or zlib adler, the image has its own digest */
+    if (st->zlib.state == ZLIB_STATE_TRAILER)
+    {
+        st->zlib.trailer += size;
+    }
+    if (st->zlib.trailer > GZIP_TRAILER_SIZE)
+    {
+        ESP_LOGE(TAG, "%u bytes after end of deflate stream", (unsigned int)st->zlib.trailer);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t zlib_finish(drv_ota_decomp_t* decomp)
+{
+    esp_err_t err = decomp_flush(decomp);
+    if ((err == ESP_OK) && (decomp->done == false))
+    {
+        ESP_LOGE(TAG, "Deflate stream ended early");
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    return err;
+}
+#endif
+
+/* *****************************************************************************
+ * heatshrink
+ **************************************************************************** */
+#if CONFIG_DRV_OTA_COMPRESSION_HEATSHRINK
+static esp_err_t heatshrink_init(drv_ota_decomp_codec_state_t* st)
+{
+    st->heatshrink.state = HEATSHRINK_STATE_TAG;
+    /* zero filled, back references in front of the first byte read zeros */
+    return decomp_window_alloc(st, DECOMP_MAX(1 << CONFIG_DRV_OTA_HEATSHRINK_WINDOW_SZ2, DECOMP_MIN_WINDOW_SIZE));
+}
+
+/*
+ * Bit stream, most significant bit first: tag 1 and 8 bit literal, or tag 0,
+ * window_sz2 bit index and lookahead_sz2 bit count for a back reference of
+ * count + 1 bytes at index + 1 bytes back. The trailing bits are padding.
+ */
+static esp_err_t heatshrink_feed(drv_ota_decomp_t* decomp, const uint8_t* data, size_t size)
+{
+    drv_ota_decomp_codec_state_t* st = decomp->state;
+    esp_err_t err = ESP_OK;
+
+    while ((size > 0) && (err == ESP_OK))
+    {
+        st->heatshrink.bit_buffer = (st->heatshrink.bit_buffer << 8) | *data++;
+        st->heatshrink.bit_count += 8;
+        size--;
+
+        for (;;)
+        {
+            int bits;
+
+            switch (st->heatshrink.state)
+            {
+            case HEATSHRINK_STATE_TAG:          bits = 1; break;
+            case HEATSHRINK_STATE_LITERAL:      bits = 8; break;
+            case HEATSHRINK_STATE_INDEX:        bits = CONFIG_DRV_OTA_HEATSHRINK_WINDOW_SZ2; break;
+            case HEATSHRINK_STATE_COUNT:
+            default:                            bits = CONFIG_DRV_OTA_HEATSHRINK_LOOKAHEAD_SZ2; break;
+            }
+            if ((st->heatshrink.bit_count < bits) || (err != ESP_OK))
+            {
+                break;
+            }
+            st->heatshrink.bit_count -= bits;
+            uint32_t value = (st->heatshrink.bit_buffer >> st->heatshrink.bit_count) & ((1U << bits) - 1);
+
+            switch (st->heatshrink.state)
+            {
+            case HEATSHRINK_STATE_TAG:
+                st->heatshrink.state = value ? HEATSHRINK_STATE_LITERAL : HEATSHRINK_STATE_INDEX;
+                break;
+            case HEATSHRINK_STATE_LITERAL:
+                err = decomp_put(decomp, (uint8_t)value);
+                st->heatshrink.state = HEATSHRINK_STATE_TAG;
+                break;
+            case HEATSHRINK_STATE_INDEX:
+                st->heatshrink.index = value + 1;
+                st->heatshrink.state = HEATSHRINK_STATE_COUNT;
+                break;
+            case HEATSHRINK_STATE_COUNT:
+            default:
+                err = decomp_copy_match(decomp, st->heatshrink.index, value + 1);
+                st->heatshrink.state = HEATSHRINK_STATE_TAG;
+                break;
+            }
+        }
+    }
+    return err;
+}
+
+static esp_err_t heatshrink_finish(drv_ota_decomp_t* decomp)
+{
+    decomp->done = true;
+    return decomp_flush(decomp);
+}
+#endif
+
+/* *****************************************************************************
+ * lz4 frame
+ **************************************************************************** */
+#if CONFIG_DRV_OTA_COMPRESSION_LZ4
+static esp_err_t lz4_init(drv_ota_decomp_codec_state_t* st)
+{
+    st->lz4.state = LZ4_STATE_FRAME_HEADER;
+    st->lz4.header_size = 7;
+    return decomp_window_alloc(st, LZ4_WINDOW_SIZE);
+}
+
+static esp_err_t lz4_frame_header(drv_ota_decomp_codec_state_t* st)
+{
+    uint8_t* header = st->lz4.header;
+    uint32_t magic = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24);
+
+    st->lz4.flags = header[4];
+    if ((magic != LZ4_FRAME_MAGIC) || ((st->lz4.flags & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION))
+    {
+        ESP_LOGE(TAG, "No lz4 frame (magic 0x%08x flags 0x%02x)", (unsigned int)magic, st->lz4.flags);
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (st->lz4.flags & LZ4_FLG_DICT_ID)
+    {
+        ESP_LOGE(TAG, "lz4 dictionaries not supported");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    return ESP_OK;
+}
+
+static void lz4_next_block(drv_ota_decomp_codec_state_t* st)
+{
+    st->lz4.left = 4;
+    st->lz4.block_size = 0;
+    st->lz4.state = LZ4_STATE_BLOCK_SIZE;
+}
+
+static void lz4_block_end(drv_ota_decomp_codec_state_t* st)
+{
+    if (st->lz4.flags & LZ4_FLG_BLOCK_CHECKSUM)
+    {
+        st->lz4.left = 4;
+        st->lz4.state = LZ4_STATE_BLOCK_CHECKSUM;
+    }
+    else
+    {
+        lz4_next_block(st);
+    }
+}
+
+static esp_err_t lz4_literals_done(drv_ota_decomp_codec_state_t* st)
+{
+    if (st->lz4.block_left == 0)
+    {
+        /* the last sequence of a block has literals only */
+        lz4_block_end(st);
+    }
+    else
+    {
+        st->lz4.left = 2;
+        st->lz4.offset = 0;
+        st->lz4.state = LZ4_STATE_OFFSET;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t lz4_match(drv_ota_decomp_t* decomp)
+{
+    drv_ota_decomp_codec_state_t* st = decomp->state;
+
+    if ((st->lz4.offset == 0) || (st->lz4.offset > st->produced))
+    {
+        ESP_LOGE(TAG, "lz4 match offset %u invalid at %u", (unsigned int)st->lz4.offset, (unsigned int)st->produced);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    st->lz4.state = LZ4_STATE_TOKEN;
+    return decomp_copy_match(decomp, st->lz4.offset, st->lz4.match_length + LZ4_MIN_MATCH);
+}
+
+static esp_err_t lz4_feed(drv_ota_decomp_t* decomp, const uint8_t* data, size_t size)
+{
+    drv_ota_decomp_codec_state_t* st = decomp->state;
+    esp_err_t err = ESP_OK;
+
+    while ((size > 0) && (err == ESP_OK))
+    {
+        size_t length = 1;
+        uint8_t value = data[0];
+
+        if ((st->lz4.state >= LZ4_STATE_TOKEN) && (st->lz4.state <= LZ4_STATE_MATCH_LENGTH))
+        {
+            if (st->lz4.block_left == 0)
+            {
+                ESP_LOGE(TAG, "lz4 block ends inside a sequence");
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+        }
+
+        switch (st->lz4.state)
+        {
+        case LZ4_STATE_FRAME_HEADER:
+            st->lz4.header[st->lz4.header_length++] = value;
+            if (st->lz4.header_length == 5)
+            {
+                err = lz4_frame_header(st);
+                st->lz4.header_size += (st->lz4.flags & LZ4_FLG_CONTENT_SIZE) ? 8 : 0;
+            }
+            if (st->lz4.header_length == st->lz4.header_size)
+            {
+                /* header checksum not checked, the image has its own digest */
+                lz4_next_block(st);
+            }
+            break;
+
+        case LZ4_STATE_BLOCK_SIZE:
+            st->lz4.block_size |= (uint32_t)value << ((4 - st->lz4.left) * 8);
+            if (--st->lz4.left > 0)
+            {
+                break;
+            }
+            st->lz4.block_left = st->lz4.block_size & ~LZ4_BLOCK_UNCOMPRESSED;
+            if (st->lz4.block_size == 0)
+            {
+                if (st->lz4.flags & LZ4_FLG_CONTENT_CHECKSUM)
+                {
+                    st->lz4.left = 4;
+                    st->lz4.state = LZ4_STATE_CONTENT_CHECKSUM;
+                }
+                else
+                {
+                    decomp->done = true;
+                }
+            }
+            else if (st->lz4.block_size & LZ4_BLOCK_UNCOMPRESSED)
+            {
+                st->lz4.state = LZ4_STATE_BLOCK_RAW;
+            }
+            else
+            {
+                st->lz4.state = LZ4_STATE_TOKEN;
+            }
+            break;
+
+        case LZ4_STATE_BLOCK_RAW:
+            length = DECOMP_MIN(size, st->lz4.block_left);
+            for (size_t index = 0; (index < length) && (err == ESP_OK); index++)
+            {
+                err = decomp_put(decomp, data[index]);
+            }
+            st->lz4.block_left -= length;
+            if (st->lz4.block_left == 0)
+            {
+                lz4_block_end(st);
+            }
+            break;
+
+        case LZ4_STATE_TOKEN:
+            st->lz4.block_left--;
+            st->lz4.literal_length = value >> 4;
+            st->lz4.match_length = value & 0x0F;
+            if (st->lz4.literal_length == 15)
+            {
+                st->lz4.state = LZ4_STATE_LITERAL_LENGTH;
+            }
+            else if (st->lz4.literal_length > 0)
+            {
+                st->lz4.state = LZ4_STATE_LITERALS;
+            }
+            else
+            {
+                err = lz4_literals_done(st);
+            }
+            break;
+
+        case LZ4_STATE_LITERAL_LENGTH:
+            st->lz4.block_left--;
+            st->lz4.literal_length += value;
+            if (value != 255)
+            {
+                st->lz4.state = LZ4_STATE_LITERALS;
+            }
+            break;
+
+        case LZ4_STATE_LITERALS:
+            length = DECOMP_MIN(size, DECOMP_MIN(st->lz4.literal_length, st->lz4.block_left));
+            for (size_t index = 0; (index < length) && (err == ESP_OK); index++)
+            {
+                err = decomp_put(decomp, data[index]);
+            }
+            st->lz4.block_left -= length;
+            st->lz4.literal_length -= length;
+            if ((err == ESP_OK) && (st->lz4.literal_length == 0))
+            {
+                err = lz4_literals_done(st);
+            }
+            break;
+
+        case LZ4_STATE_OFFSET:
+            st->lz4.block_left--;
+            st->lz4.offset |= (uint32_t)value << ((2 - st->lz4.left) * 8);
+            if (--st->lz4.left > 0)
+            {
+                break;
+            }
+            if (st->lz4.match_length == 15)
+            {
+                st->lz4.state = LZ4_STATE_MATCH_LENGTH;
+            }
+            else
+            {
+                err = lz4_match(decomp);
+            }
+            break;
+
+        case LZ4_STATE_MATCH_LENGTH:
+            st->lz4.block_left--;
+            st->lz4.match_length += value;
+            if (value != 255)
+            {
+                err = lz4_match(decomp);
+            }
+            break;
+
+        case LZ4_STATE_BLOCK_CHECKSUM:
+            if (--st->lz4.left == 0)
+            {
+                lz4_next_block(st);
+            }
+            break;
+
+        case LZ4_STATE_CONTENT_CHECKSUM:
+        default:
+            if (--st->lz4.left == 0)
+            {
+                decomp->done = true;
+            }
+            break;
+        }
+
+        data += length;
+        size -= length;
+
+        if (decomp->done && (size > 0))
+        {
+            ESP_LOGE(TAG, "%u bytes after end of lz4 frame", (unsigned int)size);
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    return err;
+}
+
+static esp_err_t lz4_finish(drv_ota_decomp_t* decomp)
+{
+    esp_err_t err = decomp_flush(decomp);
+    if ((err == ESP_OK) && (decomp->done == false))
+    {
+        ESP_LOGE(TAG, "lz4 frame ended early");
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    return err;
+}
+#endif
+
+/* *****************************************************************************
+ * Interface
+ **************************************************************************** */
+drv_ota_codec_t drv_ota_decomp_codec_from_header(const char* key, const char* value)
+{
+    drv_ota_codec_t codec = DRV_OTA_CODEC_NONE;
+
+    if ((key == NULL) || (value == NULL))
+    {
+        return DRV_OTA_CODEC_NONE;
+    }
+    if (strcasecmp(key, "Content-Encoding") == 0)
+    {
+        if (decomp_token_match(value, "gzip") || decomp_token_match(value, "x-gzip") || decomp_token_match(value, "deflate"))
+        {
+            codec = DRV_OTA_CODEC_ZLIB;
+        }
+        else if (decomp_token_match(value, "heatshrink") || decomp_token_match(value, "x-heatshrink"))
+        {
+            codec = DRV_OTA_CODEC_HEATSHRINK;
+        }
+        else if (decomp_token_match(value, "lz4") || decomp_token_match(value, "x-lz4"))
+        {
+            codec = DRV_OTA_CODEC_LZ4;
+        }
+    }
+    else if (strcasecmp(key, "Content-Type") == 0)
+    {
+        if (decomp_token_match(value, "application/gzip") || decomp_token_match(value, "application/x-gzip") || decomp_token_match(value, "application/zlib"))
+        {
+            codec = DRV_OTA_CODEC_ZLIB;
+        }
+        else if (decomp_token_match(value, "application/x-heatshrink"))
+        {
+            codec = DRV_OTA_CODEC_HEATSHRINK;
+        }
+        else if (decomp_token_match(value, "application/x-lz4"))
+        {
+            codec = DRV_OTA_CODEC_LZ4;
+        }
+    }
+    if ((codec != DRV_OTA_CODEC_NONE) && (decomp_codec_enabled(codec) == false))
+    {
+        ESP_LOGW(TAG, "%s: %s not enabled", key, value);
+    }
+    return codec;
+}
+
+const char* drv_ota_decomp_codec_name(drv_ota_codec_t codec)
+{
+    return (codec < DRV_OTA_CODEC_COUNT) ? decomp_codec_names[codec] : "unknown";
+}
+
+/* value for the Accept-Encoding request header with the enabled codecs */
+const char* drv_ota_decomp_accept_encoding(void)
+{
+    if (decomp_accept_encoding[0] == '\0')
+    {
+        #if CONFIG_DRV_OTA_COMPRESSION_ZLIB
+        strlcat(decomp_accept_encoding, "gzip, deflate, ", sizeof(decomp_accept_encoding));
+        #endif
+        #if CONFIG_DRV_OTA_COMPRESSION_HEATSHRINK
+        strlcat(decomp_accept_encoding, "x-heatshrink, ", sizeof(decomp_accept_encoding));
+        #endif
+        #if CONFIG_DRV_OTA_COMPRESSION_LZ4
+        strlcat(decomp_accept_encoding, "x-lz4, ", sizeof(decomp_accept_encoding));
+        #endif
+        strlcat(decomp_accept_encoding, "identity", sizeof(decomp_accept_encoding));
+    }
+    return decomp_accept_encoding;
+}
+
+esp_err_t drv_ota_decomp_init(drv_ota_decomp_t* decomp, drv_ota_codec_t codec, drv_ota_decomp_write_func_t write_func, void* context)
+{
+    esp_err_t err = ESP_ERR_NOT_SUPPORTED;
+
+    memset(decomp, 0, sizeof(*decomp));
+
+    if (decomp_codec_enabled(codec) == false)
+    {
+        ESP_LOGE(TAG, "Codec %s not enabled", drv_ota_decomp_codec_name(codec));
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    decomp->state = calloc(1, sizeof(drv_ota_decomp_codec_state_t));
+    if (decomp->state == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    decomp->codec = codec;
+    decomp->write_func = write_func;
+    decomp->context = context;
+
+    switch (codec)
+    {
+    #if CONFIG_DRV_OTA_COMPRESSION_ZLIB
+    case DRV_OTA_CODEC_ZLIB:
+        err = zlib_init(decomp->state);
+        break;
+    #endif
+    #if CONFIG_DRV_OTA_COMPRESSION_HEATSHRINK
+    case DRV_OTA_CODEC_HEATSHRINK:
+        err = heatshrink_init(decomp->state);
+        break;
+    #endif
+    #if CONFIG_DRV_OTA_COMPRESSION_LZ4
+    case DRV_OTA_CODEC_LZ4:
+        err = lz4_init(decomp->state);
+        break;
+    #endif
+    default:
+        break;
+    }
+    if (err != ESP_OK)
+    {
+        drv_ota_decomp_deinit(decomp);
+        return err;
+    }
+    ESP_LOGI(TAG, "%s decompression, %u byte window", drv_ota_decomp_codec_name(codec), (unsigned int)decomp->state->window_size);
+    return ESP_OK;
+}
+
+/* the compressed stream may be fed in pieces of any size */
+esp_err_t drv_ota_decomp_feed(drv_ota_decomp_t* decomp, const uint8_t* data, size_t size)
+{
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+
+    if ((decomp->state == NULL) || (size == 0))
+    {
+        return (size == 0) ? ESP_OK : ESP_ERR_INVALID_STATE;
+    }
+
+    int64_t start = esp_timer_get_time();
+    uint64_t write_us = decomp->stats.write_us;
+
+    switch (decomp->codec)
+    {
+    #if CONFIG_DRV_OTA_COMPRESSION_ZLIB
+    case DRV_OTA_CODEC_ZLIB:
+        err = zlib_feed(decomp, data, size);
+        break;
+    #endif
+    #if CONFIG_DRV_OTA_COMPRESSION_HEATSHRINK
+    case DRV_OTA_CODEC_HEATSHRINK:
+        err = heatshrink_feed(decomp, data, size);
+        break;
+    #endif
+    #if CONFIG_DRV_OTA_COMPRESSION_LZ4
+    case DRV_OTA_CODEC_LZ4:
+        err = lz4_feed(decomp, data, size);
+        break;
+    #endif
+    default:
+        break;
+    }
+
+    decomp->stats.in_bytes += size;
+    decomp->stats.decode_us += (esp_timer_get_time() - start) - (decomp->stats.write_us - write_us);
+    return err;
+}
+
+/* writes out what is left in the window, fails if the stream ended early */
+esp_err_t drv_ota_decomp_finish(drv_ota_decomp_t* decomp)
+{
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+
+    if (decomp->state == NULL)
+    {
+        return err;
+    }
+
+    switch (decomp->codec)
+    {
+    #if CONFIG_DRV_OTA_COMPRESSION_ZLIB
+    case DRV_OTA_CODEC_ZLIB:
+        err = zlib_finish(decomp);
+        break;
+    #endif
+    #if CONFIG_DRV_OTA_COMPRESSION_HEATSHRINK
+    case DRV_OTA_CODEC_HEATSHRINK:
+        err = heatshrink_finish(decomp);
+        break;
+    #endif
+    #if CONFIG_DRV_OTA_COMPRESSION_LZ4
+    case DRV_OTA_CODEC_LZ4:
+        err = lz4_finish(decomp);
+        break;
+    #endif
+    default:
+        break;
+    }
+    return err;
+}
+
+void drv_ota_decomp_deinit(drv_ota_decomp_t* decomp)
+{
+    if (decomp->state == NULL)
+    {
+        return;
+    }
+    #if CONFIG_DRV_OTA_COMPRESSION_ZLIB
+    if (decomp->codec == DRV_OTA_CODEC_ZLIB)
+    {
+        zlib_deinit(decomp->state);
+    }
+    #endif
+    free(decomp->state->window);
+    free(decomp->state);
+    decomp->state = NULL;
+}
+
+/*
+ * Decode throughput against write throughput, both in output bytes. The codec
+ * is the cheaper one for a product as long as its decode rate stays above the
+ * flash write rate, the download then only carries the compressed size.
+ */
+void drv_ota_decomp_print_stats(const drv_ota_decomp_t* decomp)
+{
+    const drv_ota_decomp_stats_t* stats = &decomp->stats;
+    uint32_t ratio = (stats->out_bytes > 0) ? (uint32_t)(((uint64_t)stats->in_bytes * 1000) / stats->out_bytes) : 0;
+    uint32_t decode_rate = (stats->decode_us > 0) ? (uint32_t)(((uint64_t)stats->out_bytes * 1000000 / 1024) / stats->decode_us) : 0;
+    uint32_t write_rate = (stats->write_us > 0) ? (uint32_t)(((uint64_t)stats->out_bytes * 1000000 / 1024) / stats->write_us) : 0;
+
+    ESP_LOGI(TAG, "%s: %u -> %u bytes (%u.%u%%)", drv_ota_decomp_codec_name(decomp->codec),
+            (unsigned int)stats->in_bytes, (unsigned int)stats->out_bytes, (unsigned int)(ratio / 10), (unsigned int)(ratio % 10));
+    ESP_LOGI(TAG, "decode %u ms (%u KB/s), write %u ms (%u KB/s)",
+            (unsigned int)(stats->decode_us / 1000), (unsigned int)decode_rate,
+            (unsigned int)(stats->write_us / 1000), (unsigned int)write_rate);
+}
@@ -0,0 +1,98 @@
+/* *****************************************************************************
+ * File:   drv_ota_decomp.h
+ * Author: DL
+ *
+ * Created on 2024 03 18
+ *
+ * Description: streaming decompression of ota payloads
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+typedef enum
+{
+    DRV_OTA_CODEC_NONE,
+    DRV_OTA_CODEC_ZLIB,         /* gzip, zlib or raw deflate */
+    DRV_OTA_CODEC_HEATSHRINK,
+    DRV_OTA_CODEC_LZ4,          /* lz4 frame format */
+    DRV_OTA_CODEC_COUNT,
+}drv_ota_codec_t;
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+/* output of the decompressor, called with decompressed bytes in order */
+typedef esp_err_t (*drv_ota_decomp_write_func_t)(void* context, const uint8_t* data, size_t size);
+
+typedef struct
+{
+    uint32_t in_bytes;
+    uint32_t out_bytes;
+    uint64_t decode_us;         /* time spent decompressing */
+    uint64_t write_us;          /* time spent in the output function */
+}drv_ota_decomp_stats_t;
+
+typedef struct drv_ota_decomp_codec_state_t drv_ota_decomp_codec_state_t;
+
+typedef struct
+{
+    drv_ota_codec_t codec;
+    drv_ota_decomp_codec_state_t* state;
+    bool done;
+    drv_ota_decomp_write_func_t write_func;
+    void* context;
+    drv_ota_decomp_stats_t stats;
+}drv_ota_decomp_t;
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+drv_ota_codec_t drv_ota_decomp_codec_from_header(const char* key, const char* value);
+const char* drv_ota_decomp_codec_name(drv_ota_codec_t codec);
+const char* drv_ota_decomp_accept_encoding(void);
+esp_err_t drv_ota_decomp_init(drv_ota_decomp_t* decomp, drv_ota_codec_t codec, drv_ota_decomp_write_func_t write_func, void* context);
+esp_err_t drv_ota_decomp_feed(drv_ota_decomp_t* decomp, const uint8_t* data, size_t size);
+esp_err_t drv_ota_decomp_finish(drv_ota_decomp_t* decomp);
+void drv_ota_decomp_deinit(drv_ota_decomp_t* decomp);
+void drv_ota_decomp_print_stats(const drv_ota_decomp_t* decomp);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
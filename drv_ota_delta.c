@@ -0,0 +1,341 @@
+/* *****************************************************************************
+ * File:   drv_ota_delta.c
+ * Author: DL
+ *
+ * Created on 2024 03 04
+ *
+ * Description: streaming binary patch decoder against the running partition
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_delta.h"
+
+#include <sdkconfig.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_delta"
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define DELTA_BASE_CHUNK_SIZE   256
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+#define DELTA_MIN(a, b)         (((a) < (b)) ? (a) : (b))
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static esp_err_t delta_flush(drv_ota_delta_t* delta)
+{
+    if (delta->out_length == 0)
+    {
+        return ESP_OK;
+    }
+    esp_err_t err = delta->write_func(delta->context, delta->out_buffer, delta->out_length);
+    delta->out_length = 0;
+    return err;
+}
+
+static esp_err_t delta_output(drv_ota_delta_t* delta, const uint8_t* data, size_t size)
+{
+    if (delta->produced + size > delta->target_size)
+    {
+        ESP_LOGE(TAG, "Patch produces more than %u bytes", (unsigned int)delta->target_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    while (size > 0)
+    {
+        size_t length = DELTA_MIN(size, delta->buffer_size - delta->out_length);
+        memcpy(&delta->out_buffer[delta->out_length], data, length);
+        delta->out_length += length;
+        delta->produced += length;
+        data += length;
+        size -= length;
+        if (delta->out_length == delta->buffer_size)
+        {
+            esp_err_t err = delta_flush(delta);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+/* adds the diff bytes to the base bytes at the base cursor */
+static esp_err_t delta_apply_diff(drv_ota_delta_t* delta, const uint8_t* data, size_t size)
+{
+    while (size > 0)
+    {
+        size_t length = DELTA_MIN(size, DELTA_BASE_CHUNK_SIZE);
+        if ((delta->base_offset < 0) || ((uint64_t)delta->base_offset + length > delta->base_size))
+        {
+            ESP_LOGE(TAG, "Patch reads base outside of %u bytes", (unsigned int)delta->base_size);
+            return ESP_ERR_INVALID_ARG;
+        }
+        esp_err_t err = esp_partition_read(delta->base_partition, (size_t)delta->base_offset, delta->base_buffer, length);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        for (size_t index = 0; index < length; index++)
+        {
+            delta->base_buffer[index] += data[index];
+        }
+        err = delta_output(delta, delta->base_buffer, length);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        delta->base_offset += length;
+        data += length;
+        size -= length;
+    }
+    return ESP_OK;
+}
+
+/* copies base bytes from the base cursor straight into the output buffer */
+static esp_err_t delta_copy(drv_ota_delta_t* delta, uint64_t size)
+{
+    if ((delta->base_offset < 0) || ((uint64_t)delta->base_offset + size > delta->base_size))
+    {
+        ESP_LOGE(TAG, "Patch reads base outside of %u bytes", (unsigned int)delta->base_size);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (delta->produced + size > delta->target_size)
+    {
+        ESP_LOGE(TAG, "Patch produces more than %u bytes", (unsigned int)delta->target_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    while (size > 0)
+    {
+        size_t length = DELTA_MIN(size, delta->buffer_size - delta->out_length);
+        esp_err_t err = esp_partition_read(delta->base_partition, (size_t)delta->base_offset, &delta->out_buffer[delta->out_length], length);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        delta->out_length += length;
+        delta->produced += length;
+        delta->base_offset += length;
+        size -= length;
+        if (delta->out_length == delta->buffer_size)
+        {
+            err = delta_flush(delta);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+/* runs an operation once its argument is complete */
+static esp_err_t delta_execute(drv_ota_delta_t* delta)
+{
+    esp_err_t err = ESP_OK;
+
+    switch (delta->opcode)
+    {
+    case DRV_OTA_DELTA_OP_COPY:
+        err = delta_copy(delta, delta->argument);
+        break;
+    case DRV_OTA_DELTA_OP_ADD:
+    case DRV_OTA_DELTA_OP_INSERT:
+        if (delta->argument > delta->target_size)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        delta->data_left = (uint32_t)delta->argument;
+        if (delta->data_left > 0)
+        {
+            delta->state = (delta->opcode == DRV_OTA_DELTA_OP_ADD) ? DRV_OTA_DELTA_STATE_ADD : DRV_OTA_DELTA_STATE_INSERT;
+            return ESP_OK;
+        }
+        break;
+    case DRV_OTA_DELTA_OP_SEEK:
+        /* zigzag: 0, -1, 1, -2, 2 ... */
+        delta->base_offset += (int64_t)(delta->argument >> 1) ^ -(int64_t)(delta->argument & 1);
+        break;
+    default:
+        break;
+    }
+    delta->state = (delta->produced == delta->target_size) ? DRV_OTA_DELTA_STATE_DONE : DRV_OTA_DELTA_STATE_OPCODE;
+    return err;
+}
+
+bool drv_ota_delta_is_patch(const void* data, size_t size)
+{
+    return (size >= DRV_OTA_DELTA_MAGIC_SIZE) && (memcmp(data, DRV_OTA_DELTA_MAGIC, DRV_OTA_DELTA_MAGIC_SIZE) == 0);
+}
+
+esp_err_t drv_ota_delta_parse_header(const void* data, size_t size, drv_ota_delta_header_t* header)
+{
+    if ((size < sizeof(*header)) || (drv_ota_delta_is_patch(data, size) == false))
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(header, data, sizeof(*header));
+    if (header->header_size < sizeof(*header))
+    {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    header->base_version[sizeof(header->base_version) - 1] = '\0';
+    header->target_version[sizeof(header->target_version) - 1] = '\0';
+    return ESP_OK;
+}
+
+esp_err_t drv_ota_delta_init(drv_ota_delta_t* delta, const esp_partition_t* base_partition, const drv_ota_delta_header_t* header, size_t buffer_size, drv_ota_delta_write_func_t write_func, void* context)
+{
+    memset(delta, 0, sizeof(*delta));
+
+    if ((base_partition == NULL) || (header->base_size > base_partition->size) || (buffer_size == 0))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    delta->base_buffer = malloc(DELTA_BASE_CHUNK_SIZE);
+    delta->out_buffer = malloc(buffer_size);
+    if ((delta->base_buffer == NULL) || (delta->out_buffer == NULL))
+    {
+        drv_ota_delta_deinit(delta);
+        return ESP_ERR_NO_MEM;
+    }
+    delta->state = DRV_OTA_DELTA_STATE_HEADER;
+    delta->base_partition = base_partition;
+    delta->base_size = header->base_size;
+    delta->target_size = header->target_size;
+    delta->header_left = header->header_size;
+    delta->buffer_size = buffer_size;
+    delta->write_func = write_func;
+    delta->context = context;
+    return ESP_OK;
+}
+
+/* the patch may be fed in pieces of any size, starting with its header */
+esp_err_t drv_ota_delta_feed(drv_ota_delta_t* delta, const uint8_t* data, size_t size)
+{
+    esp_err_t err = ESP_OK;
+
+    while ((size > 0) && (err == ESP_OK))
+    {
+        size_t length = 1;
+
+        switch (delta->state)
+        {
+        case DRV_OTA_DELTA_STATE_HEADER:
+            length = DELTA_MIN(size, delta->header_left);
+            delta->header_left -= length;
+            if (delta->header_left == 0)
+            {
+                delta->state = (delta->target_size > 0) ? DRV_OTA_DELTA_STATE_OPCODE : DRV_OTA_DELTA_STATE_DONE;
+            }
+            break;
+
+        case DRV_OTA_DELTA_STATE_OPCODE:
+            if ((data[0] < DRV_OTA_DELTA_OP_COPY) || (data[0] > DRV_OTA_DELTA_OP_SEEK))
+            {
+                ESP_LOGE(TAG, "Unknown opcode 0x%02x after %u bytes", data[0], (unsigned int)delta->produced);
+                return ESP_ERR_INVALID_ARG;
+            }
+            delta->opcode = data[0];
+            delta->argument = 0;
+            delta->argument_shift = 0;
+            delta->state = DRV_OTA_DELTA_STATE_ARGUMENT;
+            break;
+
+        case DRV_OTA_DELTA_STATE_ARGUMENT:
+            if (delta->argument_shift > 56)
+            {
+                return ESP_ERR_INVALID_ARG;
+            }
+            delta->argument |= (uint64_t)(data[0] & 0x7F) << delta->argument_shift;
+            delta->argument_shift += 7;
+            if ((data[0] & 0x80) == 0)
+            {
+                err = delta_execute(delta);
+            }
+            break;
+
+        case DRV_OTA_DELTA_STATE_ADD:
+        case DRV_OTA_DELTA_STATE_INSERT:
+            length = DELTA_MIN(size, delta->data_left);
+            if (delta->state == DRV_OTA_DELTA_STATE_ADD)
+            {
+                err = delta_apply_diff(delta, data, length);
+            }
+            else
+            {
+                err = delta_output(delta, data, length);
+            }
+            delta->data_left -= length;
+            if (delta->data_left == 0)
+            {
+                delta->state = (delta->produced == delta->target_size) ? DRV_OTA_DELTA_STATE_DONE : DRV_OTA_DELTA_STATE_OPCODE;
+            }
+            break;
+
+        case DRV_OTA_DELTA_STATE_DONE:
+        default:
+            ESP_LOGE(TAG, "%u bytes after end of patch", (unsigned int)size);
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        data += length;
+        size -= length;
+    }
+    return err;
+}
+
+/* writes out what is buffered, fails if the patch ended early */
+esp_err_t drv_ota_delta_finish(drv_ota_delta_t* delta)
+{
+    esp_err_t err = delta_flush(delta);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (delta->state != DRV_OTA_DELTA_STATE_DONE)
+    {
+        ESP_LOGE(TAG, "Patch ended after %u of %u bytes", (unsigned int)delta->produced, (unsigned int)delta->target_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+void drv_ota_delta_deinit(drv_ota_delta_t* delta)
+{
+    free(delta->base_buffer);
+    delta->base_buffer = NULL;
+    free(delta->out_buffer);
+    delta->out_buffer = NULL;
+}
@@ -0,0 +1,128 @@
+/* *****************************************************************************
+ * File:   drv_ota_delta.h
+ * Author: DL
+ *
+ * Created on 2024 03 04
+ *
+ * Description: streaming binary patch decoder against the running partition
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define DRV_OTA_DELTA_MAGIC         "DOTADIF1"
+#define DRV_OTA_DELTA_MAGIC_SIZE    8
+
+#define DRV_OTA_DELTA_OP_COPY       0x01    /* copy n base bytes */
+#define DRV_OTA_DELTA_OP_ADD        0x02    /* n patch bytes added to n base bytes */
+#define DRV_OTA_DELTA_OP_INSERT     0x03    /* n patch bytes as they are */
+#define DRV_OTA_DELTA_OP_SEEK       0x04    /* move the base cursor by a signed n */
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+typedef enum
+{
+    DRV_OTA_DELTA_STATE_HEADER,
+    DRV_OTA_DELTA_STATE_OPCODE,
+    DRV_OTA_DELTA_STATE_ARGUMENT,
+    DRV_OTA_DELTA_STATE_ADD,
+    DRV_OTA_DELTA_STATE_INSERT,
+    DRV_OTA_DELTA_STATE_DONE,
+}drv_ota_delta_state_t;
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+
+/*
+ * Patch layout, all fields little endian:
+ *   drv_ota_delta_header_t
+ *   operations until target_size bytes are produced, each an opcode byte
+ *   followed by n as LEB128 varint (zigzag encoded for SEEK) and for ADD and
+ *   INSERT n data bytes. COPY and ADD read the base at the base cursor and
+ *   advance it by n. This is the bsdiff diff/extra scheme with the zero runs
+ *   of the diff stream turned into COPY, so it is compact uncompressed and
+ *   can be applied in one pass (see tools/drv_ota_delta.py).
+ */
+typedef struct __attribute__((packed))
+{
+    char magic[DRV_OTA_DELTA_MAGIC_SIZE];
+    uint32_t header_size;
+    uint32_t target_size;
+    uint32_t base_size;
+    uint8_t base_app_elf_sha256[32];
+    char base_version[32];
+    char target_version[32];
+}drv_ota_delta_header_t;
+
+/* output of the decoder, called with up to buffer_size bytes in image order */
+typedef esp_err_t (*drv_ota_delta_write_func_t)(void* context, const uint8_t* data, size_t size);
+
+typedef struct
+{
+    drv_ota_delta_state_t state;
+    const esp_partition_t* base_partition;
+    uint32_t base_size;
+    uint32_t target_size;
+    uint32_t header_left;
+    uint8_t opcode;
+    uint64_t argument;
+    int argument_shift;
+    uint32_t data_left;
+    int64_t base_offset;
+    uint32_t produced;
+    uint8_t* base_buffer;
+    uint8_t* out_buffer;
+    size_t out_length;
+    size_t buffer_size;
+    drv_ota_delta_write_func_t write_func;
+    void* context;
+}drv_ota_delta_t;
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+bool drv_ota_delta_is_patch(const void* data, size_t size);
+esp_err_t drv_ota_delta_parse_header(const void* data, size_t size, drv_ota_delta_header_t* header);
+esp_err_t drv_ota_delta_init(drv_ota_delta_t* delta, const esp_partition_t* base_partition, const drv_ota_delta_header_t* header, size_t buffer_size, drv_ota_delta_write_func_t write_func, void* context);
+esp_err_t drv_ota_delta_feed(drv_ota_delta_t* delta, const uint8_t* data, size_t size);
+esp_err_t drv_ota_delta_finish(drv_ota_delta_t* delta);
+void drv_ota_delta_deinit(drv_ota_delta_t* delta);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
@@ -0,0 +1,300 @@
+/* *****************************************************************************
+ * File:   drv_ota_digest.c
+ * Author: DL
+ *
+ * Created on 2024 04 15
+ *
+ * Description: image digest computed while downloading
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_digest.h"
+
+#include <sdkconfig.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_app_format.h"
+#include "esp_image_format.h"
+#include "esp_flash_partitions.h"
+#include "bootloader_common.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_digest"
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define OTADATA_SECTOR_SIZE     0x1000
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static int digest_hex_value(char c)
+{
+    if ((c >= '0') && (c <= '9'))
+    {
+        return c - '0';
+    }
+    if ((c >= 'a') && (c <= 'f'))
+    {
+        return c - 'a' + 10;
+    }
+    if ((c >= 'A') && (c <= 'F'))
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* 64 hex digits, as printed by sha256sum */
+esp_err_t drv_ota_digest_parse_hex(const char* hex, uint8_t* sha_256)
+{
+    if (strlen(hex) != DRV_OTA_DIGEST_SIZE * 2)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int index = 0; index < DRV_OTA_DIGEST_SIZE; index++)
+    {
+        int high = digest_hex_value(hex[index * 2]);
+        int low = digest_hex_value(hex[index * 2 + 1]);
+        if ((high < 0) || (low < 0))
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        sha_256[index] = (uint8_t)((high << 4) | low);
+    }
+    return ESP_OK;
+}
+
+/*
+ * Starts hashing the image against the expected digest. A resumed download
+ * passes the running digest of the bytes already in flash so they are not
+ * read again.
+ */
+void drv_ota_digest_start(drv_ota_digest_t* digest, const uint8_t* expected, const mbedtls_sha256_context* written, size_t written_length)
+{
+    drv_ota_digest_stop(digest);
+    memset(digest, 0, sizeof(*digest));
+
+    mbedtls_sha256_init(&digest->sha);
+    if (written != NULL)
+    {
+        mbedtls_sha256_clone(&digest->sha, written);
+        digest->length = written_length;
+    }
+    else
+    {
+        mbedtls_sha256_starts(&digest->sha, 0);
+    }
+    memcpy(digest->expected, expected, DRV_OTA_DIGEST_SIZE);
+    digest->result = ESP_ERR_NOT_FINISHED;
+    digest->active = true;
+}
+
+/* with the size known the digest is compared before the last bytes are written */
+void drv_ota_digest_set_size(drv_ota_digest_t* digest, size_t size)
+{
+    digest->size = size;
+}
+
+/* call before writing data, fails if data completes an image with another digest */
+esp_err_t drv_ota_digest_update(drv_ota_digest_t* digest, const void* data, size_t size)
+{
+    if (digest->active == false)
+    {
+        return ESP_OK;
+    }
+    if (digest->result != ESP_ERR_NOT_FINISHED)
+    {
+        ESP_LOGE(TAG, "Data after the end of the image");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    mbedtls_sha256_update(&digest->sha, data, size);
+    digest->length += size;
+    if ((digest->size > 0) && (digest->length >= digest->size))
+    {
+        if (digest->length > digest->size)
+        {
+            ESP_LOGE(TAG, "Image is larger than %u bytes", (unsigned int)digest->size);
+            digest->result = ESP_ERR_INVALID_SIZE;
+            return digest->result;
+        }
+        return drv_ota_digest_finish(digest);
+    }
+    return ESP_OK;
+}
+
+/* ESP_OK if what was hashed matches the expected digest */
+esp_err_t drv_ota_digest_finish(drv_ota_digest_t* digest)
+{
+    uint8_t sha_256[DRV_OTA_DIGEST_SIZE];
+
+    if (digest->active == false)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (digest->result != ESP_ERR_NOT_FINISHED)
+    {
+        return digest->result;
+    }
+    mbedtls_sha256_finish(&digest->sha, sha_256);
+    if (memcmp(sha_256, digest->expected, DRV_OTA_DIGEST_SIZE) == 0)
+    {
+        ESP_LOGI(TAG, "SHA-256 of %u bytes matches", (unsigned int)digest->length);
+        digest->result = ESP_OK;
+    }
+    else
+    {
+        ESP_LOGE(TAG, "SHA-256 of %u bytes does not match", (unsigned int)digest->length);
+        digest->result = ESP_ERR_INVALID_CRC;
+    }
+    return digest->result;
+}
+
+void drv_ota_digest_stop(drv_ota_digest_t* digest)
+{
+    if (digest->active)
+    {
+        mbedtls_sha256_free(&digest->sha);
+        digest->active = false;
+    }
+}
+
+/*
+ * The checks of esp_image_verify() on the header, done on the first bytes
+ * received. The digest only says the image is the one the server meant, not
+ * that it is one for this chip.
+ */
+esp_err_t drv_ota_digest_check_header(const void* data, size_t size)
+{
+    esp_image_header_t header;
+    esp_app_desc_t app_desc;
+
+    if (size < sizeof(header) + sizeof(esp_image_segment_header_t) + sizeof(app_desc))
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(&header, data, sizeof(header));
+    memcpy(&app_desc, (const uint8_t*)data + sizeof(header) + sizeof(esp_image_segment_header_t), sizeof(app_desc));
+    if (header.magic != ESP_IMAGE_HEADER_MAGIC)
+    {
+        ESP_LOGW(TAG, "Image header magic 0x%02x", (unsigned int)header.magic);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    if (header.chip_id != CONFIG_IDF_FIRMWARE_CHIP_ID)
+    {
+        ESP_LOGW(TAG, "Image for chip id %u, not %u", (unsigned int)header.chip_id, (unsigned int)CONFIG_IDF_FIRMWARE_CHIP_ID);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    if ((header.segment_count == 0) || (header.segment_count > ESP_IMAGE_MAX_SEGMENTS))
+    {
+        ESP_LOGW(TAG, "Image with %u segments", (unsigned int)header.segment_count);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    if (app_desc.magic_word != ESP_APP_DESC_MAGIC_WORD)
+    {
+        ESP_LOGW(TAG, "No app description in the first segment");
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    return ESP_OK;
+}
+
+/*
+ * For an image whose digest was checked while it was written. Selects the
+ * partition in otadata the way esp_ota_set_boot_partition() does, without
+ * esp_image_verify() reading the whole image back from flash, only when
+ * enabled, the bootloader still verifies it then.
+ */
+esp_err_t drv_ota_digest_set_boot_partition(const esp_partition_t* partition)
+{
+    #if CONFIG_DRV_OTA_VERIFY_DIGEST_SELECT_BOOT
+    esp_ota_select_entry_t otadata[2];
+
+    if ((partition == NULL) || (partition->type != ESP_PARTITION_TYPE_APP) ||
+        (partition->subtype < ESP_PARTITION_SUBTYPE_APP_OTA_MIN) || (partition->subtype >= ESP_PARTITION_SUBTYPE_APP_OTA_MAX))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const esp_partition_t* otadata_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_OTA, NULL);
+    if (otadata_partition == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = esp_partition_read(otadata_partition, 0, &otadata[0], sizeof(otadata[0]));
+    if (err == ESP_OK)
+    {
+        err = esp_partition_read(otadata_partition, OTADATA_SECTOR_SIZE, &otadata[1], sizeof(otadata[1]));
+    }
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    uint32_t app_count = esp_ota_get_app_partition_count();
+    uint32_t sub_seq = partition->subtype - ESP_PARTITION_SUBTYPE_APP_OTA_MIN;
+    int active = bootloader_common_get_active_otadata(otadata);
+    int next = 0;
+    uint32_t seq = sub_seq + 1;
+    if (active != -1)
+    {
+        /* the smallest sequence number above the active one which selects the partition */
+        uint32_t round = 0;
+        while (otadata[active].ota_seq > (sub_seq + 1) % app_count + round * app_count)
+        {
+            round++;
+        }
+        next = active ^ 1;
+        seq = (sub_seq + 1) % app_count + round * app_count;
+    }
+
+    otadata[next].ota_seq = seq;
+    #if CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE
+    otadata[next].ota_state = ESP_OTA_IMG_NEW;
+    #else
+    otadata[next].ota_state = ESP_OTA_IMG_UNDEFINED;
+    #endif
+    otadata[next].crc = bootloader_common_ota_select_crc(&otadata[next]);
+
+    err = esp_partition_erase_range(otadata_partition, next * OTADATA_SECTOR_SIZE, OTADATA_SECTOR_SIZE);
+    if (err == ESP_OK)
+    {
+        err = esp_partition_write(otadata_partition, next * OTADATA_SECTOR_SIZE, &otadata[next], sizeof(otadata[next]));
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to write otadata (%s)", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "Boot partition set to %s (sequence %u)", partition->label, (unsigned int)seq);
+    return ESP_OK;
+    #else
+    return esp_ota_set_boot_partition(partition);
+    #endif
+}
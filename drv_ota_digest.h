@@ -0,0 +1,80 @@
+/* *****************************************************************************
+ * File:   drv_ota_digest.h
+ * Author: DL
+ *
+ * Created on 2024 04 15
+ *
+ * Description: image digest computed while downloading
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "mbedtls/sha256.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define DRV_OTA_DIGEST_SIZE     32
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef struct
+{
+    mbedtls_sha256_context sha;
+    bool active;
+    uint8_t expected[DRV_OTA_DIGEST_SIZE];
+    size_t size;                    /* image size if known, 0 otherwise */
+    size_t length;                  /* bytes hashed so far */
+    esp_err_t result;               /* ESP_ERR_NOT_FINISHED until the digest is compared */
+}drv_ota_digest_t;
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+esp_err_t drv_ota_digest_parse_hex(const char* hex, uint8_t* sha_256);
+void drv_ota_digest_start(drv_ota_digest_t* digest, const uint8_t* expected, const mbedtls_sha256_context* written, size_t written_length);
+void drv_ota_digest_set_size(drv_ota_digest_t* digest, size_t size);
+esp_err_t drv_ota_digest_update(drv_ota_digest_t* digest, const void* data, size_t size);
+esp_err_t drv_ota_digest_finish(drv_ota_digest_t* digest);
+void drv_ota_digest_stop(drv_ota_digest_t* digest);
+esp_err_t drv_ota_digest_check_header(const void* data, size_t size);
+esp_err_t drv_ota_digest_set_boot_partition(const esp_partition_t* partition);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
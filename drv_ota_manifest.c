@@ -0,0 +1,213 @@
+/* *****************************************************************************
+ * File:   drv_ota_manifest.c
+ * Author: DL
+ *
+ * Created on 2024 05 20
+ *
+ * Description: signed manifest of the image with the SHA-256 of each chunk
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_manifest.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/sha256.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_manifest"
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static void manifest_sha256(const uint8_t* data, size_t size, uint8_t* sha_256)
+{
+    mbedtls_sha256_context sha;
+
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, data, size);
+    mbedtls_sha256_finish(&sha, sha_256);
+    mbedtls_sha256_free(&sha);
+}
+
+/* key_pem as embedded, with the terminating zero counted in key_size */
+static esp_err_t manifest_verify_signature(const uint8_t* data, size_t size, const uint8_t* signature, size_t signature_size, const uint8_t* key_pem, size_t key_size)
+{
+    mbedtls_pk_context key;
+    uint8_t sha_256[DRV_OTA_MANIFEST_HASH_SIZE];
+
+    manifest_sha256(data, size, sha_256);
+    mbedtls_pk_init(&key);
+    int ret = mbedtls_pk_parse_public_key(&key, key_pem, key_size);
+    if (ret != 0)
+    {
+        ESP_LOGE(TAG, "Manifest key not usable (-0x%04x)", (unsigned int)-ret);
+    }
+    else
+    {
+        ret = mbedtls_pk_verify(&key, MBEDTLS_MD_SHA256, sha_256, sizeof(sha_256), signature, signature_size);
+        if (ret != 0)
+        {
+            ESP_LOGE(TAG, "Manifest signature not valid (-0x%04x)", (unsigned int)-ret);
+        }
+    }
+    mbedtls_pk_free(&key);
+    return (ret == 0) ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+/*
+ * Checks the layout and the signature of the manifest in data, which is
+ * owned by the manifest from here on and freed by drv_ota_manifest_release().
+ */
+esp_err_t drv_ota_manifest_parse(drv_ota_manifest_t* manifest, uint8_t* data, size_t size, const uint8_t* key_pem, size_t key_size, size_t max_chunk_size)
+{
+    drv_ota_manifest_header_t* header = &manifest->header;
+    uint16_t signature_size = 0;
+
+    memset(manifest, 0, sizeof(*manifest));
+    manifest->data = data;
+    if (size < sizeof(*header) + sizeof(signature_size))
+    {
+        ESP_LOGE(TAG, "Manifest of %u bytes too short", (unsigned int)size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(header, data, sizeof(*header));
+    if (memcmp(header->magic, DRV_OTA_MANIFEST_MAGIC, DRV_OTA_MANIFEST_MAGIC_SIZE) != 0)
+    {
+        ESP_LOGE(TAG, "No manifest magic");
+        return ESP_ERR_INVALID_VERSION;
+    }
+    header->version[DRV_OTA_MANIFEST_VERSION_SIZE - 1] = '\0';
+    if ((header->chunk_size == 0) || (header->chunk_size > max_chunk_size) || (header->file_size == 0) ||
+        (header->chunk_count != (header->file_size + header->chunk_size - 1) / header->chunk_size))
+    {
+        ESP_LOGE(TAG, "Manifest chunks of %u bytes not usable", (unsigned int)header->chunk_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t signed_size = sizeof(*header) + (size_t)header->chunk_count * DRV_OTA_MANIFEST_HASH_SIZE;
+    if (size >= signed_size + sizeof(signature_size))
+    {
+        memcpy(&signature_size, &data[signed_size], sizeof(signature_size));
+    }
+    if ((signature_size == 0) || (size != signed_size + sizeof(signature_size) + signature_size))
+    {
+        ESP_LOGE(TAG, "Manifest size %u does not match its %u chunks", (unsigned int)size, (unsigned int)header->chunk_count);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    esp_err_t err = manifest_verify_signature(data, signed_size, &data[signed_size + sizeof(signature_size)], signature_size, key_pem, key_size);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    manifest->chunk = malloc(header->chunk_size);
+    if (manifest->chunk == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    manifest->chunk_sha256 = &data[sizeof(*header)];
+    drv_ota_manifest_seek(manifest, 0);
+    ESP_LOGI(TAG, "Manifest of version %s, %u bytes in %u chunks of %u", header->version,
+             (unsigned int)header->file_size, (unsigned int)header->chunk_count, (unsigned int)header->chunk_size);
+    return ESP_OK;
+}
+
+/* the download continues at offset, a chunk collected in part is dropped */
+void drv_ota_manifest_seek(drv_ota_manifest_t* manifest, size_t offset)
+{
+    size_t chunk_size = manifest->header.chunk_size;
+    size_t chunk_end = (offset / chunk_size + 1) * chunk_size;
+
+    if (chunk_end > manifest->header.file_size)
+    {
+        chunk_end = manifest->header.file_size;
+    }
+    manifest->chunk_start = offset;
+    manifest->chunk_length = 0;
+    manifest->chunk_expected = (chunk_end > offset) ? chunk_end - offset : 0;
+    /* a resumed download has the start of this chunk in flash only */
+    manifest->chunk_partial = ((offset % chunk_size) != 0);
+}
+
+/* where to read to and how much, 0 once the whole file is received */
+uint8_t* drv_ota_manifest_chunk_room(drv_ota_manifest_t* manifest, size_t* size)
+{
+    *size = manifest->chunk_expected - manifest->chunk_length;
+    return &manifest->chunk[manifest->chunk_length];
+}
+
+/*
+ * Adds length bytes read into the room. A completed chunk matching its hash
+ * is returned to be written, chunk_length is 0 while it is not complete. On
+ * a mismatch the chunk is dropped and ESP_ERR_INVALID_CRC returned, the
+ * download is to continue from the start of the chunk.
+ */
+esp_err_t drv_ota_manifest_chunk_add(drv_ota_manifest_t* manifest, size_t length, const uint8_t** chunk, size_t* chunk_length)
+{
+    *chunk = NULL;
+    *chunk_length = 0;
+    manifest->chunk_length += length;
+    if (manifest->chunk_length < manifest->chunk_expected)
+    {
+        return ESP_OK;
+    }
+
+    if (manifest->chunk_partial == false)
+    {
+        uint32_t index = manifest->chunk_start / manifest->header.chunk_size;
+        uint8_t sha_256[DRV_OTA_MANIFEST_HASH_SIZE];
+        manifest_sha256(manifest->chunk, manifest->chunk_length, sha_256);
+        if (memcmp(sha_256, &manifest->chunk_sha256[index * DRV_OTA_MANIFEST_HASH_SIZE], DRV_OTA_MANIFEST_HASH_SIZE) != 0)
+        {
+            ESP_LOGW(TAG, "Chunk %u at %u corrupted", (unsigned int)index, (unsigned int)manifest->chunk_start);
+            manifest->chunks_failed++;
+            manifest->chunk_length = 0;
+            return ESP_ERR_INVALID_CRC;
+        }
+        manifest->chunks_verified++;
+    }
+    *chunk = manifest->chunk;
+    *chunk_length = manifest->chunk_length;
+    drv_ota_manifest_seek(manifest, manifest->chunk_start + manifest->chunk_length);
+    return ESP_OK;
+}
+
+void drv_ota_manifest_release(drv_ota_manifest_t* manifest)
+{
+    free(manifest->chunk);
+    free(manifest->data);
+    memset(manifest, 0, sizeof(*manifest));
+}
@@ -0,0 +1,98 @@
+/* *****************************************************************************
+ * File:   drv_ota_manifest.h
+ * Author: DL
+ *
+ * Created on 2024 05 20
+ *
+ * Description: signed manifest of the image with the SHA-256 of each chunk
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define DRV_OTA_MANIFEST_MAGIC          "DOTAMAN1"
+#define DRV_OTA_MANIFEST_MAGIC_SIZE     8
+#define DRV_OTA_MANIFEST_VERSION_SIZE   32
+#define DRV_OTA_MANIFEST_HASH_SIZE      32
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+/*
+ * Manifest as built by tools/drv_ota_manifest.py, little endian: this header,
+ * chunk_count SHA-256 of the file as served cut in chunk_size pieces (the
+ * last one shorter), a uint16_t signature length and the signature. The
+ * signature is over the SHA-256 of everything in front of it.
+ */
+typedef struct __attribute__((packed))
+{
+    char magic[DRV_OTA_MANIFEST_MAGIC_SIZE];
+    uint32_t file_size;             /* response body of the full request */
+    uint32_t chunk_size;
+    uint32_t chunk_count;
+    char version[DRV_OTA_MANIFEST_VERSION_SIZE];
+    uint8_t image_sha256[DRV_OTA_MANIFEST_HASH_SIZE];  /* of the image as written to flash */
+}drv_ota_manifest_header_t;
+
+typedef struct
+{
+    uint8_t* data;                  /* the manifest as received */
+    drv_ota_manifest_header_t header;
+    const uint8_t* chunk_sha256;
+    uint8_t* chunk;                 /* chunk_size bytes collected before they are passed on */
+    size_t chunk_start;             /* file offset of chunk[0] */
+    size_t chunk_length;
+    size_t chunk_expected;          /* bytes completing the chunk */
+    bool chunk_partial;             /* started inside the chunk, not verifiable */
+    uint32_t chunks_verified;
+    uint32_t chunks_failed;
+}drv_ota_manifest_t;
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+esp_err_t drv_ota_manifest_parse(drv_ota_manifest_t* manifest, uint8_t* data, size_t size, const uint8_t* key_pem, size_t key_size, size_t max_chunk_size);
+void drv_ota_manifest_seek(drv_ota_manifest_t* manifest, size_t offset);
+uint8_t* drv_ota_manifest_chunk_room(drv_ota_manifest_t* manifest, size_t* size);
+esp_err_t drv_ota_manifest_chunk_add(drv_ota_manifest_t* manifest, size_t length, const uint8_t** chunk, size_t* chunk_length);
+void drv_ota_manifest_release(drv_ota_manifest_t* manifest);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
@@ -0,0 +1,312 @@
+/* *****************************************************************************
+ * File:   drv_ota_mirror.c
+ * Author: DL
+ *
+ * Created on 2024 05 13
+ *
+ * Description: http server giving the firmware image to the neighbour devices
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_mirror.h"
+#include "drv_ota_activate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sdkconfig.h>
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_image_format.h"
+#include "esp_http_server.h"
+#include "mbedtls/sha256.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_mirror"
+
+#ifdef CONFIG_DRV_OTA_MIRROR_PORT
+#define MIRROR_PORT                 CONFIG_DRV_OTA_MIRROR_PORT
+#else
+#define MIRROR_PORT                 8070
+#endif
+
+#ifdef CONFIG_DRV_OTA_MIRROR_URI
+#define MIRROR_URI                  CONFIG_DRV_OTA_MIRROR_URI
+#else
+#define MIRROR_URI                  "/firmware.bin"
+#endif
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define MIRROR_CHUNK_SIZE           4096
+#define MIRROR_HEADER_SIZE          320
+#define MIRROR_RANGE_SIZE           48
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+static httpd_handle_t mirror_server = NULL;
+static const esp_partition_t* mirror_partition = NULL;
+static size_t mirror_image_size = 0;
+static char mirror_sha256[65];
+static char mirror_etag[20];
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+/* an update written in this boot and not run yet, or else the running one */
+static const esp_partition_t* mirror_select_partition(void)
+{
+    #if CONFIG_DRV_OTA_DEFERRED_ACTIVATION
+    /* not selected for boot until it is activated */
+    const esp_partition_t* staged = drv_ota_activate_get_partition();
+    if (staged != NULL)
+    {
+        return staged;
+    }
+    #endif
+    const esp_partition_t* boot = esp_ota_get_boot_partition();
+    const esp_partition_t* running = esp_ota_get_running_partition();
+
+    return ((boot != NULL) && (boot != running)) ? boot : running;
+}
+
+/* the image length with checksum and appended hash, and its SHA-256 for X-Image-SHA256 */
+static esp_err_t mirror_verify(const esp_partition_t* partition)
+{
+    const esp_partition_pos_t position = { .offset = partition->address, .size = partition->size };
+    esp_image_metadata_t metadata;
+    mbedtls_sha256_context sha;
+    uint8_t digest[32];
+    esp_err_t err;
+
+    err = esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &position, &metadata);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "No valid image in partition %s", partition->label);
+        return err;
+    }
+
+    uint8_t* buffer = malloc(MIRROR_CHUNK_SIZE);
+    if (buffer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    for (size_t offset = 0; (err == ESP_OK) && (offset < metadata.image_len); offset += MIRROR_CHUNK_SIZE)
+    {
+        size_t length = metadata.image_len - offset;
+        length = (length < MIRROR_CHUNK_SIZE) ? length : MIRROR_CHUNK_SIZE;
+        err = esp_partition_read(partition, offset, buffer, length);
+        mbedtls_sha256_update(&sha, buffer, length);
+    }
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    free(buffer);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    for (int index = 0; index < (int)sizeof(digest); index++)
+    {
+        sprintf(&mirror_sha256[index * 2], "%02x", digest[index]);
+    }
+    snprintf(mirror_etag, sizeof(mirror_etag), "\"%.16s\"", mirror_sha256);
+    mirror_image_size = metadata.image_len;
+    return ESP_OK;
+}
+
+/* bytes=first-last, bytes=first- and bytes=-suffix, false when not satisfiable */
+static bool mirror_parse_range(const char* range, size_t* start, size_t* end)
+{
+    unsigned long first = 0;
+    unsigned long last = 0;
+
+    if (strncmp(range, "bytes=", 6) != 0)
+    {
+        return false;
+    }
+    range += 6;
+    if (range[0] == '-')
+    {
+        if ((sscanf(range + 1, "%lu", &last) != 1) || (last == 0))
+        {
+            return false;
+        }
+        *start = (last < mirror_image_size) ? mirror_image_size - last : 0;
+        *end = mirror_image_size - 1;
+        return true;
+    }
+    int fields = sscanf(range, "%lu-%lu", &first, &last);
+    if ((fields < 1) || (first >= mirror_image_size) || ((fields == 2) && (last < first)))
+    {
+        return false;
+    }
+    *start = first;
+    *end = ((fields == 2) && (last < mirror_image_size)) ? last : mirror_image_size - 1;
+    return true;
+}
+
+/*
+ * Status line and headers are sent as they are, httpd_resp_send_chunk()
+ * would leave out the Content-Length the resume and the ranged downloads of
+ * the peers need.
+ */
+static esp_err_t mirror_handler(httpd_req_t* req)
+{
+    char header[MIRROR_HEADER_SIZE];
+    char range[MIRROR_RANGE_SIZE];
+    size_t start = 0;
+    size_t end = mirror_image_size - 1;
+    bool partial = false;
+    int length;
+
+    if (httpd_req_get_hdr_value_str(req, "Range", range, sizeof(range)) == ESP_OK)
+    {
+        char if_range[sizeof(mirror_etag)];
+        bool same = (httpd_req_get_hdr_value_str(req, "If-Range", if_range, sizeof(if_range)) != ESP_OK) || (strcmp(if_range, mirror_etag) == 0);
+        if (same)
+        {
+            if (mirror_parse_range(range, &start, &end) == false)
+            {
+                length = snprintf(header, sizeof(header), "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%u\r\nContent-Length: 0\r\n\r\n", (unsigned int)mirror_image_size);
+                return (httpd_send(req, header, length) == length) ? ESP_OK : ESP_FAIL;
+            }
+            partial = true;
+        }
+    }
+
+    length = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Type: application/octet-stream\r\nContent-Length: %u\r\nAccept-Ranges: bytes\r\nETag: %s\r\nX-Image-SHA256: %s\r\n",
+                      partial ? "206 Partial Content" : "200 OK", (unsigned int)(end + 1 - start), mirror_etag, mirror_sha256);
+    if (partial)
+    {
+        length += snprintf(header + length, sizeof(header) - length, "Content-Range: bytes %u-%u/%u\r\n", (unsigned int)start, (unsigned int)end, (unsigned int)mirror_image_size);
+    }
+    length += snprintf(header + length, sizeof(header) - length, "\r\n");
+    if (httpd_send(req, header, length) != length)
+    {
+        return ESP_FAIL;
+    }
+    if (req->method == HTTP_HEAD)
+    {
+        return ESP_OK;
+    }
+
+    ESP_LOGI(TAG, "Serving bytes %u-%u of %u", (unsigned int)start, (unsigned int)end, (unsigned int)mirror_image_size);
+    uint8_t* buffer = malloc(MIRROR_CHUNK_SIZE);
+    if (buffer == NULL)
+    {
+        return ESP_FAIL;
+    }
+    esp_err_t err = ESP_OK;
+    for (size_t offset = start; (err == ESP_OK) && (offset <= end); offset += MIRROR_CHUNK_SIZE)
+    {
+        size_t chunk = end + 1 - offset;
+        chunk = (chunk < MIRROR_CHUNK_SIZE) ? chunk : MIRROR_CHUNK_SIZE;
+        err = esp_partition_read(mirror_partition, offset, buffer, chunk);
+        if ((err == ESP_OK) && (httpd_send(req, (const char*)buffer, chunk) != (int)chunk))
+        {
+            err = ESP_FAIL;
+        }
+    }
+    free(buffer);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Peer gone at %u", (unsigned int)start);
+    }
+    return err;
+}
+
+/* partition NULL for an update written or staged in this boot, or else the running image */
+esp_err_t drv_ota_mirror_start(const esp_partition_t* partition)
+{
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    esp_err_t err;
+
+    drv_ota_mirror_stop();
+    if (partition == NULL)
+    {
+        partition = mirror_select_partition();
+    }
+    if (partition == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    err = mirror_verify(partition);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    mirror_partition = partition;
+
+    config.server_port = MIRROR_PORT;
+    /* next to the one of an application web server */
+    config.ctrl_port = ESP_HTTPD_DEF_CTRL_PORT + 1;
+    config.lru_purge_enable = true;
+    err = httpd_start(&mirror_server, &config);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Server start failed (%s)", esp_err_to_name(err));
+        mirror_server = NULL;
+        mirror_partition = NULL;
+        return err;
+    }
+
+    httpd_uri_t uri = { .uri = MIRROR_URI, .method = HTTP_GET, .handler = mirror_handler, .user_ctx = NULL };
+    httpd_register_uri_handler(mirror_server, &uri);
+    uri.method = HTTP_HEAD;
+    httpd_register_uri_handler(mirror_server, &uri);
+
+    ESP_LOGI(TAG, "Serving %u bytes of partition %s on port %d%s", (unsigned int)mirror_image_size, partition->label, MIRROR_PORT, MIRROR_URI);
+    return ESP_OK;
+}
+
+void drv_ota_mirror_stop(void)
+{
+    if (mirror_server != NULL)
+    {
+        httpd_stop(mirror_server);
+        mirror_server = NULL;
+        ESP_LOGI(TAG, "Stopped");
+    }
+    mirror_partition = NULL;
+}
+
+/* an update about to overwrite the served partition takes it back */
+void drv_ota_mirror_release(const esp_partition_t* partition)
+{
+    if ((mirror_server != NULL) && (mirror_partition == partition))
+    {
+        drv_ota_mirror_stop();
+    }
+}
+
+bool drv_ota_mirror_active(void)
+{
+    return mirror_server != NULL;
+}
@@ -0,0 +1,63 @@
+/* *****************************************************************************
+ * File:   drv_ota_mirror.h
+ * Author: DL
+ *
+ * Created on 2024 05 13
+ *
+ * Description: http server giving the firmware image to the neighbour devices
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+esp_err_t drv_ota_mirror_start(const esp_partition_t* partition);
+void drv_ota_mirror_stop(void);
+void drv_ota_mirror_release(const esp_partition_t* partition);
+bool drv_ota_mirror_active(void);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
@@ -0,0 +1,423 @@
+/* *****************************************************************************
+ * File:   drv_ota_parallel.c
+ * Author: DL
+ *
+ * Created on 2024 04 08
+ *
+ * Description: image download over several ranged connections at once
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_parallel.h"
+#include "drv_ota_pipeline.h"
+#include "drv_ota_stats.h"
+
+#include <sdkconfig.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_parallel"
+
+#ifdef CONFIG_DRV_OTA_PARALLEL_STACK_SIZE
+#define PARALLEL_WORKER_STACK_SIZE  CONFIG_DRV_OTA_PARALLEL_STACK_SIZE
+#else
+#define PARALLEL_WORKER_STACK_SIZE  8192
+#endif
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define PARALLEL_MIN_SEGMENT_SIZE   (64 * 1024)
+#define PARALLEL_SEGMENTS_PER_WORKER 4
+#define PARALLEL_MAX_RETRIES        3
+#define PARALLEL_RETRY_DELAY_MS     1000
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef struct
+{
+    const drv_ota_parallel_config_t* config;
+    esp_http_client_config_t http_config;
+    drv_ota_pipeline_t pipeline;
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t worker_exit;
+    size_t next_offset;                 /* start of the next segment not taken by a worker */
+    size_t segment_size;
+    uint8_t* erased;                    /* bitmap of the sectors erased so far */
+    volatile esp_err_t error;           /* first error of any worker, stops all of them */
+}drv_ota_parallel_t;
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+#define SECTOR_ALIGN_UP(x)      (((x) + DRV_OTA_PARALLEL_SECTOR_SIZE - 1) & ~(DRV_OTA_PARALLEL_SECTOR_SIZE - 1))
+#define SECTOR_ALIGN_DOWN(x)    ((x) & ~(DRV_OTA_PARALLEL_SECTOR_SIZE - 1))
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static void parallel_fail(drv_ota_parallel_t* parallel, esp_err_t err)
+{
+    xSemaphoreTake(parallel->lock, portMAX_DELAY);
+    if (parallel->error == ESP_OK)
+    {
+        parallel->error = err;
+    }
+    xSemaphoreGive(parallel->lock);
+}
+
+static bool parallel_next_segment(drv_ota_parallel_t* parallel, size_t* start, size_t* end)
+{
+    bool found = false;
+
+    xSemaphoreTake(parallel->lock, portMAX_DELAY);
+    if ((parallel->error == ESP_OK) && (parallel->next_offset < parallel->config->size))
+    {
+        *start = parallel->next_offset;
+        /* segments end on sector boundaries so two workers rarely share a sector */
+        *end = SECTOR_ALIGN_DOWN(*start + parallel->segment_size);
+        if ((*end <= *start) || (*end > parallel->config->size))
+        {
+            *end = parallel->config->size;
+        }
+        parallel->next_offset = *end;
+        found = true;
+    }
+    xSemaphoreGive(parallel->lock);
+    return found;
+}
+
+/*
+ * Called from the pipeline writer task, in the order the workers submit. The
+ * buffers land anywhere in the image, so each sector is erased when a write
+ * first reaches it rather than ahead of a sequential write position.
+ */
+static esp_err_t parallel_write(void* context, const drv_ota_pipeline_buffer_t* buffer)
+{
+    drv_ota_parallel_t* parallel = (drv_ota_parallel_t*)context;
+    int64_t start_us = esp_timer_get_time();
+
+    for (size_t sector = buffer->offset / DRV_OTA_PARALLEL_SECTOR_SIZE; sector * DRV_OTA_PARALLEL_SECTOR_SIZE < buffer->offset + buffer->length; sector++)
+    {
+        if (parallel->erased[sector / 8] & (1 << (sector % 8)))
+        {
+            continue;
+        }
+        esp_err_t err = esp_partition_erase_range(parallel->config->partition, sector * DRV_OTA_PARALLEL_SECTOR_SIZE, DRV_OTA_PARALLEL_SECTOR_SIZE);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Erase at 0x%x failed (%s)", (unsigned int)(sector * DRV_OTA_PARALLEL_SECTOR_SIZE), esp_err_to_name(err));
+            return err;
+        }
+        parallel->erased[sector / 8] |= (1 << (sector % 8));
+    }
+
+    esp_err_t err = esp_ota_write_with_offset(parallel->config->handle, buffer->data, buffer->length, buffer->offset);
+    drv_ota_stats_write(start_us, buffer->length);
+    return err;
+}
+
+/* If-Range makes the server answer 200 with the whole image if it changed meanwhile */
+static esp_err_t parallel_request(drv_ota_parallel_t* parallel, esp_http_client_handle_t client, size_t start, size_t end)
+{
+    char range[32];
+
+    snprintf(range, sizeof(range), "bytes=%u-%u", (unsigned int)start, (unsigned int)(end - 1));
+    esp_http_client_set_header(client, "Range", range);
+    if (parallel->config->validator[0] != '\0')
+    {
+        esp_http_client_set_header(client, "If-Range", parallel->config->validator);
+    }
+
+    int64_t connect_start = drv_ota_stats_connect_start();
+    esp_err_t err = esp_http_client_open(client, 0);
+    drv_ota_stats_connect_done(connect_start);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    esp_http_client_fetch_headers(client);
+
+    int status_code = esp_http_client_get_status_code(client);
+    if (status_code == HttpStatus_Ok)
+    {
+        ESP_LOGE(TAG, "Image changed on server during download");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (status_code != HttpStatus_PartialContent)
+    {
+        ESP_LOGE(TAG, "Unexpected HTTP status %d for range %s", status_code, range);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    if (esp_http_client_get_content_length(client) != (int64_t)(end - start))
+    {
+        ESP_LOGE(TAG, "Unexpected length %d for range %s", (int)esp_http_client_get_content_length(client), range);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    return ESP_OK;
+}
+
+/* fills whole buffers before they go to the writer, position follows what was submitted */
+static esp_err_t parallel_receive(drv_ota_parallel_t* parallel, esp_http_client_handle_t client, size_t* position, size_t end)
+{
+    esp_err_t err = ESP_OK;
+
+    while ((err == ESP_OK) && (*position < end))
+    {
+        drv_ota_pipeline_buffer_t* buffer = drv_ota_pipeline_get_free(&parallel->pipeline);
+        if (buffer == NULL)
+        {
+            return parallel->pipeline.error;
+        }
+        size_t wanted = end - *position;
+        if (wanted > buffer->size)
+        {
+            wanted = buffer->size;
+        }
+        while ((buffer->length < wanted) && (parallel->error == ESP_OK))
+        {
+            int64_t start_us = esp_timer_get_time();
+            int data_read = esp_http_client_read(client, (char*)buffer->data + buffer->length, wanted - buffer->length);
+            drv_ota_stats_read(start_us, data_read);
+            if (data_read <= 0)
+            {
+                ESP_LOGW(TAG, "Read failed at offset %u", (unsigned int)(*position + buffer->length));
+                err = ESP_FAIL;
+                break;
+            }
+            buffer->length += data_read;
+        }
+        if ((err == ESP_OK) && (parallel->error != ESP_OK))
+        {
+            err = parallel->error;
+        }
+        if (buffer->length == 0)
+        {
+            drv_ota_pipeline_put_free(&parallel->pipeline, buffer);
+            continue;
+        }
+        buffer->offset = *position;
+        *position += buffer->length;
+        esp_err_t submit_err = drv_ota_pipeline_submit(&parallel->pipeline, buffer);
+        if (submit_err != ESP_OK)
+        {
+            return submit_err;
+        }
+    }
+    return err;
+}
+
+static esp_err_t parallel_fetch_segment(drv_ota_parallel_t* parallel, esp_http_client_handle_t client, size_t start, size_t end)
+{
+    size_t position = start;
+    int retries = 0;
+
+    while (1)
+    {
+        size_t retry_position = position;
+        esp_err_t err = parallel_request(parallel, client, position, end);
+        if (err == ESP_OK)
+        {
+            err = parallel_receive(parallel, client, &position, end);
+        }
+        if (err == ESP_OK)
+        {
+            return ESP_OK;
+        }
+        if ((err == ESP_ERR_INVALID_STATE) || (parallel->error != ESP_OK) || (parallel->pipeline.error != ESP_OK))
+        {
+            return err;
+        }
+        if (position > retry_position)
+        {
+            retries = 0;
+        }
+        if (retries >= PARALLEL_MAX_RETRIES)
+        {
+            return err;
+        }
+        retries++;
+        drv_ota_stats_retry();
+        esp_http_client_close(client);
+        ESP_LOGW(TAG, "Reconnecting at offset %u (retry %d/%d)", (unsigned int)position, retries, PARALLEL_MAX_RETRIES);
+        vTaskDelay(pdMS_TO_TICKS(PARALLEL_RETRY_DELAY_MS));
+    }
+}
+
+static void parallel_worker_task(void* pvParameter)
+{
+    drv_ota_parallel_t* parallel = (drv_ota_parallel_t*)pvParameter;
+    size_t start;
+    size_t end;
+
+    /* the connection is kept open from one segment to the next */
+    esp_http_client_handle_t client = esp_http_client_init(&parallel->http_config);
+    if (client == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to initialise HTTP connection");
+        parallel_fail(parallel, ESP_ERR_NO_MEM);
+    }
+    else
+    {
+        while (parallel_next_segment(parallel, &start, &end))
+        {
+            ESP_LOGD(TAG, "Segment %u-%u", (unsigned int)start, (unsigned int)end);
+            esp_err_t err = parallel_fetch_segment(parallel, client, start, end);
+            if (err != ESP_OK)
+            {
+                parallel_fail(parallel, err);
+                break;
+            }
+        }
+        esp_http_client_close(client);
+        esp_http_client_cleanup(client);
+    }
+
+    xSemaphoreGive(parallel->worker_exit);
+    vTaskDelete(NULL);
+}
+
+static void parallel_free(drv_ota_parallel_t* parallel)
+{
+    drv_ota_pipeline_deinit(&parallel->pipeline);
+    if (parallel->lock != NULL)
+    {
+        vSemaphoreDelete(parallel->lock);
+    }
+    if (parallel->worker_exit != NULL)
+    {
+        vSemaphoreDelete(parallel->worker_exit);
+    }
+    free(parallel->erased);
+    free(parallel);
+}
+
+/*
+ * Downloads [offset, size) of the image with up to config->connections ranged
+ * requests at a time and writes it through one pipeline writer task. The
+ * receive buffers double as reorder buffer, a worker only blocks when all of
+ * them wait for the flash. Returns when everything is written or after the
+ * first error, the caller validates the image as usual.
+ */
+esp_err_t drv_ota_parallel_download(const drv_ota_parallel_config_t* config)
+{
+    if ((config == NULL) || (config->http_config == NULL) || (config->partition == NULL) || (config->connections < 1) ||
+        (config->offset > config->size) || (config->size > config->partition->size))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->offset == config->size)
+    {
+        return ESP_OK;
+    }
+
+    int buffer_count = config->buffer_memory / DRV_OTA_PARALLEL_SECTOR_SIZE;
+    if (buffer_count > DRV_OTA_PIPELINE_MAX_BUFFERS)
+    {
+        buffer_count = DRV_OTA_PIPELINE_MAX_BUFFERS;
+    }
+    if (buffer_count < 2)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t buffer_size = SECTOR_ALIGN_DOWN(config->buffer_memory / buffer_count);
+    /* one buffer more than workers keeps the writer busy while all of them receive */
+    int connections = (config->connections < buffer_count) ? config->connections : buffer_count - 1;
+
+    drv_ota_parallel_t* parallel = calloc(1, sizeof(drv_ota_parallel_t));
+    if (parallel == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    parallel->config = config;
+    parallel->http_config = *config->http_config;
+    parallel->http_config.event_handler = NULL;
+    parallel->http_config.keep_alive_enable = true;
+    parallel->next_offset = config->offset;
+    parallel->segment_size = (config->size - config->offset) / (connections * PARALLEL_SEGMENTS_PER_WORKER);
+    if (parallel->segment_size < PARALLEL_MIN_SEGMENT_SIZE)
+    {
+        parallel->segment_size = PARALLEL_MIN_SEGMENT_SIZE;
+    }
+    parallel->segment_size = SECTOR_ALIGN_UP(parallel->segment_size);
+
+    size_t sector_count = SECTOR_ALIGN_UP(config->size) / DRV_OTA_PARALLEL_SECTOR_SIZE;
+    parallel->erased = calloc((sector_count + 7) / 8, 1);
+    parallel->lock = xSemaphoreCreateMutex();
+    parallel->worker_exit = xSemaphoreCreateCounting(connections, 0);
+    if ((parallel->erased == NULL) || (parallel->lock == NULL) || (parallel->worker_exit == NULL))
+    {
+        parallel_free(parallel);
+        return ESP_ERR_NO_MEM;
+    }
+    /* the sectors holding [0, offset) were erased by the sequential write of it */
+    for (size_t sector = 0; sector < SECTOR_ALIGN_UP(config->offset) / DRV_OTA_PARALLEL_SECTOR_SIZE; sector++)
+    {
+        parallel->erased[sector / 8] |= (1 << (sector % 8));
+    }
+
+    esp_err_t err = drv_ota_pipeline_init(&parallel->pipeline, NULL, buffer_count, buffer_size, parallel_write, parallel);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start pipeline (%s)", esp_err_to_name(err));
+        parallel_free(parallel);
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Downloading %u bytes from offset %u over %d connections in segments of %u bytes",
+             (unsigned int)(config->size - config->offset), (unsigned int)config->offset, connections, (unsigned int)parallel->segment_size);
+
+    int started = 0;
+    for (; started < connections; started++)
+    {
+        if (xTaskCreate(&parallel_worker_task, "ota_parallel", PARALLEL_WORKER_STACK_SIZE, parallel, uxTaskPriorityGet(NULL), NULL) != pdPASS)
+        {
+            ESP_LOGE(TAG, "Failed to start worker %d", started);
+            parallel_fail(parallel, ESP_ERR_NO_MEM);
+            break;
+        }
+    }
+    for (int index = 0; index < started; index++)
+    {
+        xSemaphoreTake(parallel->worker_exit, portMAX_DELAY);
+    }
+
+    esp_err_t flush_err = drv_ota_pipeline_flush(&parallel->pipeline);
+    err = (parallel->error != ESP_OK) ? parallel->error : flush_err;
+    if (err == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Parallel download complete");
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Parallel download failed (%s)", esp_err_to_name(err));
+    }
+    parallel_free(parallel);
+    return err;
+}
@@ -0,0 +1,77 @@
+/* *****************************************************************************
+ * File:   drv_ota_parallel.h
+ * Author: DL
+ *
+ * Created on 2024 04 08
+ *
+ * Description: image download over several ranged connections at once
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_http_client.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define DRV_OTA_PARALLEL_SECTOR_SIZE    4096
+#define DRV_OTA_PARALLEL_VALIDATOR_SIZE 64
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef struct
+{
+    const esp_http_client_config_t* http_config;    /* url and tls settings, the event handler is not used */
+    const esp_partition_t* partition;
+    esp_ota_handle_t handle;                        /* from esp_ota_begin() with OTA_WITH_SEQUENTIAL_WRITES */
+    size_t offset;                                  /* [0, offset) is written, the sectors holding it erased */
+    size_t size;                                    /* image size */
+    char validator[DRV_OTA_PARALLEL_VALIDATOR_SIZE];/* ETag or Last-Modified for If-Range, may be empty */
+    int connections;
+    size_t buffer_memory;                           /* for all receive buffers together */
+}drv_ota_parallel_config_t;
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+esp_err_t drv_ota_parallel_download(const drv_ota_parallel_config_t* config);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
@@ -0,0 +1,239 @@
+/* *****************************************************************************
+ * File:   drv_ota_pipeline.c
+ * Author: DL
+ *
+ * Created on 2024 02 12
+ *
+ * Description: reader/writer pipeline between download and flash write
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_pipeline.h"
+#include "drv_ota_sched.h"
+
+#include <sdkconfig.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_pipeline"
+
+#ifdef CONFIG_DRV_OTA_PIPELINE_WRITER_STACK_SIZE
+#define PIPELINE_WRITER_STACK_SIZE  CONFIG_DRV_OTA_PIPELINE_WRITER_STACK_SIZE
+#else
+#define PIPELINE_WRITER_STACK_SIZE  4096
+#endif
+
+#if CONFIG_DRV_OTA_DEFERRED_ACTIVATION
+#define PIPELINE_WRITER_PRIORITY    CONFIG_DRV_OTA_DEFERRED_TASK_PRIORITY
+#elif defined CONFIG_DRV_OTA_PIPELINE_WRITER_PRIORITY
+#define PIPELINE_WRITER_PRIORITY    CONFIG_DRV_OTA_PIPELINE_WRITER_PRIORITY
+#else
+#define PIPELINE_WRITER_PRIORITY    5
+#endif
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static void pipeline_writer_task(void* pvParameter)
+{
+    drv_ota_pipeline_t* pipeline = (drv_ota_pipeline_t*)pvParameter;
+    drv_ota_pipeline_buffer_t* buffer = NULL;
+
+    while (xQueueReceive(pipeline->full_queue, &buffer, portMAX_DELAY) == pdTRUE)
+    {
+        if (buffer == NULL)
+        {
+            /* exit request from drv_ota_pipeline_deinit */
+            break;
+        }
+        if (pipeline->error == ESP_OK)
+        {
+            esp_err_t err = pipeline->write_func(pipeline->context, buffer);
+            if (err != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Write at offset %u failed (%s)", (unsigned int)buffer->offset, esp_err_to_name(err));
+                pipeline->error = err;
+            }
+        }
+        /* after an error the buffers are only recycled so the reader never blocks forever */
+        xQueueSend(pipeline->free_queue, &buffer, portMAX_DELAY);
+    }
+
+    xSemaphoreGive(pipeline->writer_exit);
+    vTaskDelete(NULL);
+}
+
+/* buffers are buffer_count blocks owned by the caller, NULL to allocate them here */
+esp_err_t drv_ota_pipeline_init(drv_ota_pipeline_t* pipeline, uint8_t* const* buffers, int buffer_count, size_t buffer_size, drv_ota_pipeline_write_func_t write_func, void* context)
+{
+    memset(pipeline, 0, sizeof(*pipeline));
+
+    if ((buffer_count < 2) || (buffer_count > DRV_OTA_PIPELINE_MAX_BUFFERS) || (write_func == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pipeline->write_func = write_func;
+    pipeline->context = context;
+    pipeline->error = ESP_OK;
+    pipeline->buffers_owned = (buffers == NULL);
+
+    pipeline->free_queue = xQueueCreate(buffer_count, sizeof(drv_ota_pipeline_buffer_t*));
+    /* one extra slot for the exit request */
+    pipeline->full_queue = xQueueCreate(buffer_count + 1, sizeof(drv_ota_pipeline_buffer_t*));
+    pipeline->writer_exit = xSemaphoreCreateBinary();
+    if ((pipeline->free_queue == NULL) || (pipeline->full_queue == NULL) || (pipeline->writer_exit == NULL))
+    {
+        drv_ota_pipeline_deinit(pipeline);
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int index = 0; index < buffer_count; index++)
+    {
+        drv_ota_pipeline_buffer_t* buffer = &pipeline->buffers[index];
+        buffer->data = (buffers != NULL) ? buffers[index] : malloc(buffer_size);
+        if (buffer->data == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to allocate pipeline buffer %d of %u bytes", index, (unsigned int)buffer_size);
+            drv_ota_pipeline_deinit(pipeline);
+            return ESP_ERR_NO_MEM;
+        }
+        buffer->size = buffer_size;
+        pipeline->buffer_count++;
+        xQueueSend(pipeline->free_queue, &buffer, 0);
+    }
+
+    if (xTaskCreatePinnedToCore(&pipeline_writer_task, "ota_writer", PIPELINE_WRITER_STACK_SIZE, pipeline, PIPELINE_WRITER_PRIORITY, &pipeline->writer_task, drv_ota_sched_core(true)) != pdPASS)
+    {
+        pipeline->writer_task = NULL;
+        drv_ota_pipeline_deinit(pipeline);
+        return ESP_ERR_NO_MEM;
+    }
+    drv_ota_sched_register_writer(pipeline->writer_task);
+
+    ESP_LOGI(TAG, "Pipeline started with %d buffers of %u bytes", buffer_count, (unsigned int)buffer_size);
+    return ESP_OK;
+}
+
+void drv_ota_pipeline_deinit(drv_ota_pipeline_t* pipeline)
+{
+    if (pipeline->writer_task != NULL)
+    {
+        drv_ota_pipeline_buffer_t* exit_request = NULL;
+        drv_ota_sched_register_writer(NULL);
+        xQueueSend(pipeline->full_queue, &exit_request, portMAX_DELAY);
+        xSemaphoreTake(pipeline->writer_exit, portMAX_DELAY);
+        pipeline->writer_task = NULL;
+    }
+    for (int index = 0; index < pipeline->buffer_count; index++)
+    {
+        if (pipeline->buffers_owned)
+        {
+            free(pipeline->buffers[index].data);
+        }
+        pipeline->buffers[index].data = NULL;
+    }
+    pipeline->buffer_count = 0;
+    if (pipeline->free_queue != NULL)
+    {
+        vQueueDelete(pipeline->free_queue);
+        pipeline->free_queue = NULL;
+    }
+    if (pipeline->full_queue != NULL)
+    {
+        vQueueDelete(pipeline->full_queue);
+        pipeline->full_queue = NULL;
+    }
+    if (pipeline->writer_exit != NULL)
+    {
+        vSemaphoreDelete(pipeline->writer_exit);
+        pipeline->writer_exit = NULL;
+    }
+}
+
+/* blocks until the writer recycles a buffer, returns NULL if the writer failed */
+drv_ota_pipeline_buffer_t* drv_ota_pipeline_get_free(drv_ota_pipeline_t* pipeline)
+{
+    drv_ota_pipeline_buffer_t* buffer = NULL;
+
+    if (pipeline->error != ESP_OK)
+    {
+        return NULL;
+    }
+    if (xQueueReceive(pipeline->free_queue, &buffer, portMAX_DELAY) != pdTRUE)
+    {
+        return NULL;
+    }
+    if (pipeline->error != ESP_OK)
+    {
+        xQueueSend(pipeline->free_queue, &buffer, 0);
+        return NULL;
+    }
+    buffer->length = 0;
+    return buffer;
+}
+
+/* return a buffer taken with drv_ota_pipeline_get_free without writing it */
+void drv_ota_pipeline_put_free(drv_ota_pipeline_t* pipeline, drv_ota_pipeline_buffer_t* buffer)
+{
+    xQueueSend(pipeline->free_queue, &buffer, portMAX_DELAY);
+}
+
+esp_err_t drv_ota_pipeline_submit(drv_ota_pipeline_t* pipeline, drv_ota_pipeline_buffer_t* buffer)
+{
+    if (pipeline->error != ESP_OK)
+    {
+        drv_ota_pipeline_put_free(pipeline, buffer);
+        return pipeline->error;
+    }
+    xQueueSend(pipeline->full_queue, &buffer, portMAX_DELAY);
+    return ESP_OK;
+}
+
+/* waits until every submitted buffer is written and returns the first write error */
+esp_err_t drv_ota_pipeline_flush(drv_ota_pipeline_t* pipeline)
+{
+    drv_ota_pipeline_buffer_t* buffers[DRV_OTA_PIPELINE_MAX_BUFFERS];
+
+    for (int index = 0; index < pipeline->buffer_count; index++)
+    {
+        xQueueReceive(pipeline->free_queue, &buffers[index], portMAX_DELAY);
+    }
+    for (int index = 0; index < pipeline->buffer_count; index++)
+    {
+        xQueueSend(pipeline->free_queue, &buffers[index], 0);
+    }
+    return pipeline->error;
+}
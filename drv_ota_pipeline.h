@@ -0,0 +1,95 @@
+/* *****************************************************************************
+ * File:   drv_ota_pipeline.h
+ * Author: DL
+ *
+ * Created on 2024 02 12
+ *
+ * Description: reader/writer pipeline between download and flash write
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define DRV_OTA_PIPELINE_MAX_BUFFERS    16
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef struct
+{
+    uint8_t* data;
+    size_t size;        /* capacity of data */
+    size_t length;      /* valid bytes in data */
+    size_t offset;      /* offset of data[0] in the image */
+}drv_ota_pipeline_buffer_t;
+
+/* called from the writer task for each submitted buffer in submit order */
+typedef esp_err_t (*drv_ota_pipeline_write_func_t)(void* context, const drv_ota_pipeline_buffer_t* buffer);
+
+typedef struct
+{
+    drv_ota_pipeline_buffer_t buffers[DRV_OTA_PIPELINE_MAX_BUFFERS];
+    int buffer_count;
+    bool buffers_owned;
+    QueueHandle_t free_queue;
+    QueueHandle_t full_queue;
+    SemaphoreHandle_t writer_exit;
+    TaskHandle_t writer_task;
+    drv_ota_pipeline_write_func_t write_func;
+    void* context;
+    volatile esp_err_t error;
+}drv_ota_pipeline_t;
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+esp_err_t drv_ota_pipeline_init(drv_ota_pipeline_t* pipeline, uint8_t* const* buffers, int buffer_count, size_t buffer_size, drv_ota_pipeline_write_func_t write_func, void* context);
+void drv_ota_pipeline_deinit(drv_ota_pipeline_t* pipeline);
+drv_ota_pipeline_buffer_t* drv_ota_pipeline_get_free(drv_ota_pipeline_t* pipeline);
+void drv_ota_pipeline_put_free(drv_ota_pipeline_t* pipeline, drv_ota_pipeline_buffer_t* buffer);
+esp_err_t drv_ota_pipeline_submit(drv_ota_pipeline_t* pipeline, drv_ota_pipeline_buffer_t* buffer);
+esp_err_t drv_ota_pipeline_flush(drv_ota_pipeline_t* pipeline);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
@@ -0,0 +1,427 @@
+/* *****************************************************************************
+ * File:   drv_ota_preerase.c
+ * Author: DL
+ *
+ * Created on 2024 05 27
+ *
+ * Description: erase of the update partition ahead of the download
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_preerase.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sdkconfig.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_ota_ops.h"
+#include "esp_image_format.h"
+#include "nvs.h"
+
+#include "drv_ota_activate.h"
+#include "drv_ota_resume.h"
+#include "drv_ota_sched.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_preerase"
+
+#ifdef CONFIG_DRV_OTA_PREERASE_MARGIN_KB
+#define PREERASE_MARGIN_SIZE        (CONFIG_DRV_OTA_PREERASE_MARGIN_KB * 1024)
+#else
+#define PREERASE_MARGIN_SIZE        (256 * 1024)
+#endif
+
+#ifdef CONFIG_DRV_OTA_PREERASE_DELAY_MS
+#define PREERASE_DELAY_MS           CONFIG_DRV_OTA_PREERASE_DELAY_MS
+#else
+#define PREERASE_DELAY_MS           20
+#endif
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define PREERASE_SECTOR_SIZE        4096
+#define PREERASE_PERSIST_SIZE       65536
+#define PREERASE_PRIORITY           (tskIDLE_PRIORITY + 1)
+#define PREERASE_STACK_SIZE         3072
+
+#define PREERASE_NVS_NAMESPACE      "drv_ota"
+#define PREERASE_NVS_KEY            "preerase"
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+/* stored in nvs, the partition is known blank in [start, end) */
+typedef struct
+{
+    uint32_t partition_address;
+    uint32_t start;
+    uint32_t end;
+}preerase_record_t;
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+#define SECTOR_ALIGN_UP(x)      (((x) + PREERASE_SECTOR_SIZE - 1) & ~(PREERASE_SECTOR_SIZE - 1))
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+/* held while a sector is erased and while the range below changes */
+static SemaphoreHandle_t preerase_lock = NULL;
+static TaskHandle_t preerase_task = NULL;
+static TaskHandle_t preerase_stopper = NULL;
+static volatile bool preerase_run = false;
+static const esp_partition_t* preerase_partition = NULL;
+static size_t preerase_start = 0;
+static size_t preerase_end = 0;
+static size_t preerase_limit = 0;
+/* handed to a download, the range is not stored any more as the flash below it gets written */
+static bool preerase_taken = false;
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static void preerase_record_load(preerase_record_t* record)
+{
+    nvs_handle_t nvs;
+    size_t length = sizeof(*record);
+
+    memset(record, 0, sizeof(*record));
+    if (nvs_open(PREERASE_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK)
+    {
+        if ((nvs_get_blob(nvs, PREERASE_NVS_KEY, record, &length) != ESP_OK) || (length != sizeof(*record)))
+        {
+            memset(record, 0, sizeof(*record));
+        }
+        nvs_close(nvs);
+    }
+}
+
+static void preerase_record_save(const preerase_record_t* record)
+{
+    nvs_handle_t nvs;
+
+    if (nvs_open(PREERASE_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK)
+    {
+        esp_err_t err = (record != NULL) ? nvs_set_blob(nvs, PREERASE_NVS_KEY, record, sizeof(*record)) : nvs_erase_key(nvs, PREERASE_NVS_KEY);
+        if (err == ESP_OK)
+        {
+            nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+}
+
+/* a range stored by an earlier boot is trusted only once it reads back blank */
+static bool preerase_blank(const esp_partition_t* partition, size_t start, size_t end)
+{
+    uint32_t* buffer = malloc(PREERASE_SECTOR_SIZE);
+    bool blank = (buffer != NULL);
+
+    for (size_t offset = start; blank && (offset < end); offset += PREERASE_SECTOR_SIZE)
+    {
+        blank = (esp_partition_read(partition, offset, buffer, PREERASE_SECTOR_SIZE) == ESP_OK);
+        for (int index = 0; blank && (index < PREERASE_SECTOR_SIZE / sizeof(uint32_t)); index++)
+        {
+            blank = (buffer[index] == 0xFFFFFFFF);
+        }
+    }
+    free(buffer);
+    return blank;
+}
+
+/* the size of the running image and a margin for growth, the writer erases past it itself */
+static size_t preerase_get_limit(const esp_partition_t* partition)
+{
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    esp_partition_pos_t position = { .offset = running->address, .size = running->size };
+    esp_image_metadata_t metadata;
+    size_t limit = partition->size;
+
+    if (esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &position, &metadata) == ESP_OK)
+    {
+        limit = SECTOR_ALIGN_UP(metadata.image_len) + PREERASE_MARGIN_SIZE;
+    }
+    return (limit < partition->size) ? limit : partition->size;
+}
+
+static void preerase_task_func(void* pvParameter)
+{
+    preerase_record_t record = { .partition_address = preerase_partition->address };
+    size_t end;
+
+    preerase_limit = preerase_get_limit(preerase_partition);
+    /* under the lock, a download taking the range meanwhile waits for the check */
+    xSemaphoreTake(preerase_lock, portMAX_DELAY);
+    if ((preerase_end > preerase_start) && (preerase_blank(preerase_partition, preerase_start, preerase_end) == false))
+    {
+        ESP_LOGW(TAG, "Partition %s written since it was erased, erasing it again", preerase_partition->label);
+        preerase_end = preerase_start;
+    }
+    size_t stored = preerase_end;
+    xSemaphoreGive(preerase_lock);
+    int64_t erase_start_us = esp_timer_get_time();
+
+    while (preerase_run)
+    {
+        xSemaphoreTake(preerase_lock, portMAX_DELAY);
+        end = preerase_end;
+        bool taken = preerase_taken;
+        esp_err_t err = ESP_OK;
+        if (end < preerase_limit)
+        {
+            err = esp_partition_erase_range(preerase_partition, end, PREERASE_SECTOR_SIZE);
+            if (err == ESP_OK)
+            {
+                end += PREERASE_SECTOR_SIZE;
+                preerase_end = end;
+            }
+        }
+        xSemaphoreGive(preerase_lock);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Erase at 0x%x failed (%s)", (unsigned int)end, esp_err_to_name(err));
+            break;
+        }
+        if ((taken == false) && ((end - stored >= PREERASE_PERSIST_SIZE) || (end >= preerase_limit)))
+        {
+            record.start = preerase_start;
+            record.end = end;
+            preerase_record_save(&record);
+            stored = end;
+        }
+        if (end >= preerase_limit)
+        {
+            ESP_LOGI(TAG, "Partition %s erased up to %u KB in %u ms", preerase_partition->label,
+                     (unsigned int)(end / 1024), (unsigned int)((esp_timer_get_time() - erase_start_us) / 1000));
+            break;
+        }
+        /* idle time only until a download takes over, then it keeps ahead of the writes */
+        vTaskDelay(taken ? 1 : pdMS_TO_TICKS(PREERASE_DELAY_MS));
+    }
+
+    xSemaphoreTake(preerase_lock, portMAX_DELAY);
+    if (preerase_run == false)
+    {
+        xTaskNotifyGive(preerase_stopper);
+    }
+    preerase_run = false;
+    preerase_task = NULL;
+    xSemaphoreGive(preerase_lock);
+    vTaskDelete(NULL);
+}
+
+/*
+ * Starts erasing the partition the next update goes to, in idle time. Not
+ * while an update waits for the reboot or while the running image is not
+ * confirmed yet, the other partition then holds the image to roll back to.
+ */
+esp_err_t drv_ota_preerase_start(void)
+{
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    const esp_partition_t* partition = esp_ota_get_next_update_partition(NULL);
+
+    if (preerase_lock == NULL)
+    {
+        preerase_lock = xSemaphoreCreateMutex();
+        if (preerase_lock == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if ((preerase_task != NULL) || preerase_taken)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (partition == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (esp_ota_get_boot_partition() != running)
+    {
+        ESP_LOGI(TAG, "Update waits for the reboot, nothing erased");
+        return ESP_ERR_INVALID_STATE;
+    }
+    #if CONFIG_DRV_OTA_DEFERRED_ACTIVATION
+    if (drv_ota_activate_pending())
+    {
+        ESP_LOGI(TAG, "Update staged in %s, nothing erased", partition->label);
+        return ESP_ERR_INVALID_STATE;
+    }
+    #endif
+    #if CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE
+    esp_ota_img_states_t state;
+    if ((esp_ota_get_state_partition(running, &state) == ESP_OK) && (state == ESP_OTA_IMG_PENDING_VERIFY))
+    {
+        ESP_LOGI(TAG, "Running image not confirmed yet, partition %s kept for the rollback", partition->label);
+        return ESP_ERR_INVALID_STATE;
+    }
+    #endif
+
+    /* a download stopped part way continues from its checkpoint, the flash before it is kept */
+    size_t start = 0;
+    #if CONFIG_DRV_OTA_RESUME
+    drv_ota_resume_state_t resume;
+    if ((drv_ota_resume_load(&resume) == ESP_OK) && (resume.partition_address == partition->address))
+    {
+        start = SECTOR_ALIGN_UP(resume.written);
+    }
+    #endif
+    preerase_record_t record;
+    preerase_record_load(&record);
+    if ((record.partition_address == partition->address) && (record.start >= start) && (record.end <= partition->size))
+    {
+        start = record.start;
+    }
+    else
+    {
+        record.end = start;
+    }
+
+    xSemaphoreTake(preerase_lock, portMAX_DELAY);
+    preerase_partition = partition;
+    preerase_start = start;
+    preerase_end = (record.end > start) ? record.end : start;
+    preerase_run = true;
+    xSemaphoreGive(preerase_lock);
+    if (xTaskCreatePinnedToCore(&preerase_task_func, "ota_preerase", PREERASE_STACK_SIZE, NULL, PREERASE_PRIORITY, &preerase_task, drv_ota_sched_core(true)) != pdPASS)
+    {
+        preerase_run = false;
+        preerase_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Erasing partition %s from %u KB, %u KB erased before", partition->label,
+             (unsigned int)(preerase_end / 1024), (unsigned int)((preerase_end - start) / 1024));
+    return ESP_OK;
+}
+
+/* waits for the sector being erased, the range erased so far is forgotten */
+void drv_ota_preerase_stop(void)
+{
+    if (preerase_lock == NULL)
+    {
+        return;
+    }
+    xSemaphoreTake(preerase_lock, portMAX_DELAY);
+    bool wait = (preerase_task != NULL);
+    if (wait)
+    {
+        preerase_stopper = xTaskGetCurrentTaskHandle();
+        preerase_run = false;
+    }
+    xSemaphoreGive(preerase_lock);
+    if (wait)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    xSemaphoreTake(preerase_lock, portMAX_DELAY);
+    preerase_partition = NULL;
+    preerase_start = 0;
+    preerase_end = 0;
+    preerase_taken = false;
+    xSemaphoreGive(preerase_lock);
+}
+
+bool drv_ota_preerase_active(void)
+{
+    return preerase_task != NULL;
+}
+
+size_t drv_ota_preerase_get_erased(void)
+{
+    return preerase_end - preerase_start;
+}
+
+/*
+ * Hands the erased range of partition to a download about to write it, empty
+ * if the range is of another partition. The stored range is dropped before
+ * the first write, after a reset the partition is erased from scratch. A
+ * running erase keeps going at the priority of the caller ahead of the
+ * writes, drv_ota_preerase_stop() ends it.
+ */
+void drv_ota_preerase_take(const esp_partition_t* partition, size_t* start, size_t* end)
+{
+    *start = 0;
+    *end = 0;
+    if (preerase_lock == NULL)
+    {
+        preerase_record_save(NULL);
+        return;
+    }
+    xSemaphoreTake(preerase_lock, portMAX_DELAY);
+    preerase_record_save(NULL);
+    if ((preerase_partition != NULL) && (preerase_partition->address == partition->address))
+    {
+        preerase_taken = true;
+        *start = preerase_start;
+        *end = preerase_end;
+        if (preerase_task != NULL)
+        {
+            vTaskPrioritySet(preerase_task, uxTaskPriorityGet(NULL));
+        }
+    }
+    xSemaphoreGive(preerase_lock);
+    if (*end > *start)
+    {
+        ESP_LOGI(TAG, "Download starts on %u KB erased before", (unsigned int)((*end - *start) / 1024));
+    }
+}
+
+/*
+ * Makes the partition erased from from up to at least to and returns up to
+ * where it is. The sectors past the erased range are erased here under the
+ * lock, so they are never erased twice. ESP_ERR_NOT_FOUND if the range of
+ * drv_ota_preerase_take() does not reach from.
+ */
+esp_err_t drv_ota_preerase_extend(const esp_partition_t* partition, size_t from, size_t to, size_t* erased_end)
+{
+    esp_err_t err = ESP_OK;
+
+    if (preerase_lock == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    xSemaphoreTake(preerase_lock, portMAX_DELAY);
+    if ((preerase_taken == false) || (preerase_partition == NULL) || (preerase_partition->address != partition->address) ||
+        (from < preerase_start) || (from > preerase_end))
+    {
+        xSemaphoreGive(preerase_lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+    while ((err == ESP_OK) && (preerase_end < to))
+    {
+        err = esp_partition_erase_range(partition, preerase_end, PREERASE_SECTOR_SIZE);
+        if (err == ESP_OK)
+        {
+            preerase_end += PREERASE_SECTOR_SIZE;
+        }
+    }
+    *erased_end = preerase_end;
+    xSemaphoreGive(preerase_lock);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Erase at 0x%x failed (%s)", (unsigned int)*erased_end, esp_err_to_name(err));
+    }
+    return err;
+}
@@ -0,0 +1,67 @@
+/* *****************************************************************************
+ * File:   drv_ota_preerase.h
+ * Author: DL
+ *
+ * Created on 2024 05 27
+ *
+ * Description: erase of the update partition ahead of the download
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+esp_err_t drv_ota_preerase_start(void);
+void drv_ota_preerase_stop(void);
+bool drv_ota_preerase_active(void);
+size_t drv_ota_preerase_get_erased(void);
+
+void drv_ota_preerase_take(const esp_partition_t* partition, size_t* start, size_t* end);
+esp_err_t drv_ota_preerase_extend(const esp_partition_t* partition, size_t from, size_t to, size_t* erased_end);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
@@ -0,0 +1,559 @@
+/* *****************************************************************************
+ * File:   drv_ota_process.c
+ * Author: DL
+ *
+ * Created on 2024 04 29
+ *
+ * Description: processes stopped for the firmware update and started again
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_process.h"
+
+#include <sdkconfig.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_process"
+
+#define MAX_START_STOP_PROCESSES    CONFIG_DRV_OTA_MAX_START_STOP_PROCESSES
+
+#ifdef CONFIG_DRV_OTA_PROCESS_TIMEOUT_MS
+#define PROCESS_TIMEOUT_MS          CONFIG_DRV_OTA_PROCESS_TIMEOUT_MS
+#else
+#define PROCESS_TIMEOUT_MS          5000
+#endif
+
+#ifdef CONFIG_DRV_OTA_PROCESS_DEADLINE_MS
+#define PROCESS_DEADLINE_MS         CONFIG_DRV_OTA_PROCESS_DEADLINE_MS
+#else
+#define PROCESS_DEADLINE_MS         10000
+#endif
+
+#ifdef CONFIG_DRV_OTA_PROCESS_STACK_SIZE
+#define PROCESS_STACK_SIZE          CONFIG_DRV_OTA_PROCESS_STACK_SIZE
+#else
+#define PROCESS_STACK_SIZE          4096
+#endif
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+typedef enum
+{
+    PROCESS_WAITING,
+    PROCESS_RUNNING,
+    PROCESS_FINISHED,
+}process_state_t;
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef struct
+{
+    char name[DRV_OTA_PROCESS_NAME_SIZE];
+    drv_ota_start_stop_process_func_t start_func;
+    drv_ota_start_stop_process_func_t stop_func;
+    char depends_on[DRV_OTA_PROCESS_MAX_DEPENDENCIES][DRV_OTA_PROCESS_NAME_SIZE];
+    uint32_t timeout_ms;
+    uint32_t resources;
+    bool stopped;                   /* stopped for the update running now */
+    bool sequential;                /* registered with drv_ota_register_start_stop_process() */
+    volatile bool busy;             /* a worker still runs one of the functions */
+    bool run_stop;
+    uint32_t run_phase;
+    drv_ota_process_result_t stop_result;
+    drv_ota_process_result_t start_result;
+    int64_t stop_us;
+    int64_t start_us;
+}process_entry_t;
+
+typedef struct
+{
+    int index;
+    uint32_t phase;
+    int64_t elapsed_us;
+}process_done_t;
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+static process_entry_t process_list[MAX_START_STOP_PROCESSES];
+static int process_count = 0;
+static QueueHandle_t process_done_queue = NULL;
+static uint32_t process_phase = 0;
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static void process_copy_name(char* name, const char* source)
+{
+    if (source == NULL)
+    {
+        name[0] = '\0';
+        return;
+    }
+    if (strlen(source) >= DRV_OTA_PROCESS_NAME_SIZE)
+    {
+        ESP_LOGW(TAG, "Process name %s truncated", source);
+    }
+    strlcpy(name, source, DRV_OTA_PROCESS_NAME_SIZE);
+}
+
+/* true if process user depends on process used */
+static bool process_depends(int user, int used)
+{
+    const process_entry_t* entry = &process_list[user];
+
+    if (entry->sequential && process_list[used].sequential)
+    {
+        /* stopped in registration order and started in reverse, as before dependencies existed */
+        for (int index = user + 1; index < process_count; index++)
+        {
+            if (process_list[index].sequential)
+            {
+                return index == used;
+            }
+        }
+        return false;
+    }
+    for (int dependency = 0; dependency < DRV_OTA_PROCESS_MAX_DEPENDENCIES; dependency++)
+    {
+        if ((entry->depends_on[dependency][0] != '\0') && (strcmp(entry->depends_on[dependency], process_list[used].name) == 0))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void process_worker_task(void* pvParameter)
+{
+    int index = (int)(intptr_t)pvParameter;
+    process_entry_t* entry = &process_list[index];
+    process_done_t done = { .index = index, .phase = entry->run_phase };
+
+    int64_t start_us = esp_timer_get_time();
+    if (entry->run_stop)
+    {
+        entry->stop_func();
+    }
+    else
+    {
+        entry->start_func();
+    }
+    done.elapsed_us = esp_timer_get_time() - start_us;
+    entry->busy = false;
+    xQueueSend(process_done_queue, &done, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+static void process_set_result(int index, bool stop, drv_ota_process_result_t result, int64_t elapsed_us)
+{
+    process_entry_t* entry = &process_list[index];
+
+    if (stop)
+    {
+        entry->stop_result = result;
+        entry->stop_us = elapsed_us;
+    }
+    else
+    {
+        entry->start_result = result;
+        entry->start_us = elapsed_us;
+    }
+}
+
+/* ESP_OK if the function of the process was started */
+static esp_err_t process_launch(int index, bool stop)
+{
+    process_entry_t* entry = &process_list[index];
+    drv_ota_start_stop_process_func_t func = stop ? entry->stop_func : entry->start_func;
+
+    if (func == NULL)
+    {
+        ESP_LOGD(TAG, "%s process %s skipped", stop ? "Stop" : "Start", entry->name);
+        process_set_result(index, stop, DRV_OTA_PROCESS_SKIPPED, 0);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (entry->busy)
+    {
+        ESP_LOGW(TAG, "%s process %s skipped, the last call has not returned", stop ? "Stop" : "Start", entry->name);
+        process_set_result(index, stop, DRV_OTA_PROCESS_SKIPPED, 0);
+        return ESP_ERR_INVALID_STATE;
+    }
+    entry->busy = true;
+    entry->run_stop = stop;
+    entry->run_phase = process_phase;
+    if (xTaskCreate(&process_worker_task, "ota_process", PROCESS_STACK_SIZE, (void*)(intptr_t)index, uxTaskPriorityGet(NULL), NULL) != pdPASS)
+    {
+        /* no memory for a worker, the caller waits for this one */
+        int64_t start_us = esp_timer_get_time();
+        func();
+        entry->busy = false;
+        process_set_result(index, stop, DRV_OTA_PROCESS_DONE, esp_timer_get_time() - start_us);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/*
+ * Runs the stop or start function of the selected processes, each as soon
+ * as the ones it has to wait for are finished. A process not done within its
+ * timeout, or by the deadline, is left running in its worker and counts as
+ * finished.
+ */
+static esp_err_t process_run(bool stop, const bool* selected)
+{
+    process_state_t state[MAX_START_STOP_PROCESSES];
+    int64_t launched_us[MAX_START_STOP_PROCESSES];
+    int finished = 0;
+    int selected_count = 0;
+    esp_err_t result = ESP_OK;
+
+    if (process_done_queue == NULL)
+    {
+        process_done_queue = xQueueCreate(MAX_START_STOP_PROCESSES, sizeof(process_done_t));
+        if (process_done_queue == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    process_done_t done;
+    while (xQueueReceive(process_done_queue, &done, 0) == pdTRUE)
+    {
+        /* from a worker given up on in an earlier call */
+    }
+    process_phase++;
+
+    int64_t phase_start_us = esp_timer_get_time();
+    int64_t deadline_us = phase_start_us + (int64_t)PROCESS_DEADLINE_MS * 1000;
+    for (int index = 0; index < process_count; index++)
+    {
+        if (selected[index])
+        {
+            state[index] = PROCESS_WAITING;
+            process_set_result(index, stop, DRV_OTA_PROCESS_NOT_RUN, 0);
+            selected_count++;
+        }
+        else
+        {
+            state[index] = PROCESS_FINISHED;
+            finished++;
+        }
+    }
+
+    while (finished < process_count)
+    {
+        bool launched;
+        do
+        {
+            launched = false;
+            for (int index = 0; index < process_count; index++)
+            {
+                if (state[index] != PROCESS_WAITING)
+                {
+                    continue;
+                }
+                bool ready = true;
+                for (int other = 0; (other < process_count) && ready; other++)
+                {
+                    /* stop users before what they use, start in the other order */
+                    bool before = stop ? process_depends(other, index) : process_depends(index, other);
+                    if (before && (state[other] != PROCESS_FINISHED))
+                    {
+                        ready = false;
+                    }
+                }
+                if (ready == false)
+                {
+                    continue;
+                }
+                launched = true;
+                if (process_launch(index, stop) == ESP_OK)
+                {
+                    state[index] = PROCESS_RUNNING;
+                    launched_us[index] = esp_timer_get_time();
+                }
+                else
+                {
+                    state[index] = PROCESS_FINISHED;
+                    finished++;
+                }
+            }
+        } while (launched);
+
+        int64_t now_us = esp_timer_get_time();
+        int64_t wait_until_us = INT64_MAX;
+        for (int index = 0; index < process_count; index++)
+        {
+            if (state[index] == PROCESS_RUNNING)
+            {
+                uint32_t timeout_ms = (process_list[index].timeout_ms > 0) ? process_list[index].timeout_ms : PROCESS_TIMEOUT_MS;
+                int64_t until_us = launched_us[index] + (int64_t)timeout_ms * 1000;
+                if (until_us > deadline_us)
+                {
+                    until_us = deadline_us;
+                }
+                if (until_us < wait_until_us)
+                {
+                    wait_until_us = until_us;
+                }
+            }
+        }
+        if (wait_until_us == INT64_MAX)
+        {
+            if (finished < process_count)
+            {
+                ESP_LOGE(TAG, "Dependency cycle, %d processes not %s", process_count - finished, stop ? "stopped" : "started");
+                result = ESP_ERR_INVALID_STATE;
+            }
+            break;
+        }
+
+        TickType_t ticks = 0;
+        if (wait_until_us > now_us)
+        {
+            ticks = pdMS_TO_TICKS((wait_until_us - now_us + 999) / 1000);
+            if (ticks == 0)
+            {
+                ticks = 1;
+            }
+        }
+        if (xQueueReceive(process_done_queue, &done, ticks) == pdTRUE)
+        {
+            if ((done.phase == process_phase) && (state[done.index] == PROCESS_RUNNING))
+            {
+                state[done.index] = PROCESS_FINISHED;
+                finished++;
+                process_set_result(done.index, stop, DRV_OTA_PROCESS_DONE, done.elapsed_us);
+                ESP_LOGI(TAG, "Process %s %s in %lld ms", process_list[done.index].name, stop ? "stopped" : "started", (long long)(done.elapsed_us / 1000));
+            }
+            continue;
+        }
+
+        now_us = esp_timer_get_time();
+        for (int index = 0; index < process_count; index++)
+        {
+            if (state[index] != PROCESS_RUNNING)
+            {
+                continue;
+            }
+            uint32_t timeout_ms = (process_list[index].timeout_ms > 0) ? process_list[index].timeout_ms : PROCESS_TIMEOUT_MS;
+            if ((now_us >= launched_us[index] + (int64_t)timeout_ms * 1000) || (now_us >= deadline_us))
+            {
+                state[index] = PROCESS_FINISHED;
+                finished++;
+                process_set_result(index, stop, DRV_OTA_PROCESS_TIMEOUT, now_us - launched_us[index]);
+                ESP_LOGW(TAG, "Process %s not %s after %lld ms, continuing without it", process_list[index].name,
+                         stop ? "stopped" : "started", (long long)((now_us - launched_us[index]) / 1000));
+                result = ESP_ERR_TIMEOUT;
+            }
+        }
+    }
+
+    ESP_LOGI(TAG, "%s %d processes in %lld ms", stop ? "Stopped" : "Started", selected_count, (long long)((esp_timer_get_time() - phase_start_us) / 1000));
+    return result;
+}
+
+/* a process which uses resources, or uses a process being stopped, is stopped too */
+static int process_select(uint32_t resources, bool* selected)
+{
+    int count = 0;
+    bool changed = true;
+
+    for (int index = 0; index < process_count; index++)
+    {
+        uint32_t used = (process_list[index].resources != 0) ? process_list[index].resources : DRV_OTA_RESOURCE_ALL;
+        selected[index] = (process_list[index].stopped == false) && ((used & resources) != 0);
+    }
+    while (changed)
+    {
+        changed = false;
+        for (int user = 0; user < process_count; user++)
+        {
+            for (int used = 0; (used < process_count) && (selected[user] == false) && (process_list[user].stopped == false); used++)
+            {
+                if ((selected[used] || process_list[used].stopped) && process_depends(user, used))
+                {
+                    selected[user] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+    for (int index = 0; index < process_count; index++)
+    {
+        count += selected[index];
+    }
+    return count;
+}
+
+esp_err_t drv_ota_register_process(const drv_ota_process_config_t* config)
+{
+    if ((config == NULL) || (config->name == NULL) || (config->name[0] == '\0'))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (process_count >= MAX_START_STOP_PROCESSES)
+    {
+        ESP_LOGE(TAG, "Cannot register %s process start stop (no space left)", config->name);
+        return ESP_ERR_NO_MEM;
+    }
+    process_entry_t* entry = &process_list[process_count];
+    memset(entry, 0, sizeof(*entry));
+    process_copy_name(entry->name, config->name);
+    entry->start_func = config->start_func;
+    entry->stop_func = config->stop_func;
+    for (int dependency = 0; dependency < DRV_OTA_PROCESS_MAX_DEPENDENCIES; dependency++)
+    {
+        process_copy_name(entry->depends_on[dependency], config->depends_on[dependency]);
+    }
+    entry->timeout_ms = config->timeout_ms;
+    entry->resources = config->resources;
+    process_count++;
+    ESP_LOGI(TAG, "Register process %s", entry->name);
+    return ESP_OK;
+}
+
+/* processes registered here are stopped one after another in registration order */
+void drv_ota_register_start_stop_process(drv_ota_start_stop_process_func_t start_func, drv_ota_start_stop_process_func_t stop_func, char* process_name)
+{
+    if (process_count >= MAX_START_STOP_PROCESSES)
+    {
+        ESP_LOGE(TAG, "Cannot register %s process start stop (no space left)", (process_name != NULL) ? process_name : "");
+        return;
+    }
+    process_entry_t* entry = &process_list[process_count];
+    memset(entry, 0, sizeof(*entry));
+    process_copy_name(entry->name, process_name);
+    entry->start_func = start_func;
+    entry->stop_func = stop_func;
+    entry->sequential = true;
+    process_count++;
+    ESP_LOGI(TAG, "Register process %s", entry->name);
+}
+
+/*
+ * Stops the processes contending for any of resources which still run. Called
+ * as the update reaches the phase which needs them, so processes which do not
+ * contend keep running through most of the download.
+ */
+esp_err_t drv_ota_stop_processes_for(uint32_t resources)
+{
+    bool selected[MAX_START_STOP_PROCESSES];
+    bool first = true;
+
+    for (int index = 0; index < process_count; index++)
+    {
+        first = first && (process_list[index].stopped == false);
+    }
+    if (process_select(resources, selected) == 0)
+    {
+        return ESP_OK;
+    }
+    for (int index = 0; index < process_count; index++)
+    {
+        if (first)
+        {
+            /* the first stop of an update, the results of the last one are cleared */
+            process_set_result(index, true, DRV_OTA_PROCESS_NOT_RUN, 0);
+            process_set_result(index, false, DRV_OTA_PROCESS_NOT_RUN, 0);
+        }
+        if (selected[index])
+        {
+            process_list[index].stopped = true;
+        }
+    }
+    return process_run(true, selected);
+}
+
+esp_err_t drv_ota_stop_processes(void)
+{
+    return drv_ota_stop_processes_for(DRV_OTA_RESOURCE_ALL);
+}
+
+/* starts what was stopped for the update */
+esp_err_t drv_ota_start_processes(void)
+{
+    bool selected[MAX_START_STOP_PROCESSES];
+    int count = 0;
+
+    for (int index = 0; index < process_count; index++)
+    {
+        selected[index] = process_list[index].stopped;
+        process_list[index].stopped = false;
+        count += selected[index];
+    }
+    if (count == 0)
+    {
+        return ESP_OK;
+    }
+    return process_run(false, selected);
+}
+
+int drv_ota_get_process_timing(drv_ota_process_timing_t* timing, int count)
+{
+    int index;
+
+    for (index = 0; (index < count) && (index < process_count); index++)
+    {
+        strlcpy(timing[index].name, process_list[index].name, sizeof(timing[index].name));
+        timing[index].stop_result = process_list[index].stop_result;
+        timing[index].start_result = process_list[index].start_result;
+        timing[index].stop_us = process_list[index].stop_us;
+        timing[index].start_us = process_list[index].start_us;
+    }
+    return index;
+}
+
+static const char* process_result_name(drv_ota_process_result_t result)
+{
+    switch (result)
+    {
+    case DRV_OTA_PROCESS_DONE:
+        return "done";
+    case DRV_OTA_PROCESS_TIMEOUT:
+        return "timeout";
+    case DRV_OTA_PROCESS_SKIPPED:
+        return "skipped";
+    default:
+        return "-";
+    }
+}
+
+void drv_ota_print_processes(void)
+{
+    for (int index = 0; index < process_count; index++)
+    {
+        const process_entry_t* entry = &process_list[index];
+        printf("Process %-16s stop %-7s %6lld ms, start %-7s %6lld ms\n", entry->name,
+               process_result_name(entry->stop_result), (long long)(entry->stop_us / 1000),
+               process_result_name(entry->start_result), (long long)(entry->start_us / 1000));
+    }
+}
@@ -0,0 +1,113 @@
+/* *****************************************************************************
+ * File:   drv_ota_process.h
+ * Author: DL
+ *
+ * Created on 2024 04 29
+ *
+ * Description: processes stopped for the firmware update and started again
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define DRV_OTA_PROCESS_NAME_SIZE       16
+#define DRV_OTA_PROCESS_MAX_DEPENDENCIES 4
+
+/* what a process contends for with the update */
+#define DRV_OTA_RESOURCE_FLASH          (1 << 0)    /* erases or writes flash, or needs the cache enabled */
+#define DRV_OTA_RESOURCE_NETWORK        (1 << 1)
+#define DRV_OTA_RESOURCE_CPU            (1 << 2)
+#define DRV_OTA_RESOURCE_PSRAM          (1 << 3)    /* shares the SPI bus and cache with the flash */
+#define DRV_OTA_RESOURCE_ALL            (DRV_OTA_RESOURCE_FLASH | DRV_OTA_RESOURCE_NETWORK | DRV_OTA_RESOURCE_CPU | DRV_OTA_RESOURCE_PSRAM)
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+typedef enum
+{
+    DRV_OTA_PROCESS_NOT_RUN,
+    DRV_OTA_PROCESS_DONE,
+    DRV_OTA_PROCESS_TIMEOUT,        /* still running in its worker, not waited for any more */
+    DRV_OTA_PROCESS_SKIPPED,        /* no function, or the one of the last call still running */
+}drv_ota_process_result_t;
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef void (*drv_ota_start_stop_process_func_t)(void);
+
+/*
+ * A process is stopped before the processes it depends on and started after
+ * them. Processes which do not depend on each other are stopped and started
+ * at the same time, each on its own worker task. A process is stopped only
+ * once the update reaches a phase using one of its resources, the network
+ * and cpu before the download, the flash and psram before the first write,
+ * everything before the image is verified and selected for boot.
+ */
+typedef struct
+{
+    const char* name;
+    drv_ota_start_stop_process_func_t start_func;
+    drv_ota_start_stop_process_func_t stop_func;
+    const char* depends_on[DRV_OTA_PROCESS_MAX_DEPENDENCIES];  /* names of other processes, unused entries NULL */
+    uint32_t timeout_ms;            /* for each of stop and start, 0 for CONFIG_DRV_OTA_PROCESS_TIMEOUT_MS */
+    uint32_t resources;             /* DRV_OTA_RESOURCE_*, 0 for all of them */
+}drv_ota_process_config_t;
+
+typedef struct
+{
+    char name[DRV_OTA_PROCESS_NAME_SIZE];
+    drv_ota_process_result_t stop_result;
+    drv_ota_process_result_t start_result;
+    int64_t stop_us;
+    int64_t start_us;
+}drv_ota_process_timing_t;
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+esp_err_t drv_ota_register_process(const drv_ota_process_config_t* config);
+void drv_ota_register_start_stop_process(
+                drv_ota_start_stop_process_func_t start_func,
+                drv_ota_start_stop_process_func_t stop_func,
+                char* process_name);
+esp_err_t drv_ota_stop_processes(void);
+esp_err_t drv_ota_stop_processes_for(uint32_t resources);
+esp_err_t drv_ota_start_processes(void);
+int drv_ota_get_process_timing(drv_ota_process_timing_t* timing, int count);
+void drv_ota_print_processes(void);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
@@ -0,0 +1,123 @@
+/* *****************************************************************************
+ * File:   drv_ota_resume.c
+ * Author: DL
+ *
+ * Created on 2024 02 19
+ *
+ * Description: persisted download progress for resumable ota
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_resume.h"
+
+#include <sdkconfig.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_resume"
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define RESUME_NVS_NAMESPACE    "drv_ota"
+#define RESUME_NVS_KEY          "resume"
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+esp_err_t drv_ota_resume_load(drv_ota_resume_state_t* state)
+{
+    nvs_handle_t nvs;
+    size_t length = sizeof(*state);
+
+    memset(state, 0, sizeof(*state));
+    esp_err_t err = nvs_open(RESUME_NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    err = nvs_get_blob(nvs, RESUME_NVS_KEY, state, &length);
+    nvs_close(nvs);
+    if ((err == ESP_OK) && (length != sizeof(*state)))
+    {
+        /* stored by a build with different layout */
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err != ESP_OK)
+    {
+        memset(state, 0, sizeof(*state));
+        return err;
+    }
+    state->etag[sizeof(state->etag) - 1] = '\0';
+    state->last_modified[sizeof(state->last_modified) - 1] = '\0';
+    return ESP_OK;
+}
+
+esp_err_t drv_ota_resume_save(const drv_ota_resume_state_t* state)
+{
+    nvs_handle_t nvs;
+
+    esp_err_t err = nvs_open(RESUME_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Checkpoint not saved, nvs_open failed (%s)", esp_err_to_name(err));
+        return err;
+    }
+    err = nvs_set_blob(nvs, RESUME_NVS_KEY, state, sizeof(*state));
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Checkpoint not saved (%s)", esp_err_to_name(err));
+    }
+    else
+    {
+        ESP_LOGD(TAG, "Checkpoint at %u bytes", (unsigned int)state->written);
+    }
+    return err;
+}
+
+void drv_ota_resume_clear(void)
+{
+    nvs_handle_t nvs;
+
+    if (nvs_open(RESUME_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK)
+    {
+        if (nvs_erase_key(nvs, RESUME_NVS_KEY) == ESP_OK)
+        {
+            nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+}
@@ -0,0 +1,72 @@
+/* *****************************************************************************
+ * File:   drv_ota_resume.h
+ * Author: DL
+ *
+ * Created on 2024 02 19
+ *
+ * Description: persisted download progress for resumable ota
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define DRV_OTA_RESUME_ETAG_SIZE            64
+#define DRV_OTA_RESUME_LAST_MODIFIED_SIZE   32
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef struct
+{
+    uint32_t partition_address;
+    uint32_t written;           /* image bytes already in the partition */
+    uint32_t image_size;        /* 0 if the server did not send the length */
+    char etag[DRV_OTA_RESUME_ETAG_SIZE];
+    char last_modified[DRV_OTA_RESUME_LAST_MODIFIED_SIZE];
+    uint8_t sha256[32];         /* SHA-256 of the first written bytes */
+}drv_ota_resume_state_t;
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+esp_err_t drv_ota_resume_load(drv_ota_resume_state_t* state);
+esp_err_t drv_ota_resume_save(const drv_ota_resume_state_t* state);
+void drv_ota_resume_clear(void);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
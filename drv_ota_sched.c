@@ -0,0 +1,406 @@
+/* *****************************************************************************
+ * File:   drv_ota_sched.c
+ * Author: DL
+ *
+ * Created on 2024 05 06
+ *
+ * Description: priority, core and duty cycle of the update tasks
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_sched.h"
+
+#include <sdkconfig.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_sched"
+
+/* the image is activated later, the download runs in the background */
+#if CONFIG_DRV_OTA_DEFERRED_ACTIVATION
+#define SCHED_PRIORITY              CONFIG_DRV_OTA_DEFERRED_TASK_PRIORITY
+#elif defined CONFIG_DRV_OTA_TASK_PRIORITY
+#define SCHED_PRIORITY              CONFIG_DRV_OTA_TASK_PRIORITY
+#else
+#define SCHED_PRIORITY              5
+#endif
+
+#ifdef CONFIG_DRV_OTA_SCHED_DUTY_PERCENT
+#define SCHED_DUTY_PERCENT          CONFIG_DRV_OTA_SCHED_DUTY_PERCENT
+#else
+#define SCHED_DUTY_PERCENT          100
+#endif
+
+#ifdef CONFIG_DRV_OTA_RATE_LIMIT_KB_S
+#define SCHED_RATE_LIMIT            (CONFIG_DRV_OTA_RATE_LIMIT_KB_S * 1024)
+#else
+#define SCHED_RATE_LIMIT            0
+#endif
+
+#ifdef CONFIG_DRV_OTA_RATE_BURST_KB
+#define SCHED_RATE_BURST            (CONFIG_DRV_OTA_RATE_BURST_KB * 1024)
+#else
+#define SCHED_RATE_BURST            (8 * 1024)
+#endif
+
+/* the network stack runs where Wi-Fi and lwIP are pinned, core 0 unless moved */
+#if CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU1 || CONFIG_ESP_WIFI_TASK_PINNED_TO_CORE_1 || CONFIG_ESP32_WIFI_TASK_PINNED_TO_CORE_1
+#define SCHED_NETWORK_CORE          1
+#else
+#define SCHED_NETWORK_CORE          0
+#endif
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define SCHED_WINDOW_US             (200 * 1000)
+#define SCHED_PROBE_PERIOD_MS       10
+#define SCHED_PROBE_STACK_SIZE      2048
+#define SCHED_DUTY_STEP             10
+#define SCHED_RATE_GRANT            1024        /* smallest read once limited, fewer and larger reads */
+#define SCHED_US_PER_S              1000000LL
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+static uint32_t sched_duty = SCHED_DUTY_PERCENT;
+static int64_t sched_window_start_us = 0;
+static int64_t sched_window_slept_us = 0;
+static int64_t sched_window_blocked_us = 0;
+static uint32_t sched_window_bytes = 0;
+
+/* token bucket, in bytes times microseconds so that no fraction is lost */
+static volatile uint32_t sched_rate_limit = SCHED_RATE_LIMIT;
+static int64_t sched_tokens = 0;
+static int64_t sched_tokens_us = 0;
+
+#if CONFIG_DRV_OTA_SCHED_ADAPTIVE
+static TaskHandle_t sched_task = NULL;
+static UBaseType_t sched_start_priority = SCHED_PRIORITY;
+static UBaseType_t sched_priority = SCHED_PRIORITY;
+static TaskHandle_t sched_writer = NULL;
+static UBaseType_t sched_writer_priority = 0;
+static uint32_t sched_peak_rate = 0;
+static TaskHandle_t sched_probe_task = NULL;
+static TaskHandle_t sched_probe_stopper = NULL;
+static volatile bool sched_probe_run = false;
+static volatile uint32_t sched_probe_late_us = 0;
+#endif
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+/* bytes per second, 0 for no limit, taken by the next read of a running update */
+void drv_ota_set_rate_limit(uint32_t bytes_per_second)
+{
+    sched_rate_limit = bytes_per_second;
+    ESP_LOGI(TAG, "Rate limit %u KB/s%s", (unsigned int)(bytes_per_second / 1024), (bytes_per_second > 0) ? "" : " (none)");
+}
+
+uint32_t drv_ota_get_rate_limit(void)
+{
+    return sched_rate_limit;
+}
+
+UBaseType_t drv_ota_sched_priority(void)
+{
+    return SCHED_PRIORITY;
+}
+
+/* the task writing the flash is kept away from the network stack */
+BaseType_t drv_ota_sched_core(bool writer)
+{
+    #if CONFIG_FREERTOS_UNICORE
+    return tskNO_AFFINITY;
+    #elif CONFIG_DRV_OTA_TASK_CORE_0
+    return 0;
+    #elif CONFIG_DRV_OTA_TASK_CORE_1
+    return 1;
+    #elif CONFIG_DRV_OTA_TASK_CORE_AWAY_FROM_NETWORK
+    return writer ? (SCHED_NETWORK_CORE ^ 1) : tskNO_AFFINITY;
+    #else
+    return tskNO_AFFINITY;
+    #endif
+}
+
+#if CONFIG_DRV_OTA_SCHED_ADAPTIVE
+/* stands in for the application tasks, how late it wakes is how late they would */
+static void sched_probe_task_func(void* pvParameter)
+{
+    TickType_t wake = xTaskGetTickCount();
+    int64_t last_us = esp_timer_get_time();
+    const int64_t period_us = (int64_t)pdMS_TO_TICKS(SCHED_PROBE_PERIOD_MS) * portTICK_PERIOD_MS * 1000;
+
+    while (sched_probe_run)
+    {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(SCHED_PROBE_PERIOD_MS));
+        int64_t now_us = esp_timer_get_time();
+        int64_t late_us = now_us - last_us - period_us;
+        last_us = now_us;
+        if (late_us > (int64_t)sched_probe_late_us)
+        {
+            sched_probe_late_us = (uint32_t)late_us;
+        }
+    }
+    xTaskNotifyGive(sched_probe_stopper);
+    vTaskDelete(NULL);
+}
+
+/* the writer of a pipelined download drops as many steps as the reader, not below the lowest */
+static void sched_writer_apply(void)
+{
+    int step = (int)sched_start_priority - (int)sched_priority;
+    int priority = (int)sched_writer_priority - ((step > 0) ? step : 0);
+
+    if (priority < CONFIG_DRV_OTA_SCHED_MIN_PRIORITY)
+    {
+        priority = CONFIG_DRV_OTA_SCHED_MIN_PRIORITY;
+    }
+    if (priority > (int)sched_writer_priority)
+    {
+        priority = (int)sched_writer_priority;
+    }
+    vTaskPrioritySet(sched_writer, (UBaseType_t)priority);
+}
+
+/*
+ * Once per window: when the application tasks wake later than the latency
+ * objective the update first drops in priority, at the lowest one it works
+ * less of the time. When they are on time and the update is slower than it
+ * was before, the duty cycle and then the priority go back up.
+ */
+static void sched_adapt(uint32_t rate_kb_s)
+{
+    uint32_t late_ms = sched_probe_late_us / 1000;
+    UBaseType_t priority = sched_priority;
+    uint32_t duty = sched_duty;
+
+    sched_probe_late_us = 0;
+    if (rate_kb_s > sched_peak_rate)
+    {
+        sched_peak_rate = rate_kb_s;
+    }
+    if (late_ms > CONFIG_DRV_OTA_SCHED_LATENCY_SLO_MS)
+    {
+        if (priority > CONFIG_DRV_OTA_SCHED_MIN_PRIORITY)
+        {
+            priority--;
+        }
+        else if (duty > CONFIG_DRV_OTA_SCHED_MIN_DUTY_PERCENT)
+        {
+            duty = (duty > CONFIG_DRV_OTA_SCHED_MIN_DUTY_PERCENT + SCHED_DUTY_STEP) ? duty - SCHED_DUTY_STEP : CONFIG_DRV_OTA_SCHED_MIN_DUTY_PERCENT;
+        }
+    }
+    else if ((late_ms <= CONFIG_DRV_OTA_SCHED_LATENCY_SLO_MS / 2) && (rate_kb_s < sched_peak_rate - sched_peak_rate / 10))
+    {
+        if (duty < SCHED_DUTY_PERCENT)
+        {
+            duty = (duty + SCHED_DUTY_STEP < SCHED_DUTY_PERCENT) ? duty + SCHED_DUTY_STEP : SCHED_DUTY_PERCENT;
+        }
+        else if (priority < SCHED_PRIORITY)
+        {
+            priority++;
+        }
+    }
+    if ((priority != sched_priority) || (duty != sched_duty))
+    {
+        ESP_LOGI(TAG, "Priority %u, duty %u%% (application %u ms late, %u KB/s)", (unsigned int)priority, (unsigned int)duty, (unsigned int)late_ms, (unsigned int)rate_kb_s);
+        if (priority != sched_priority)
+        {
+            vTaskPrioritySet(sched_task, priority);
+            sched_priority = priority;
+            if (sched_writer != NULL)
+            {
+                sched_writer_apply();
+            }
+        }
+        sched_duty = duty;
+    }
+}
+#endif
+
+/* called from the task doing the download, which is the one adapted */
+void drv_ota_sched_start(void)
+{
+    sched_duty = SCHED_DUTY_PERCENT;
+    sched_window_start_us = esp_timer_get_time();
+    sched_window_slept_us = 0;
+    sched_window_blocked_us = 0;
+    sched_window_bytes = 0;
+    sched_tokens = (int64_t)SCHED_RATE_BURST * SCHED_US_PER_S;
+    sched_tokens_us = sched_window_start_us;
+    if (sched_rate_limit > 0)
+    {
+        ESP_LOGI(TAG, "Background download at %u KB/s", (unsigned int)(sched_rate_limit / 1024));
+    }
+
+    #if CONFIG_DRV_OTA_SCHED_ADAPTIVE
+    sched_task = xTaskGetCurrentTaskHandle();
+    sched_priority = uxTaskPriorityGet(NULL);
+    sched_start_priority = sched_priority;
+    sched_peak_rate = 0;
+    sched_probe_late_us = 0;
+    sched_probe_run = true;
+    if (xTaskCreatePinnedToCore(&sched_probe_task_func, "ota_probe", SCHED_PROBE_STACK_SIZE, NULL, CONFIG_DRV_OTA_SCHED_PROBE_PRIORITY,
+                                &sched_probe_task, drv_ota_sched_core(true)) != pdPASS)
+    {
+        ESP_LOGW(TAG, "No latency probe, priority not adapted");
+        sched_probe_run = false;
+        sched_probe_task = NULL;
+    }
+    #endif
+}
+
+/*
+ * Called before each read with the size of the buffer, returns how much of
+ * it may be read. Once the bucket is empty the task sleeps until it holds
+ * enough for a read, the connection stays open and the server is held back
+ * by the tcp window.
+ */
+/*
+ * The flash writer task of a pipelined download, NULL before it is deleted.
+ * Its priority is stepped with the one of the task reading, the duty cycle
+ * of the reader holds it back through the pipeline queue.
+ */
+void drv_ota_sched_register_writer(TaskHandle_t task)
+{
+    #if CONFIG_DRV_OTA_SCHED_ADAPTIVE
+    sched_writer = task;
+    if (task != NULL)
+    {
+        sched_writer_priority = uxTaskPriorityGet(task);
+        sched_writer_apply();
+    }
+    #endif
+}
+
+size_t drv_ota_sched_acquire(size_t wanted)
+{
+    uint32_t rate = sched_rate_limit;
+    int64_t now_us = esp_timer_get_time();
+    const int64_t burst = (int64_t)SCHED_RATE_BURST * SCHED_US_PER_S;
+
+    if (rate == 0)
+    {
+        sched_tokens = burst;
+        sched_tokens_us = now_us;
+        return wanted;
+    }
+
+    size_t grant = (wanted < SCHED_RATE_GRANT) ? wanted : SCHED_RATE_GRANT;
+    while (1)
+    {
+        sched_tokens += (now_us - sched_tokens_us) * rate;
+        sched_tokens_us = now_us;
+        if (sched_tokens > burst)
+        {
+            sched_tokens = burst;
+        }
+        if (sched_tokens >= (int64_t)grant * SCHED_US_PER_S)
+        {
+            break;
+        }
+        int64_t wait_us = ((int64_t)grant * SCHED_US_PER_S - sched_tokens) / rate;
+        TickType_t ticks = (TickType_t)((wait_us + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000));
+        vTaskDelay(ticks);
+        int64_t woken_us = esp_timer_get_time();
+        sched_window_slept_us += woken_us - now_us;
+        now_us = woken_us;
+        rate = sched_rate_limit;
+        if (rate == 0)
+        {
+            return wanted;
+        }
+    }
+
+    int64_t available = sched_tokens / SCHED_US_PER_S;
+    return ((int64_t)wanted < available) ? wanted : (size_t)available;
+}
+
+/*
+ * Called after each chunk with the time spent blocked reading it. Time the
+ * task was not blocked counts against the duty cycle, once it runs ahead the
+ * task sleeps so other tasks of its priority and below get the cpu.
+ */
+void drv_ota_sched_yield(int64_t blocked_us, size_t length)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    sched_window_blocked_us += blocked_us;
+    sched_window_bytes += length;
+    sched_tokens -= (int64_t)length * SCHED_US_PER_S;
+
+    if (sched_duty < 100)
+    {
+        int64_t elapsed_us = now_us - sched_window_start_us;
+        int64_t busy_us = elapsed_us - sched_window_slept_us - sched_window_blocked_us;
+        int64_t sleep_us = busy_us * 100 / sched_duty - elapsed_us;
+        TickType_t ticks = (TickType_t)(sleep_us / (portTICK_PERIOD_MS * 1000));
+        if ((sleep_us > 0) && (ticks > 0))
+        {
+            vTaskDelay(ticks);
+            int64_t woken_us = esp_timer_get_time();
+            sched_window_slept_us += woken_us - now_us;
+            now_us = woken_us;
+        }
+    }
+
+    if (now_us - sched_window_start_us >= SCHED_WINDOW_US)
+    {
+        #if CONFIG_DRV_OTA_SCHED_ADAPTIVE
+        if (sched_probe_task != NULL)
+        {
+            /* bytes per ms is KB/s */
+            sched_adapt((uint32_t)(sched_window_bytes * 1000LL / (now_us - sched_window_start_us)));
+        }
+        #endif
+        sched_window_start_us = now_us;
+        sched_window_slept_us = 0;
+        sched_window_blocked_us = 0;
+        sched_window_bytes = 0;
+    }
+}
+
+void drv_ota_sched_stop(void)
+{
+    #if CONFIG_DRV_OTA_SCHED_ADAPTIVE
+    if (sched_probe_task != NULL)
+    {
+        sched_probe_stopper = xTaskGetCurrentTaskHandle();
+        sched_probe_run = false;
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        sched_probe_task = NULL;
+    }
+    if ((sched_task != NULL) && (sched_task == xTaskGetCurrentTaskHandle()))
+    {
+        vTaskPrioritySet(NULL, SCHED_PRIORITY);
+        sched_priority = SCHED_PRIORITY;
+    }
+    sched_start_priority = sched_priority;
+    sched_task = NULL;
+    sched_writer = NULL;
+    #endif
+}
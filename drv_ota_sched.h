@@ -0,0 +1,71 @@
+/* *****************************************************************************
+ * File:   drv_ota_sched.h
+ * Author: DL
+ *
+ * Created on 2024 05 06
+ *
+ * Description: priority, core and duty cycle of the update tasks
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+void drv_ota_set_rate_limit(uint32_t bytes_per_second);
+uint32_t drv_ota_get_rate_limit(void);
+
+UBaseType_t drv_ota_sched_priority(void);
+BaseType_t drv_ota_sched_core(bool writer);
+void drv_ota_sched_start(void);
+void drv_ota_sched_register_writer(TaskHandle_t task);
+size_t drv_ota_sched_acquire(size_t wanted);
+void drv_ota_sched_yield(int64_t blocked_us, size_t length);
+void drv_ota_sched_stop(void);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
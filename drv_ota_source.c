@@ -0,0 +1,292 @@
+/* *****************************************************************************
+ * File:   drv_ota_source.c
+ * Author: DL
+ *
+ * Created on 2024 06 10
+ *
+ * Description: readers of an image from other places than an http server
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_source.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sdkconfig.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#if CONFIG_DRV_OTA_SOURCE_UART
+#include "driver/uart.h"
+#endif
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_source"
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+#if CONFIG_DRV_OTA_SOURCE_UART
+typedef struct
+{
+    uart_port_t port;
+    bool installed;                 /* driver installed by us, deleted on close */
+    uint32_t baud_restore;          /* rate before baud= changed it, 0 if unchanged */
+    int64_t size;                   /* -1 until a pause ends the image */
+    int64_t received;
+}source_uart_t;
+#endif
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+#if CONFIG_DRV_OTA_SOURCE_FILE
+static esp_err_t source_file_open(const char* path, void** context, int64_t* size);
+static int source_file_read(void* context, char* buffer, size_t size);
+static void source_file_close(void* context);
+#endif
+
+#if CONFIG_DRV_OTA_SOURCE_UART
+static esp_err_t source_uart_open(const char* path, void** context, int64_t* size);
+static int source_uart_read(void* context, char* buffer, size_t size);
+static void source_uart_close(void* context);
+#endif
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+#if CONFIG_DRV_OTA_SOURCE_FILE
+/* file:///spiffs/firmware.bin, any path of the vfs */
+static const drv_ota_source_t source_file =
+{
+    .scheme = "file",
+    .open = source_file_open,
+    .read = source_file_read,
+    .close = source_file_close,
+};
+#endif
+
+#if CONFIG_DRV_OTA_SOURCE_UART
+/* uart://1?baud=921600&size=1048576, baud and size optional */
+static const drv_ota_source_t source_uart =
+{
+    .scheme = "uart",
+    .open = source_uart_open,
+    .read = source_uart_read,
+    .close = source_uart_close,
+};
+static source_uart_t source_uart_context;
+#endif
+
+static const drv_ota_source_t* source_list[DRV_OTA_SOURCE_MAX] =
+{
+    #if CONFIG_DRV_OTA_SOURCE_FILE
+    &source_file,
+    #endif
+    #if CONFIG_DRV_OTA_SOURCE_UART
+    &source_uart,
+    #endif
+};
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+#if CONFIG_DRV_OTA_SOURCE_FILE
+static esp_err_t source_file_open(const char* path, void** context, int64_t* size)
+{
+    FILE* file = fopen(path, "rb");
+
+    if (file == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to open %s (errno %d)", path, errno);
+        return ESP_ERR_NOT_FOUND;
+    }
+    /* reads are of a whole ota buffer, unbuffered they go to the file system without a copy */
+    setvbuf(file, NULL, _IONBF, 0);
+    *size = -1;
+    if (fseek(file, 0, SEEK_END) == 0)
+    {
+        long length = ftell(file);
+        *size = (length >= 0) ? length : -1;
+        fseek(file, 0, SEEK_SET);
+    }
+    *context = file;
+    return ESP_OK;
+}
+
+static int source_file_read(void* context, char* buffer, size_t size)
+{
+    FILE* file = (FILE*)context;
+
+    size_t length = fread(buffer, 1, size, file);
+    if ((length == 0) && ferror(file))
+    {
+        ESP_LOGE(TAG, "File read failed (errno %d)", errno);
+        return -1;
+    }
+    return (int)length;
+}
+
+static void source_file_close(void* context)
+{
+    fclose((FILE*)context);
+}
+#endif
+
+#if CONFIG_DRV_OTA_SOURCE_UART
+static esp_err_t source_uart_open(const char* path, void** context, int64_t* size)
+{
+    source_uart_t* uart = &source_uart_context;
+    char* end = NULL;
+
+    memset(uart, 0, sizeof(*uart));
+    uart->port = (uart_port_t)strtol(path, &end, 10);
+    if ((end == path) || (uart->port < 0) || (uart->port >= UART_NUM_MAX))
+    {
+        ESP_LOGE(TAG, "No uart port in %s", path);
+        return ESP_ERR_INVALID_ARG;
+    }
+    const char* baud = strstr(path, "baud=");
+    const char* length = strstr(path, "size=");
+    uart->size = (length != NULL) ? strtoll(length + 5, NULL, 10) : -1;
+
+    if (uart_is_driver_installed(uart->port) == false)
+    {
+        esp_err_t err = uart_driver_install(uart->port, CONFIG_DRV_OTA_SOURCE_UART_RX_BUFFER_SIZE, 0, 0, NULL, 0);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to install uart %d driver (%s)", uart->port, esp_err_to_name(err));
+            return err;
+        }
+        uart->installed = true;
+    }
+    if (baud != NULL)
+    {
+        /* the port may be the console or one the application configured */
+        uint32_t baud_rate = 0;
+        if (uart_get_baudrate(uart->port, &baud_rate) == ESP_OK)
+        {
+            uart->baud_restore = baud_rate;
+        }
+        uart_set_baudrate(uart->port, (uint32_t)strtoul(baud + 5, NULL, 10));
+    }
+    uart_flush_input(uart->port);
+    ESP_LOGI(TAG, "Waiting for the image on uart %d", uart->port);
+    *size = uart->size;
+    *context = uart;
+    return ESP_OK;
+}
+
+/* without a size the image ends with a pause of the sender */
+static int source_uart_read(void* context, char* buffer, size_t size)
+{
+    source_uart_t* uart = (source_uart_t*)context;
+
+    if ((uart->size >= 0) && (size > (size_t)(uart->size - uart->received)))
+    {
+        size = (size_t)(uart->size - uart->received);
+    }
+    if (size == 0)
+    {
+        return 0;
+    }
+    uint32_t timeout_ms = (uart->received == 0) ? CONFIG_DRV_OTA_SOURCE_UART_START_TIMEOUT_MS : CONFIG_DRV_OTA_SOURCE_UART_IDLE_MS;
+    int length = uart_read_bytes(uart->port, buffer, size, pdMS_TO_TICKS(timeout_ms));
+    if (length < 0)
+    {
+        return -1;
+    }
+    if (length == 0)
+    {
+        if ((uart->received == 0) || (uart->size >= 0))
+        {
+            ESP_LOGE(TAG, "No data on uart %d for %u ms", uart->port, (unsigned int)timeout_ms);
+            return -1;
+        }
+        return 0;
+    }
+    uart->received += length;
+    return length;
+}
+
+static void source_uart_close(void* context)
+{
+    source_uart_t* uart = (source_uart_t*)context;
+
+    if (uart->baud_restore != 0)
+    {
+        uart_set_baudrate(uart->port, uart->baud_restore);
+        uart->baud_restore = 0;
+    }
+    if (uart->installed)
+    {
+        uart_driver_delete(uart->port);
+        uart->installed = false;
+    }
+}
+#endif
+
+esp_err_t drv_ota_source_register(const drv_ota_source_t* source)
+{
+    if ((source == NULL) || (source->scheme == NULL) || (source->open == NULL) || (source->read == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int index = 0; index < DRV_OTA_SOURCE_MAX; index++)
+    {
+        if ((source_list[index] == NULL) || (strcmp(source_list[index]->scheme, source->scheme) == 0))
+        {
+            source_list[index] = source;
+            ESP_LOGI(TAG, "Register source %s://", source->scheme);
+            return ESP_OK;
+        }
+    }
+    ESP_LOGE(TAG, "Cannot register source %s:// (no space left)", source->scheme);
+    return ESP_ERR_NO_MEM;
+}
+
+/* the source for <scheme>://<path>, NULL for http, https and unknown schemes */
+const drv_ota_source_t* drv_ota_source_find(const char* url, const char** path)
+{
+    const char* separator = strstr(url, "://");
+
+    if (separator == NULL)
+    {
+        return NULL;
+    }
+    size_t scheme_length = separator - url;
+    for (int index = 0; index < DRV_OTA_SOURCE_MAX; index++)
+    {
+        const drv_ota_source_t* source = source_list[index];
+        if ((source != NULL) && (strlen(source->scheme) == scheme_length) && (strncmp(source->scheme, url, scheme_length) == 0))
+        {
+            if (path != NULL)
+            {
+                *path = separator + 3;
+            }
+            return source;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,76 @@
+/* *****************************************************************************
+ * File:   drv_ota_source.h
+ * Author: DL
+ *
+ * Created on 2024 06 10
+ *
+ * Description: readers of an image from other places than an http server
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define DRV_OTA_SOURCE_MAX              4
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+/*
+ * An image from <scheme>://<path> instead of http. ota_task reads it to its
+ * end and runs the same checks, writes and verification as for a download.
+ * Only one image is read at a time.
+ */
+typedef struct
+{
+    const char* scheme;
+    /* *size is the image size, -1 if not known before the end */
+    esp_err_t (*open)(const char* path, void** context, int64_t* size);
+    /* bytes read, 0 at the end of the image, negative on an error */
+    int (*read)(void* context, char* buffer, size_t size);
+    void (*close)(void* context);
+}drv_ota_source_t;
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+esp_err_t drv_ota_source_register(const drv_ota_source_t* source);
+const drv_ota_source_t* drv_ota_source_find(const char* url, const char** path);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
@@ -0,0 +1,315 @@
+/* *****************************************************************************
+ * File:   drv_ota_stats.c
+ * Author: DL
+ *
+ * Created on 2024 04 02
+ *
+ * Description: timing counters of the ota download
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_stats.h"
+
+#include <sdkconfig.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_stats"
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define STATS_RATE_WINDOW_US    (1000 * 1000)
+
+/* the stack, tls and buffers of the update come from internal ram */
+#define STATS_HEAP_CAPS         MALLOC_CAP_INTERNAL
+
+#if CONFIG_DRV_OTA_DOWNLOAD_MODE_PIPELINED
+#define STATS_MODE_NAME         "pipelined"
+#elif CONFIG_DRV_OTA_DOWNLOAD_MODE_HTTP_CLIENT
+#define STATS_MODE_NAME         "http client"
+#else
+#define STATS_MODE_NAME         "esp_https_ota"
+#endif
+
+#if CONFIG_DRV_OTA_LOW_MEMORY
+#define STATS_MEMORY_NAME       ", low memory"
+#else
+#define STATS_MEMORY_NAME       ""
+#endif
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+static drv_ota_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int64_t stats_start_us = 0;
+static int64_t stats_first_connect_us = 0;
+static int64_t stats_window_start_us = 0;
+static uint32_t stats_window_bytes = 0;
+static size_t stats_heap_reserved = 0;
+static size_t stats_heap_free_start = 0;
+static size_t stats_heap_min_ever_start = 0;
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static int stats_rate_bucket(uint32_t kb_per_s)
+{
+    int bucket = 0;
+
+    while ((kb_per_s >= 2) && (bucket < DRV_OTA_STATS_RATE_BUCKETS - 1))
+    {
+        kb_per_s >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+/* closes the one second windows passed since the last call */
+static void stats_rate_sample(int64_t now)
+{
+    int64_t elapsed = now - stats_window_start_us;
+
+    if (elapsed < STATS_RATE_WINDOW_US)
+    {
+        return;
+    }
+    uint32_t kb_per_s = (uint32_t)(((uint64_t)stats_window_bytes * 1000000 / elapsed) / 1024);
+    stats.rate_seconds[stats_rate_bucket(kb_per_s)] += (uint32_t)(elapsed / STATS_RATE_WINDOW_US);
+    stats_window_start_us = now;
+    stats_window_bytes = 0;
+}
+
+/* outside the lock, the heap takes its own */
+static void stats_heap_sample(void)
+{
+    uint32_t free_size = (uint32_t)heap_caps_get_free_size(STATS_HEAP_CAPS);
+
+    portENTER_CRITICAL(&stats_lock);
+    if (free_size < stats.heap_free_min)
+    {
+        stats.heap_free_min = free_size;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+/*
+ * Before anything of the update is allocated. The samples miss short peaks
+ * inside a call such as the TLS handshake, a new low of the heap since boot
+ * catches those when the update set it.
+ */
+void drv_ota_stats_prepare(size_t reserved)
+{
+    stats_heap_reserved = reserved;
+    stats_heap_free_start = heap_caps_get_free_size(STATS_HEAP_CAPS);
+    stats_heap_min_ever_start = heap_caps_get_minimum_free_size(STATS_HEAP_CAPS);
+}
+
+void drv_ota_stats_begin(void)
+{
+    uint32_t runs = stats.runs;
+    uint32_t completed = stats.completed;
+
+    portENTER_CRITICAL(&stats_lock);
+    memset(&stats, 0, sizeof(stats));
+    stats.runs = runs + 1;
+    stats.completed = completed;
+    stats.last_error = ESP_ERR_NOT_FINISHED;
+    stats.heap_reserved = (uint32_t)stats_heap_reserved;
+    stats.heap_free_start = (uint32_t)stats_heap_free_start;
+    stats.heap_free_min = (uint32_t)stats_heap_free_start;
+    portEXIT_CRITICAL(&stats_lock);
+    stats_heap_sample();
+
+    stats_start_us = esp_timer_get_time();
+    stats_first_connect_us = 0;
+    stats_window_start_us = stats_start_us;
+    stats_window_bytes = 0;
+}
+
+void drv_ota_stats_end(esp_err_t err)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t min_ever = (uint32_t)heap_caps_get_minimum_free_size(STATS_HEAP_CAPS);
+
+    stats_heap_sample();
+    portENTER_CRITICAL(&stats_lock);
+    if ((min_ever < stats_heap_min_ever_start) && (min_ever < stats.heap_free_min))
+    {
+        stats.heap_free_min = min_ever;
+    }
+    stats.heap_peak = (stats.heap_free_start > stats.heap_free_min) ? stats.heap_free_start - stats.heap_free_min : 0;
+    stats_rate_sample(now);
+    stats.last_error = err;
+    stats.total_us = now - stats_start_us;
+    if (err == ESP_OK)
+    {
+        stats.completed++;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+/* returns the start time to pass to drv_ota_stats_connect_done() */
+int64_t drv_ota_stats_connect_start(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&stats_lock);
+    if (stats_first_connect_us == 0)
+    {
+        stats_first_connect_us = now;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+    return now;
+}
+
+void drv_ota_stats_connect_done(int64_t start_us)
+{
+    int64_t elapsed = esp_timer_get_time() - start_us;
+
+    portENTER_CRITICAL(&stats_lock);
+    stats.connect_us += elapsed;
+    stats.connections++;
+    portEXIT_CRITICAL(&stats_lock);
+    stats_heap_sample();
+}
+
+/* length as returned by the read, negative for an error */
+void drv_ota_stats_read(int64_t start_us, int length)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed = now - start_us;
+
+    portENTER_CRITICAL(&stats_lock);
+    stats.read_us += elapsed;
+    if ((elapsed >= (int64_t)CONFIG_DRV_OTA_STATS_STALL_MS * 1000) || (length < 0))
+    {
+        stats.stalls++;
+    }
+    if (length > 0)
+    {
+        if (stats.bytes_received == 0)
+        {
+            stats.first_byte_us = now - stats_first_connect_us;
+        }
+        stats.bytes_received += length;
+        stats_window_bytes += length;
+    }
+    stats_rate_sample(now);
+    portEXIT_CRITICAL(&stats_lock);
+    stats_heap_sample();
+}
+
+void drv_ota_stats_write(int64_t start_us, size_t length)
+{
+    int64_t elapsed = esp_timer_get_time() - start_us;
+
+    portENTER_CRITICAL(&stats_lock);
+    stats.write_us += elapsed;
+    stats.bytes_written += length;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void drv_ota_stats_retry(void)
+{
+    portENTER_CRITICAL(&stats_lock);
+    stats.retries++;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void drv_ota_stats_finish(int64_t start_us)
+{
+    int64_t elapsed = esp_timer_get_time() - start_us;
+
+    portENTER_CRITICAL(&stats_lock);
+    stats.finish_us += elapsed;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void drv_ota_get_stats(drv_ota_stats_t* out)
+{
+    portENTER_CRITICAL(&stats_lock);
+    memcpy(out, &stats, sizeof(*out));
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void drv_ota_reset_stats(void)
+{
+    portENTER_CRITICAL(&stats_lock);
+    memset(&stats, 0, sizeof(stats));
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void drv_ota_print_stats(void)
+{
+    drv_ota_stats_t snapshot;
+
+    drv_ota_get_stats(&snapshot);
+    uint32_t read_ms = (uint32_t)(snapshot.read_us / 1000);
+    uint32_t write_ms = (uint32_t)(snapshot.write_us / 1000);
+
+    printf("Runs: %u (%u completed), last result %s\n", (unsigned int)snapshot.runs, (unsigned int)snapshot.completed, esp_err_to_name(snapshot.last_error));
+    printf("Total: %u ms\n", (unsigned int)(snapshot.total_us / 1000));
+    printf("Connect incl. TLS handshake: %u ms in %u connections\n", (unsigned int)(snapshot.connect_us / 1000), (unsigned int)snapshot.connections);
+    printf("Time to first byte: %u ms\n", (unsigned int)(snapshot.first_byte_us / 1000));
+    printf("Socket read: %u ms for %llu bytes\n", (unsigned int)read_ms, (unsigned long long)snapshot.bytes_received);
+    printf("Flash write: %u ms for %llu bytes\n", (unsigned int)write_ms, (unsigned long long)snapshot.bytes_written);
+    printf("Finish: %u ms\n", (unsigned int)(snapshot.finish_us / 1000));
+    printf("Retries: %u, stalls: %u\n", (unsigned int)snapshot.retries, (unsigned int)snapshot.stalls);
+    printf("Heap (%s%s): %u bytes at peak, %u of %u free at least, %u reserved\n", STATS_MODE_NAME, STATS_MEMORY_NAME,
+           (unsigned int)snapshot.heap_peak, (unsigned int)snapshot.heap_free_min, (unsigned int)snapshot.heap_free_start,
+           (unsigned int)snapshot.heap_reserved);
+    printf("Rate histogram (seconds):\n");
+    for (int bucket = 0; bucket < DRV_OTA_STATS_RATE_BUCKETS; bucket++)
+    {
+        if (snapshot.rate_seconds[bucket] == 0)
+        {
+            continue;
+        }
+        if (bucket == 0)
+        {
+            printf("  < 2 KB/s: %u\n", (unsigned int)snapshot.rate_seconds[bucket]);
+        }
+        else if (bucket == DRV_OTA_STATS_RATE_BUCKETS - 1)
+        {
+            printf("  >= %u KB/s: %u\n", 1u << bucket, (unsigned int)snapshot.rate_seconds[bucket]);
+        }
+        else
+        {
+            printf("  %u-%u KB/s: %u\n", 1u << bucket, 2u << bucket, (unsigned int)snapshot.rate_seconds[bucket]);
+        }
+    }
+    if ((read_ms > 0) || (write_ms > 0))
+    {
+        printf("Bound by: %s\n", (write_ms > read_ms) ? "flash" : "network");
+    }
+}
@@ -0,0 +1,104 @@
+/* *****************************************************************************
+ * File:   drv_ota_stats.h
+ * Author: DL
+ *
+ * Created on 2024 04 02
+ *
+ * Description: timing counters of the ota download
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+/* bucket 0 below 2 KB/s, bucket n from 2^n KB/s, the last one open ended */
+#define DRV_OTA_STATS_RATE_BUCKETS  11
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+/*
+ * All but runs and completed describe the last (or running) download. Read
+ * and write time is counted in us around each call, both block and may end
+ * on another core. With CONFIG_DRV_OTA_DOWNLOAD_MODE_HTTPS_OTA the socket
+ * read and flash write happen together in esp_https_ota_perform(), which
+ * counts as read time then.
+ */
+typedef struct
+{
+    uint32_t runs;                  /* downloads started since boot */
+    uint32_t completed;             /* downloads which set the boot partition */
+    esp_err_t last_error;
+    uint32_t connections;
+    uint32_t retries;               /* reconnects after a read error or a closed connection */
+    uint32_t stalls;                /* reads blocked longer than CONFIG_DRV_OTA_STATS_STALL_MS */
+    int64_t connect_us;             /* connect incl. TLS handshake, all connections */
+    int64_t first_byte_us;          /* start of the first connect to the first image byte */
+    int64_t finish_us;              /* esp_ota_end() and esp_ota_set_boot_partition() */
+    int64_t total_us;
+    int64_t read_us;                /* blocked in reading the socket */
+    int64_t write_us;               /* writing the update partition */
+    uint64_t bytes_received;
+    uint64_t bytes_written;
+    uint32_t rate_seconds[DRV_OTA_STATS_RATE_BUCKETS];  /* seconds of download spent at each rate */
+    uint32_t heap_reserved;         /* kept by drv_ota between updates, not in heap_peak */
+    uint32_t heap_free_start;       /* free internal heap as drv_ota_create_task() was called */
+    uint32_t heap_free_min;         /* least free internal heap seen during the update */
+    uint32_t heap_peak;             /* heap_free_start - heap_free_min */
+}drv_ota_stats_t;
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+void drv_ota_stats_prepare(size_t reserved);
+void drv_ota_stats_begin(void);
+void drv_ota_stats_end(esp_err_t err);
+int64_t drv_ota_stats_connect_start(void);
+void drv_ota_stats_connect_done(int64_t start_us);
+void drv_ota_stats_read(int64_t start_us, int length);
+void drv_ota_stats_write(int64_t start_us, size_t length);
+void drv_ota_stats_retry(void);
+void drv_ota_stats_finish(int64_t start_us);
+
+void drv_ota_get_stats(drv_ota_stats_t* stats);
+void drv_ota_reset_stats(void);
+void drv_ota_print_stats(void);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
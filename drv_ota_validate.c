@@ -0,0 +1,328 @@
+/* *****************************************************************************
+ * File:   drv_ota_validate.c
+ * Author: DL
+ *
+ * Created on 2024 06 24
+ *
+ * Description: health checks of a new image on its first boot
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_validate.h"
+
+#include <sdkconfig.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_idf_version.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#if CONFIG_DRV_OTA_PREERASE_AUTOSTART
+#include "drv_ota_preerase.h"
+#endif
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_validate"
+
+#ifdef CONFIG_DRV_OTA_VALIDATE_TIMEOUT_MS
+#define VALIDATE_TIMEOUT_MS         CONFIG_DRV_OTA_VALIDATE_TIMEOUT_MS
+#else
+#define VALIDATE_TIMEOUT_MS         30000
+#endif
+
+#ifdef CONFIG_DRV_OTA_VALIDATE_STACK_SIZE
+#define VALIDATE_STACK_SIZE         CONFIG_DRV_OTA_VALIDATE_STACK_SIZE
+#else
+#define VALIDATE_STACK_SIZE         4096
+#endif
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define VALIDATE_NVS_NAMESPACE      "drv_ota"
+#define VALIDATE_NVS_KEY            "validate"
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef struct
+{
+    char name[DRV_OTA_VALIDATE_NAME_SIZE];
+    drv_ota_validate_func_t func;
+}validate_check_t;
+
+typedef struct
+{
+    int index;
+    esp_err_t err;
+    int64_t elapsed_us;
+}validate_done_t;
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+static validate_check_t validate_checks[DRV_OTA_VALIDATE_MAX_CHECKS];
+static int validate_check_count = 0;
+static QueueHandle_t validate_done_queue = NULL;
+static TaskHandle_t validate_task = NULL;
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static void validate_record_save(const drv_ota_validate_record_t* record)
+{
+    nvs_handle_t nvs;
+
+    esp_err_t err = nvs_open(VALIDATE_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_blob(nvs, VALIDATE_NVS_KEY, record, sizeof(*record));
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Result not saved (%s)", esp_err_to_name(err));
+    }
+}
+
+static void validate_worker_task(void* pvParameter)
+{
+    int index = (int)(intptr_t)pvParameter;
+    validate_done_t done = { .index = index };
+
+    int64_t start_us = esp_timer_get_time();
+    done.err = validate_checks[index].func();
+    done.elapsed_us = esp_timer_get_time() - start_us;
+    xQueueSend(validate_done_queue, &done, 0);
+    vTaskDelete(NULL);
+}
+
+/*
+ * All checks run at once, the first one failing decides without waiting for
+ * the others. A check still running at the deadline is left to itself, the
+ * rollback restarts the device anyway.
+ */
+static void validate_task_func(void* pvParameter)
+{
+    drv_ota_validate_record_t record = { .result = DRV_OTA_VALIDATE_CONFIRMED, .check_count = validate_check_count };
+    bool passed[DRV_OTA_VALIDATE_MAX_CHECKS] = { false };
+    int passed_count = 0;
+    validate_done_t done;
+
+    #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5,0,0)
+    strlcpy(record.version, esp_app_get_description()->version, sizeof(record.version));
+    #else
+    strlcpy(record.version, esp_ota_get_app_description()->version, sizeof(record.version));
+    #endif
+    int64_t start_us = esp_timer_get_time();
+    int64_t deadline_us = start_us + (int64_t)VALIDATE_TIMEOUT_MS * 1000;
+    for (int index = 0; index < validate_check_count; index++)
+    {
+        if (xTaskCreate(&validate_worker_task, "ota_check", VALIDATE_STACK_SIZE, (void*)(intptr_t)index, uxTaskPriorityGet(NULL), NULL) != pdPASS)
+        {
+            /* no memory for a worker, this one runs here */
+            done.index = index;
+            done.err = validate_checks[index].func();
+            done.elapsed_us = 0;
+            xQueueSend(validate_done_queue, &done, 0);
+        }
+    }
+    while (passed_count < validate_check_count)
+    {
+        int64_t now_us = esp_timer_get_time();
+        TickType_t ticks = (now_us < deadline_us) ? pdMS_TO_TICKS((deadline_us - now_us + 999) / 1000) : 0;
+        if ((ticks == 0) || (xQueueReceive(validate_done_queue, &done, ticks) != pdTRUE))
+        {
+            int index = 0;
+            while (passed[index])
+            {
+                index++;
+            }
+            record.result = DRV_OTA_VALIDATE_TIMEOUT;
+            record.error = ESP_ERR_TIMEOUT;
+            strlcpy(record.check, validate_checks[index].name, sizeof(record.check));
+            break;
+        }
+        if (done.err != ESP_OK)
+        {
+            record.result = DRV_OTA_VALIDATE_FAILED;
+            record.error = done.err;
+            strlcpy(record.check, validate_checks[done.index].name, sizeof(record.check));
+            break;
+        }
+        ESP_LOGI(TAG, "Check %s passed in %lld ms", validate_checks[done.index].name, (long long)(done.elapsed_us / 1000));
+        passed[done.index] = true;
+        passed_count++;
+    }
+    int64_t now_us = esp_timer_get_time();
+    record.boot_to_healthy_ms = (uint32_t)(now_us / 1000);
+    record.checks_ms = (uint32_t)((now_us - start_us) / 1000);
+    validate_record_save(&record);
+
+    if (record.result == DRV_OTA_VALIDATE_CONFIRMED)
+    {
+        esp_err_t err = esp_ota_mark_app_valid_cancel_rollback();
+        ESP_LOGI(TAG, "Image %s confirmed %u ms after boot, %d checks in %u ms (%s)", record.version, (unsigned int)record.boot_to_healthy_ms,
+                 validate_check_count, (unsigned int)record.checks_ms, esp_err_to_name(err));
+        #if CONFIG_DRV_OTA_PREERASE_AUTOSTART
+        /* the partition of the old image is no longer needed for a rollback */
+        drv_ota_preerase_start();
+        #endif
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Image %s %s in check %s (%s) %u ms after boot, rolling back", record.version, drv_ota_validate_result_name(record.result),
+                 record.check, esp_err_to_name(record.error), (unsigned int)record.boot_to_healthy_ms);
+        esp_err_t err = esp_ota_mark_app_invalid_rollback_and_reboot();
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Rollback failed (%s)", esp_err_to_name(err));
+        }
+    }
+    validate_task = NULL;
+    vTaskDelete(NULL);
+}
+
+/* before drv_ota_validate_start(), with CONFIG_DRV_OTA_VALIDATE_AUTOSTART before drv_ota_init() */
+esp_err_t drv_ota_validate_register(const char* name, drv_ota_validate_func_t func)
+{
+    if ((name == NULL) || (func == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((validate_check_count >= DRV_OTA_VALIDATE_MAX_CHECKS) || (validate_task != NULL))
+    {
+        ESP_LOGE(TAG, "Cannot register check %s", name);
+        return (validate_task != NULL) ? ESP_ERR_INVALID_STATE : ESP_ERR_NO_MEM;
+    }
+    strlcpy(validate_checks[validate_check_count].name, name, sizeof(validate_checks[0].name));
+    validate_checks[validate_check_count].func = func;
+    validate_check_count++;
+    return ESP_OK;
+}
+
+/* runs the checks in the background if the running image waits to be confirmed */
+esp_err_t drv_ota_validate_start(void)
+{
+    if (validate_task != NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (drv_ota_validate_pending() == false)
+    {
+        ESP_LOGD(TAG, "Running image confirmed before, nothing to check");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (validate_done_queue == NULL)
+    {
+        validate_done_queue = xQueueCreate(DRV_OTA_VALIDATE_MAX_CHECKS, sizeof(validate_done_t));
+        if (validate_done_queue == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    ESP_LOGI(TAG, "New image, %d checks within %u ms", validate_check_count, (unsigned int)VALIDATE_TIMEOUT_MS);
+    if (xTaskCreate(&validate_task_func, "ota_validate", VALIDATE_STACK_SIZE, NULL, uxTaskPriorityGet(NULL), &validate_task) != pdPASS)
+    {
+        validate_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+bool drv_ota_validate_pending(void)
+{
+    esp_ota_img_states_t state;
+
+    return (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK) && (state == ESP_OTA_IMG_PENDING_VERIFY);
+}
+
+esp_err_t drv_ota_validate_get_record(drv_ota_validate_record_t* record)
+{
+    nvs_handle_t nvs;
+    size_t length = sizeof(*record);
+
+    memset(record, 0, sizeof(*record));
+    esp_err_t err = nvs_open(VALIDATE_NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err == ESP_OK)
+    {
+        err = nvs_get_blob(nvs, VALIDATE_NVS_KEY, record, &length);
+        nvs_close(nvs);
+    }
+    if ((err == ESP_OK) && (length != sizeof(*record)))
+    {
+        /* stored by a build with different layout */
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err != ESP_OK)
+    {
+        memset(record, 0, sizeof(*record));
+        return err;
+    }
+    record->version[sizeof(record->version) - 1] = '\0';
+    record->check[sizeof(record->check) - 1] = '\0';
+    return ESP_OK;
+}
+
+void drv_ota_validate_print(void)
+{
+    drv_ota_validate_record_t record;
+
+    if (drv_ota_validate_get_record(&record) != ESP_OK)
+    {
+        printf("Validation: no image validated\n");
+        return;
+    }
+    printf("Validation of %s: %s %u ms after boot, %u checks in %u ms", record.version, drv_ota_validate_result_name(record.result),
+           (unsigned int)record.boot_to_healthy_ms, (unsigned int)record.check_count, (unsigned int)record.checks_ms);
+    if (record.result != DRV_OTA_VALIDATE_CONFIRMED)
+    {
+        printf(", check %s (%s)", record.check, esp_err_to_name(record.error));
+    }
+    printf("\n");
+}
+
+const char* drv_ota_validate_result_name(drv_ota_validate_result_t result)
+{
+    switch (result)
+    {
+    case DRV_OTA_VALIDATE_NONE:
+        return "none";
+    case DRV_OTA_VALIDATE_CONFIRMED:
+        return "confirmed";
+    case DRV_OTA_VALIDATE_FAILED:
+        return "failed";
+    case DRV_OTA_VALIDATE_TIMEOUT:
+        return "timed out";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,88 @@
+/* *****************************************************************************
+ * File:   drv_ota_validate.h
+ * Author: DL
+ *
+ * Created on 2024 06 24
+ *
+ * Description: health checks of a new image on its first boot
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define DRV_OTA_VALIDATE_MAX_CHECKS     8
+#define DRV_OTA_VALIDATE_NAME_SIZE      16
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+typedef enum
+{
+    DRV_OTA_VALIDATE_NONE,          /* no image validated yet */
+    DRV_OTA_VALIDATE_CONFIRMED,     /* all checks passed, the image is marked valid */
+    DRV_OTA_VALIDATE_FAILED,        /* a check failed, rolled back */
+    DRV_OTA_VALIDATE_TIMEOUT,       /* a check did not return by the deadline, rolled back */
+}drv_ota_validate_result_t;
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+/* ESP_OK once the part of the firmware it checks works, it may block until then */
+typedef esp_err_t (*drv_ota_validate_func_t)(void);
+
+/* kept in nvs, after a rollback the old image reads why the new one was rejected */
+typedef struct
+{
+    drv_ota_validate_result_t result;
+    char version[32];               /* of the image validated */
+    char check[DRV_OTA_VALIDATE_NAME_SIZE];  /* failed or timed out, empty when confirmed */
+    esp_err_t error;                /* returned by that check */
+    uint32_t boot_to_healthy_ms;    /* boot to the image marked valid or rolled back */
+    uint32_t checks_ms;             /* start of the checks to the decision */
+    uint32_t check_count;
+}drv_ota_validate_record_t;
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+esp_err_t drv_ota_validate_register(const char* name, drv_ota_validate_func_t func);
+esp_err_t drv_ota_validate_start(void);
+bool drv_ota_validate_pending(void);
+esp_err_t drv_ota_validate_get_record(drv_ota_validate_record_t* record);
+void drv_ota_validate_print(void);
+const char* drv_ota_validate_result_name(drv_ota_validate_result_t result);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
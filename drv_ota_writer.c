@@ -0,0 +1,367 @@
+/* *****************************************************************************
+ * File:   drv_ota_writer.c
+ * Author: DL
+ *
+ * Created on 2024 02 19
+ *
+ * Description: offset based image writer with own sector erase and digest
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "drv_ota_writer.h"
+
+#include <sdkconfig.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "drv_ota_preerase.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "drv_ota_writer"
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define WRITER_READ_BUFFSIZE    DRV_OTA_WRITER_SECTOR_SIZE
+#define WRITER_COMPARE_CHUNK    256
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+#define SECTOR_ALIGN_UP(x)      (((x) + DRV_OTA_WRITER_SECTOR_SIZE - 1) & ~(DRV_OTA_WRITER_SECTOR_SIZE - 1))
+#define SECTOR_ALIGN_DOWN(x)    ((x) & ~(DRV_OTA_WRITER_SECTOR_SIZE - 1))
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static esp_err_t writer_hash_partition(drv_ota_writer_t* writer, size_t size)
+{
+    uint8_t* buffer = malloc(WRITER_READ_BUFFSIZE);
+    if (buffer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = ESP_OK;
+    for (size_t offset = 0; offset < size; offset += WRITER_READ_BUFFSIZE)
+    {
+        size_t length = size - offset;
+        if (length > WRITER_READ_BUFFSIZE)
+        {
+            length = WRITER_READ_BUFFSIZE;
+        }
+        err = esp_partition_read(writer->partition, offset, buffer, length);
+        if (err != ESP_OK)
+        {
+            break;
+        }
+        mbedtls_sha256_update(&writer->sha, buffer, length);
+    }
+    free(buffer);
+    return err;
+}
+
+/* the first length bytes of the current sector against what the flash holds */
+static bool writer_sector_unchanged(drv_ota_writer_t* writer, size_t length)
+{
+    uint8_t chunk[WRITER_COMPARE_CHUNK];
+
+    for (size_t position = 0; position < length; position += sizeof(chunk))
+    {
+        size_t compare_length = length - position;
+        if (compare_length > sizeof(chunk))
+        {
+            compare_length = sizeof(chunk);
+        }
+        if ((esp_partition_read(writer->partition, writer->sector_start + position, chunk, compare_length) != ESP_OK) ||
+            (memcmp(chunk, &writer->sector[position], compare_length) != 0))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Puts the first length bytes of the current sector in flash. Until they
+ * differ from the flash the sector is neither erased nor programmed, after
+ * that only the bytes not written yet are programmed.
+ */
+static esp_err_t writer_commit_sector(drv_ota_writer_t* writer, size_t length)
+{
+    if (writer->sector_erased == false)
+    {
+        if (writer_sector_unchanged(writer, length))
+        {
+            if (length == DRV_OTA_WRITER_SECTOR_SIZE)
+            {
+                writer->sectors_skipped++;
+            }
+            return ESP_OK;
+        }
+        esp_err_t err = esp_partition_erase_range(writer->partition, writer->sector_start, DRV_OTA_WRITER_SECTOR_SIZE);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Erase at 0x%x failed (%s)", (unsigned int)writer->sector_start, esp_err_to_name(err));
+            return err;
+        }
+        writer->sector_erased = true;
+        writer->sector_written = 0;
+    }
+    if (length > writer->sector_written)
+    {
+        esp_err_t err = esp_ota_write_with_offset(writer->handle, &writer->sector[writer->sector_written], length - writer->sector_written, writer->sector_start + writer->sector_written);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Write at 0x%x failed (%s)", (unsigned int)(writer->sector_start + writer->sector_written), esp_err_to_name(err));
+            return err;
+        }
+        writer->sector_written = length;
+    }
+    if (length == DRV_OTA_WRITER_SECTOR_SIZE)
+    {
+        writer->sectors_programmed++;
+    }
+    return ESP_OK;
+}
+
+/* erased ahead by drv_ota_preerase if it holds the sectors from erased_end on */
+static esp_err_t writer_erase_to(drv_ota_writer_t* writer, size_t write_end)
+{
+    #if CONFIG_DRV_OTA_PREERASE
+    esp_err_t err = drv_ota_preerase_extend(writer->partition, writer->erased_end, write_end, &writer->erased_end);
+    if (err != ESP_ERR_NOT_FOUND)
+    {
+        return err;
+    }
+    #endif
+    size_t erase_size = SECTOR_ALIGN_UP(write_end) - writer->erased_end;
+    esp_err_t erase_err = esp_partition_erase_range(writer->partition, writer->erased_end, erase_size);
+    if (erase_err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Erase at 0x%x failed (%s)", (unsigned int)writer->erased_end, esp_err_to_name(erase_err));
+        return erase_err;
+    }
+    writer->erased_end += erase_size;
+    return ESP_OK;
+}
+
+static esp_err_t writer_write_unchanged(drv_ota_writer_t* writer, const uint8_t* data, size_t size)
+{
+    size_t position = writer->offset;
+
+    while (size > 0)
+    {
+        size_t in_sector = position - writer->sector_start;
+        size_t length = DRV_OTA_WRITER_SECTOR_SIZE - in_sector;
+        if (length > size)
+        {
+            length = size;
+        }
+        memcpy(&writer->sector[in_sector], data, length);
+        position += length;
+        data += length;
+        size -= length;
+        if (position - writer->sector_start == DRV_OTA_WRITER_SECTOR_SIZE)
+        {
+            esp_err_t err = writer_commit_sector(writer, DRV_OTA_WRITER_SECTOR_SIZE);
+            if (err != ESP_OK)
+            {
+                return err;
+            }
+            writer->sector_start += DRV_OTA_WRITER_SECTOR_SIZE;
+            writer->sector_written = 0;
+            writer->sector_erased = false;
+        }
+    }
+    return ESP_OK;
+}
+
+/*
+ * Starts writing the image at offset. The flash before offset is kept as is
+ * and only hashed, so the digest always covers the image from its first byte.
+ * esp_ota_begin() is called with OTA_WITH_SEQUENTIAL_WRITES so it erases
+ * nothing, the sectors are erased here just ahead of each write. With
+ * skip_unchanged each sector is collected first and only erased and
+ * programmed if it differs from what the partition already holds.
+ */
+esp_err_t drv_ota_writer_begin(drv_ota_writer_t* writer, const esp_partition_t* partition, size_t offset, bool skip_unchanged)
+{
+    memset(writer, 0, sizeof(*writer));
+
+    if ((partition == NULL) || (offset > partition->size))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &writer->handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "esp_ota_begin failed (%s)", esp_err_to_name(err));
+        writer->handle = 0;
+        return err;
+    }
+
+    writer->partition = partition;
+    writer->offset = offset;
+    /* the sector holding offset was erased before the bytes in front of offset were written */
+    writer->erased_end = SECTOR_ALIGN_UP(offset);
+    #if CONFIG_DRV_OTA_PREERASE
+    size_t preerased_start;
+    size_t preerased_end;
+    drv_ota_preerase_take(partition, &preerased_start, &preerased_end);
+    if ((preerased_start <= writer->erased_end) && (preerased_end > writer->erased_end))
+    {
+        writer->erased_end = preerased_end;
+    }
+    #endif
+
+    mbedtls_sha256_init(&writer->sha);
+    mbedtls_sha256_starts(&writer->sha, 0);
+    writer->sha_active = true;
+
+    if (offset > 0)
+    {
+        err = writer_hash_partition(writer, offset);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to hash %u written bytes (%s)", (unsigned int)offset, esp_err_to_name(err));
+            drv_ota_writer_release(writer);
+            return err;
+        }
+    }
+
+    if (skip_unchanged)
+    {
+        writer->sector = malloc(DRV_OTA_WRITER_SECTOR_SIZE);
+        if (writer->sector == NULL)
+        {
+            drv_ota_writer_release(writer);
+            return ESP_ERR_NO_MEM;
+        }
+        /* the rest of the sector holding offset may not be erased, so it is collected from its start */
+        writer->sector_start = SECTOR_ALIGN_DOWN(offset);
+        if (offset > writer->sector_start)
+        {
+            err = esp_partition_read(partition, writer->sector_start, writer->sector, offset - writer->sector_start);
+            if (err != ESP_OK)
+            {
+                drv_ota_writer_release(writer);
+                return err;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t drv_ota_writer_write(drv_ota_writer_t* writer, const void* data, size_t size)
+{
+    if (writer->handle == 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (writer->offset + size > writer->partition->size)
+    {
+        ESP_LOGE(TAG, "Image does not fit in partition (%u bytes)", (unsigned int)writer->partition->size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    size_t write_end = writer->offset + size;
+    if (writer->sector != NULL)
+    {
+        esp_err_t err = writer_write_unchanged(writer, data, size);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        mbedtls_sha256_update(&writer->sha, data, size);
+        writer->offset = write_end;
+        return ESP_OK;
+    }
+    if (write_end > writer->erased_end)
+    {
+        esp_err_t err = writer_erase_to(writer, write_end);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+    }
+
+    esp_err_t err = esp_ota_write_with_offset(writer->handle, data, size, writer->offset);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Write at 0x%x failed (%s)", (unsigned int)writer->offset, esp_err_to_name(err));
+        return err;
+    }
+    mbedtls_sha256_update(&writer->sha, data, size);
+    writer->offset = write_end;
+    return ESP_OK;
+}
+
+/* puts a partly collected sector in flash, before a checkpoint or at the end of the image */
+esp_err_t drv_ota_writer_flush(drv_ota_writer_t* writer)
+{
+    if ((writer->handle == 0) || (writer->sector == NULL) || (writer->offset == writer->sector_start))
+    {
+        return ESP_OK;
+    }
+    return writer_commit_sector(writer, writer->offset - writer->sector_start);
+}
+
+/* digest of everything written so far, the running digest keeps going */
+void drv_ota_writer_get_sha256(drv_ota_writer_t* writer, uint8_t* sha_256)
+{
+    mbedtls_sha256_context sha;
+
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_clone(&sha, &writer->sha);
+    mbedtls_sha256_finish(&sha, sha_256);
+    mbedtls_sha256_free(&sha);
+}
+
+/*
+ * Frees the ota handle without touching the written flash. esp_ota_end() can
+ * not be used as esp_ota_write_with_offset() does not count written bytes,
+ * esp_ota_set_boot_partition() validates the image instead.
+ */
+void drv_ota_writer_release(drv_ota_writer_t* writer)
+{
+    if (writer->handle != 0)
+    {
+        esp_ota_abort(writer->handle);
+        writer->handle = 0;
+    }
+    if (writer->sha_active)
+    {
+        mbedtls_sha256_free(&writer->sha);
+        writer->sha_active = false;
+    }
+    free(writer->sector);
+    writer->sector = NULL;
+    #if CONFIG_DRV_OTA_PREERASE
+    drv_ota_preerase_stop();
+    #endif
+}
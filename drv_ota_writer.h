@@ -0,0 +1,85 @@
+/* *****************************************************************************
+ * File:   drv_ota_writer.h
+ * Author: DL
+ *
+ * Created on 2024 02 19
+ *
+ * Description: offset based image writer with own sector erase and digest
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "mbedtls/sha256.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define DRV_OTA_WRITER_SECTOR_SIZE  4096
+#define DRV_OTA_WRITER_HASH_LEN     32
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef struct
+{
+    const esp_partition_t* partition;
+    esp_ota_handle_t handle;
+    size_t offset;                  /* image bytes written so far */
+    size_t erased_end;              /* partition is erased from offset up to here */
+    bool sha_active;
+    mbedtls_sha256_context sha;     /* digest of image bytes [0, offset) */
+    uint8_t* sector;                /* skip unchanged: image bytes of the sector holding offset, NULL otherwise */
+    size_t sector_start;
+    size_t sector_written;          /* bytes of the sector in flash since it was erased */
+    bool sector_erased;
+    uint32_t sectors_skipped;
+    uint32_t sectors_programmed;
+}drv_ota_writer_t;
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+esp_err_t drv_ota_writer_begin(drv_ota_writer_t* writer, const esp_partition_t* partition, size_t offset, bool skip_unchanged);
+esp_err_t drv_ota_writer_write(drv_ota_writer_t* writer, const void* data, size_t size);
+esp_err_t drv_ota_writer_flush(drv_ota_writer_t* writer);
+void drv_ota_writer_get_sha256(drv_ota_writer_t* writer, uint8_t* sha_256);
+void drv_ota_writer_release(drv_ota_writer_t* writer);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
@@ -0,0 +1,130 @@
+/* *****************************************************************************
+ * File:   bench.h
+ * Author: DL
+ *
+ * Created on 2024 03 25
+ *
+ * Description: ota host bench, shared state of the esp-idf stand-ins
+ *
+ **************************************************************************** */
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define BENCH_SECTOR_SIZE       4096
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+/* filled in by the stand-ins while ota_task runs, times in us */
+typedef struct
+{
+    int64_t start;              /* drv_ota_create_task() called */
+    int64_t end;                /* ota_task gone */
+    int64_t first_byte;         /* first body byte returned by esp_http_client_read() */
+    int64_t begin_done;         /* esp_ota_begin() returned */
+    int64_t connect_us;         /* esp_http_client_open() and fetch_headers() */
+    int64_t read_us;            /* esp_http_client_read() */
+    int64_t flash_us;           /* erase and program of the update partition */
+    int64_t finish_us;          /* esp_ota_end() and esp_ota_set_boot_partition() */
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t bytes_erased;
+    uint32_t connections;
+    uint32_t resumed;           /* connections with the TLS session of an earlier one */
+    uint32_t requests;
+    uint32_t image_requests;    /* image bodies the loopback server sent */
+    uint32_t first_offset;      /* where the first of them started, from its Range header */
+    bool restarted;             /* esp_restart() reached */
+}bench_stats_t;
+
+typedef struct
+{
+    uint32_t erase_us;          /* per 4 KB sector */
+    uint32_t write_us;          /* per KB programmed */
+    uint32_t read_us;           /* per KB read */
+}bench_flash_timing_t;
+
+typedef struct
+{
+    const uint8_t* data;
+    size_t size;
+    const char* content_encoding;
+    uint32_t rate_kb_s;         /* KB/s, 0 for unlimited */
+    uint32_t latency_ms;        /* before each response */
+    uint32_t drop_after;        /* close the connection once after this many body bytes, 0 never */
+    uint32_t cut_after;         /* stop serving after this many body bytes, later requests get 503, 0 never */
+    const char* image_sha256;   /* sent as X-Image-SHA256, NULL for none */
+    uint32_t corrupt_at;        /* flip this body byte once, 0 never */
+    const uint8_t* manifest;    /* sent for <path>.manifest, NULL for 404 */
+    size_t manifest_size;
+}bench_server_config_t;
+
+/* *****************************************************************************
+ * Function-Like Macro
+ **************************************************************************** */
+#define BENCH_ADD(field, value) __atomic_add_fetch(&(field), (value), __ATOMIC_RELAXED)
+
+/* *****************************************************************************
+ * Variables External Usage
+ **************************************************************************** */
+extern bench_stats_t bench_stats;
+
+/* *****************************************************************************
+ * Function Prototypes
+ **************************************************************************** */
+int64_t bench_time_us(void);
+void bench_log_set_level(esp_log_level_t level);
+
+void bench_heap_set_base(void);
+void bench_heap_reset_peak(void);
+size_t bench_heap_used(void);
+size_t bench_heap_peak(void);
+void bench_heap_add(long size);
+
+void bench_task_wait(const char* name);
+
+esp_err_t bench_flash_init(const char* path, uint32_t partition_size, const bench_flash_timing_t* timing, bool keep);
+esp_err_t bench_flash_load_running(const uint8_t* image, size_t size);
+esp_err_t bench_flash_load_update(const uint8_t* image, size_t size);
+esp_err_t bench_flash_boot_pending(void);
+bool bench_flash_update_equals(const uint8_t* image, size_t size);
+void bench_flash_deinit(void);
+
+/* *port 0 binds any free port, the bound one is returned in it */
+esp_err_t bench_server_start(const bench_server_config_t* config, uint16_t* port);
+void bench_server_stop(void);
+
+void bench_http_set_handshake_ms(uint32_t ms);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
@@ -0,0 +1,743 @@
+/* *****************************************************************************
+ * File:   bench_flash.c
+ * Author: DL
+ *
+ * Created on 2024 03 25
+ *
+ * Description: ota host bench, file backed partitions and esp_ota_ops
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "bench.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bootloader_common.h"
+#include "esp_app_format.h"
+#include "esp_flash_partitions.h"
+#include "esp_image_format.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "mbedtls/sha256.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "bench_flash"
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define BENCH_FLASH_BASE        0x10000
+#define BENCH_PARTITION_COUNT   2
+#define BENCH_DATA_COUNT        3
+#define BENCH_DATA_SIZE         (256 * 1024)
+#define BENCH_OTADATA_SIZE      (2 * BENCH_SECTOR_SIZE)
+#define BENCH_OTA_HANDLES       2
+#define BENCH_VERIFY_CHUNK      4096
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef struct
+{
+    esp_ota_handle_t handle;
+    const esp_partition_t* partition;
+    uint32_t erased_size;
+    uint32_t wrote_size;
+    bool need_erase;
+}bench_ota_t;
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+#define ALIGN_UP(x, a)          (((x) + (a) - 1) & ~((a) - 1))
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+static esp_partition_t bench_partitions[BENCH_PARTITION_COUNT] =
+{
+    { .type = ESP_PARTITION_TYPE_APP, .subtype = ESP_PARTITION_SUBTYPE_APP_OTA_0, .erase_size = BENCH_SECTOR_SIZE, .label = "ota_0" },
+    { .type = ESP_PARTITION_TYPE_APP, .subtype = ESP_PARTITION_SUBTYPE_APP_OTA_1, .erase_size = BENCH_SECTOR_SIZE, .label = "ota_1" },
+};
+
+/* behind the app partitions, a pair of slots for bundles and one written in place */
+static esp_partition_t bench_data_partitions[BENCH_DATA_COUNT] =
+{
+    { .type = ESP_PARTITION_TYPE_DATA, .subtype = ESP_PARTITION_SUBTYPE_DATA_SPIFFS, .erase_size = BENCH_SECTOR_SIZE, .label = "assets_0" },
+    { .type = ESP_PARTITION_TYPE_DATA, .subtype = ESP_PARTITION_SUBTYPE_DATA_SPIFFS, .erase_size = BENCH_SECTOR_SIZE, .label = "assets_1" },
+    { .type = ESP_PARTITION_TYPE_DATA, .subtype = ESP_PARTITION_SUBTYPE_DATA_NVS, .erase_size = BENCH_SECTOR_SIZE, .label = "nvs_def" },
+};
+
+/* in front of the app partitions, as two otadata entries one sector apart */
+static esp_partition_t bench_otadata =
+{
+    .type = ESP_PARTITION_TYPE_DATA, .subtype = ESP_PARTITION_SUBTYPE_DATA_OTA, .erase_size = BENCH_SECTOR_SIZE, .label = "otadata",
+};
+
+static uint8_t* bench_flash = NULL;
+static size_t bench_flash_size = 0;
+static int bench_flash_fd = -1;
+static bench_flash_timing_t bench_flash_timing;
+static uint32_t bench_flash_dirty_writes = 0;
+
+static const esp_partition_t* bench_running = &bench_partitions[0];
+static const esp_partition_t* bench_boot = &bench_partitions[0];
+static esp_app_desc_t bench_running_desc;
+static bool bench_pending_verify = false;
+
+static bench_ota_t bench_ota[BENCH_OTA_HANDLES];
+static uint32_t bench_ota_next_handle = 1;
+static pthread_mutex_t bench_ota_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Flash
+ **************************************************************************** */
+/* spends the modelled flash time, the real file access counts on top */
+static void bench_flash_delay(uint64_t us)
+{
+    if (us > 0)
+    {
+        struct timespec delay = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+        nanosleep(&delay, NULL);
+    }
+}
+
+static uint8_t* bench_flash_at(const esp_partition_t* partition, size_t offset)
+{
+    return &bench_flash[partition->address - BENCH_FLASH_BASE + offset];
+}
+
+static bool bench_is_update(const esp_partition_t* partition)
+{
+    bool data = (partition >= &bench_data_partitions[0]) && (partition < &bench_data_partitions[BENCH_DATA_COUNT]);
+    return data || ((partition->type == ESP_PARTITION_TYPE_APP) && (partition != bench_running));
+}
+
+/* keep leaves the flash of the last run as it was, as after a power cut */
+esp_err_t bench_flash_init(const char* path, uint32_t partition_size, const bench_flash_timing_t* timing, bool keep)
+{
+    bench_flash_size = BENCH_OTADATA_SIZE + (size_t)partition_size * BENCH_PARTITION_COUNT + BENCH_DATA_SIZE * BENCH_DATA_COUNT;
+    bench_flash_fd = open(path, O_RDWR | O_CREAT | (keep ? 0 : O_TRUNC), 0644);
+    if ((bench_flash_fd < 0) || (ftruncate(bench_flash_fd, (off_t)bench_flash_size) != 0))
+    {
+        perror(path);
+        return ESP_FAIL;
+    }
+    bench_flash = mmap(NULL, bench_flash_size, PROT_READ | PROT_WRITE, MAP_SHARED, bench_flash_fd, 0);
+    if (bench_flash == MAP_FAILED)
+    {
+        perror("mmap");
+        bench_flash = NULL;
+        return ESP_FAIL;
+    }
+    if (keep == false)
+    {
+        memset(bench_flash, 0xFF, bench_flash_size);
+    }
+    bench_otadata.address = BENCH_FLASH_BASE;
+    bench_otadata.size = BENCH_OTADATA_SIZE;
+    for (int index = 0; index < BENCH_PARTITION_COUNT; index++)
+    {
+        bench_partitions[index].address = BENCH_FLASH_BASE + BENCH_OTADATA_SIZE + index * partition_size;
+        bench_partitions[index].size = partition_size;
+    }
+    for (int index = 0; index < BENCH_DATA_COUNT; index++)
+    {
+        bench_data_partitions[index].address = BENCH_FLASH_BASE + BENCH_OTADATA_SIZE + BENCH_PARTITION_COUNT * partition_size + index * BENCH_DATA_SIZE;
+        bench_data_partitions[index].size = BENCH_DATA_SIZE;
+    }
+    bench_flash_timing = *timing;
+    bench_flash_dirty_writes = 0;
+    bench_running = &bench_partitions[0];
+    bench_boot = &bench_partitions[0];
+    bench_pending_verify = false;
+    memset(bench_ota, 0, sizeof(bench_ota));
+    return ESP_OK;
+}
+
+esp_err_t bench_flash_load_running(const uint8_t* image, size_t size)
+{
+    if (size > bench_running->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(bench_flash_at(bench_running, 0), image, size);
+    if (esp_ota_get_partition_description(bench_running, &bench_running_desc) != ESP_OK)
+    {
+        memset(&bench_running_desc, 0, sizeof(bench_running_desc));
+        strcpy(bench_running_desc.version, "0.0.0");
+    }
+    return ESP_OK;
+}
+
+/* the bootloader started the image of the boot partition for the first time */
+esp_err_t bench_flash_boot_pending(void)
+{
+    const esp_partition_t* boot = esp_ota_get_boot_partition();
+    if ((boot == NULL) || (boot == bench_running) || (esp_ota_get_partition_description(boot, &bench_running_desc) != ESP_OK))
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    bench_running = boot;
+    bench_pending_verify = true;
+    return ESP_OK;
+}
+
+/* the image a run wrote to the partition the update goes to */
+bool bench_flash_update_equals(const uint8_t* image, size_t size)
+{
+    const esp_partition_t* update = (bench_running == &bench_partitions[0]) ? &bench_partitions[1] : &bench_partitions[0];
+    return (size <= update->size) && (memcmp(bench_flash_at(update, 0), image, size) == 0);
+}
+
+/* what an earlier update left in the partition the next one is written to */
+esp_err_t bench_flash_load_update(const uint8_t* image, size_t size)
+{
+    const esp_partition_t* update = (bench_running == &bench_partitions[0]) ? &bench_partitions[1] : &bench_partitions[0];
+    if (size > update->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(bench_flash_at(update, 0), image, size);
+    return ESP_OK;
+}
+
+void bench_flash_deinit(void)
+{
+    if (bench_flash != NULL)
+    {
+        munmap(bench_flash, bench_flash_size);
+        bench_flash = NULL;
+    }
+    if (bench_flash_fd >= 0)
+    {
+        close(bench_flash_fd);
+        bench_flash_fd = -1;
+    }
+    if (bench_flash_dirty_writes > 0)
+    {
+        fprintf(stderr, "%u writes to flash that was not erased\n", (unsigned int)bench_flash_dirty_writes);
+    }
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label)
+{
+    if ((type == ESP_PARTITION_TYPE_DATA) && (subtype == ESP_PARTITION_SUBTYPE_DATA_OTA) && ((label == NULL) || (strcmp(label, bench_otadata.label) == 0)))
+    {
+        return &bench_otadata;
+    }
+    for (int index = 0; index < BENCH_PARTITION_COUNT; index++)
+    {
+        const esp_partition_t* partition = &bench_partitions[index];
+        if (((type == ESP_PARTITION_TYPE_ANY) || (partition->type == type)) &&
+            ((subtype == ESP_PARTITION_SUBTYPE_ANY) || (partition->subtype == subtype)) &&
+            ((label == NULL) || (strcmp(partition->label, label) == 0)))
+        {
+            return partition;
+        }
+    }
+    for (int index = 0; index < BENCH_DATA_COUNT; index++)
+    {
+        const esp_partition_t* partition = &bench_data_partitions[index];
+        if (((type == ESP_PARTITION_TYPE_ANY) || (partition->type == type)) &&
+            ((subtype == ESP_PARTITION_SUBTYPE_ANY) || (partition->subtype == subtype)) &&
+            ((label != NULL) && (strcmp(partition->label, label) == 0)))
+        {
+            return partition;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size)
+{
+    if ((partition == NULL) || (bench_flash == NULL) || (src_offset + size > partition->size))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(dst, bench_flash_at(partition, src_offset), size);
+    bench_flash_delay((uint64_t)bench_flash_timing.read_us * size / 1024);
+    return ESP_OK;
+}
+
+/* nor flash: programming only clears bits */
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size)
+{
+    if ((partition == NULL) || (bench_flash == NULL) || (dst_offset + size > partition->size))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int64_t start = bench_time_us();
+    uint8_t* flash = bench_flash_at(partition, dst_offset);
+    const uint8_t* data = (const uint8_t*)src;
+    bool dirty = false;
+    for (size_t index = 0; index < size; index++)
+    {
+        dirty |= ((flash[index] & data[index]) != data[index]);
+        flash[index] &= data[index];
+    }
+    if (dirty)
+    {
+        __atomic_add_fetch(&bench_flash_dirty_writes, 1, __ATOMIC_RELAXED);
+        ESP_LOGE(TAG, "Write to not erased flash at 0x%x+0x%x", (unsigned int)partition->address, (unsigned int)dst_offset);
+    }
+    bench_flash_delay((uint64_t)bench_flash_timing.write_us * size / 1024);
+    if (bench_is_update(partition))
+    {
+        BENCH_ADD(bench_stats.flash_us, bench_time_us() - start);
+        BENCH_ADD(bench_stats.bytes_written, size);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size)
+{
+    if ((partition == NULL) || (bench_flash == NULL) || (offset + size > partition->size) ||
+        (offset % BENCH_SECTOR_SIZE) || (size % BENCH_SECTOR_SIZE))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int64_t start = bench_time_us();
+    memset(bench_flash_at(partition, offset), 0xFF, size);
+    bench_flash_delay((uint64_t)bench_flash_timing.erase_us * (size / BENCH_SECTOR_SIZE));
+    if (bench_is_update(partition))
+    {
+        BENCH_ADD(bench_stats.flash_us, bench_time_us() - start);
+        BENCH_ADD(bench_stats.bytes_erased, size);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_get_sha256(const esp_partition_t* partition, uint8_t* sha_256)
+{
+    mbedtls_sha256_context sha;
+
+    if ((partition == NULL) || (bench_flash == NULL) || (partition->address < BENCH_FLASH_BASE))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, bench_flash_at(partition, 0), partition->size);
+    mbedtls_sha256_finish(&sha, sha_256);
+    mbedtls_sha256_free(&sha);
+    return ESP_OK;
+}
+
+/* *****************************************************************************
+ * Image check as done by esp_image_verify(): segments, checksum, appended sha
+ **************************************************************************** */
+static esp_err_t bench_image_verify(const esp_partition_t* partition, uint32_t* image_size)
+{
+    esp_image_header_t header;
+    mbedtls_sha256_context sha;
+    uint8_t buffer[BENCH_VERIFY_CHUNK];
+    uint8_t checksum = 0xEF;
+    uint32_t offset = sizeof(header);
+    esp_err_t err = ESP_ERR_OTA_VALIDATE_FAILED;
+
+    if (esp_partition_read(partition, 0, &header, sizeof(header)) != ESP_OK || (header.magic != ESP_IMAGE_HEADER_MAGIC))
+    {
+        ESP_LOGE(TAG, "No image header in partition %s", partition->label);
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, (const unsigned char*)&header, sizeof(header));
+
+    for (int segment = 0; segment < header.segment_count; segment++)
+    {
+        esp_image_segment_header_t segment_header;
+        if ((esp_partition_read(partition, offset, &segment_header, sizeof(segment_header)) != ESP_OK) ||
+            (offset + sizeof(segment_header) + segment_header.data_len > partition->size))
+        {
+            ESP_LOGE(TAG, "Segment %d at 0x%x out of partition", segment, (unsigned int)offset);
+            goto done;
+        }
+        mbedtls_sha256_update(&sha, (const unsigned char*)&segment_header, sizeof(segment_header));
+        offset += sizeof(segment_header);
+        for (uint32_t left = segment_header.data_len; left > 0;)
+        {
+            uint32_t length = (left < sizeof(buffer)) ? left : sizeof(buffer);
+            esp_partition_read(partition, offset, buffer, length);
+            mbedtls_sha256_update(&sha, buffer, length);
+            for (uint32_t index = 0; index < length; index++)
+            {
+                checksum ^= buffer[index];
+            }
+            offset += length;
+            left -= length;
+        }
+    }
+
+    /* zero padding up to the checksum in the last byte of a 16 byte block */
+    uint32_t padded = ALIGN_UP(offset + 1, 16);
+    if (padded + (header.hash_appended ? 32 : 0) > partition->size)
+    {
+        goto done;
+    }
+    esp_partition_read(partition, offset, buffer, padded - offset);
+    mbedtls_sha256_update(&sha, buffer, padded - offset);
+    if (buffer[padded - offset - 1] != checksum)
+    {
+        ESP_LOGE(TAG, "Image checksum 0x%02x, expected 0x%02x", buffer[padded - offset - 1], checksum);
+        goto done;
+    }
+    offset = padded;
+    if (header.hash_appended)
+    {
+        uint8_t digest[32];
+        uint8_t appended[32];
+        mbedtls_sha256_finish(&sha, digest);
+        esp_partition_read(partition, offset, appended, sizeof(appended));
+        if (memcmp(digest, appended, sizeof(digest)) != 0)
+        {
+            ESP_LOGE(TAG, "Image SHA-256 mismatch");
+            goto done;
+        }
+        offset += sizeof(appended);
+    }
+    *image_size = offset;
+    err = ESP_OK;
+
+done:
+    mbedtls_sha256_free(&sha);
+    return err;
+}
+
+esp_err_t esp_image_verify(esp_image_load_mode_t mode, const esp_partition_pos_t* part, esp_image_metadata_t* data)
+{
+    for (int index = 0; index < BENCH_PARTITION_COUNT; index++)
+    {
+        const esp_partition_t* partition = &bench_partitions[index];
+        if (partition->address == part->offset)
+        {
+            memset(data, 0, sizeof(*data));
+            data->start_addr = part->offset;
+            esp_partition_read(partition, 0, &data->image, sizeof(data->image));
+            return bench_image_verify(partition, &data->image_len);
+        }
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+/* *****************************************************************************
+ * esp_ota_ops
+ **************************************************************************** */
+static bench_ota_t* bench_ota_find(esp_ota_handle_t handle)
+{
+    for (int index = 0; index < BENCH_OTA_HANDLES; index++)
+    {
+        if ((handle != 0) && (bench_ota[index].handle == handle))
+        {
+            return &bench_ota[index];
+        }
+    }
+    return NULL;
+}
+
+const esp_app_desc_t* esp_app_get_description(void)
+{
+    return &bench_running_desc;
+}
+
+const esp_app_desc_t* esp_ota_get_app_description(void)
+{
+    return &bench_running_desc;
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t* partition, size_t image_size, esp_ota_handle_t* out_handle)
+{
+    bench_ota_t* ota = NULL;
+    esp_err_t err = ESP_OK;
+
+    if ((partition == NULL) || (out_handle == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (partition == bench_running)
+    {
+        return ESP_ERR_OTA_PARTITION_CONFLICT;
+    }
+
+    pthread_mutex_lock(&bench_ota_lock);
+    for (int index = 0; (ota == NULL) && (index < BENCH_OTA_HANDLES); index++)
+    {
+        if (bench_ota[index].handle == 0)
+        {
+            ota = &bench_ota[index];
+            memset(ota, 0, sizeof(*ota));
+            ota->handle = bench_ota_next_handle++;
+        }
+    }
+    pthread_mutex_unlock(&bench_ota_lock);
+    if (ota == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    ota->partition = partition;
+
+    if (image_size == OTA_WITH_SEQUENTIAL_WRITES)
+    {
+        ota->need_erase = true;
+    }
+    else
+    {
+        uint32_t erase_size = (image_size == OTA_SIZE_UNKNOWN) ? partition->size : ALIGN_UP((uint32_t)image_size, BENCH_SECTOR_SIZE);
+        err = esp_partition_erase_range(partition, 0, erase_size);
+        ota->erased_size = erase_size;
+    }
+    if (err != ESP_OK)
+    {
+        ota->handle = 0;
+        return err;
+    }
+    *out_handle = ota->handle;
+    bench_stats.begin_done = bench_time_us();
+    return ESP_OK;
+}
+
+/* like esp-idf, sequential writes erase each sector as the writes reach it */
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void* data, size_t size)
+{
+    bench_ota_t* ota = bench_ota_find(handle);
+
+    if (ota == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((ota->wrote_size == 0) && (size > 0) && (((const uint8_t*)data)[0] != ESP_IMAGE_HEADER_MAGIC))
+    {
+        ESP_LOGE(TAG, "OTA image has invalid magic byte (expected 0xE9, saw 0x%02x)", ((const uint8_t*)data)[0]);
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    if (ota->wrote_size + size > ota->partition->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (ota->need_erase && (ota->wrote_size + size > ota->erased_size))
+    {
+        uint32_t erase_end = ALIGN_UP(ota->wrote_size + (uint32_t)size, BENCH_SECTOR_SIZE);
+        esp_err_t err = esp_partition_erase_range(ota->partition, ota->erased_size, erase_end - ota->erased_size);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        ota->erased_size = erase_end;
+    }
+    esp_err_t err = esp_partition_write(ota->partition, ota->wrote_size, data, size);
+    if (err == ESP_OK)
+    {
+        ota->wrote_size += size;
+    }
+    return err;
+}
+
+/* like esp-idf, nothing is erased and the written size is not counted */
+esp_err_t esp_ota_write_with_offset(esp_ota_handle_t handle, const void* data, size_t size, uint32_t offset)
+{
+    bench_ota_t* ota = bench_ota_find(handle);
+
+    if (ota == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return esp_partition_write(ota->partition, offset, data, size);
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+    bench_ota_t* ota = bench_ota_find(handle);
+    uint32_t image_size = 0;
+    esp_err_t err;
+
+    if (ota == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    int64_t start = bench_time_us();
+    if (ota->wrote_size == 0)
+    {
+        err = ESP_ERR_INVALID_ARG;
+    }
+    else
+    {
+        err = bench_image_verify(ota->partition, &image_size);
+    }
+    ota->handle = 0;
+    BENCH_ADD(bench_stats.finish_us, bench_time_us() - start);
+    return err;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle)
+{
+    bench_ota_t* ota = bench_ota_find(handle);
+
+    if (ota == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    ota->handle = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition)
+{
+    uint32_t image_size = 0;
+
+    if (partition == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int64_t start = bench_time_us();
+    esp_err_t err = bench_image_verify(partition, &image_size);
+    if (err == ESP_OK)
+    {
+        bench_boot = partition;
+        ESP_LOGI(TAG, "Boot partition %s, image of %u bytes verified", partition->label, (unsigned int)image_size);
+    }
+    BENCH_ADD(bench_stats.finish_us, bench_time_us() - start);
+    return err;
+}
+
+/* otadata written directly wins over esp_ota_set_boot_partition(), as the bootloader reads only otadata */
+const esp_partition_t* esp_ota_get_boot_partition(void)
+{
+    esp_ota_select_entry_t otadata[2];
+
+    esp_partition_read(&bench_otadata, 0, &otadata[0], sizeof(otadata[0]));
+    esp_partition_read(&bench_otadata, BENCH_SECTOR_SIZE, &otadata[1], sizeof(otadata[1]));
+    int active = bootloader_common_get_active_otadata(otadata);
+    if (active != -1)
+    {
+        return &bench_partitions[(otadata[active].ota_seq - 1) % BENCH_PARTITION_COUNT];
+    }
+    return bench_boot;
+}
+
+uint8_t esp_ota_get_app_partition_count(void)
+{
+    return BENCH_PARTITION_COUNT;
+}
+
+/* *****************************************************************************
+ * bootloader_common
+ **************************************************************************** */
+uint32_t bootloader_common_ota_select_crc(const esp_ota_select_entry_t* s)
+{
+    const uint8_t* data = (const uint8_t*)&s->ota_seq;
+    /* esp_rom_crc32_le(UINT32_MAX, ...), which inverts the seed */
+    uint32_t crc = ~UINT32_MAX;
+
+    for (size_t index = 0; index < sizeof(s->ota_seq); index++)
+    {
+        crc ^= data[index];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+bool bootloader_common_ota_select_valid(const esp_ota_select_entry_t* s)
+{
+    return (s->ota_seq != UINT32_MAX) && (s->crc == bootloader_common_ota_select_crc(s)) &&
+           (s->ota_state != ESP_OTA_IMG_INVALID) && (s->ota_state != ESP_OTA_IMG_ABORTED);
+}
+
+int bootloader_common_get_active_otadata(esp_ota_select_entry_t* two_otadata)
+{
+    bool valid[2] = { bootloader_common_ota_select_valid(&two_otadata[0]), bootloader_common_ota_select_valid(&two_otadata[1]) };
+
+    if (valid[0] && valid[1])
+    {
+        return (two_otadata[0].ota_seq >= two_otadata[1].ota_seq) ? 0 : 1;
+    }
+    return valid[0] ? 0 : valid[1] ? 1 : -1;
+}
+
+const esp_partition_t* esp_ota_get_running_partition(void)
+{
+    return bench_running;
+}
+
+const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start_from)
+{
+    const esp_partition_t* from = (start_from != NULL) ? start_from : bench_running;
+    return (from == &bench_partitions[0]) ? &bench_partitions[1] : &bench_partitions[0];
+}
+
+esp_err_t esp_ota_get_partition_description(const esp_partition_t* partition, esp_app_desc_t* app_desc)
+{
+    if ((partition == NULL) || (app_desc == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = esp_partition_read(partition, sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t), app_desc, sizeof(*app_desc));
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    return (app_desc->magic_word == ESP_APP_DESC_MAGIC_WORD) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+const esp_partition_t* esp_ota_get_last_invalid_partition(void)
+{
+    return NULL;
+}
+
+esp_err_t esp_ota_get_state_partition(const esp_partition_t* partition, esp_ota_img_states_t* ota_state)
+{
+    if ((partition == NULL) || (ota_state == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *ota_state = (partition != bench_running) ? ESP_OTA_IMG_UNDEFINED : bench_pending_verify ? ESP_OTA_IMG_PENDING_VERIFY : ESP_OTA_IMG_VALID;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void)
+{
+    bench_pending_verify = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void)
+{
+    if (bench_pending_verify == false)
+    {
+        return ESP_ERR_OTA_ROLLBACK_INVALID_STATE;
+    }
+    bench_pending_verify = false;
+    esp_restart();
+    return ESP_OK;
+}
+
+/* the device would reboot here, the bench only records it */
+void esp_restart(void)
+{
+    bench_stats.restarted = true;
+}
@@ -0,0 +1,634 @@
+/* *****************************************************************************
+ * File:   bench_freertos.c
+ * Author: DL
+ *
+ * Created on 2024 03 25
+ *
+ * Description: ota host bench, freertos tasks, queues and semaphores on pthreads
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "bench.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define BENCH_MAX_TASKS         16
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+struct tskTaskControlBlock
+{
+    pthread_t thread;
+    TaskFunction_t func;
+    void* param;
+    char name[16];
+    uint32_t stack_size;
+    UBaseType_t priority;
+    uint32_t notify;
+    bool used;
+    bool static_stack;          /* on a stack of the caller, not on the heap */
+    bool suspended;
+    bool deleted;               /* by another task while suspended */
+};
+
+/* a semaphore is a queue of items without size */
+struct QueueDefinition
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint8_t* items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+};
+
+struct EventGroupDef_t
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    EventBits_t bits;
+};
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+static struct tskTaskControlBlock bench_tasks[BENCH_MAX_TASKS];
+static pthread_mutex_t bench_tasks_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bench_tasks_changed = PTHREAD_COND_INITIALIZER;
+static __thread struct tskTaskControlBlock* bench_current_task = NULL;
+
+static pthread_mutex_t bench_critical_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static void bench_deadline(struct timespec* deadline, TickType_t ticks)
+{
+    clock_gettime(CLOCK_REALTIME, deadline);
+    uint64_t ns = (uint64_t)deadline->tv_nsec + (uint64_t)ticks * (1000000000ULL / configTICK_RATE_HZ);
+    deadline->tv_sec += ns / 1000000000ULL;
+    deadline->tv_nsec = ns % 1000000000ULL;
+}
+
+/* waits on cond, false once ticks passed */
+static bool bench_wait(pthread_cond_t* cond, pthread_mutex_t* lock, TickType_t ticks, const struct timespec* deadline)
+{
+    if (ticks == 0)
+    {
+        return false;
+    }
+    if (ticks == portMAX_DELAY)
+    {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+/* *****************************************************************************
+ * Tasks, priorities are kept but not applied
+ **************************************************************************** */
+static void* bench_task_entry(void* arg)
+{
+    struct tskTaskControlBlock* task = (struct tskTaskControlBlock*)arg;
+
+    bench_current_task = task;
+    task->func(task->param);
+    /* a freertos task must not return */
+    fprintf(stderr, "task %s returned\n", task->name);
+    abort();
+    return NULL;
+}
+
+static BaseType_t bench_task_create(TaskFunction_t pvTaskCode, const char* const pcName, const uint32_t usStackDepth,
+        void* const pvParameters, UBaseType_t uxPriority, TaskHandle_t* const pvCreatedTask, bool static_stack)
+{
+    struct tskTaskControlBlock* task = NULL;
+
+    pthread_mutex_lock(&bench_tasks_lock);
+    for (int index = 0; (task == NULL) && (index < BENCH_MAX_TASKS); index++)
+    {
+        if (bench_tasks[index].used == false)
+        {
+            task = &bench_tasks[index];
+            memset(task, 0, sizeof(*task));
+            task->used = true;
+        }
+    }
+    pthread_mutex_unlock(&bench_tasks_lock);
+    if (task == NULL)
+    {
+        return pdFAIL;
+    }
+
+    task->func = pvTaskCode;
+    task->param = pvParameters;
+    task->stack_size = usStackDepth;
+    task->priority = uxPriority;
+    snprintf(task->name, sizeof(task->name), "%s", pcName);
+    task->static_stack = static_stack;
+    /* the stack comes from the heap on the device */
+    if (static_stack == false)
+    {
+        bench_heap_add((long)usStackDepth);
+    }
+    if (pvCreatedTask != NULL)
+    {
+        *pvCreatedTask = task;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&task->thread, &attr, bench_task_entry, task) != 0)
+    {
+        pthread_attr_destroy(&attr);
+        if (static_stack == false)
+        {
+            bench_heap_add(-(long)usStackDepth);
+        }
+        task->used = false;
+        return pdFAIL;
+    }
+    pthread_attr_destroy(&attr);
+    return pdPASS;
+}
+
+/* the bench thread gets its own stack, only the heap counts differ */
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t pxTaskCode, const char* const pcName, const uint32_t ulStackDepth, void* const pvParameters,
+        UBaseType_t uxPriority, StackType_t* const puxStackBuffer, StaticTask_t* const pxTaskBuffer, const BaseType_t xCoreID)
+{
+    TaskHandle_t handle = NULL;
+
+    (void)xCoreID;
+    if ((puxStackBuffer == NULL) || (pxTaskBuffer == NULL) ||
+        (bench_task_create(pxTaskCode, pcName, ulStackDepth, pvParameters, uxPriority, &handle, true) != pdPASS))
+    {
+        return NULL;
+    }
+    return handle;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char* const pcName, const uint32_t usStackDepth,
+        void* const pvParameters, UBaseType_t uxPriority, TaskHandle_t* const pvCreatedTask, const BaseType_t xCoreID)
+{
+    (void)xCoreID;
+    return bench_task_create(pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pvCreatedTask, false);
+}
+
+BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char* const pcName, const uint32_t usStackDepth,
+        void* const pvParameters, UBaseType_t uxPriority, TaskHandle_t* const pvCreatedTask)
+{
+    return xTaskCreatePinnedToCore(pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pvCreatedTask, tskNO_AFFINITY);
+}
+
+static void bench_task_exit(struct tskTaskControlBlock* task)
+{
+    if (task->static_stack == false)
+    {
+        bench_heap_add(-(long)task->stack_size);
+    }
+    pthread_mutex_lock(&bench_tasks_lock);
+    task->used = false;
+    pthread_cond_broadcast(&bench_tasks_changed);
+    pthread_mutex_unlock(&bench_tasks_lock);
+    pthread_exit(NULL);
+}
+
+/* a task deletes itself, or another one once it is suspended */
+void vTaskDelete(TaskHandle_t xTaskToDelete)
+{
+    struct tskTaskControlBlock* task = bench_current_task;
+
+    if ((xTaskToDelete != NULL) && (xTaskToDelete != task))
+    {
+        pthread_mutex_lock(&bench_tasks_lock);
+        if (xTaskToDelete->suspended == false)
+        {
+            fprintf(stderr, "vTaskDelete of another task not suspended not supported\n");
+            abort();
+        }
+        xTaskToDelete->deleted = true;
+        pthread_cond_broadcast(&bench_tasks_changed);
+        pthread_mutex_unlock(&bench_tasks_lock);
+        return;
+    }
+    if (task == NULL)
+    {
+        pthread_exit(NULL);
+    }
+    bench_task_exit(task);
+}
+
+/* only the calling task, until another one deletes it */
+void vTaskSuspend(TaskHandle_t xTaskToSuspend)
+{
+    struct tskTaskControlBlock* task = bench_current_task;
+
+    if ((task == NULL) || ((xTaskToSuspend != NULL) && (xTaskToSuspend != task)))
+    {
+        fprintf(stderr, "vTaskSuspend of another task not supported\n");
+        abort();
+    }
+    pthread_mutex_lock(&bench_tasks_lock);
+    task->suspended = true;
+    pthread_cond_broadcast(&bench_tasks_changed);
+    while (task->deleted == false)
+    {
+        pthread_cond_wait(&bench_tasks_changed, &bench_tasks_lock);
+    }
+    pthread_mutex_unlock(&bench_tasks_lock);
+    bench_task_exit(task);
+}
+
+eTaskState eTaskGetState(TaskHandle_t xTask)
+{
+    eTaskState state;
+
+    pthread_mutex_lock(&bench_tasks_lock);
+    state = ((xTask->used == false) || xTask->deleted) ? eDeleted : xTask->suspended ? eSuspended : (xTask == bench_current_task) ? eRunning : eReady;
+    pthread_mutex_unlock(&bench_tasks_lock);
+    return state;
+}
+
+/* returns once no task with this name is left, or only suspended ones */
+void bench_task_wait(const char* name)
+{
+    pthread_mutex_lock(&bench_tasks_lock);
+    for (;;)
+    {
+        bool found = false;
+        for (int index = 0; index < BENCH_MAX_TASKS; index++)
+        {
+            if (bench_tasks[index].used && (bench_tasks[index].suspended == false) && (strcmp(bench_tasks[index].name, name) == 0))
+            {
+                found = true;
+            }
+        }
+        if (found == false)
+        {
+            break;
+        }
+        pthread_cond_wait(&bench_tasks_changed, &bench_tasks_lock);
+    }
+    pthread_mutex_unlock(&bench_tasks_lock);
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+    usleep((useconds_t)xTicksToDelay * (1000000 / configTICK_RATE_HZ));
+}
+
+void vTaskDelayUntil(TickType_t* const pxPreviousWakeTime, const TickType_t xTimeIncrement)
+{
+    TickType_t wake = *pxPreviousWakeTime + xTimeIncrement;
+    TickType_t now = xTaskGetTickCount();
+
+    if ((int32_t)(wake - now) > 0)
+    {
+        vTaskDelay(wake - now);
+    }
+    *pxPreviousWakeTime = wake;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(bench_time_us() / (1000000 / configTICK_RATE_HZ));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return bench_current_task;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t xTask)
+{
+    struct tskTaskControlBlock* task = (xTask != NULL) ? xTask : bench_current_task;
+    return (task != NULL) ? task->priority : 0;
+}
+
+void vTaskPrioritySet(TaskHandle_t xTask, UBaseType_t uxNewPriority)
+{
+    struct tskTaskControlBlock* task = (xTask != NULL) ? xTask : bench_current_task;
+    if (task != NULL)
+    {
+        task->priority = uxNewPriority;
+    }
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask)
+{
+    struct tskTaskControlBlock* task = (xTask != NULL) ? xTask : bench_current_task;
+    return (task != NULL) ? task->stack_size : 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t xTaskToNotify)
+{
+    pthread_mutex_lock(&bench_tasks_lock);
+    xTaskToNotify->notify++;
+    pthread_cond_broadcast(&bench_tasks_changed);
+    pthread_mutex_unlock(&bench_tasks_lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+    struct tskTaskControlBlock* task = bench_current_task;
+    struct timespec deadline;
+    uint32_t value;
+
+    bench_deadline(&deadline, xTicksToWait);
+    pthread_mutex_lock(&bench_tasks_lock);
+    while ((task->notify == 0) && bench_wait(&bench_tasks_changed, &bench_tasks_lock, xTicksToWait, &deadline))
+    {
+    }
+    value = task->notify;
+    if (value > 0)
+    {
+        task->notify = xClearCountOnExit ? 0 : (value - 1);
+    }
+    pthread_mutex_unlock(&bench_tasks_lock);
+    return value;
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    return 0;
+}
+
+void vPortEnterCritical(portMUX_TYPE* mux)
+{
+    (void)mux;
+    pthread_mutex_lock(&bench_critical_lock);
+}
+
+void vPortExitCritical(portMUX_TYPE* mux)
+{
+    (void)mux;
+    pthread_mutex_unlock(&bench_critical_lock);
+}
+
+/* *****************************************************************************
+ * Queues and semaphores
+ **************************************************************************** */
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize)
+{
+    QueueHandle_t queue = calloc(1, sizeof(*queue));
+    if (queue == NULL)
+    {
+        return NULL;
+    }
+    if (uxItemSize > 0)
+    {
+        queue->items = malloc((size_t)uxQueueLength * uxItemSize);
+        if (queue->items == NULL)
+        {
+            free(queue);
+            return NULL;
+        }
+    }
+    queue->length = uxQueueLength;
+    queue->item_size = uxItemSize;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    return queue;
+}
+
+static BaseType_t bench_queue_send(QueueHandle_t xQueue, const void* pvItemToQueue, TickType_t xTicksToWait, bool front)
+{
+    struct timespec deadline;
+    BaseType_t result = pdFAIL;
+
+    bench_deadline(&deadline, xTicksToWait);
+    pthread_mutex_lock(&xQueue->lock);
+    while ((xQueue->count == xQueue->length) && bench_wait(&xQueue->changed, &xQueue->lock, xTicksToWait, &deadline))
+    {
+    }
+    if (xQueue->count < xQueue->length)
+    {
+        UBaseType_t index;
+        if (front)
+        {
+            xQueue->head = (xQueue->head + xQueue->length - 1) % xQueue->length;
+            index = xQueue->head;
+        }
+        else
+        {
+            index = (xQueue->head + xQueue->count) % xQueue->length;
+        }
+        if (xQueue->item_size > 0)
+        {
+            memcpy(&xQueue->items[index * xQueue->item_size], pvItemToQueue, xQueue->item_size);
+        }
+        xQueue->count++;
+        pthread_cond_broadcast(&xQueue->changed);
+        result = pdPASS;
+    }
+    pthread_mutex_unlock(&xQueue->lock);
+    return result;
+}
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void* pvItemToQueue, TickType_t xTicksToWait)
+{
+    return bench_queue_send(xQueue, pvItemToQueue, xTicksToWait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t xQueue, const void* pvItemToQueue, TickType_t xTicksToWait)
+{
+    return bench_queue_send(xQueue, pvItemToQueue, xTicksToWait, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void* pvBuffer, TickType_t xTicksToWait)
+{
+    struct timespec deadline;
+    BaseType_t result = pdFAIL;
+
+    bench_deadline(&deadline, xTicksToWait);
+    pthread_mutex_lock(&xQueue->lock);
+    while ((xQueue->count == 0) && bench_wait(&xQueue->changed, &xQueue->lock, xTicksToWait, &deadline))
+    {
+    }
+    if (xQueue->count > 0)
+    {
+        if (xQueue->item_size > 0)
+        {
+            memcpy(pvBuffer, &xQueue->items[xQueue->head * xQueue->item_size], xQueue->item_size);
+        }
+        xQueue->head = (xQueue->head + 1) % xQueue->length;
+        xQueue->count--;
+        pthread_cond_broadcast(&xQueue->changed);
+        result = pdPASS;
+    }
+    pthread_mutex_unlock(&xQueue->lock);
+    return result;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue)
+{
+    pthread_mutex_lock(&xQueue->lock);
+    UBaseType_t count = xQueue->count;
+    pthread_mutex_unlock(&xQueue->lock);
+    return count;
+}
+
+void vQueueDelete(QueueHandle_t xQueue)
+{
+    if (xQueue == NULL)
+    {
+        return;
+    }
+    pthread_cond_destroy(&xQueue->changed);
+    pthread_mutex_destroy(&xQueue->lock);
+    free(xQueue->items);
+    free(xQueue);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t uxMaxCount, UBaseType_t uxInitialCount)
+{
+    SemaphoreHandle_t semaphore = xQueueCreate(uxMaxCount, 0);
+    if (semaphore != NULL)
+    {
+        semaphore->count = uxInitialCount;
+    }
+    return semaphore;
+}
+
+/* not recursive and without priority inheritance */
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime)
+{
+    return xQueueReceive(xSemaphore, NULL, xBlockTime);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore)
+{
+    return xQueueSend(xSemaphore, NULL, 0);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t xSemaphore)
+{
+    vQueueDelete(xSemaphore);
+}
+
+/* *****************************************************************************
+ * Event groups
+ **************************************************************************** */
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    EventGroupHandle_t group = calloc(1, sizeof(*group));
+    if (group != NULL)
+    {
+        pthread_mutex_init(&group->lock, NULL);
+        pthread_cond_init(&group->changed, NULL);
+    }
+    return group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToSet)
+{
+    pthread_mutex_lock(&xEventGroup->lock);
+    xEventGroup->bits |= uxBitsToSet;
+    EventBits_t bits = xEventGroup->bits;
+    pthread_cond_broadcast(&xEventGroup->changed);
+    pthread_mutex_unlock(&xEventGroup->lock);
+    return bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToClear)
+{
+    pthread_mutex_lock(&xEventGroup->lock);
+    EventBits_t bits = xEventGroup->bits;
+    xEventGroup->bits &= ~uxBitsToClear;
+    pthread_mutex_unlock(&xEventGroup->lock);
+    return bits;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t xEventGroup)
+{
+    pthread_mutex_lock(&xEventGroup->lock);
+    EventBits_t bits = xEventGroup->bits;
+    pthread_mutex_unlock(&xEventGroup->lock);
+    return bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t xEventGroup, const EventBits_t uxBitsToWaitFor,
+        const BaseType_t xClearOnExit, const BaseType_t xWaitForAllBits, TickType_t xTicksToWait)
+{
+    struct timespec deadline;
+
+    bench_deadline(&deadline, xTicksToWait);
+    pthread_mutex_lock(&xEventGroup->lock);
+    for (;;)
+    {
+        EventBits_t set = xEventGroup->bits & uxBitsToWaitFor;
+        bool done = xWaitForAllBits ? (set == uxBitsToWaitFor) : (set != 0);
+        if (done || !bench_wait(&xEventGroup->changed, &xEventGroup->lock, xTicksToWait, &deadline))
+        {
+            break;
+        }
+    }
+    EventBits_t bits = xEventGroup->bits;
+    EventBits_t set = bits & uxBitsToWaitFor;
+    if (xClearOnExit && (xWaitForAllBits ? (set == uxBitsToWaitFor) : (set != 0)))
+    {
+        xEventGroup->bits &= ~uxBitsToWaitFor;
+    }
+    pthread_mutex_unlock(&xEventGroup->lock);
+    return bits;
+}
+
+void vEventGroupDelete(EventGroupHandle_t xEventGroup)
+{
+    if (xEventGroup == NULL)
+    {
+        return;
+    }
+    pthread_cond_destroy(&xEventGroup->changed);
+    pthread_mutex_destroy(&xEventGroup->lock);
+    free(xEventGroup);
+}
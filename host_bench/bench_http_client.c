@@ -0,0 +1,591 @@
+/* *****************************************************************************
+ * File:   bench_http_client.c
+ * Author: DL
+ *
+ * Created on 2024 03 25
+ *
+ * Description: ota host bench, esp_http_client over plain tcp
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "bench.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "esp_http_client.h"
+#include "esp_log.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "bench_http"
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define BENCH_HTTP_URL_SIZE         256
+#define BENCH_HTTP_HEADERS          16
+#define BENCH_HTTP_KEY_SIZE         32
+#define BENCH_HTTP_VALUE_SIZE       128
+#define BENCH_HTTP_BUFFER_SIZE      4096
+#define BENCH_HTTP_TIMEOUT_DEFAULT  5000
+#define BENCH_HTTP_IDF_BUFFER_DEFAULT   512     /* DEFAULT_HTTP_BUF_SIZE of esp_http_client */
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef struct
+{
+    char key[BENCH_HTTP_KEY_SIZE];
+    char value[BENCH_HTTP_VALUE_SIZE];
+}bench_http_header_t;
+
+struct esp_http_client
+{
+    char host[BENCH_HTTP_URL_SIZE];
+    char path[BENCH_HTTP_URL_SIZE];
+    int port;
+    esp_http_client_method_t method;
+    int timeout_ms;
+    bool keep_alive;
+    bool save_session;
+    bool session;               /* a connection of this client got a session to resume */
+    http_event_handle_cb event_handler;
+    void* user_data;
+    bench_http_header_t headers[BENCH_HTTP_HEADERS];
+    int fd;
+    int status_code;
+    int64_t content_length;
+    int64_t received;
+    bool response_open;         /* headers fetched, body not drained */
+    bool server_close;          /* "Connection: close" in the response */
+    int error;
+    int64_t open_start;
+    char buffer[BENCH_HTTP_BUFFER_SIZE];
+    size_t buffer_length;       /* body bytes read with the headers */
+    size_t buffer_offset;
+    long idf_buffers;           /* rx and tx buffers the esp-idf client allocates, counted only */
+};
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+static uint32_t bench_handshake_ms = 0;
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static void http_event(esp_http_client_handle_t client, esp_http_client_event_id_t event_id, char* key, char* value)
+{
+    if (client->event_handler != NULL)
+    {
+        esp_http_client_event_t event =
+        {
+            .event_id = event_id,
+            .client = client,
+            .user_data = client->user_data,
+            .header_key = key,
+            .header_value = value,
+        };
+        client->event_handler(&event);
+    }
+}
+
+static esp_err_t http_parse_url(esp_http_client_handle_t client, const char* url)
+{
+    const char* host = NULL;
+
+    if (strncasecmp(url, "http://", 7) == 0)
+    {
+        host = url + 7;
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Only http:// urls on the bench, got %s", url);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    const char* path = strchr(host, '/');
+    size_t host_length = (path != NULL) ? (size_t)(path - host) : strlen(host);
+    if (host_length >= sizeof(client->host))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(client->host, host, host_length);
+    client->host[host_length] = '\0';
+    strlcpy(client->path, (path != NULL) ? path : "/", sizeof(client->path));
+
+    client->port = 80;
+    char* colon = strchr(client->host, ':');
+    if (colon != NULL)
+    {
+        *colon = '\0';
+        client->port = atoi(colon + 1);
+    }
+    return ESP_OK;
+}
+
+static void http_disconnect(esp_http_client_handle_t client)
+{
+    if (client->fd >= 0)
+    {
+        close(client->fd);
+        client->fd = -1;
+        client->response_open = false;
+        http_event(client, HTTP_EVENT_DISCONNECTED, NULL, NULL);
+    }
+}
+
+static esp_err_t http_connect(esp_http_client_handle_t client)
+{
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo* address = NULL;
+    char port[8];
+
+    snprintf(port, sizeof(port), "%d", client->port);
+    if (getaddrinfo(client->host, port, &hints, &address) != 0)
+    {
+        ESP_LOGE(TAG, "Unknown host %s", client->host);
+        return ESP_ERR_HTTP_CONNECT;
+    }
+    client->fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if ((client->fd < 0) || (connect(client->fd, address->ai_addr, address->ai_addrlen) != 0))
+    {
+        ESP_LOGE(TAG, "Connect to %s:%d failed, errno %d", client->host, client->port, errno);
+        freeaddrinfo(address);
+        if (client->fd >= 0)
+        {
+            close(client->fd);
+            client->fd = -1;
+        }
+        return ESP_ERR_HTTP_CONNECT;
+    }
+    freeaddrinfo(address);
+
+    struct timeval timeout = { .tv_sec = client->timeout_ms / 1000, .tv_usec = (client->timeout_ms % 1000) * 1000 };
+    int one = 1;
+    setsockopt(client->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    /* plain tcp, the time of a full TLS handshake is added, a resumed one is taken as free */
+    if (client->session)
+    {
+        BENCH_ADD(bench_stats.resumed, 1);
+    }
+    else if (bench_handshake_ms > 0)
+    {
+        usleep(bench_handshake_ms * 1000);
+    }
+    client->session = client->save_session;
+    BENCH_ADD(bench_stats.connections, 1);
+    http_event(client, HTTP_EVENT_ON_CONNECTED, NULL, NULL);
+    return ESP_OK;
+}
+
+static bool http_send_all(int fd, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t* config)
+{
+    esp_http_client_handle_t client = calloc(1, sizeof(*client));
+
+    if (client == NULL)
+    {
+        return NULL;
+    }
+    if (http_parse_url(client, config->url) != ESP_OK)
+    {
+        free(client);
+        return NULL;
+    }
+    client->fd = -1;
+    client->method = config->method;
+    client->timeout_ms = (config->timeout_ms > 0) ? config->timeout_ms : BENCH_HTTP_TIMEOUT_DEFAULT;
+    client->keep_alive = config->keep_alive_enable;
+    client->save_session = config->save_client_session;
+    client->event_handler = config->event_handler;
+    client->user_data = config->user_data;
+    client->content_length = -1;
+    client->idf_buffers = ((config->buffer_size > 0) ? config->buffer_size : BENCH_HTTP_IDF_BUFFER_DEFAULT) +
+                          ((config->buffer_size_tx > 0) ? config->buffer_size_tx : BENCH_HTTP_IDF_BUFFER_DEFAULT);
+    bench_heap_add(client->idf_buffers);
+    return client;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char* url)
+{
+    char host[BENCH_HTTP_URL_SIZE];
+    int port = client->port;
+
+    strlcpy(host, client->host, sizeof(host));
+    esp_err_t err = http_parse_url(client, url);
+    if ((err == ESP_OK) && ((strcmp(host, client->host) != 0) || (port != client->port)))
+    {
+        http_disconnect(client);
+    }
+    return err;
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method)
+{
+    client->method = method;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_timeout_ms(esp_http_client_handle_t client, int timeout_ms)
+{
+    client->timeout_ms = timeout_ms;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char* key, const char* value)
+{
+    bench_http_header_t* free_header = NULL;
+
+    for (int index = 0; index < BENCH_HTTP_HEADERS; index++)
+    {
+        bench_http_header_t* header = &client->headers[index];
+        if (strcasecmp(header->key, key) == 0)
+        {
+            strlcpy(header->value, value, sizeof(header->value));
+            return ESP_OK;
+        }
+        if ((free_header == NULL) && (header->key[0] == '\0'))
+        {
+            free_header = header;
+        }
+    }
+    if (free_header == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    strlcpy(free_header->key, key, sizeof(free_header->key));
+    strlcpy(free_header->value, value, sizeof(free_header->value));
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char* key)
+{
+    for (int index = 0; index < BENCH_HTTP_HEADERS; index++)
+    {
+        if (strcasecmp(client->headers[index].key, key) == 0)
+        {
+            client->headers[index].key[0] = '\0';
+        }
+    }
+    return ESP_OK;
+}
+
+/* reuses the connection when the last response was read to its end */
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+    static const char* methods[] = { "GET", "POST", "PUT", "PATCH", "DELETE", "HEAD" };
+    char request[BENCH_HTTP_BUFFER_SIZE];
+    int length;
+
+    client->open_start = bench_time_us();
+    if ((client->fd >= 0) && (client->response_open || client->server_close || (client->keep_alive == false)))
+    {
+        http_disconnect(client);
+    }
+    if (client->fd < 0)
+    {
+        esp_err_t err = http_connect(client);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+    }
+
+    length = snprintf(request, sizeof(request), "%s %s HTTP/1.1\r\nHost: %s:%d\r\nUser-Agent: ESP32 HTTP Client/1.0\r\nConnection: %s\r\n",
+                      methods[client->method], client->path, client->host, client->port, client->keep_alive ? "keep-alive" : "close");
+    if (write_len > 0)
+    {
+        length += snprintf(request + length, sizeof(request) - length, "Content-Length: %d\r\n", write_len);
+    }
+    for (int index = 0; index < BENCH_HTTP_HEADERS; index++)
+    {
+        if (client->headers[index].key[0] != '\0')
+        {
+            length += snprintf(request + length, sizeof(request) - length, "%s: %s\r\n", client->headers[index].key, client->headers[index].value);
+        }
+    }
+    length += snprintf(request + length, sizeof(request) - length, "\r\n");
+    if (http_send_all(client->fd, request, length) == false)
+    {
+        http_disconnect(client);
+        return ESP_ERR_HTTP_CONNECT;
+    }
+    BENCH_ADD(bench_stats.requests, 1);
+    http_event(client, HTTP_EVENT_HEADERS_SENT, NULL, NULL);
+    client->status_code = 0;
+    client->content_length = -1;
+    client->received = 0;
+    client->buffer_length = 0;
+    client->buffer_offset = 0;
+    client->server_close = false;
+    client->response_open = true;
+    return ESP_OK;
+}
+
+int esp_http_client_write(esp_http_client_handle_t client, const char* buffer, int len)
+{
+    return http_send_all(client->fd, buffer, len) ? len : -1;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    size_t length = 0;
+    char* end = NULL;
+
+    if (client->fd < 0)
+    {
+        return ESP_FAIL;
+    }
+    while (end == NULL)
+    {
+        if (length >= sizeof(client->buffer) - 1)
+        {
+            ESP_LOGE(TAG, "Response headers too long");
+            return ESP_FAIL;
+        }
+        ssize_t received = recv(client->fd, client->buffer + length, sizeof(client->buffer) - 1 - length, 0);
+        if (received <= 0)
+        {
+            client->error = (received == 0) ? ENOTCONN : errno;
+            http_disconnect(client);
+            return ESP_FAIL;
+        }
+        length += received;
+        client->buffer[length] = '\0';
+        end = strstr(client->buffer, "\r\n\r\n");
+    }
+
+    char* line = client->buffer;
+    *end = '\0';
+    sscanf(line, "HTTP/%*d.%*d %d", &client->status_code);
+    for (line = strstr(line, "\r\n"); line != NULL;)
+    {
+        line += 2;
+        char* next = strstr(line, "\r\n");
+        if (next != NULL)
+        {
+            *next = '\0';
+        }
+        char* colon = strchr(line, ':');
+        if (colon != NULL)
+        {
+            *colon = '\0';
+            char* value = colon + 1;
+            while (*value == ' ')
+            {
+                value++;
+            }
+            if (strcasecmp(line, "Content-Length") == 0)
+            {
+                client->content_length = strtoll(value, NULL, 10);
+            }
+            else if ((strcasecmp(line, "Connection") == 0) && (strcasecmp(value, "close") == 0))
+            {
+                client->server_close = true;
+            }
+            http_event(client, HTTP_EVENT_ON_HEADER, line, value);
+        }
+        line = next;
+    }
+
+    /* body bytes which came with the headers are moved to the front */
+    size_t header_size = (end + 4) - client->buffer;
+    client->buffer_length = length - header_size;
+    memmove(client->buffer, client->buffer + header_size, client->buffer_length);
+    client->buffer_offset = 0;
+    if (client->method == HTTP_METHOD_HEAD)
+    {
+        client->received = client->content_length;
+    }
+    if (client->received >= client->content_length && client->content_length >= 0)
+    {
+        client->response_open = false;
+    }
+    BENCH_ADD(bench_stats.connect_us, bench_time_us() - client->open_start);
+    return client->content_length;
+}
+
+bool esp_http_client_is_chunked_response(esp_http_client_handle_t client)
+{
+    return false;
+}
+
+/* like esp-idf, 0 and errno ENOTCONN when the server closes before the end */
+int esp_http_client_read(esp_http_client_handle_t client, char* buffer, int len)
+{
+    int64_t left = client->content_length - client->received;
+    int length = 0;
+
+    if ((client->content_length >= 0) && (left <= 0))
+    {
+        errno = 0;
+        return 0;
+    }
+    if ((client->content_length >= 0) && (len > left))
+    {
+        len = (int)left;
+    }
+    if (client->buffer_offset < client->buffer_length)
+    {
+        length = (int)(client->buffer_length - client->buffer_offset);
+        length = (length < len) ? length : len;
+        memcpy(buffer, client->buffer + client->buffer_offset, length);
+        client->buffer_offset += length;
+    }
+    else if (client->fd < 0)
+    {
+        errno = ENOTCONN;
+        return 0;
+    }
+    else
+    {
+        int64_t start = bench_time_us();
+        ssize_t received = recv(client->fd, buffer, len, 0);
+        BENCH_ADD(bench_stats.read_us, bench_time_us() - start);
+        if (received == 0)
+        {
+            http_disconnect(client);
+            client->error = ENOTCONN;
+            errno = ENOTCONN;
+            return 0;
+        }
+        if (received < 0)
+        {
+            client->error = errno;
+            ESP_LOGE(TAG, "Read failed, errno %d", errno);
+            return (errno == EAGAIN) ? -ESP_ERR_HTTP_EAGAIN : ESP_FAIL;
+        }
+        length = (int)received;
+    }
+
+    if (bench_stats.first_byte == 0)
+    {
+        bench_stats.first_byte = bench_time_us();
+    }
+    BENCH_ADD(bench_stats.bytes_read, length);
+    client->received += length;
+    if ((client->content_length >= 0) && (client->received >= client->content_length))
+    {
+        client->response_open = false;
+    }
+    http_event(client, HTTP_EVENT_ON_DATA, NULL, NULL);
+    return length;
+}
+
+esp_err_t esp_http_client_flush_response(esp_http_client_handle_t client, int* len)
+{
+    char buffer[512];
+    int total = 0;
+    int length;
+
+    while ((length = esp_http_client_read(client, buffer, sizeof(buffer))) > 0)
+    {
+        total += length;
+    }
+    if (len != NULL)
+    {
+        *len = total;
+    }
+    return (length < 0) ? ESP_FAIL : ESP_OK;
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client)
+{
+    esp_err_t err = esp_http_client_open(client, 0);
+
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (esp_http_client_fetch_headers(client) < 0 && client->status_code == 0)
+    {
+        return ESP_FAIL;
+    }
+    err = esp_http_client_flush_response(client, NULL);
+    http_event(client, HTTP_EVENT_ON_FINISH, NULL, NULL);
+    return err;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status_code;
+}
+
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client)
+{
+    return client->content_length;
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client)
+{
+    return (client->content_length >= 0) && (client->received >= client->content_length);
+}
+
+int esp_http_client_get_errno(esp_http_client_handle_t client)
+{
+    return client->error;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    http_disconnect(client);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    if (client != NULL)
+    {
+        http_disconnect(client);
+        bench_heap_add(-client->idf_buffers);
+        free(client);
+    }
+    return ESP_OK;
+}
+
+void bench_http_set_handshake_ms(uint32_t ms)
+{
+    bench_handshake_ms = ms;
+}
@@ -0,0 +1,367 @@
+/* *****************************************************************************
+ * File:   bench_httpd.c
+ * Author: DL
+ *
+ * Created on 2024 05 13
+ *
+ * Description: ota host bench, esp_http_server over plain tcp
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "bench.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "esp_http_server.h"
+#include "esp_log.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "bench_httpd"
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define BENCH_HTTPD_CONNECTIONS     16
+#define BENCH_HTTPD_HANDLERS        8
+#define BENCH_HTTPD_REQUEST_SIZE    2048
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef struct
+{
+    int fd;
+    pthread_t thread;
+    httpd_uri_t handlers[BENCH_HTTPD_HANDLERS];
+    int handler_count;
+    int connections[BENCH_HTTPD_CONNECTIONS];
+    int active;
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+    pthread_mutex_t request_lock;   /* one request at a time, as the single server task */
+}bench_httpd_t;
+
+typedef struct
+{
+    httpd_req_t req;
+    int fd;
+    char* headers;              /* the header lines of the request */
+}bench_httpd_req_t;
+
+typedef struct
+{
+    bench_httpd_t* server;
+    int fd;
+}bench_httpd_connection_t;
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static size_t httpd_read_request(int fd, char* buffer, size_t size)
+{
+    size_t length = 0;
+
+    while (length < size - 1)
+    {
+        ssize_t received = recv(fd, buffer + length, size - 1 - length, 0);
+        if (received <= 0)
+        {
+            return 0;
+        }
+        length += received;
+        buffer[length] = '\0';
+        if (strstr(buffer, "\r\n\r\n") != NULL)
+        {
+            return length;
+        }
+    }
+    return 0;
+}
+
+static void httpd_send_status(int fd, const char* status)
+{
+    char response[128];
+    int length = snprintf(response, sizeof(response), "HTTP/1.1 %s\r\nContent-Length: 0\r\n\r\n", status);
+    send(fd, response, length, MSG_NOSIGNAL);
+}
+
+/* false when the connection is to be closed */
+static bool httpd_serve(bench_httpd_t* server, int fd, char* buffer)
+{
+    bench_httpd_req_t request;
+    char method[8] = "";
+    char* path = NULL;
+    const httpd_uri_t* handler = NULL;
+
+    memset(&request, 0, sizeof(request));
+    request.fd = fd;
+    request.req.handle = server;
+    request.req.aux = &request;
+    request.headers = strstr(buffer, "\r\n");
+    sscanf(buffer, "%7s", method);
+    request.req.method = (strcmp(method, "GET") == 0) ? HTTP_GET : (strcmp(method, "HEAD") == 0) ? HTTP_HEAD :
+                         (strcmp(method, "POST") == 0) ? HTTP_POST : (strcmp(method, "PUT") == 0) ? HTTP_PUT : -1;
+    path = strchr(buffer, ' ');
+    if ((path != NULL) && (request.headers != NULL))
+    {
+        path++;
+        size_t length = strcspn(path, " ?\r");
+        memcpy((char*)request.req.uri, path, (length < sizeof(request.req.uri) - 1) ? length : sizeof(request.req.uri) - 1);
+    }
+    for (int index = 0; index < server->handler_count; index++)
+    {
+        if ((server->handlers[index].method == request.req.method) && (strcmp(server->handlers[index].uri, request.req.uri) == 0))
+        {
+            handler = &server->handlers[index];
+        }
+    }
+    if (handler == NULL)
+    {
+        httpd_send_status(fd, "404 Not Found");
+        return true;
+    }
+    request.req.user_ctx = handler->user_ctx;
+
+    pthread_mutex_lock(&server->request_lock);
+    esp_err_t err = handler->handler(&request.req);
+    pthread_mutex_unlock(&server->request_lock);
+    return (err == ESP_OK) && (strcasestr(request.headers, "\r\nConnection: close") == NULL);
+}
+
+static void* httpd_connection(void* argument)
+{
+    bench_httpd_connection_t connection = *(bench_httpd_connection_t*)argument;
+    bench_httpd_t* server = connection.server;
+    char buffer[BENCH_HTTPD_REQUEST_SIZE];
+
+    free(argument);
+    while (httpd_read_request(connection.fd, buffer, sizeof(buffer)) > 0)
+    {
+        if (httpd_serve(server, connection.fd, buffer) == false)
+        {
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&server->lock);
+    for (int index = 0; index < BENCH_HTTPD_CONNECTIONS; index++)
+    {
+        if (server->connections[index] == connection.fd)
+        {
+            server->connections[index] = -1;
+        }
+    }
+    server->active--;
+    pthread_cond_broadcast(&server->idle);
+    pthread_mutex_unlock(&server->lock);
+    close(connection.fd);
+    return NULL;
+}
+
+static void* httpd_accept(void* argument)
+{
+    bench_httpd_t* server = argument;
+
+    while (1)
+    {
+        int fd = accept(server->fd, NULL, NULL);
+        if (fd < 0)
+        {
+            break;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        bool stored = false;
+        pthread_mutex_lock(&server->lock);
+        for (int index = 0; (stored == false) && (index < BENCH_HTTPD_CONNECTIONS); index++)
+        {
+            if (server->connections[index] < 0)
+            {
+                server->connections[index] = fd;
+                server->active++;
+                stored = true;
+            }
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        bench_httpd_connection_t* connection = malloc(sizeof(*connection));
+        pthread_t thread;
+        if ((stored == false) || (connection == NULL))
+        {
+            free(connection);
+            close(fd);
+            continue;
+        }
+        connection->server = server;
+        connection->fd = fd;
+        if (pthread_create(&thread, NULL, httpd_connection, connection) != 0)
+        {
+            free(connection);
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+/* *****************************************************************************
+ * esp_http_server
+ **************************************************************************** */
+esp_err_t httpd_start(httpd_handle_t* handle, const httpd_config_t* config)
+{
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = htons(config->server_port), .sin_addr.s_addr = htonl(INADDR_ANY) };
+    bench_httpd_t* server = calloc(1, sizeof(*server));
+    int one = 1;
+
+    if (server == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->idle, NULL);
+    pthread_mutex_init(&server->request_lock, NULL);
+    for (int index = 0; index < BENCH_HTTPD_CONNECTIONS; index++)
+    {
+        server->connections[index] = -1;
+    }
+    server->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->fd >= 0)
+    {
+        setsockopt(server->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if ((server->fd < 0) ||
+        (bind(server->fd, (struct sockaddr*)&address, sizeof(address)) != 0) ||
+        (listen(server->fd, config->backlog_conn) != 0) ||
+        (pthread_create(&server->thread, NULL, httpd_accept, server) != 0))
+    {
+        ESP_LOGE(TAG, "Port %u not available", (unsigned int)config->server_port);
+        if (server->fd >= 0)
+        {
+            close(server->fd);
+        }
+        free(server);
+        return ESP_ERR_HTTPD_TASK;
+    }
+    *handle = server;
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+    bench_httpd_t* server = handle;
+
+    if (server == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    shutdown(server->fd, SHUT_RDWR);
+    close(server->fd);
+    pthread_join(server->thread, NULL);
+    pthread_mutex_lock(&server->lock);
+    for (int index = 0; index < BENCH_HTTPD_CONNECTIONS; index++)
+    {
+        if (server->connections[index] >= 0)
+        {
+            shutdown(server->connections[index], SHUT_RDWR);
+        }
+    }
+    while (server->active > 0)
+    {
+        pthread_cond_wait(&server->idle, &server->lock);
+    }
+    pthread_mutex_unlock(&server->lock);
+    free(server);
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t* uri_handler)
+{
+    bench_httpd_t* server = handle;
+
+    if ((server == NULL) || (server->handler_count >= BENCH_HTTPD_HANDLERS))
+    {
+        return ESP_ERR_HTTPD_HANDLERS_FULL;
+    }
+    server->handlers[server->handler_count++] = *uri_handler;
+    return ESP_OK;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t* r, const char* field, char* val, size_t val_size)
+{
+    bench_httpd_req_t* request = r->aux;
+    size_t field_length = strlen(field);
+
+    for (const char* line = request->headers; (line != NULL) && (line[2] != '\r') && (line[2] != '\0');)
+    {
+        line += 2;
+        const char* next = strstr(line, "\r\n");
+        if ((strncasecmp(line, field, field_length) == 0) && (line[field_length] == ':'))
+        {
+            const char* value = line + field_length + 1;
+            while (*value == ' ')
+            {
+                value++;
+            }
+            size_t length = (next != NULL) ? (size_t)(next - value) : strlen(value);
+            if (length >= val_size)
+            {
+                strlcpy(val, value, val_size);
+                return ESP_ERR_HTTPD_RESULT_TRUNC;
+            }
+            memcpy(val, value, length);
+            val[length] = '\0';
+            return ESP_OK;
+        }
+        line = next;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+int httpd_send(httpd_req_t* r, const char* buf, size_t buf_len)
+{
+    bench_httpd_req_t* request = r->aux;
+    size_t sent = 0;
+
+    while (sent < buf_len)
+    {
+        ssize_t length = send(request->fd, buf + sent, buf_len - sent, MSG_NOSIGNAL);
+        if (length <= 0)
+        {
+            return HTTPD_SOCK_ERR_FAIL;
+        }
+        sent += length;
+    }
+    return (int)sent;
+}
@@ -0,0 +1,928 @@
+/* *****************************************************************************
+ * File:   bench_main.c
+ * Author: DL
+ *
+ * Created on 2024 03 25
+ *
+ * Description: ota host bench, runs ota_task against the loopback server
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "bench.h"
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <sdkconfig.h>
+#include "drv_ota.h"
+#include "drv_ota_resume.h"
+#include "esp_app_format.h"
+#include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mbedtls/sha256.h"
+
+#if BENCH_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define BENCH_IMAGE_SIZE_DEFAULT    (1024 * 1024)
+#define BENCH_PARTITION_SIZE        (2 * 1024 * 1024)
+#define BENCH_SEGMENTS              4
+#define BENCH_URL_SIZE              256
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef struct
+{
+    uint8_t* data;
+    size_t size;
+}bench_buffer_t;
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+#define MS(us)                  ((double)(us) / 1000.0)
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+/* ota_ca_cert.pem is embedded on the target, the bench has no tls */
+const uint8_t bench_ca_cert_start[] asm("_binary_ota_ca_cert_pem_start") = "";
+const uint8_t bench_ca_cert_end[] asm("_binary_ota_ca_cert_pem_end") = "";
+
+static uint32_t bench_random_state = 0x12345678;
+static bool bench_ota_stats = false;
+static bool bench_reboot = false;
+static uint32_t bench_process_ms = 0;
+static const char* bench_url = NULL;
+static uint32_t bench_mirror_s = 0;
+static uint32_t bench_preerase_ms = 0;
+static int bench_checks = 0;
+static int bench_validate_count = -1;
+static uint32_t bench_validate_ms = 0;
+static char bench_validate_last = '\0';
+static uint32_t bench_validate_ticket = 0;
+static int32_t bench_activate_ms = -1;
+static volatile int64_t bench_activate_at = INT64_MAX;
+static uint32_t bench_interrupt_at = 0;
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Images
+ **************************************************************************** */
+static uint32_t bench_random(void)
+{
+    bench_random_state ^= bench_random_state << 13;
+    bench_random_state ^= bench_random_state >> 17;
+    bench_random_state ^= bench_random_state << 5;
+    return bench_random_state;
+}
+
+/* roughly as compressible as firmware: short random runs between repeats */
+static void bench_fill_code(uint8_t* data, size_t size)
+{
+    size_t offset = 0;
+
+    while (offset < size)
+    {
+        uint32_t choice = bench_random();
+        size_t length = 4 + (choice >> 8) % 29;
+        length = (length < size - offset) ? length : size - offset;
+        if ((offset >= 4096) && (choice & 1))
+        {
+            size_t distance = 4 + (bench_random() % 4092);
+            for (size_t index = 0; index < length; index++)
+            {
+                data[offset + index] = data[offset + index - distance];
+            }
+        }
+        else
+        {
+            for (size_t index = 0; index < length; index++)
+            {
+                data[offset + index] = (uint8_t)bench_random();
+            }
+        }
+        offset += length;
+    }
+}
+
+/* checksum after the segments, padded to 16 bytes, then the appended sha-256 */
+static size_t bench_seal_image(uint8_t* data)
+{
+    const esp_image_header_t* header = (const esp_image_header_t*)data;
+    size_t offset = sizeof(*header);
+    uint8_t checksum = 0xEF;
+    mbedtls_sha256_context sha;
+
+    for (int segment = 0; segment < header->segment_count; segment++)
+    {
+        esp_image_segment_header_t segment_header;
+        memcpy(&segment_header, data + offset, sizeof(segment_header));
+        offset += sizeof(segment_header);
+        for (size_t index = 0; index < segment_header.data_len; index++)
+        {
+            checksum ^= data[offset + index];
+        }
+        offset += segment_header.data_len;
+    }
+    offset = (offset + 16) & ~(size_t)15;
+    data[offset - 1] = checksum;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, data, offset);
+    mbedtls_sha256_finish(&sha, data + offset);
+    mbedtls_sha256_free(&sha);
+    return offset + 32;
+}
+
+/* a valid esp image with the app description at the start of the first segment */
+static bench_buffer_t bench_make_image(size_t size, const char* version)
+{
+    bench_buffer_t image = { .data = NULL, .size = 0 };
+    uint8_t* data = calloc(1, size + 64);
+    esp_image_header_t* header = (esp_image_header_t*)data;
+    size_t offset = sizeof(*header);
+
+    if (data == NULL)
+    {
+        return image;
+    }
+    header->magic = ESP_IMAGE_HEADER_MAGIC;
+    header->segment_count = BENCH_SEGMENTS;
+    header->spi_mode = 2;
+    header->entry_addr = 0x40080000;
+    header->wp_pin = 0xEE;
+    header->hash_appended = 1;
+
+    bench_random_state = 0x12345678;
+    size_t segment_size = ((size - offset - 64) / BENCH_SEGMENTS) & ~(size_t)3;
+    for (int segment = 0; segment < BENCH_SEGMENTS; segment++)
+    {
+        esp_image_segment_header_t segment_header = { .load_addr = 0x3F400020 + segment * 0x100000, .data_len = segment_size };
+        memcpy(data + offset, &segment_header, sizeof(segment_header));
+        offset += sizeof(segment_header);
+        bench_fill_code(data + offset, segment_size);
+        if (segment == 0)
+        {
+            esp_app_desc_t* app_desc = (esp_app_desc_t*)(data + offset);
+            memset(app_desc, 0, sizeof(*app_desc));
+            app_desc->magic_word = ESP_APP_DESC_MAGIC_WORD;
+            strlcpy(app_desc->version, version, sizeof(app_desc->version));
+            strlcpy(app_desc->project_name, "ota_host_bench", sizeof(app_desc->project_name));
+            strlcpy(app_desc->idf_ver, "v5.1-host", sizeof(app_desc->idf_ver));
+        }
+        offset += segment_size;
+    }
+    image.data = data;
+    image.size = bench_seal_image(data);
+    return image;
+}
+
+/* the base with a few scattered edits, as a patch release would be */
+static bench_buffer_t bench_make_update(size_t size, const char* version)
+{
+    bench_buffer_t image = bench_make_image(size, version);
+
+    if (image.data != NULL)
+    {
+        bench_random_state = 0x9E3779B9;
+        for (int edit = 0; edit < 64; edit++)
+        {
+            size_t offset = 512 + bench_random() % (image.size - 1024);
+            image.data[offset] ^= (uint8_t)(bench_random() | 1);
+        }
+        bench_seal_image(image.data);
+    }
+    return image;
+}
+
+static bench_buffer_t bench_load(const char* path)
+{
+    bench_buffer_t buffer = { .data = NULL, .size = 0 };
+    FILE* file = fopen(path, "rb");
+
+    if (file == NULL)
+    {
+        perror(path);
+        return buffer;
+    }
+    fseek(file, 0, SEEK_END);
+    buffer.size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    buffer.data = malloc(buffer.size);
+    if ((buffer.data == NULL) || (fread(buffer.data, 1, buffer.size, file) != buffer.size))
+    {
+        free(buffer.data);
+        buffer.data = NULL;
+        buffer.size = 0;
+    }
+    fclose(file);
+    return buffer;
+}
+
+static bool bench_save(const char* prefix, const char* name, const bench_buffer_t* buffer)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s%s", prefix, name);
+    FILE* file = fopen(path, "wb");
+
+    if ((file == NULL) || (fwrite(buffer->data, 1, buffer->size, file) != buffer->size))
+    {
+        perror(path);
+        if (file != NULL)
+        {
+            fclose(file);
+        }
+        return false;
+    }
+    fclose(file);
+    printf("%s written\n", path);
+    return true;
+}
+
+static void bench_sha256_hex(const bench_buffer_t* buffer, char* hex)
+{
+    mbedtls_sha256_context sha;
+    uint8_t digest[32];
+
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    mbedtls_sha256_update(&sha, buffer->data, buffer->size);
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    for (int index = 0; index < 32; index++)
+    {
+        sprintf(&hex[index * 2], "%02x", digest[index]);
+    }
+}
+
+#if BENCH_HAVE_ZLIB
+static bench_buffer_t bench_gzip(const bench_buffer_t* input)
+{
+    bench_buffer_t output = { .data = NULL, .size = 0 };
+    z_stream stream = { 0 };
+
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return output;
+    }
+    size_t capacity = deflateBound(&stream, input->size);
+    output.data = malloc(capacity);
+    stream.next_in = input->data;
+    stream.avail_in = input->size;
+    stream.next_out = output.data;
+    stream.avail_out = capacity;
+    if (deflate(&stream, Z_FINISH) == Z_STREAM_END)
+    {
+        output.size = stream.total_out;
+    }
+    deflateEnd(&stream);
+    return output;
+}
+#endif
+
+/* *****************************************************************************
+ * Processes
+ **************************************************************************** */
+/* a subsystem which takes a while to drain and to come back */
+static void bench_process_func(void)
+{
+    vTaskDelay(pdMS_TO_TICKS(bench_process_ms));
+}
+
+/*
+ * count:ms[:resources], resources as letters of flash, network, cpu and psram.
+ * With a leading s registered one after another as before dependencies existed.
+ */
+static bool bench_register_processes(const char* spec)
+{
+    static char names[CONFIG_DRV_OTA_MAX_START_STOP_PROCESSES][DRV_OTA_PROCESS_NAME_SIZE];
+    static int registered = 0;
+    bool sequential = (spec[0] == 's');
+    int count = 0;
+    unsigned int ms = 0;
+    char letters[8] = "";
+    uint32_t resources = 0;
+
+    if (sscanf(sequential ? &spec[1] : spec, "%d:%u:%7s", &count, &ms, letters) < 2)
+    {
+        return false;
+    }
+    for (const char* letter = letters; *letter != '\0'; letter++)
+    {
+        resources |= (*letter == 'f') ? DRV_OTA_RESOURCE_FLASH : (*letter == 'n') ? DRV_OTA_RESOURCE_NETWORK :
+                     (*letter == 'c') ? DRV_OTA_RESOURCE_CPU : (*letter == 'p') ? DRV_OTA_RESOURCE_PSRAM : 0;
+    }
+    bench_process_ms = ms;
+    for (int index = registered; (index < registered + count) && (index < CONFIG_DRV_OTA_MAX_START_STOP_PROCESSES); index++)
+    {
+        snprintf(names[index], sizeof(names[index]), "process%d%s%s", index, (letters[0] != '\0') ? "_" : "", letters);
+        if (sequential)
+        {
+            drv_ota_register_start_stop_process(bench_process_func, bench_process_func, names[index]);
+        }
+        else
+        {
+            drv_ota_process_config_t config = { .name = names[index], .start_func = bench_process_func, .stop_func = bench_process_func, .resources = resources };
+            drv_ota_register_process(&config);
+        }
+    }
+    registered += count;
+    return true;
+}
+
+/* *****************************************************************************
+ * Sources
+ **************************************************************************** */
+/* the file:// source of the driver, counted like the reads of the http client */
+static const drv_ota_source_t* bench_file_source = NULL;
+
+static esp_err_t bench_source_open(const char* path, void** context, int64_t* size)
+{
+    return bench_file_source->open(path, context, size);
+}
+
+static int bench_source_read(void* context, char* buffer, size_t size)
+{
+    int64_t start = bench_time_us();
+    int length = bench_file_source->read(context, buffer, size);
+
+    BENCH_ADD(bench_stats.read_us, bench_time_us() - start);
+    if (length > 0)
+    {
+        if (bench_stats.first_byte == 0)
+        {
+            bench_stats.first_byte = bench_time_us();
+        }
+        BENCH_ADD(bench_stats.bytes_read, length);
+    }
+    return length;
+}
+
+static void bench_source_close(void* context)
+{
+    bench_file_source->close(context);
+}
+
+static void bench_register_sources(void)
+{
+    static drv_ota_source_t source =
+    {
+        .scheme = "file",
+        .open = bench_source_open,
+        .read = bench_source_read,
+        .close = bench_source_close,
+    };
+
+    bench_file_source = drv_ota_source_find("file://", NULL);
+    if (bench_file_source != NULL)
+    {
+        drv_ota_source_register(&source);
+    }
+}
+
+/* *****************************************************************************
+ * Validation
+ **************************************************************************** */
+/* a subsystem coming up after the boot, the last one to return fails or hangs with -Y */
+static esp_err_t bench_validate_func(void)
+{
+    uint32_t ticket = BENCH_ADD(bench_validate_ticket, 1);
+
+    vTaskDelay(pdMS_TO_TICKS(bench_validate_ms));
+    if ((ticket == (uint32_t)bench_validate_count) && (bench_validate_last == 't'))
+    {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_DRV_OTA_VALIDATE_TIMEOUT_MS * 2));
+    }
+    return ((ticket == (uint32_t)bench_validate_count) && (bench_validate_last == 'f')) ? ESP_FAIL : ESP_OK;
+}
+
+/* count:ms[:f|t] */
+static bool bench_register_validate(const char* spec)
+{
+    static char names[DRV_OTA_VALIDATE_MAX_CHECKS][DRV_OTA_VALIDATE_NAME_SIZE];
+    unsigned int ms = 0;
+
+    if ((sscanf(spec, "%d:%u:%c", &bench_validate_count, &ms, &bench_validate_last) < 2) ||
+        (bench_validate_count < 0) || (bench_validate_count > DRV_OTA_VALIDATE_MAX_CHECKS))
+    {
+        return false;
+    }
+    bench_validate_ms = ms;
+    for (int index = 0; index < bench_validate_count; index++)
+    {
+        snprintf(names[index], sizeof(names[index]), "check%d", index);
+        drv_ota_validate_register(names[index], bench_validate_func);
+    }
+    return true;
+}
+
+/* the first boot of the image a run installed, false if it did not end as -Y asked for */
+static bool bench_validate(void)
+{
+    drv_ota_validate_record_t record;
+
+    bench_stats.restarted = false;
+    bench_validate_ticket = 0;
+    int64_t boot = bench_time_us();
+    if ((bench_flash_boot_pending() != ESP_OK) || (drv_ota_validate_start() != ESP_OK))
+    {
+        printf("first boot: validation not started\n");
+        return false;
+    }
+    bench_task_wait("ota_validate");
+    int64_t decided = bench_time_us() - boot;
+    drv_ota_validate_get_record(&record);
+    bool rollback = (bench_validate_last == 'f') || (bench_validate_last == 't');
+    printf("first boot: %s in %.1f ms, %s, %d checks of %u ms each\n", drv_ota_validate_result_name(record.result), MS(decided),
+           bench_stats.restarted ? "rolled back" : "kept", bench_validate_count, (unsigned int)bench_validate_ms);
+    if (bench_ota_stats)
+    {
+        drv_ota_validate_print();
+    }
+    return (bench_stats.restarted == rollback) && (drv_ota_validate_pending() == false);
+}
+
+#if CONFIG_DRV_OTA_DEFERRED_ACTIVATION
+/* *****************************************************************************
+ * Activation
+ **************************************************************************** */
+/* the application allows the restart -A ms after the image was staged */
+static bool bench_safe_to_reboot(void* arg)
+{
+    return bench_time_us() >= bench_activate_at;
+}
+
+/* the image a run staged, false if it was not activated or before -A allowed it */
+static bool bench_activate(void)
+{
+    int64_t staged = bench_time_us();
+    int64_t wait_us = ((bench_activate_ms > 0) ? (int64_t)bench_activate_ms * 1000 : 0) + 5000000;
+
+    if (bench_activate_ms >= 0)
+    {
+        bench_activate_at = staged + (int64_t)bench_activate_ms * 1000;
+    }
+    while ((bench_stats.restarted == false) && (bench_time_us() - staged < wait_us))
+    {
+        vTaskDelay(1);
+    }
+    int64_t activated = bench_time_us();
+    bench_task_wait("ota_activate");
+    bool early = (bench_activate_ms >= 0) && (activated < bench_activate_at);
+    printf("activation: %s %.1f ms after the download%s\n", bench_stats.restarted ? "restarted" : "NOT restarted", MS(activated - staged),
+           (bench_activate_ms >= 0) ? ((early) ? ", before the application allowed it" : ", once the application allowed it") : ", no callback");
+    bench_activate_at = INT64_MAX;
+    return bench_stats.restarted && (early == false) && (esp_ota_get_boot_partition() != esp_ota_get_running_partition()) && (drv_ota_activate_pending() == false);
+}
+#endif
+
+#if CONFIG_DRV_OTA_RESUME
+/* *****************************************************************************
+ * Resume
+ **************************************************************************** */
+static uint32_t bench_resume_stored(void)
+{
+    drv_ota_resume_state_t state;
+
+    return (drv_ota_resume_load(&state) == ESP_OK) ? state.written : 0;
+}
+
+/*
+ * The run cut off by -I keeps its progress, the next one asks for the rest from
+ * there and writes the served image, or with -c rejects it and drops the progress.
+ * False if the run did not end that way, failed is set for a run meant to fail.
+ */
+static bool bench_resume_check(const bench_server_config_t* server, uint32_t stored, bool ok, bool* failed)
+{
+    uint32_t kept = bench_resume_stored();
+
+    if (server->cut_after > 0)
+    {
+        printf("resume: cut off at %u bytes, %u bytes kept for the next run\n", (unsigned int)server->cut_after, (unsigned int)kept);
+        *failed = (ok == false) && (bench_stats.restarted == false) && (kept > 0) && (kept <= server->cut_after);
+        return false;
+    }
+    printf("resume: %u bytes kept, requested from %u\n", (unsigned int)stored, (unsigned int)bench_stats.first_offset);
+    if (bench_stats.first_offset != stored)
+    {
+        return false;
+    }
+    if ((server->corrupt_at > 0) && (server->corrupt_at >= stored))
+    {
+        printf("resume: corrupted image %s, %u bytes kept\n", ok ? "installed" : "rejected", (unsigned int)kept);
+        *failed = (ok == false) && (kept == 0);
+        return false;
+    }
+    bool same = ok && bench_flash_update_equals(server->data, server->size);
+    printf("resume: image written %s the served one\n", same ? "is" : "is NOT");
+    return same;
+}
+#endif
+
+/* *****************************************************************************
+ * Run
+ **************************************************************************** */
+static void bench_usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -i file     image or patch served, default a synthesized image\n"
+            "  -b file     image in the running partition, default a synthesized one\n"
+            "  -p file     image left in the update partition by an earlier update, base or\n"
+            "              image for the running or the served one, default erased\n"
+            "  -s bytes    size of the synthesized images (%d)\n"
+            "  -z coding   Content-Encoding sent, gzip compresses the image if needed\n"
+            "  -r KB/s     server rate limit, 0 unlimited\n"
+            "  -l ms       server latency per response\n"
+            "  -d bytes    drop the connection once after this many bytes\n"
+            "  -c byte     flip this byte of the body once, 0 never\n"
+            "  -I bytes    the server of the first run stops after this many bytes, the next\n"
+            "              runs keep flash and nvs and resume, -c is for the second run and\n"
+            "              has it rejected, needs -DOTA_BENCH_RESUME=ON\n"
+            "  -m file     manifest served for <url>.manifest, e.g. from tools/drv_ota_manifest.py\n"
+            "  -H sha256   X-Image-SHA256 header sent, auto for the SHA-256 of the image\n"
+            "              before compression\n"
+            "  -E us       flash erase time per 4 KB sector, about 25000 on spi nor\n"
+            "  -W us       flash program time per KB, about 1500\n"
+            "  -R us       flash read time per KB, about 50\n"
+            "  -n runs     number of runs (1)\n"
+            "  -f file     flash file (ota_bench_flash.bin)\n"
+            "  -o prefix   save the images as <prefix>base.bin and <prefix>image.bin and exit,\n"
+            "              e.g. for tools/drv_ota_delta.py\n"
+            "  -q n:ms[:r] register n processes each taking ms to stop and start, contending\n"
+            "              for r of f(lash), n(etwork), c(pu), p(sram), default all, sn:ms\n"
+            "              registers them one after another with the old call, may repeat with\n"
+            "              the ms of the last one\n"
+            "  -u url      update from this url, e.g. the mirror of another bench, instead of the\n"
+            "              loopback server\n"
+            "  -M s        after a good run serve the update with drv_ota_mirror_start() on port\n"
+            "              %d for s seconds, before the activation with -A\n"
+            "  -e ms       run drv_ota_preerase_start() up to ms before the update, the rest is\n"
+            "              erased ahead of the writes\n"
+            "  -C n        call drv_ota_check_available() n times before each run\n"
+            "  -T ms       time of a full TLS handshake on each new connection, a session\n"
+            "              resumed by the same client is taken as free\n"
+            "  -Y n:ms[:x] after a good run boot the new image and validate it with n checks each\n"
+            "              taking ms, the last one f(ails) or t(imes out), needs\n"
+            "              -DOTA_BENCH_VALIDATE=ON\n"
+            "  -A ms       after a good run the application allows the restart ms later, needs\n"
+            "              -DOTA_BENCH_DEFERRED=ON, without it the image is activated at once\n"
+            "  -B          the image served runs after a good run, the next runs poll a server\n"
+            "              with nothing new\n"
+            "  -S          print drv_ota_print_stats() after each run\n"
+            "  -v          ota logs at info level, -vv debug\n",
+            name, BENCH_IMAGE_SIZE_DEFAULT, CONFIG_DRV_OTA_MIRROR_PORT);
+}
+
+static void bench_mirror(void)
+{
+    if ((bench_mirror_s > 0) && (drv_ota_mirror_start(NULL) == ESP_OK))
+    {
+        printf("mirror on http://127.0.0.1:%d%s for %u s\n", CONFIG_DRV_OTA_MIRROR_PORT, CONFIG_DRV_OTA_MIRROR_URI, (unsigned int)bench_mirror_s);
+        vTaskDelay(pdMS_TO_TICKS(bench_mirror_s * 1000));
+        drv_ota_mirror_stop();
+    }
+}
+
+static bool bench_run(const bench_server_config_t* server, const bench_buffer_t* base, const bench_buffer_t* previous, const char* flash_path, const bench_flash_timing_t* timing, int run)
+{
+    /* the same url each run, for what drv_ota keeps of the last one */
+    static uint16_t port = 0;
+    static char url[BENCH_URL_SIZE];
+    bool keep = (bench_interrupt_at > 0) && (run > 1);
+
+    if ((bench_flash_init(flash_path, BENCH_PARTITION_SIZE, timing, keep) != ESP_OK) ||
+        (bench_flash_load_running(base->data, base->size) != ESP_OK) ||
+        ((previous->data != NULL) && (bench_flash_load_update(previous->data, previous->size) != ESP_OK)) ||
+        ((bench_url == NULL) && (bench_server_start(server, &port) != ESP_OK)))
+    {
+        return false;
+    }
+    if (bench_url != NULL)
+    {
+        strlcpy(url, bench_url, sizeof(url));
+    }
+    else
+    {
+        snprintf(url, sizeof(url), "http://127.0.0.1:%u/firmware.bin", port);
+    }
+
+    #if CONFIG_DRV_OTA_PREERASE
+    if ((bench_preerase_ms > 0) && (drv_ota_preerase_start() == ESP_OK))
+    {
+        int64_t preerase_start = bench_time_us();
+        while (drv_ota_preerase_active() && (bench_time_us() - preerase_start < (int64_t)bench_preerase_ms * 1000))
+        {
+            vTaskDelay(1);
+        }
+        printf("pre-erase %u KB in %.1f ms before the update\n", (unsigned int)(drv_ota_preerase_get_erased() / 1024), MS(bench_time_us() - preerase_start));
+    }
+    #endif
+
+    for (int check_index = 0; check_index < bench_checks; check_index++)
+    {
+        drv_ota_check_t check;
+        memset(&bench_stats, 0, sizeof(bench_stats));
+        int64_t check_start = bench_time_us();
+        esp_err_t err = drv_ota_check_available(url, &check);
+        printf("check %d: %s in %.1f ms, %s %s%s, %llu bytes received\n", check_index + 1, esp_err_to_name(err), MS(bench_time_us() - check_start),
+               (err == ESP_OK) ? check.app.version : "-", (err == ESP_OK) ? drv_ota_check_result_name(check.result) : "-",
+               ((err == ESP_OK) && check.not_modified) ? " (not modified)" : "", (unsigned long long)bench_stats.bytes_read);
+    }
+
+    #if CONFIG_DRV_OTA_RESUME
+    uint32_t stored = bench_resume_stored();
+    #endif
+    memset(&bench_stats, 0, sizeof(bench_stats));
+    bench_heap_reset_peak();
+    size_t heap_before = bench_heap_used();
+    bench_stats.start = bench_time_us();
+    drv_ota_create_task(url);
+    int64_t quiesce = bench_time_us() - bench_stats.start;
+    bench_task_wait("ota_task");
+    bench_stats.end = bench_time_us();
+    size_t heap_peak = bench_heap_peak() - heap_before;
+    /* of ota_task, a deferred activation adds its own */
+    int64_t finish_us = bench_stats.finish_us;
+
+    /* base is the served image once a -B run installed it */
+    bool up_to_date = (base->data == server->data);
+    #if CONFIG_DRV_OTA_DEFERRED_ACTIVATION
+    /* the image is staged, the activation may already have run without a callback */
+    bool ok = up_to_date ? ((esp_ota_get_boot_partition() == esp_ota_get_running_partition()) && (bench_stats.restarted == false))
+                         : (drv_ota_activate_pending() || bench_stats.restarted);
+    #else
+    bool ok = up_to_date ? ((esp_ota_get_boot_partition() == esp_ota_get_running_partition()) && (bench_stats.restarted == false))
+                         : ((esp_ota_get_boot_partition() != esp_ota_get_running_partition()) && bench_stats.restarted);
+    #endif
+    if (bench_url == NULL)
+    {
+        bench_server_stop();
+    }
+    bool failed = false;
+    #if CONFIG_DRV_OTA_RESUME
+    if (bench_interrupt_at > 0)
+    {
+        ok = bench_resume_check(server, stored, ok, &failed);
+    }
+    #endif
+    #if CONFIG_DRV_OTA_DEFERRED_ACTIVATION
+    if (ok && (up_to_date == false))
+    {
+        /* the staged image is served until the application allows the restart */
+        bench_mirror();
+        ok = bench_activate();
+    }
+    #endif
+    #if CONFIG_DRV_OTA_VALIDATE
+    if (ok && (up_to_date == false) && (bench_validate_count >= 0))
+    {
+        ok = bench_validate();
+    }
+    #endif
+    #if CONFIG_DRV_OTA_DEFERRED_ACTIVATION
+    if (ok && up_to_date)
+    #else
+    if (ok)
+    #endif
+    {
+        bench_mirror();
+    }
+    #if CONFIG_DRV_OTA_PREERASE
+    drv_ota_preerase_stop();
+    #endif
+    bench_flash_deinit();
+
+    int64_t total = bench_stats.end - bench_stats.start;
+    int64_t header = (bench_stats.begin_done > bench_stats.first_byte) ? bench_stats.begin_done - bench_stats.first_byte : 0;
+    int64_t download = (bench_stats.first_byte > 0) ? bench_stats.end - bench_stats.first_byte - finish_us : 0;
+
+    /* bytes per us is MB/s */
+    printf("run %d: %s in %.1f ms, %.2f MB/s received, %.2f MB/s written\n", run, ok ? (up_to_date ? "up to date" : "ok") : (failed ? "failed as meant to" : "FAILED"), MS(total),
+           (total > 0) ? (double)bench_stats.bytes_read / (double)total : 0.0,
+           (total > 0) ? (double)bench_stats.bytes_written / (double)total : 0.0);
+    printf("  quiesce     %9.1f ms  (stopping processes in drv_ota_create_task)\n", MS(quiesce));
+    printf("  connect     %9.1f ms  (%u connections, %u resumed, %u requests)\n", MS(bench_stats.connect_us), (unsigned int)bench_stats.connections,
+           (unsigned int)bench_stats.resumed, (unsigned int)bench_stats.requests);
+    printf("  header      %9.1f ms  (first byte to esp_ota_begin done)\n", MS(header));
+    printf("  download    %9.1f ms  (%.1f ms blocked in read)\n", MS(download), MS(bench_stats.read_us));
+    printf("  write       %9.1f ms  (%llu bytes written, %llu erased)\n", MS(bench_stats.flash_us),
+           (unsigned long long)bench_stats.bytes_written, (unsigned long long)bench_stats.bytes_erased);
+    printf("  finish      %9.1f ms  (esp_ota_end and esp_ota_set_boot_partition)\n", MS(finish_us));
+    printf("  peak heap   %9zu bytes\n", heap_peak);
+    if (bench_ota_stats)
+    {
+        drv_ota_print_stats();
+        drv_ota_print_processes();
+    }
+    return ok || failed;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* image_path = NULL;
+    const char* base_path = NULL;
+    const char* previous_path = NULL;
+    const char* manifest_path = NULL;
+    const char* flash_path = "ota_bench_flash.bin";
+    const char* save_prefix = NULL;
+    size_t image_size = BENCH_IMAGE_SIZE_DEFAULT;
+    bench_flash_timing_t timing = { 0 };
+    bench_server_config_t server = { 0 };
+    int verbose = 0;
+    int runs = 1;
+    int failed = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "i:b:p:q:s:z:r:l:d:c:I:m:H:E:W:R:n:f:o:u:M:e:C:T:Y:A:BSvh")) != -1)
+    {
+        switch (option)
+        {
+        case 'i': image_path = optarg; break;
+        case 'b': base_path = optarg; break;
+        case 'p': previous_path = optarg; break;
+        case 'q':
+            if (bench_register_processes(optarg) == false)
+            {
+                bench_usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 's': image_size = strtoul(optarg, NULL, 0); break;
+        case 'z': server.content_encoding = optarg; break;
+        case 'r': server.rate_kb_s = strtoul(optarg, NULL, 0); break;
+        case 'l': server.latency_ms = strtoul(optarg, NULL, 0); break;
+        case 'd': server.drop_after = strtoul(optarg, NULL, 0); break;
+        case 'c': server.corrupt_at = strtoul(optarg, NULL, 0); break;
+        case 'I': bench_interrupt_at = strtoul(optarg, NULL, 0); break;
+        case 'm': manifest_path = optarg; break;
+        case 'H': server.image_sha256 = optarg; break;
+        case 'E': timing.erase_us = strtoul(optarg, NULL, 0); break;
+        case 'W': timing.write_us = strtoul(optarg, NULL, 0); break;
+        case 'R': timing.read_us = strtoul(optarg, NULL, 0); break;
+        case 'n': runs = atoi(optarg); break;
+        case 'f': flash_path = optarg; break;
+        case 'o': save_prefix = optarg; break;
+        case 'u': bench_url = optarg; break;
+        case 'M': bench_mirror_s = strtoul(optarg, NULL, 0); break;
+        case 'C': bench_checks = atoi(optarg); break;
+        case 'e': bench_preerase_ms = strtoul(optarg, NULL, 0); break;
+        case 'Y':
+            if (bench_register_validate(optarg) == false)
+            {
+                bench_usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'A': bench_activate_ms = atoi(optarg); break;
+        case 'T': bench_http_set_handshake_ms(strtoul(optarg, NULL, 0)); break;
+        case 'B': bench_reboot = true; break;
+        case 'S': bench_ota_stats = true; break;
+        case 'v': verbose++; break;
+        default:
+            bench_usage(argv[0]);
+            return 2;
+        }
+    }
+    if ((image_size < 4096) || (image_size > BENCH_PARTITION_SIZE - 4096))
+    {
+        fprintf(stderr, "image size out of range\n");
+        return 2;
+    }
+    #if CONFIG_DRV_OTA_RESUME == 0
+    if (bench_interrupt_at > 0)
+    {
+        fprintf(stderr, "-I needs -DOTA_BENCH_RESUME=ON\n");
+        return 2;
+    }
+    #endif
+    signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    bench_log_set_level((verbose >= 2) ? ESP_LOG_DEBUG : (verbose == 1) ? ESP_LOG_INFO : ESP_LOG_WARN);
+
+    bench_buffer_t base = (base_path != NULL) ? bench_load(base_path) : bench_make_image(image_size, "1.0.0");
+    bench_buffer_t image = (image_path != NULL) ? bench_load(image_path) : bench_make_update(image_size, "1.0.1");
+    if ((base.data == NULL) || (image.data == NULL))
+    {
+        return 1;
+    }
+    bench_buffer_t previous = { 0 };
+    if (previous_path != NULL)
+    {
+        const bench_buffer_t* same = (strcmp(previous_path, "base") == 0) ? &base : (strcmp(previous_path, "image") == 0) ? &image : NULL;
+        if (same != NULL)
+        {
+            previous.data = malloc(same->size);
+            if (previous.data != NULL)
+            {
+                memcpy(previous.data, same->data, same->size);
+                previous.size = same->size;
+            }
+        }
+        else
+        {
+            previous = bench_load(previous_path);
+        }
+        if (previous.data == NULL)
+        {
+            return 1;
+        }
+    }
+    if (save_prefix != NULL)
+    {
+        return (bench_save(save_prefix, "base.bin", &base) && bench_save(save_prefix, "image.bin", &image)) ? 0 : 1;
+    }
+    bench_buffer_t manifest = { 0 };
+    if (manifest_path != NULL)
+    {
+        manifest = bench_load(manifest_path);
+        if (manifest.data == NULL)
+        {
+            return 1;
+        }
+        server.manifest = manifest.data;
+        server.manifest_size = manifest.size;
+    }
+    static char image_sha256[65];
+    if ((server.image_sha256 != NULL) && (strcmp(server.image_sha256, "auto") == 0))
+    {
+        bench_sha256_hex(&image, image_sha256);
+        server.image_sha256 = image_sha256;
+    }
+    if ((server.content_encoding != NULL) && (strcasecmp(server.content_encoding, "gzip") == 0) &&
+        ((image.size < 2) || (image.data[0] != 0x1F) || (image.data[1] != 0x8B)))
+    {
+        #if BENCH_HAVE_ZLIB
+        bench_buffer_t compressed = bench_gzip(&image);
+        if (compressed.size == 0)
+        {
+            return 1;
+        }
+        printf("image gzip compressed %zu to %zu bytes\n", image.size, compressed.size);
+        free(image.data);
+        image = compressed;
+        #else
+        fprintf(stderr, "built without zlib, pass a gzip file with -i\n");
+        return 2;
+        #endif
+    }
+    server.data = image.data;
+    server.size = image.size;
+
+    printf("ota host bench, %s, %zu bytes served\n", BENCH_MODE_NAME, image.size);
+    bench_heap_set_base();
+    drv_ota_init();
+    bench_register_sources();
+    #if CONFIG_DRV_OTA_DEFERRED_ACTIVATION
+    if (bench_activate_ms >= 0)
+    {
+        drv_ota_activate_set_callback(bench_safe_to_reboot, NULL);
+    }
+    #endif
+    const bench_buffer_t* running = &base;
+    for (int run = 1; run <= runs; run++)
+    {
+        bench_server_config_t run_server = server;
+        if (bench_interrupt_at > 0)
+        {
+            run_server.cut_after = (run == 1) ? bench_interrupt_at : 0;
+            run_server.corrupt_at = (run == 2) ? server.corrupt_at : 0;
+        }
+        bool ok = bench_run(&run_server, running, &previous, flash_path, &timing, run);
+        failed += (ok == false);
+        if (ok && bench_reboot)
+        {
+            running = &image;
+        }
+    }
+    free(base.data);
+    free(previous.data);
+    free(image.data);
+    free(manifest.data);
+    return (failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,60 @@
+/* *****************************************************************************
+ * File:   bench_pk.c
+ * Author: DL
+ *
+ * Created on 2024 05 20
+ *
+ * Description: ota host bench, mbedtls public key stand-in over openssl
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include <openssl/bio.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+
+#include "mbedtls/pk.h"
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+void mbedtls_pk_init(mbedtls_pk_context *ctx)
+{
+    ctx->pk_ctx = NULL;
+}
+
+void mbedtls_pk_free(mbedtls_pk_context *ctx)
+{
+    EVP_PKEY_free(ctx->pk_ctx);
+    ctx->pk_ctx = NULL;
+}
+
+/* keylen counts the terminating null of a pem key as with mbedtls */
+int mbedtls_pk_parse_public_key(mbedtls_pk_context *ctx, const unsigned char *key, size_t keylen)
+{
+    if ((keylen == 0) || (key[keylen - 1] != '\0'))
+    {
+        return MBEDTLS_ERR_PK_KEY_INVALID_FORMAT;
+    }
+    BIO* bio = BIO_new_mem_buf(key, (int)keylen - 1);
+    ctx->pk_ctx = (bio != NULL) ? PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL) : NULL;
+    BIO_free(bio);
+    return (ctx->pk_ctx != NULL) ? 0 : MBEDTLS_ERR_PK_KEY_INVALID_FORMAT;
+}
+
+int mbedtls_pk_verify(mbedtls_pk_context *ctx, mbedtls_md_type_t md_alg, const unsigned char *hash, size_t hash_len, const unsigned char *sig, size_t sig_len)
+{
+    if ((ctx->pk_ctx == NULL) || (md_alg != MBEDTLS_MD_SHA256))
+    {
+        return MBEDTLS_ERR_PK_BAD_INPUT_DATA;
+    }
+    EVP_PKEY_CTX* verify = EVP_PKEY_CTX_new(ctx->pk_ctx, NULL);
+    int ok = (verify != NULL) &&
+             (EVP_PKEY_verify_init(verify) > 0) &&
+             (EVP_PKEY_CTX_set_signature_md(verify, EVP_sha256()) > 0) &&
+             (EVP_PKEY_verify(verify, sig, sig_len, hash, hash_len) == 1);
+    EVP_PKEY_CTX_free(verify);
+    return ok ? 0 : MBEDTLS_ERR_RSA_VERIFY_FAILED;
+}
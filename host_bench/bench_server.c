@@ -0,0 +1,447 @@
+/* *****************************************************************************
+ * File:   bench_server.c
+ * Author: DL
+ *
+ * Created on 2024 03 25
+ *
+ * Description: ota host bench, loopback http server for the image
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "bench.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+#define TAG "bench_server"
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define BENCH_SERVER_CONNECTIONS    16
+#define BENCH_SERVER_REQUEST_SIZE   2048
+#define BENCH_SERVER_CHUNK_SIZE     1460
+#define BENCH_SERVER_LAST_MODIFIED  "Mon, 25 Mar 2024 12:00:00 GMT"
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef struct
+{
+    char method[8];
+    bool manifest;              /* <path>.manifest requested */
+    bool has_range;
+    size_t range_start;
+    size_t range_end;           /* inclusive */
+    char if_range[64];
+    char if_none_match[64];
+    char if_modified_since[32];
+    bool close;
+}bench_request_t;
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+static bench_server_config_t server_config;
+static char server_etag[32];
+static int server_fd = -1;
+static pthread_t server_thread;
+static int server_connections[BENCH_SERVER_CONNECTIONS];
+static pthread_mutex_t server_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool server_dropped = false;
+static bool server_cut = false;
+static bool server_corrupted = false;
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Functions
+ **************************************************************************** */
+static bool server_send_all(int fd, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static void server_sleep_us(int64_t us)
+{
+    if (us > 0)
+    {
+        struct timespec delay = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+        nanosleep(&delay, NULL);
+    }
+}
+
+/* returns the length of one request read into buffer, 0 when the client is gone */
+static size_t server_read_request(int fd, char* buffer, size_t size)
+{
+    size_t length = 0;
+
+    while (length < size - 1)
+    {
+        ssize_t received = recv(fd, buffer + length, size - 1 - length, 0);
+        if (received <= 0)
+        {
+            return 0;
+        }
+        length += received;
+        buffer[length] = '\0';
+        if (strstr(buffer, "\r\n\r\n") != NULL)
+        {
+            return length;
+        }
+    }
+    return 0;
+}
+
+static void server_parse_request(char* buffer, bench_request_t* request)
+{
+    char path[256] = "";
+
+    memset(request, 0, sizeof(*request));
+    sscanf(buffer, "%7s %255s", request->method, path);
+    size_t path_length = strlen(path);
+    request->manifest = (path_length > 9) && (strcmp(&path[path_length - 9], ".manifest") == 0);
+    for (char* line = strstr(buffer, "\r\n"); (line != NULL) && (line[2] != '\r');)
+    {
+        line += 2;
+        char* next = strstr(line, "\r\n");
+        *next = '\0';
+        if (strncasecmp(line, "Range: bytes=", 13) == 0)
+        {
+            unsigned long long start = 0;
+            unsigned long long end = 0;
+            int fields = sscanf(line + 13, "%llu-%llu", &start, &end);
+            request->has_range = (fields >= 1);
+            request->range_start = start;
+            request->range_end = (fields == 2) ? end : SIZE_MAX;
+        }
+        else if (strncasecmp(line, "If-Range: ", 10) == 0)
+        {
+            strlcpy(request->if_range, line + 10, sizeof(request->if_range));
+        }
+        else if (strncasecmp(line, "If-None-Match: ", 15) == 0)
+        {
+            strlcpy(request->if_none_match, line + 15, sizeof(request->if_none_match));
+        }
+        else if (strncasecmp(line, "If-Modified-Since: ", 19) == 0)
+        {
+            strlcpy(request->if_modified_since, line + 19, sizeof(request->if_modified_since));
+        }
+        else if (strncasecmp(line, "Connection: close", 17) == 0)
+        {
+            request->close = true;
+        }
+        *next = '\r';
+        line = next;
+    }
+}
+
+/* paced to rate_kb_s, the connection is dropped once after drop_after bytes and for good after cut_after */
+static bool server_send_body(int fd, size_t start, size_t length)
+{
+    int64_t begin = bench_time_us();
+    size_t sent = 0;
+
+    while (sent < length)
+    {
+        size_t chunk = length - sent;
+        chunk = (chunk < BENCH_SERVER_CHUNK_SIZE) ? chunk : BENCH_SERVER_CHUNK_SIZE;
+
+        pthread_mutex_lock(&server_lock);
+        bool drop = (server_config.drop_after > 0) && (server_dropped == false) && (start + sent + chunk > server_config.drop_after);
+        if (drop)
+        {
+            server_dropped = true;
+            chunk = (server_config.drop_after > start + sent) ? server_config.drop_after - (start + sent) : 0;
+        }
+        bool cut = (server_config.cut_after > 0) && (start + sent + chunk > server_config.cut_after);
+        if (cut)
+        {
+            server_cut = true;
+            chunk = (server_config.cut_after > start + sent) ? server_config.cut_after - (start + sent) : 0;
+        }
+        pthread_mutex_unlock(&server_lock);
+
+        const char* data = (const char*)server_config.data + start + sent;
+        char corrupted[BENCH_SERVER_CHUNK_SIZE];
+        pthread_mutex_lock(&server_lock);
+        if ((server_config.corrupt_at > 0) && (server_corrupted == false) &&
+            (start + sent <= server_config.corrupt_at) && (server_config.corrupt_at < start + sent + chunk))
+        {
+            server_corrupted = true;
+            memcpy(corrupted, data, chunk);
+            corrupted[server_config.corrupt_at - (start + sent)] ^= 0x55;
+            data = corrupted;
+            ESP_LOGW(TAG, "Corrupting byte %u", (unsigned int)server_config.corrupt_at);
+        }
+        pthread_mutex_unlock(&server_lock);
+
+        if ((chunk > 0) && (server_send_all(fd, data, chunk) == false))
+        {
+            return false;
+        }
+        sent += chunk;
+        if (drop || cut)
+        {
+            ESP_LOGW(TAG, "%s connection at %u", cut ? "Cutting" : "Dropping", (unsigned int)(start + sent));
+            return false;
+        }
+        if (server_config.rate_kb_s > 0)
+        {
+            int64_t due = begin + (int64_t)sent * 1000000 / ((int64_t)server_config.rate_kb_s * 1024);
+            server_sleep_us(due - bench_time_us());
+        }
+    }
+    return true;
+}
+
+static void server_respond(int fd, const bench_request_t* request, bool* keep_open)
+{
+    char header[512];
+    size_t start = 0;
+    size_t length = server_config.size;
+    int status = 200;
+    const char* reason = "OK";
+    int header_length;
+
+    if (request->manifest)
+    {
+        server_sleep_us((int64_t)server_config.latency_ms * 1000);
+        if (server_config.manifest == NULL)
+        {
+            header_length = snprintf(header, sizeof(header), "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+            *keep_open = server_send_all(fd, header, header_length) && (request->close == false);
+            return;
+        }
+        header_length = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Length: %u\r\nConnection: %s\r\n\r\n",
+                                 (unsigned int)server_config.manifest_size, request->close ? "close" : "keep-alive");
+        bool sent = server_send_all(fd, header, header_length);
+        if (sent && (strcmp(request->method, "HEAD") != 0))
+        {
+            sent = server_send_all(fd, (const char*)server_config.manifest, server_config.manifest_size);
+        }
+        *keep_open = sent && (request->close == false);
+        return;
+    }
+
+    pthread_mutex_lock(&server_lock);
+    bool cut = server_cut;
+    pthread_mutex_unlock(&server_lock);
+    if (cut)
+    {
+        header_length = snprintf(header, sizeof(header), "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+        *keep_open = server_send_all(fd, header, header_length) && (request->close == false);
+        return;
+    }
+
+    /* If-None-Match wins over If-Modified-Since, a date is taken as unchanged only if it is the same */
+    if ((request->if_none_match[0] != '\0') ? (strcmp(request->if_none_match, server_etag) == 0) :
+        (strcmp(request->if_modified_since, BENCH_SERVER_LAST_MODIFIED) == 0))
+    {
+        header_length = snprintf(header, sizeof(header), "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nContent-Length: 0\r\n\r\n", server_etag);
+        server_sleep_us((int64_t)server_config.latency_ms * 1000);
+        *keep_open = server_send_all(fd, header, header_length) && (request->close == false);
+        return;
+    }
+
+    if (request->has_range && ((request->if_range[0] == '\0') || (strcmp(request->if_range, server_etag) == 0)))
+    {
+        if (request->range_start >= server_config.size)
+        {
+            status = 416;
+            reason = "Range Not Satisfiable";
+            length = 0;
+        }
+        else
+        {
+            size_t end = (request->range_end < server_config.size) ? request->range_end : server_config.size - 1;
+            status = 206;
+            reason = "Partial Content";
+            start = request->range_start;
+            length = end + 1 - start;
+        }
+    }
+
+    header_length = snprintf(header, sizeof(header), "HTTP/1.1 %d %s\r\nContent-Length: %u\r\nETag: %s\r\nLast-Modified: %s\r\nAccept-Ranges: bytes\r\nConnection: %s\r\n",
+                             status, reason, (unsigned int)length, server_etag, BENCH_SERVER_LAST_MODIFIED, request->close ? "close" : "keep-alive");
+    if (status == 206)
+    {
+        header_length += snprintf(header + header_length, sizeof(header) - header_length, "Content-Range: bytes %u-%u/%u\r\n",
+                                  (unsigned int)start, (unsigned int)(start + length - 1), (unsigned int)server_config.size);
+    }
+    if (server_config.image_sha256 != NULL)
+    {
+        header_length += snprintf(header + header_length, sizeof(header) - header_length, "X-Image-SHA256: %s\r\n", server_config.image_sha256);
+    }
+    if (server_config.content_encoding != NULL)
+    {
+        header_length += snprintf(header + header_length, sizeof(header) - header_length, "Content-Encoding: %s\r\n", server_config.content_encoding);
+    }
+    header_length += snprintf(header + header_length, sizeof(header) - header_length, "\r\n");
+
+    server_sleep_us((int64_t)server_config.latency_ms * 1000);
+    bool sent = server_send_all(fd, header, header_length);
+    if (sent && (strcmp(request->method, "HEAD") != 0))
+    {
+        if (BENCH_ADD(bench_stats.image_requests, 1) == 1)
+        {
+            bench_stats.first_offset = (uint32_t)start;
+        }
+        sent = server_send_body(fd, start, length);
+    }
+    *keep_open = sent && (request->close == false);
+}
+
+static void* server_connection(void* argument)
+{
+    int fd = (int)(intptr_t)argument;
+    char buffer[BENCH_SERVER_REQUEST_SIZE];
+    bench_request_t request;
+    bool keep_open = true;
+
+    while (keep_open && (server_read_request(fd, buffer, sizeof(buffer)) > 0))
+    {
+        server_parse_request(buffer, &request);
+        server_respond(fd, &request, &keep_open);
+    }
+
+    pthread_mutex_lock(&server_lock);
+    for (int index = 0; index < BENCH_SERVER_CONNECTIONS; index++)
+    {
+        if (server_connections[index] == fd)
+        {
+            server_connections[index] = -1;
+        }
+    }
+    pthread_mutex_unlock(&server_lock);
+    close(fd);
+    return NULL;
+}
+
+static void* server_accept(void* argument)
+{
+    (void)argument;
+    while (1)
+    {
+        int fd = accept(server_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            break;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        bool stored = false;
+        pthread_mutex_lock(&server_lock);
+        for (int index = 0; (stored == false) && (index < BENCH_SERVER_CONNECTIONS); index++)
+        {
+            if (server_connections[index] < 0)
+            {
+                server_connections[index] = fd;
+                stored = true;
+            }
+        }
+        pthread_mutex_unlock(&server_lock);
+
+        pthread_t thread;
+        if ((stored == false) || (pthread_create(&thread, NULL, server_connection, (void*)(intptr_t)fd) != 0))
+        {
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+esp_err_t bench_server_start(const bench_server_config_t* config, uint16_t* port)
+{
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = htons(*port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t address_length = sizeof(address);
+    uint32_t hash = 2166136261u;
+    int reuse = 1;
+
+    server_config = *config;
+    server_dropped = false;
+    server_cut = false;
+    server_corrupted = false;
+    for (size_t index = 0; index < config->size; index++)
+    {
+        hash = (hash ^ config->data[index]) * 16777619u;
+    }
+    snprintf(server_etag, sizeof(server_etag), "\"%08x-%x\"", (unsigned int)hash, (unsigned int)config->size);
+    for (int index = 0; index < BENCH_SERVER_CONNECTIONS; index++)
+    {
+        server_connections[index] = -1;
+    }
+
+    server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if ((server_fd < 0) ||
+        (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0) ||
+        (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) != 0) ||
+        (listen(server_fd, BENCH_SERVER_CONNECTIONS) != 0) ||
+        (getsockname(server_fd, (struct sockaddr*)&address, &address_length) != 0))
+    {
+        perror("bench server");
+        return ESP_FAIL;
+    }
+    *port = ntohs(address.sin_port);
+    if (pthread_create(&server_thread, NULL, server_accept, NULL) != 0)
+    {
+        close(server_fd);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void bench_server_stop(void)
+{
+    shutdown(server_fd, SHUT_RDWR);
+    close(server_fd);
+    pthread_join(server_thread, NULL);
+    pthread_mutex_lock(&server_lock);
+    for (int index = 0; index < BENCH_SERVER_CONNECTIONS; index++)
+    {
+        if (server_connections[index] >= 0)
+        {
+            shutdown(server_connections[index], SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&server_lock);
+    server_fd = -1;
+}
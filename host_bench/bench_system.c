@@ -0,0 +1,591 @@
+/* *****************************************************************************
+ * File:   bench_system.c
+ * Author: DL
+ *
+ * Created on 2024 03 25
+ *
+ * Description: ota host bench, log, timer, heap, nvs and sha-256 stand-ins
+ *
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Header Includes
+ **************************************************************************** */
+#include "bench.h"
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_cpu.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include "nvs.h"
+
+/* *****************************************************************************
+ * Configuration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Constants and Macros Definitions
+ **************************************************************************** */
+#define BENCH_HEAP_SIZE         (320 * 1024)    /* internal ram left to applications on an esp32 */
+#define BENCH_NVS_ENTRIES       16
+#define BENCH_NVS_KEY_SIZE      32
+#define BENCH_NVS_VALUE_SIZE    512
+
+/* *****************************************************************************
+ * Enumeration Definitions
+ **************************************************************************** */
+
+/* *****************************************************************************
+ * Type Definitions
+ **************************************************************************** */
+typedef struct
+{
+    char key[BENCH_NVS_KEY_SIZE];
+    uint8_t value[BENCH_NVS_VALUE_SIZE];
+    size_t length;
+    bool used;
+}bench_nvs_entry_t;
+
+/* *****************************************************************************
+ * Function-Like Macros
+ **************************************************************************** */
+#define ROTR(x, n)      (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* *****************************************************************************
+ * Variables Definitions
+ **************************************************************************** */
+bench_stats_t bench_stats;
+
+static esp_log_level_t bench_log_level = ESP_LOG_WARN;
+static pthread_mutex_t bench_log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long bench_heap_current = 0;
+static long bench_heap_max = 0;
+static long bench_heap_min_free = BENCH_HEAP_SIZE;
+static long bench_heap_base = 0;           /* held by the bench itself, e.g. the images */
+
+static bench_nvs_entry_t bench_nvs[BENCH_NVS_ENTRIES];
+static pthread_mutex_t bench_nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const uint32_t sha256_k[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/* *****************************************************************************
+ * Prototype of functions definitions
+ **************************************************************************** */
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+/* *****************************************************************************
+ * Time and log
+ **************************************************************************** */
+int64_t bench_time_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    static int64_t boot = 0;
+    if (boot == 0)
+    {
+        boot = bench_time_us();
+    }
+    return bench_time_us() - boot;
+}
+
+/* the cpu cycle counter runs at 1 GHz on the bench */
+uint32_t esp_cpu_get_cycle_count(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000000000 + now.tv_nsec);
+}
+
+uint32_t esp_rom_get_cpu_ticks_per_us(void)
+{
+    return 1000;
+}
+
+void bench_log_set_level(esp_log_level_t level)
+{
+    bench_log_level = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...)
+{
+    va_list args;
+
+    (void)tag;
+    if (level > bench_log_level)
+    {
+        return;
+    }
+    pthread_mutex_lock(&bench_log_lock);
+    fprintf(stderr, "%8.3f ", (double)esp_timer_get_time() / 1000000.0);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    pthread_mutex_unlock(&bench_log_lock);
+}
+
+const char* esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK:                    return "ESP_OK";
+    case ESP_FAIL:                  return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:            return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:       return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:     return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:      return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:         return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:     return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:           return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE:  return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC:       return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION:   return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_NOT_FINISHED:      return "ESP_ERR_NOT_FINISHED";
+    case 0x1503:                    return "ESP_ERR_OTA_VALIDATE_FAILED";
+    case 0x1102:                    return "ESP_ERR_NVS_NOT_FOUND";
+    case 0x7002:                    return "ESP_ERR_HTTP_CONNECT";
+    default:                        return "UNKNOWN ERROR";
+    }
+}
+
+/* *****************************************************************************
+ * Heap, every malloc of the process is counted (linked with --wrap)
+ **************************************************************************** */
+static void bench_heap_count(void* ptr, int sign)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+    bench_heap_add(sign * (long)malloc_usable_size(ptr));
+}
+
+void bench_heap_add(long size)
+{
+    long current = __atomic_add_fetch(&bench_heap_current, size, __ATOMIC_RELAXED);
+    long peak = __atomic_load_n(&bench_heap_max, __ATOMIC_RELAXED);
+    while ((current > peak) && !__atomic_compare_exchange_n(&bench_heap_max, &peak, current, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+    long free_size = BENCH_HEAP_SIZE - (current - __atomic_load_n(&bench_heap_base, __ATOMIC_RELAXED));
+    long min_free = __atomic_load_n(&bench_heap_min_free, __ATOMIC_RELAXED);
+    while ((free_size < min_free) && !__atomic_compare_exchange_n(&bench_heap_min_free, &min_free, free_size, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+/* what is allocated so far is not on the device, the free heap counts from here */
+void bench_heap_set_base(void)
+{
+    long current = __atomic_load_n(&bench_heap_current, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&bench_heap_base, current, __ATOMIC_RELAXED);
+    __atomic_store_n(&bench_heap_min_free, BENCH_HEAP_SIZE, __ATOMIC_RELAXED);
+}
+
+void bench_heap_reset_peak(void)
+{
+    __atomic_store_n(&bench_heap_max, __atomic_load_n(&bench_heap_current, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+size_t bench_heap_used(void)
+{
+    return (size_t)__atomic_load_n(&bench_heap_current, __ATOMIC_RELAXED);
+}
+
+size_t bench_heap_peak(void)
+{
+    return (size_t)__atomic_load_n(&bench_heap_max, __ATOMIC_RELAXED);
+}
+
+void* __wrap_malloc(size_t size)
+{
+    void* ptr = __real_malloc(size);
+    bench_heap_count(ptr, 1);
+    return ptr;
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    void* ptr = __real_calloc(count, size);
+    bench_heap_count(ptr, 1);
+    return ptr;
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    bench_heap_count(ptr, -1);
+    void* result = __real_realloc(ptr, size);
+    bench_heap_count((result != NULL) ? result : ptr, 1);
+    return result;
+}
+
+void __wrap_free(void* ptr)
+{
+    bench_heap_count(ptr, -1);
+    __real_free(ptr);
+}
+
+void* heap_caps_malloc(size_t size, uint32_t caps)
+{
+    (void)caps;
+    return malloc(size);
+}
+
+void* heap_caps_calloc(size_t count, size_t size, uint32_t caps)
+{
+    (void)caps;
+    return calloc(count, size);
+}
+
+void* heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps)
+{
+    (void)alignment;
+    (void)caps;
+    return malloc(size);
+}
+
+void heap_caps_free(void* ptr)
+{
+    free(ptr);
+}
+
+void heap_caps_aligned_free(void* ptr)
+{
+    free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    (void)caps;
+    long free_size = BENCH_HEAP_SIZE - ((long)bench_heap_used() - __atomic_load_n(&bench_heap_base, __ATOMIC_RELAXED));
+    return (free_size > 0) ? (size_t)free_size : 0;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    (void)caps;
+    long min_free = __atomic_load_n(&bench_heap_min_free, __ATOMIC_RELAXED);
+    return (min_free > 0) ? (size_t)min_free : 0;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return heap_caps_get_free_size(caps);
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return (uint32_t)heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return (uint32_t)heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+}
+
+/* *****************************************************************************
+ * nvs, one namespace kept in ram for the life of the process
+ **************************************************************************** */
+static bench_nvs_entry_t* bench_nvs_find(const char* key)
+{
+    for (int index = 0; index < BENCH_NVS_ENTRIES; index++)
+    {
+        if (bench_nvs[index].used && (strcmp(bench_nvs[index].key, key) == 0))
+        {
+            return &bench_nvs[index];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t nvs_open(const char* namespace_name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle)
+{
+    (void)namespace_name;
+    (void)open_mode;
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length)
+{
+    esp_err_t err = ESP_OK;
+
+    (void)handle;
+    pthread_mutex_lock(&bench_nvs_lock);
+    bench_nvs_entry_t* entry = bench_nvs_find(key);
+    if (entry == NULL)
+    {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    }
+    else if (out_value == NULL)
+    {
+        *length = entry->length;
+    }
+    else if (*length < entry->length)
+    {
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    else
+    {
+        memcpy(out_value, entry->value, entry->length);
+        *length = entry->length;
+    }
+    pthread_mutex_unlock(&bench_nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length)
+{
+    esp_err_t err = ESP_OK;
+
+    (void)handle;
+    if ((length > BENCH_NVS_VALUE_SIZE) || (strlen(key) >= BENCH_NVS_KEY_SIZE))
+    {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    pthread_mutex_lock(&bench_nvs_lock);
+    bench_nvs_entry_t* entry = bench_nvs_find(key);
+    for (int index = 0; (entry == NULL) && (index < BENCH_NVS_ENTRIES); index++)
+    {
+        if (bench_nvs[index].used == false)
+        {
+            entry = &bench_nvs[index];
+        }
+    }
+    if (entry == NULL)
+    {
+        err = ESP_ERR_NO_MEM;
+    }
+    else
+    {
+        strcpy(entry->key, key);
+        memcpy(entry->value, value, length);
+        entry->length = length;
+        entry->used = true;
+    }
+    pthread_mutex_unlock(&bench_nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out_value, size_t* length)
+{
+    return nvs_get_blob(handle, key, out_value, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value)
+{
+    return nvs_set_blob(handle, key, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char* key, uint32_t* out_value)
+{
+    size_t length = sizeof(*out_value);
+    return nvs_get_blob(handle, key, out_value, &length);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char* key, uint32_t value)
+{
+    return nvs_set_blob(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key)
+{
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+
+    (void)handle;
+    pthread_mutex_lock(&bench_nvs_lock);
+    bench_nvs_entry_t* entry = bench_nvs_find(key);
+    if (entry != NULL)
+    {
+        entry->used = false;
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&bench_nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    (void)handle;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    (void)handle;
+}
+
+/* *****************************************************************************
+ * sha-256, plain software, the esp32 digest runs on the sha accelerator
+ **************************************************************************** */
+static void sha256_block(mbedtls_sha256_context* ctx, const unsigned char* block)
+{
+    uint32_t w[64];
+    uint32_t s[8];
+
+    for (int index = 0; index < 16; index++)
+    {
+        w[index] = ((uint32_t)block[index * 4] << 24) | ((uint32_t)block[index * 4 + 1] << 16) |
+                   ((uint32_t)block[index * 4 + 2] << 8) | block[index * 4 + 3];
+    }
+    for (int index = 16; index < 64; index++)
+    {
+        uint32_t s0 = ROTR(w[index - 15], 7) ^ ROTR(w[index - 15], 18) ^ (w[index - 15] >> 3);
+        uint32_t s1 = ROTR(w[index - 2], 17) ^ ROTR(w[index - 2], 19) ^ (w[index - 2] >> 10);
+        w[index] = w[index - 16] + s0 + w[index - 7] + s1;
+    }
+    memcpy(s, ctx->state, sizeof(s));
+    for (int index = 0; index < 64; index++)
+    {
+        uint32_t t1 = s[7] + (ROTR(s[4], 6) ^ ROTR(s[4], 11) ^ ROTR(s[4], 25)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[index] + w[index];
+        uint32_t t2 = (ROTR(s[0], 2) ^ ROTR(s[0], 13) ^ ROTR(s[0], 22)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+        memmove(&s[1], &s[0], 7 * sizeof(s[0]));
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+    for (int index = 0; index < 8; index++)
+    {
+        ctx->state[index] += s[index];
+    }
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context* ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context* ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+void mbedtls_sha256_clone(mbedtls_sha256_context* dst, const mbedtls_sha256_context* src)
+{
+    *dst = *src;
+}
+
+int mbedtls_sha256_starts(mbedtls_sha256_context* ctx, int is224)
+{
+    static const uint32_t init[8] =
+    {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memset(ctx, 0, sizeof(*ctx));
+    memcpy(ctx->state, init, sizeof(init));
+    ctx->is224 = is224;
+    return 0;
+}
+
+int mbedtls_sha256_update(mbedtls_sha256_context* ctx, const unsigned char* input, size_t ilen)
+{
+    size_t fill = ctx->total[0] & 63;
+
+    ctx->total[0] += (uint32_t)ilen;
+    if (ctx->total[0] < ilen)
+    {
+        ctx->total[1]++;
+    }
+    while (ilen > 0)
+    {
+        size_t length = 64 - fill;
+        if (length > ilen)
+        {
+            length = ilen;
+        }
+        memcpy(&ctx->buffer[fill], input, length);
+        fill += length;
+        input += length;
+        ilen -= length;
+        if (fill == 64)
+        {
+            sha256_block(ctx, ctx->buffer);
+            fill = 0;
+        }
+    }
+    return 0;
+}
+
+int mbedtls_sha256_finish(mbedtls_sha256_context* ctx, unsigned char* output)
+{
+    uint64_t bits = (((uint64_t)ctx->total[1] << 32) | ctx->total[0]) * 8;
+    unsigned char pad[72] = { 0x80 };
+    size_t fill = ctx->total[0] & 63;
+    size_t pad_length = (fill < 56) ? (56 - fill) : (120 - fill);
+
+    for (int index = 0; index < 8; index++)
+    {
+        pad[pad_length + index] = (unsigned char)(bits >> (56 - index * 8));
+    }
+    mbedtls_sha256_update(ctx, pad, pad_length + 8);
+    for (int index = 0; index < 8; index++)
+    {
+        output[index * 4] = (unsigned char)(ctx->state[index] >> 24);
+        output[index * 4 + 1] = (unsigned char)(ctx->state[index] >> 16);
+        output[index * 4 + 2] = (unsigned char)(ctx->state[index] >> 8);
+        output[index * 4 + 3] = (unsigned char)ctx->state[index];
+    }
+    return 0;
+}
+
+/* *****************************************************************************
+ * Misc
+ **************************************************************************** */
+#ifndef HAVE_STRLCPY
+size_t strlcpy(char* dst, const char* src, size_t size)
+{
+    size_t length = strlen(src);
+    if (size > 0)
+    {
+        size_t copy = (length >= size) ? (size - 1) : length;
+        memcpy(dst, src, copy);
+        dst[copy] = '\0';
+    }
+    return length;
+}
+
+size_t strlcat(char* dst, const char* src, size_t size)
+{
+    size_t length = strnlen(dst, size);
+    if (length == size)
+    {
+        return size + strlen(src);
+    }
+    return length + strlcpy(&dst[length], src, size - length);
+}
+#endif
+
+/* the console is not part of the bench */
+void cmd_ota_register(void)
+{
+}
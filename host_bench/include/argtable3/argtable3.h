@@ -0,0 +1,17 @@
+#pragma once
+/* ota host bench: stand-in for argtable3/argtable3.h of esp-idf */
+#include <stdio.h>
+struct arg_hdr { int mincount; int maxcount; };
+struct arg_str { struct arg_hdr hdr; int count; const char **sval; };
+struct arg_int { struct arg_hdr hdr; int count; int *ival; };
+struct arg_lit { struct arg_hdr hdr; int count; };
+struct arg_end { struct arg_hdr hdr; int count; };
+struct arg_str *arg_strn(const char *shortopts, const char *longopts, const char *datatype, int mincount, int maxcount, const char *glossary);
+struct arg_str *arg_str0(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+struct arg_str *arg_str1(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+struct arg_int *arg_int0(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+struct arg_int *arg_int1(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+struct arg_lit *arg_lit0(const char *shortopts, const char *longopts, const char *glossary);
+struct arg_end *arg_end(int maxerrors);
+int arg_parse(int argc, char **argv, void **argtable);
+void arg_print_errors(FILE *fp, struct arg_end *end, const char *progname);
@@ -0,0 +1,8 @@
+#pragma once
+/* ota host bench: stand-in for bootloader_common.h of esp-idf */
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_flash_partitions.h"
+uint32_t bootloader_common_ota_select_crc(const esp_ota_select_entry_t *s);
+bool bootloader_common_ota_select_valid(const esp_ota_select_entry_t *s);
+int bootloader_common_get_active_otadata(esp_ota_select_entry_t *two_otadata);
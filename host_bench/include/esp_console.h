@@ -0,0 +1,12 @@
+#pragma once
+/* ota host bench: stand-in for esp_console.h of esp-idf */
+#include "esp_err.h"
+typedef int (*esp_console_cmd_func_t)(int argc, char **argv);
+typedef struct {
+    const char *command;
+    const char *help;
+    const char *hint;
+    esp_console_cmd_func_t func;
+    void *argtable;
+} esp_console_cmd_t;
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t *cmd);
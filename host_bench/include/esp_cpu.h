@@ -0,0 +1,5 @@
+#pragma once
+/* ota host bench: stand-in for esp_cpu.h of esp-idf, one cycle per ns */
+#include <stdint.h>
+typedef uint32_t esp_cpu_cycle_count_t;
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void);
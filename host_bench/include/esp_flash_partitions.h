@@ -0,0 +1,16 @@
+#pragma once
+/* ota host bench: stand-in for esp_flash_partitions.h of esp-idf */
+#include <stdint.h>
+#include "esp_partition.h"
+#define ESP_BOOTLOADER_OFFSET 0x1000
+#define ESP_PARTITION_TABLE_OFFSET 0x8000
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+} esp_partition_pos_t;
+typedef struct {
+    uint32_t ota_seq;
+    uint8_t  seq_label[20];
+    uint32_t ota_state;
+    uint32_t crc;
+} esp_ota_select_entry_t;
@@ -0,0 +1,4 @@
+#pragma once
+/* ota host bench: stand-in for esp_idf_version.h of esp-idf */
+#define ESP_IDF_VERSION_VAL(major, minor, patch) ((major << 16) | (minor << 8) | (patch))
+#define ESP_IDF_VERSION ESP_IDF_VERSION_VAL(5, 1, 0)
@@ -0,0 +1,15 @@
+#pragma once
+/* ota host bench: stand-in for esp_image_format.h of esp-idf */
+#include "esp_app_format.h"
+#include "esp_err.h"
+#include "esp_flash_partitions.h"
+#define ESP_ERR_IMAGE_BASE 0x2000
+#define ESP_ERR_IMAGE_INVALID (ESP_ERR_IMAGE_BASE + 2)
+typedef enum { ESP_IMAGE_VERIFY, ESP_IMAGE_VERIFY_SILENT } esp_image_load_mode_t;
+typedef struct {
+    uint32_t start_addr;
+    esp_image_header_t image;
+    uint32_t image_len;
+    uint8_t image_digest[32];
+} esp_image_metadata_t;
+esp_err_t esp_image_verify(esp_image_load_mode_t mode, const esp_partition_pos_t *part, esp_image_metadata_t *data);
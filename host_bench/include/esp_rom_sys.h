@@ -0,0 +1,4 @@
+#pragma once
+/* ota host bench: stand-in for esp_rom_sys.h of esp-idf */
+#include <stdint.h>
+uint32_t esp_rom_get_cpu_ticks_per_us(void);
@@ -0,0 +1,8 @@
+#pragma once
+/* ota host bench: stand-in for esp_system.h of esp-idf */
+#include "esp_err.h"
+#include <stdint.h>
+/* returns on the bench, so ota_task runs its cleanup and can be started again */
+void esp_restart(void);
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
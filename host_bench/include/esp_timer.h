@@ -0,0 +1,4 @@
+#pragma once
+/* ota host bench: stand-in for esp_timer.h of esp-idf */
+#include <stdint.h>
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,17 @@
+#pragma once
+/* ota host bench: stand-in for mbedtls/pk.h of esp-idf, verify only */
+#include <stddef.h>
+#define MBEDTLS_ERR_PK_KEY_INVALID_FORMAT   -0x3D00
+#define MBEDTLS_ERR_PK_BAD_INPUT_DATA       -0x3E80
+#define MBEDTLS_ERR_RSA_VERIFY_FAILED       -0x4380
+typedef enum {
+    MBEDTLS_MD_NONE = 0,
+    MBEDTLS_MD_SHA256 = 6,
+} mbedtls_md_type_t;
+typedef struct mbedtls_pk_context {
+    void *pk_ctx;
+} mbedtls_pk_context;
+void mbedtls_pk_init(mbedtls_pk_context *ctx);
+void mbedtls_pk_free(mbedtls_pk_context *ctx);
+int mbedtls_pk_parse_public_key(mbedtls_pk_context *ctx, const unsigned char *key, size_t keylen);
+int mbedtls_pk_verify(mbedtls_pk_context *ctx, mbedtls_md_type_t md_alg, const unsigned char *hash, size_t hash_len, const unsigned char *sig, size_t sig_len);
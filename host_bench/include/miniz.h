@@ -0,0 +1,56 @@
+#pragma once
+/* ota host bench: stand-in for miniz.h of esp-idf, the ROM tinfl on top of zlib inflate */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+#define TINFL_LZ_DICT_SIZE 32768
+#define TINFL_FLAG_PARSE_ZLIB_HEADER 1
+#define TINFL_FLAG_HAS_MORE_INPUT 2
+
+typedef enum {
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2,
+} tinfl_status;
+
+/* padded to the size of the ROM decompressor so heap figures compare */
+typedef struct {
+    z_stream zs;
+    int started;
+    uint8_t pad[11000 - sizeof(z_stream)];
+} tinfl_decompressor;
+
+#define tinfl_init(r) do { (r)->started = 0; } while (0)
+
+/* zlib keeps its own window, the circular output buffer is only written */
+static inline tinfl_status tinfl_decompress(tinfl_decompressor *r, const uint8_t *in, size_t *in_size,
+        uint8_t *out_start, uint8_t *out_next, size_t *out_size, int flags)
+{
+    (void)out_start;
+    if (!r->started) {
+        memset(&r->zs, 0, sizeof(r->zs));
+        inflateInit2(&r->zs, (flags & TINFL_FLAG_PARSE_ZLIB_HEADER) ? 15 : -15);
+        r->started = 1;
+    }
+    r->zs.next_in = (Bytef *)in;
+    r->zs.avail_in = *in_size;
+    r->zs.next_out = out_next;
+    r->zs.avail_out = *out_size;
+    int ret = inflate(&r->zs, Z_NO_FLUSH);
+    *in_size -= r->zs.avail_in;
+    *out_size -= r->zs.avail_out;
+    if (ret == Z_STREAM_END) {
+        inflateEnd(&r->zs);
+        r->started = 0;
+        return TINFL_STATUS_DONE;
+    }
+    if ((ret != Z_OK) && (ret != Z_BUF_ERROR)) {
+        inflateEnd(&r->zs);
+        r->started = 0;
+        return TINFL_STATUS_FAILED;
+    }
+    return (r->zs.avail_out == 0) ? TINFL_STATUS_HAS_MORE_OUTPUT : TINFL_STATUS_NEEDS_MORE_INPUT;
+}
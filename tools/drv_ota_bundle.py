@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+#
+# File:   drv_ota_bundle.py
+# Author: DL
+#
+# Created on 2024 06 17
+#
+# Description: builds a drv_ota bundle of an app and data partitions (see drv_ota_bundle.h)
+#
+# usage: drv_ota_bundle.py app.bin [label=file ...] -o bundle.bin
+#
+# app.bin is the image or a delta patch of it. Each label=file is written to
+# the partition pair <label>_0 / <label>_1 of the device, or to <label> when
+# there is no pair, e.g. assets=spiffs.bin nvs_def=nvs_defaults.bin. Images of
+# SPIFFS, FAT or NVS partitions come from spiffsgen.py, fatfsgen.py or
+# nvs_partition_gen.py. The bundle can be compressed as a whole and signed
+# with drv_ota_manifest.py --image app.bin.
+
+import argparse
+import hashlib
+import struct
+import sys
+
+MAGIC = b"DOTABND1"
+HEADER_FORMAT = "<8sII"
+SECTION_FORMAT = "<16sII32s"
+MAX_SECTIONS = 8
+FLAG_APP = 0x01
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build a drv_ota bundle")
+    parser.add_argument("app", help="app image or delta patch")
+    parser.add_argument("data", nargs="*", help="label=file of a data partition")
+    parser.add_argument("-o", "--output", required=True)
+    args = parser.parse_args()
+
+    sections = []
+    with open(args.app, "rb") as f:
+        sections.append((b"app", FLAG_APP, f.read()))
+    for item in args.data:
+        label, separator, path = item.partition("=")
+        if not separator or not label or len(label.encode()) > 16:
+            sys.exit("%s is not label=file with a label of up to 16 characters" % item)
+        with open(path, "rb") as f:
+            sections.append((label.encode(), 0, f.read()))
+    if len(sections) > MAX_SECTIONS:
+        sys.exit("at most %d sections" % MAX_SECTIONS)
+    if any(len(data) == 0 for _, _, data in sections):
+        sys.exit("empty section")
+
+    header_size = struct.calcsize(HEADER_FORMAT) + len(sections) * struct.calcsize(SECTION_FORMAT)
+    out = struct.pack(HEADER_FORMAT, MAGIC, header_size, len(sections))
+    for label, flags, data in sections:
+        out += struct.pack(SECTION_FORMAT, label, len(data), flags, hashlib.sha256(data).digest())
+    for _, _, data in sections:
+        out += data
+
+    with open(args.output, "wb") as f:
+        f.write(out)
+    print("%s: %d bytes, %s" % (args.output, len(out),
+          ", ".join("%s %d" % (label.decode(), len(data)) for label, _, data in sections)))
+
+
+if __name__ == "__main__":
+    main()
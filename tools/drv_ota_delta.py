@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+#
+# File:   drv_ota_delta.py
+# Author: DL
+#
+# Created on 2024 03 04
+#
+# Description: builds a drv_ota delta patch (see drv_ota_delta.h)
+#
+# usage: drv_ota_delta.py base.bin target.bin -o patch.bin [--bsdiff patch.bsdiff]
+#
+# With --bsdiff the control/diff/extra streams of a BSDIFF40 patch made by
+# the bsdiff tool (bsdiff base.bin target.bin patch.bsdiff) are converted.
+# Without it the images are compared at equal offsets, which only gives a
+# small patch when the code in front of the changes did not move.
+
+import argparse
+import bz2
+import struct
+import sys
+
+MAGIC = b"DOTADIF1"
+HEADER_FORMAT = "<8sIII32s32s32s"
+OP_COPY = 0x01
+OP_ADD = 0x02
+OP_INSERT = 0x03
+OP_SEEK = 0x04
+# zero runs of the diff stream shorter than this stay inside ADD
+MIN_COPY = 8
+
+# esp_image_header_t + esp_image_segment_header_t, then esp_app_desc_t
+APP_DESC_OFFSET = 24 + 8
+APP_DESC_VERSION = APP_DESC_OFFSET + 16
+APP_DESC_ELF_SHA256 = APP_DESC_OFFSET + 144
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def zigzag(value):
+    return (value << 1) if value >= 0 else ((-value << 1) - 1)
+
+
+def offtin(data):
+    value = int.from_bytes(data[0:7], "little") | ((data[7] & 0x7F) << 56)
+    return -value if data[7] & 0x80 else value
+
+
+def read_bsdiff(path, target_size):
+    with open(path, "rb") as f:
+        patch = f.read()
+    if patch[0:8] != b"BSDIFF40":
+        sys.exit("%s is not a BSDIFF40 patch" % path)
+    ctrl_len = offtin(patch[8:16])
+    diff_len = offtin(patch[16:24])
+    if offtin(patch[24:32]) != target_size:
+        sys.exit("bsdiff patch is not for this target image")
+    ctrl = bz2.decompress(patch[32:32 + ctrl_len])
+    diff = bz2.decompress(patch[32 + ctrl_len:32 + ctrl_len + diff_len])
+    extra = bz2.decompress(patch[32 + ctrl_len + diff_len:])
+    triples = []
+    for index in range(0, len(ctrl), 24):
+        triples.append((offtin(ctrl[index:index + 8]),
+                        offtin(ctrl[index + 8:index + 16]),
+                        offtin(ctrl[index + 16:index + 24])))
+    return triples, diff, extra
+
+
+def same_offset_diff(base, target):
+    common = min(len(base), len(target))
+    diff = bytes((target[i] - base[i]) & 0xFF for i in range(common))
+    return [(common, len(target) - common, 0)], diff, target[common:]
+
+
+def encode_diff(out, diff):
+    start = 0
+    index = 0
+    while index < len(diff):
+        if diff[index] == 0:
+            run = index
+            while run < len(diff) and diff[run] == 0:
+                run += 1
+            if run - index >= MIN_COPY or run == len(diff):
+                if index > start:
+                    out += bytes([OP_ADD]) + varint(index - start) + diff[start:index]
+                out += bytes([OP_COPY]) + varint(run - index)
+                start = run
+            index = run
+        else:
+            index += 1
+    if index > start:
+        out += bytes([OP_ADD]) + varint(index - start) + diff[start:index]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build a drv_ota delta patch")
+    parser.add_argument("base")
+    parser.add_argument("target")
+    parser.add_argument("-o", "--output", required=True)
+    parser.add_argument("--bsdiff", help="BSDIFF40 patch from base to target")
+    args = parser.parse_args()
+
+    with open(args.base, "rb") as f:
+        base = f.read()
+    with open(args.target, "rb") as f:
+        target = f.read()
+
+    if args.bsdiff:
+        triples, diff, extra = read_bsdiff(args.bsdiff, len(target))
+    else:
+        triples, diff, extra = same_offset_diff(base, target)
+
+    ops = bytearray()
+    diff_pos = 0
+    extra_pos = 0
+    for diff_len, extra_len, seek in triples:
+        encode_diff(ops, diff[diff_pos:diff_pos + diff_len])
+        diff_pos += diff_len
+        if extra_len:
+            ops += bytes([OP_INSERT]) + varint(extra_len) + extra[extra_pos:extra_pos + extra_len]
+            extra_pos += extra_len
+        # the device stops reading once the whole target is produced
+        if seek and diff_pos + extra_pos < len(target):
+            ops += bytes([OP_SEEK]) + varint(zigzag(seek))
+
+    header = struct.pack(HEADER_FORMAT, MAGIC, struct.calcsize(HEADER_FORMAT),
+                         len(target), len(base),
+                         base[APP_DESC_ELF_SHA256:APP_DESC_ELF_SHA256 + 32],
+                         base[APP_DESC_VERSION:APP_DESC_VERSION + 32],
+                         target[APP_DESC_VERSION:APP_DESC_VERSION + 32])
+    with open(args.output, "wb") as f:
+        f.write(header + ops)
+    print("patch %d bytes for %d byte image (%.1fx smaller)" %
+          (len(header) + len(ops), len(target), len(target) / (len(header) + len(ops))))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+#
+# File:   drv_ota_manifest.py
+# Author: DL
+#
+# Created on 2024 05 20
+#
+# Description: builds the signed manifest of a drv_ota update (see drv_ota_manifest.h)
+#
+# usage: drv_ota_manifest.py file.bin --key private.pem [-o file.bin.manifest]
+#                            [--chunk-size 16384] [--image image.bin] [--version 1.2.3]
+#
+# file.bin is the file as the server sends it: image, delta patch or
+# compressed image. The image digest is taken from --image, or from the file
+# if it is an image itself. The signature is made with the openssl command,
+# the device checks it with the public key embedded as ota_manifest_key.pem:
+#
+#   openssl ecparam -name prime256v1 -genkey -noout -out private.pem
+#   openssl ec -in private.pem -pubout -out ota_manifest_key.pem
+
+import argparse
+import hashlib
+import struct
+import subprocess
+import sys
+
+MAGIC = b"DOTAMAN1"
+HEADER_FORMAT = "<8sIII32s32s"
+ESP_IMAGE_MAGIC = 0xE9
+# esp_image_header_t + esp_image_segment_header_t, then esp_app_desc_t
+APP_DESC_OFFSET = 24 + 8
+APP_DESC_VERSION = APP_DESC_OFFSET + 16
+
+
+def sign(data, key):
+    result = subprocess.run(["openssl", "dgst", "-sha256", "-sign", key], input=data,
+                            stdout=subprocess.PIPE, check=True)
+    return result.stdout
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build a signed drv_ota manifest")
+    parser.add_argument("file")
+    parser.add_argument("-o", "--output", help="default <file>.manifest")
+    parser.add_argument("--key", required=True, help="private key in PEM, EC or RSA")
+    parser.add_argument("--chunk-size", type=int, default=16384)
+    parser.add_argument("--image", help="image the file produces, if it is a patch or compressed")
+    parser.add_argument("--version", help="default the version in the app description of the image")
+    args = parser.parse_args()
+
+    with open(args.file, "rb") as f:
+        data = f.read()
+    image = data
+    if args.image:
+        with open(args.image, "rb") as f:
+            image = f.read()
+    is_image = len(image) > APP_DESC_VERSION + 32 and image[0] == ESP_IMAGE_MAGIC
+
+    if args.version:
+        version = args.version.encode()
+    elif is_image:
+        version = image[APP_DESC_VERSION:APP_DESC_VERSION + 32].split(b"\0")[0]
+    else:
+        sys.exit("no image to take the version from, pass --image or --version")
+    # all zero leaves the image to be verified by reading it back
+    image_sha256 = hashlib.sha256(image).digest() if is_image else bytes(32)
+
+    chunks = [data[offset:offset + args.chunk_size] for offset in range(0, len(data), args.chunk_size)]
+    body = struct.pack(HEADER_FORMAT, MAGIC, len(data), args.chunk_size, len(chunks), version[:31], image_sha256)
+    body += b"".join(hashlib.sha256(chunk).digest() for chunk in chunks)
+    signature = sign(body, args.key)
+
+    output = args.output or args.file + ".manifest"
+    with open(output, "wb") as f:
+        f.write(body + struct.pack("<H", len(signature)) + signature)
+    print("%s: version %s, %d chunks of %d bytes, %d byte signature" %
+          (output, version.decode(errors="replace"), len(chunks), args.chunk_size, len(signature)))
+
+
+if __name__ == "__main__":
+    main()